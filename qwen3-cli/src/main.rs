@@ -3,8 +3,10 @@ use std::path::Path;
 use anyhow::Result;
 use clap::{Arg, ArgMatches, Command};
 use log::{debug, error, info};
-use qwen3_export::{export_model, load_hf_config};
-use qwen3_inference::{InferenceConfigBuilder, run_inference};
+use qwen3_export::{ExportOptions, VocabKeepSpec, export_model_with_options, load_hf_config};
+use qwen3_inference::{
+    InferenceConfigBuilder, run_inference, run_perplexity_evaluation, run_tokenizer_validation,
+};
 
 /// Define the export subcommand.
 fn export_subcommand() -> Command {
@@ -24,6 +26,81 @@ fn export_subcommand() -> Command {
             .help("Quantization group size")
             .value_name("SIZE")
             .default_value("64"))
+        .arg(Arg::new("prescreen-head")
+            .long("prescreen-head")
+            .help("Also export a 4-bit classifier copy for two-stage logits (see inference --prescreen)")
+            .action(clap::ArgAction::SetTrue))
+        .arg(Arg::new("vocab-keep")
+            .long("vocab-keep")
+            .help("Keep only tokens made of these characters, e.g. ascii,latin1,punct or U+0100-U+017F (special tokens are always kept)")
+            .value_name("SPEC"))
+}
+
+/// Define the validate-tokenizer subcommand.
+fn validate_tokenizer_subcommand() -> Command {
+    Command::new("validate-tokenizer")
+        .about("Check a checkpoint's tokenizer on a text corpus: round trip and token inflation")
+        .arg(
+            Arg::new("checkpoint")
+                .help("Model checkpoint or GGUF file")
+                .required(true)
+                .index(1),
+        )
+        .arg(
+            Arg::new("corpus")
+                .help("UTF-8 text file, validated line by line")
+                .required(true)
+                .index(2),
+        )
+        .arg(
+            Arg::new("reference")
+                .long("reference")
+                .value_name("CHECKPOINT")
+                .help("Untrimmed checkpoint to compare token counts against"),
+        )
+        .arg(
+            Arg::new("max-inflation")
+                .long("max-inflation")
+                .value_name("PERCENT")
+                .help("Fail above this percentage of extra tokens against the reference")
+                .default_value("5")
+                .value_parser(clap::value_parser!(f64)),
+        )
+}
+
+/// Define the eval-ppl subcommand.
+fn eval_ppl_subcommand() -> Command {
+    Command::new("eval-ppl")
+        .about("Measure the perplexity of a checkpoint on a text file")
+        .arg(
+            Arg::new("checkpoint")
+                .help("Model checkpoint file, GGUF file or Hugging Face model directory")
+                .required(true)
+                .index(1),
+        )
+        .arg(
+            Arg::new("text")
+                .help("UTF-8 text file to evaluate")
+                .required(true)
+                .index(2),
+        )
+        .arg(
+            Arg::new("context")
+                .short('c')
+                .long("context")
+                .value_name("INT")
+                .help("Tokens per evaluation window")
+                .default_value("512")
+                .value_parser(clap::value_parser!(usize)),
+        )
+        .arg(
+            Arg::new("sessions")
+                .long("sessions")
+                .value_name("INT")
+                .help("Windows evaluated in parallel, each with its own KV cache")
+                .default_value("2")
+                .value_parser(clap::value_parser!(usize)),
+        )
 }
 
 /// Define the inference subcommand.
@@ -32,10 +109,16 @@ fn inference_subcommand() -> Command {
         .about("Qwen3 inference in Rust")
         .arg(
             Arg::new("checkpoint")
-                .help("Model checkpoint file")
+                .help("Model checkpoint file, GGUF file, or a Hugging Face model directory to quantize on load")
                 .required(true)
                 .index(1),
         )
+        .arg(
+            Arg::new("checkpoint-cache")
+                .long("checkpoint-cache")
+                .value_name("FILE")
+                .help("Keep the checkpoint quantized from a model directory here and reuse it while it is up to date"),
+        )
         .arg(
             Arg::new("temperature")
                 .short('t')
@@ -75,7 +158,7 @@ fn inference_subcommand() -> Command {
                 .short('m')
                 .long("mode")
                 .value_name("STRING")
-                .help("Mode: generate|chat [default: chat]")
+                .help("Mode: generate|chat|score|embed [default: chat]")
                 .default_value("chat"),
         )
         .arg(
@@ -101,6 +184,89 @@ fn inference_subcommand() -> Command {
                 .default_value("0")
                 .value_parser(clap::value_parser!(i32)),
         )
+        .arg(
+            Arg::new("thinking-budget")
+                .long("thinking-budget")
+                .value_name("INT")
+                .help("Maximum tokens inside <think> per reply, then </think> is forced")
+                .value_parser(clap::value_parser!(usize)),
+        )
+        .arg(
+            Arg::new("grammar")
+                .long("grammar")
+                .value_name("REGEX")
+                .help("Constrain the output to match a regular expression")
+                .conflicts_with("json-schema"),
+        )
+        .arg(
+            Arg::new("json-schema")
+                .long("json-schema")
+                .value_name("FILE")
+                .help("Constrain the output to JSON conforming to the schema in FILE")
+                .conflicts_with("allowed-tokens"),
+        )
+        .arg(
+            Arg::new("allowed-tokens")
+                .long("allowed-tokens")
+                .value_name("LIST")
+                .help("Restrict the output to a comma-separated list of vocabulary tokens")
+                .conflicts_with("grammar"),
+        )
+        .arg(
+            Arg::new("stop")
+                .long("stop")
+                .value_name("STRING")
+                .help("End the reply when this string is generated (repeatable, \\n for newline)")
+                .action(clap::ArgAction::Append),
+        )
+        .arg(
+            Arg::new("continuation")
+                .long("continuation")
+                .value_name("STRING")
+                .help("In score mode, a continuation of the input to score (repeatable)")
+                .action(clap::ArgAction::Append),
+        )
+        .arg(
+            Arg::new("top-logprobs")
+                .long("top-logprobs")
+                .value_name("INT")
+                .help("In score mode, alternatives reported per token [default: 5]")
+                .value_parser(clap::value_parser!(usize)),
+        )
+        .arg(
+            Arg::new("pooling")
+                .long("pooling")
+                .value_name("STRING")
+                .help("In embed mode, pooling of the hidden states: mean|last [default: mean]"),
+        )
+        .arg(
+            Arg::new("normalize")
+                .long("normalize")
+                .help("In embed mode, scale embeddings to unit L2 norm")
+                .action(clap::ArgAction::SetTrue),
+        )
+        .arg(
+            Arg::new("int8")
+                .long("int8")
+                .help("In embed mode, print embeddings quantized to int8 with a scale")
+                .action(clap::ArgAction::SetTrue),
+        )
+        .arg(
+            Arg::new("prescreen")
+                .long("prescreen")
+                .value_name("K")
+                .help(
+                    "Two-stage logits: rescore only the top K tokens of the 4-bit classifier copy",
+                )
+                .value_parser(clap::value_parser!(usize)),
+        )
+        .arg(
+            Arg::new("prescreen-verify")
+                .long("prescreen-verify")
+                .help("Also run the exact classifier and report prescreen agreement and time saved")
+                .requires("prescreen")
+                .action(clap::ArgAction::SetTrue),
+        )
 }
 
 /// Run the export command with the provided arguments
@@ -160,7 +326,16 @@ fn run_export_command(matches: &ArgMatches) -> Result<()> {
     debug!("{config:#?}");
 
     // Create exporter and run the export
-    export_model(model_path, output_path, config, group_size)?;
+    let vocab_keep = matches
+        .get_one::<String>("vocab-keep")
+        .map(|spec| VocabKeepSpec::parse(spec))
+        .transpose()?;
+    let options = ExportOptions {
+        group_size,
+        classifier_prescreen: matches.get_flag("prescreen-head"),
+        vocab_keep,
+    };
+    export_model_with_options(model_path, output_path, config, &options)?;
 
     Ok(())
 }
@@ -169,6 +344,7 @@ fn run_export_command(matches: &ArgMatches) -> Result<()> {
 fn run_inference_command(matches: &ArgMatches) -> Result<()> {
     let config = InferenceConfigBuilder::default()
         .checkpoint_path(matches.get_one::<String>("checkpoint"))
+        .checkpoint_cache(matches.get_one::<String>("checkpoint-cache"))
         .temperature(matches.get_one::<f32>("temperature").copied())
         .topp(matches.get_one::<f32>("topp").copied())
         .ctx_length(matches.get_one::<usize>("context").copied())
@@ -176,7 +352,24 @@ fn run_inference_command(matches: &ArgMatches) -> Result<()> {
         .prompt(matches.get_one::<String>("input"))
         .system_prompt(matches.get_one::<String>("system"))
         .enable_thinking(matches.get_one::<i32>("reasoning").map(|v| *v != 0))
+        .thinking_budget(matches.get_one::<usize>("thinking-budget").copied())
         .seed(matches.get_one::<u64>("seed").copied())
+        .grammar(matches.get_one::<String>("grammar"))
+        .json_schema(matches.get_one::<String>("json-schema"))
+        .allowed_tokens(matches.get_one::<String>("allowed-tokens"))
+        .stop_sequences(matches.get_many::<String>("stop").into_iter().flatten())
+        .prescreen_top_k(matches.get_one::<usize>("prescreen").copied())
+        .prescreen_verify(Some(matches.get_flag("prescreen-verify")))
+        .continuations(
+            matches
+                .get_many::<String>("continuation")
+                .into_iter()
+                .flatten(),
+        )
+        .top_logprobs(matches.get_one::<usize>("top-logprobs").copied())
+        .pooling(matches.get_one::<String>("pooling"))
+        .normalize_embeddings(Some(matches.get_flag("normalize")))
+        .int8_embeddings(Some(matches.get_flag("int8")))
         .build()
         .map_err(|e| anyhow::anyhow!(e))?;
 
@@ -185,6 +378,26 @@ fn run_inference_command(matches: &ArgMatches) -> Result<()> {
     Ok(())
 }
 
+/// Run the validate-tokenizer command with the provided arguments
+fn run_validate_tokenizer_command(matches: &ArgMatches) -> Result<()> {
+    run_tokenizer_validation(
+        matches.get_one::<String>("checkpoint").unwrap(),
+        matches.get_one::<String>("corpus").unwrap(),
+        matches.get_one::<String>("reference").map(String::as_str),
+        *matches.get_one::<f64>("max-inflation").unwrap(),
+    )
+}
+
+/// Run the eval-ppl command with the provided arguments
+fn run_eval_ppl_command(matches: &ArgMatches) -> Result<()> {
+    run_perplexity_evaluation(
+        matches.get_one::<String>("checkpoint").unwrap(),
+        matches.get_one::<String>("text").unwrap(),
+        matches.get_one::<usize>("context").copied(),
+        *matches.get_one::<usize>("sessions").unwrap(),
+    )
+}
+
 fn execute_commands() -> Result<()> {
     // Initialize logger with clean format (no timestamp/module prefix) and use info level by default
     env_logger::Builder::from_env(env_logger::Env::default().default_filter_or("info"))
@@ -198,11 +411,15 @@ fn execute_commands() -> Result<()> {
         .about("Qwen3 CLI: an educational tool for exporting and running Qwen3 models")
         .subcommand(export_subcommand())
         .subcommand(inference_subcommand())
+        .subcommand(validate_tokenizer_subcommand())
+        .subcommand(eval_ppl_subcommand())
         .get_matches();
 
     match matches.subcommand() {
         Some(("export", matches)) => run_export_command(matches),
         Some(("inference", matches)) => run_inference_command(matches),
+        Some(("validate-tokenizer", matches)) => run_validate_tokenizer_command(matches),
+        Some(("eval-ppl", matches)) => run_eval_ppl_command(matches),
         _ => anyhow::bail!("No subcommand specified. Use -h to print help information."),
     }
 }
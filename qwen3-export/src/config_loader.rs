@@ -86,3 +86,13 @@ pub fn load_hf_config(model_path: &str) -> Result<ModelConfig> {
 
     Ok(config)
 }
+
+/// Read `tie_word_embeddings` from the model's config.json, if it is there.
+///
+/// Tied models use the embedding table as the classifier; their checkpoint may still hold
+/// an `lm_head` copy of it.
+pub(crate) fn load_tie_word_embeddings(model_path: &Path) -> Option<bool> {
+    let contents = std::fs::read_to_string(model_path.join("config.json")).ok()?;
+    let config: Value = serde_json::from_str(&contents).ok()?;
+    config.get("tie_word_embeddings")?.as_bool()
+}
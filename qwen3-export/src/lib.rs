@@ -29,17 +29,40 @@ pub mod model_exporter;
 pub mod tensor_reader;
 pub mod tokenizer_exporter;
 mod utils;
+pub mod vocab_trimmer;
 
 // Re-export main types for easy access
 pub use chat_template_exporter::ChatTemplateExporter;
 pub use config_loader::{ModelConfig, load_hf_config};
-pub use model_exporter::{BinaryModelExporter, QuantizedWeight};
+pub use model_exporter::{BinaryModelExporter, PackedQ4Weight, QuantizedWeight};
 pub use tokenizer_exporter::TokenizerExporter;
+pub use vocab_trimmer::{VocabKeepSpec, VocabMap};
 
 use anyhow::Result;
 use log::info;
 use std::path::Path;
 
+/// Options controlling the exported checkpoint.
+#[derive(Debug, Clone)]
+pub struct ExportOptions {
+    /// Quantization group size
+    pub group_size: usize,
+    /// Append a 4-bit copy of the classifier for two-stage logits at inference
+    pub classifier_prescreen: bool,
+    /// Drop tokens outside this spec from the vocabulary, embeddings and classifier
+    pub vocab_keep: Option<VocabKeepSpec>,
+}
+
+impl Default for ExportOptions {
+    fn default() -> Self {
+        Self {
+            group_size: 64,
+            classifier_prescreen: false,
+            vocab_keep: None,
+        }
+    }
+}
+
 /// Export the model weights in Q8_0 into .bin file to be used by later within inference implementation.
 /// That is:
 /// - quantize all weights to symmetric int8, in range [-127, 127]
@@ -50,6 +73,20 @@ pub fn export_model(
     output_path: &str,
     config: ModelConfig,
     group_size: usize,
+) -> Result<()> {
+    let options = ExportOptions {
+        group_size,
+        ..Default::default()
+    };
+    export_model_with_options(model_path, output_path, config, &options)
+}
+
+/// Same as [`export_model`], with all export options.
+pub fn export_model_with_options(
+    model_path: &str,
+    output_path: &str,
+    config: ModelConfig,
+    options: &ExportOptions,
 ) -> Result<()> {
     info!("🚀 Starting complete model export...");
     info!("");
@@ -57,17 +94,38 @@ pub fn export_model(
     let model_path = Path::new(model_path);
     let output_path = Path::new(output_path);
 
+    let vocab_map = match &options.vocab_keep {
+        Some(spec) => {
+            info!("✂️  Trimming vocabulary...");
+            let vocab_map = TokenizerExporter::new().plan_vocab_trim(
+                model_path,
+                spec,
+                config.bos_token_id,
+                config.eos_token_id,
+            )?;
+            let map_path = format!("{}.vocab-map", output_path.display());
+            vocab_map.write(Path::new(&map_path))?;
+            info!("💾 Written vocabulary map to {map_path}");
+            info!("");
+            Some(vocab_map)
+        }
+        None => None,
+    };
+
     info!("🧮 Exporting quantized binary model...");
-    BinaryModelExporter::new(config.clone(), group_size)
+    BinaryModelExporter::new(config.clone(), options.group_size)
+        .with_classifier_prescreen(options.classifier_prescreen)
+        .with_vocab_map(vocab_map.clone())
         .export_binary_model(model_path, output_path)?;
     info!("");
 
     info!("🔤 Exporting tokenizer...");
-    TokenizerExporter::new().export_tokenizer(
+    TokenizerExporter::new().export_tokenizer_with_vocab_map(
         model_path,
         output_path,
         config.bos_token_id,
         config.eos_token_id,
+        vocab_map.as_ref(),
     )?;
     info!("");
 
@@ -7,14 +7,21 @@ use byteorder::{LittleEndian, WriteBytesExt};
 use log::{info, warn};
 use rayon::prelude::*;
 use std::{
+    collections::BTreeMap,
     fs::File,
     io::{BufWriter, Write},
+    num::NonZeroUsize,
     path::Path,
+    slice,
+    sync::{Condvar, Mutex, mpsc},
+    thread,
 };
 
 use crate::ModelConfig;
-use crate::tensor_reader::TensorReader;
+use crate::config_loader::load_tie_word_embeddings;
+use crate::tensor_reader::{RawTensor, TensorReader};
 use crate::utils::ProgressTracker;
+use crate::vocab_trimmer::VocabMap;
 
 // Quantization result
 #[derive(Debug)]
@@ -24,16 +31,74 @@ pub struct QuantizedWeight {
     pub max_error: f32,
 }
 
+/// 4-bit quantization result: two values per byte, low nibble first, stored with a +8 offset
+#[derive(Debug)]
+pub struct PackedQ4Weight {
+    pub packed_data: Vec<u8>,
+    pub scales: Vec<f32>,
+    pub max_error: f32,
+}
+
+/// A weight tensor as it is quantized: the stored tensor, or only the kept rows of a
+/// vocabulary tensor
+#[derive(Debug, Clone, Copy)]
+struct WeightSource<'a> {
+    tensor: RawTensor<'a>,
+    kept_rows: Option<&'a [u32]>,
+    row_len: usize,
+}
+
+impl WeightSource<'_> {
+    fn len(&self) -> usize {
+        match self.kept_rows {
+            Some(kept_rows) => kept_rows.len() * self.row_len,
+            None => self.tensor.len(),
+        }
+    }
+
+    /// Convert the weights from `start` on into `out`
+    fn read(&self, start: usize, out: &mut [f32]) {
+        let Some(kept_rows) = self.kept_rows else {
+            self.tensor.read_f32(start, out);
+            return;
+        };
+
+        let mut filled = 0;
+        while filled < out.len() {
+            let pos = start + filled;
+            let (row, col) = (pos / self.row_len, pos % self.row_len);
+            let len = (self.row_len - col).min(out.len() - filled);
+            let source_start = kept_rows[row] as usize * self.row_len + col;
+            self.tensor
+                .read_f32(source_start, &mut out[filled..filled + len]);
+            filled += len;
+        }
+    }
+}
+
+/// A run of whole groups of one weight tensor, the unit of work of the export pipeline
+#[derive(Debug, Clone, Copy)]
+struct QuantizeJob {
+    tensor: usize,
+    start: usize,
+    len: usize,
+    /// Whether this run ends the tensor, so its scales follow
+    last: bool,
+}
+
 /// Header information structure (lightweight)
 #[derive(Debug)]
 struct HeaderInfo {
     pub shared_classifier: bool,
+    pub classifier_prescreen: bool,
 }
 
 /// Binary model exporter for quantized model weights
 pub struct BinaryModelExporter {
     config: ModelConfig,
     group_size: usize,
+    classifier_prescreen: bool,
+    vocab_map: Option<VocabMap>,
 }
 
 impl BinaryModelExporter {
@@ -41,6 +106,12 @@ impl BinaryModelExporter {
     const VERSION: i32 = 1;
     const HEADER_SIZE: usize = 256;
     const MIN_GROUP_SIZE: usize = 4;
+    /// Bits per weight of the optional classifier prescreen copy
+    const PRESCREEN_BITS: u32 = 4;
+    /// Most chunks decoded and quantized ahead of the writer, which bounds memory use
+    const PIPELINE_DEPTH: usize = 4;
+    /// Weights converted to f32 and quantized at a time
+    const CHUNK_WEIGHTS: usize = 1 << 20;
 
     // Tensor name constants
     const EMBED_TOKENS_KEY: &'static str = "model.embed_tokens.weight";
@@ -80,50 +151,138 @@ impl BinaryModelExporter {
         Self {
             config,
             group_size: optimal_group_size,
+            classifier_prescreen: false,
+            vocab_map: None,
+        }
+    }
+
+    /// Also export a 4-bit copy of the classifier, appended after all Q8 weights.
+    ///
+    /// Inference can use it to prescreen the vocabulary cheaply and rescore only the best
+    /// candidates with the Q8 classifier.
+    pub fn with_classifier_prescreen(mut self, enabled: bool) -> Self {
+        self.classifier_prescreen = enabled;
+        self
+    }
+
+    /// Keep only the embedding and classifier rows of the tokens in `vocab_map`.
+    pub fn with_vocab_map(mut self, vocab_map: Option<VocabMap>) -> Self {
+        self.vocab_map = vocab_map;
+        self
+    }
+
+    /// Look up a weight tensor; tensors with one row per token keep only the rows of the
+    /// tokens in the vocabulary map.
+    fn weight_source<'a>(
+        &'a self,
+        tensor_reader: &'a TensorReader,
+        key: &str,
+    ) -> Result<WeightSource<'a>> {
+        let tensor = tensor_reader
+            .raw_tensor(key)?
+            .ok_or_else(|| anyhow::anyhow!("Missing weight tensor: {key}"))?;
+        let row_len = self.config.dim as usize;
+
+        let is_vocab_tensor = key == Self::EMBED_TOKENS_KEY || key == Self::LM_HEAD_KEY;
+        let kept_rows = self
+            .vocab_map
+            .as_ref()
+            .filter(|_| is_vocab_tensor)
+            .map(VocabMap::kept_ids);
+        if let Some(&last) = kept_rows.and_then(|kept_rows| kept_rows.last()) {
+            let rows = tensor.len() / row_len;
+            if last as usize >= rows {
+                anyhow::bail!("Kept token {last} is outside the {rows}-row vocabulary tensor");
+            }
+        }
+
+        Ok(WeightSource {
+            tensor,
+            kept_rows,
+            row_len,
+        })
+    }
+
+    /// Length of a chunk: whole groups, about [`Self::CHUNK_WEIGHTS`] weights
+    fn chunk_len(&self) -> usize {
+        (Self::CHUNK_WEIGHTS / self.group_size).max(1) * self.group_size
+    }
+
+    /// Whether the classifier is the embedding table.
+    ///
+    /// Taken from `tie_word_embeddings` when config.json has it; otherwise `lm_head.weight`
+    /// and `model.embed_tokens.weight` are compared chunk by chunk, like the Python exporter.
+    fn is_classifier_shared(
+        &self,
+        model_path: &Path,
+        tensor_reader: &TensorReader,
+    ) -> Result<bool> {
+        let lm_head = tensor_reader.raw_tensor(Self::LM_HEAD_KEY)?;
+        let embed_tokens = tensor_reader.raw_tensor(Self::EMBED_TOKENS_KEY)?;
+        let (lm_head, embed_tokens) = match (lm_head, embed_tokens) {
+            (Some(lm_head), Some(embed_tokens)) => (lm_head, embed_tokens),
+            (None, Some(_)) => return Ok(true), // No lm_head means shared
+            _ => return Ok(false), // Missing embed_tokens is an error, but we'll handle it later
+        };
+
+        if let Some(tied) = load_tie_word_embeddings(model_path) {
+            return Ok(tied);
+        }
+        if lm_head.len() != embed_tokens.len() {
+            return Ok(false);
+        }
+
+        let chunk_len = Self::CHUNK_WEIGHTS.min(lm_head.len());
+        let mut lm_head_chunk = vec![0.0f32; chunk_len];
+        let mut embed_chunk = vec![0.0f32; chunk_len];
+        for start in (0..lm_head.len()).step_by(chunk_len.max(1)) {
+            let len = chunk_len.min(lm_head.len() - start);
+            lm_head.read_f32(start, &mut lm_head_chunk[..len]);
+            embed_tokens.read_f32(start, &mut embed_chunk[..len]);
+            let identical = lm_head_chunk[..len]
+                .iter()
+                .zip(&embed_chunk[..len])
+                .all(|(a, b)| (a - b).abs() < 1e-6);
+            if !identical {
+                return Ok(false);
+            }
         }
+        Ok(true)
     }
 
     /// Export binary model with quantized weights using streaming to minimize memory usage
     pub fn export_binary_model(&self, model_path: &Path, output_path: &Path) -> Result<()> {
-        let mut tensor_reader = TensorReader::new(model_path)?;
-
         let file = File::create(output_path)?;
         let mut writer = BufWriter::new(file);
+        self.write_binary_model(model_path, &mut writer)?;
 
-        // Check if classifier is shared by comparing tensor values (like Python)
-        // If lm_head.weight and model.embed_tokens.weight are identical, classifier is shared
-        let shared_classifier = match (
-            tensor_reader.load_tensor(Self::LM_HEAD_KEY)?,
-            tensor_reader.load_tensor(Self::EMBED_TOKENS_KEY)?,
-        ) {
-            (Some(lm_head_weights), Some(embed_weights)) => {
-                // Compare tensor values to determine if they're identical
-                lm_head_weights.len() == embed_weights.len()
-                    && lm_head_weights
-                        .iter()
-                        .zip(embed_weights.iter())
-                        .all(|(a, b)| (a - b).abs() < 1e-6)
-            }
-            (None, Some(_)) => true, // No lm_head means shared
-            _ => false,              // Missing embed_tokens is an error, but we'll handle it later
+        writer.flush()?;
+        info!("💾 Written model checkpoint to {}", output_path.display());
+
+        Ok(())
+    }
+
+    /// Writes the quantized checkpoint to `writer`, which may be an in-memory buffer
+    pub fn write_binary_model<W: Write>(&self, model_path: &Path, writer: &mut W) -> Result<()> {
+        let tensor_reader = TensorReader::new(model_path)?;
+
+        let shared_classifier = self.is_classifier_shared(model_path, &tensor_reader)?;
+        let header_info = HeaderInfo {
+            shared_classifier,
+            classifier_prescreen: self.classifier_prescreen,
         };
-        let header_info = HeaderInfo { shared_classifier };
 
         // Write header (256 bytes)
-        self.write_header(&mut writer, &header_info)?;
+        self.write_header(writer, &header_info)?;
 
         // Write normalization weights (fp32) - these are small
-        self.write_norm_weights(&mut writer, &mut tensor_reader)?;
-
-        // Stream and quantize weights one by one
-        self.stream_and_quantize_weights(&mut writer, &mut tensor_reader, shared_classifier)?;
+        self.write_norm_weights(writer, &tensor_reader)?;
 
-        writer.flush()?;
-        info!("💾 Written model checkpoint to {}", output_path.display());
+        // Quantize weights in a pipeline, writing them in order
+        self.stream_and_quantize_weights(writer, &tensor_reader, shared_classifier)?;
 
-        // Clear cache to free memory
-        if let Err(e) = tensor_reader.clear_cache() {
-            warn!("Failed to clear cache: {e}");
+        if self.classifier_prescreen {
+            self.write_classifier_prescreen(writer, &tensor_reader, shared_classifier)?;
         }
 
         Ok(())
@@ -199,6 +358,61 @@ impl BinaryModelExporter {
         })
     }
 
+    /// Quantize weights to symmetric 4-bit values in [-7, 7], packed two per byte
+    pub fn quantize_q4(&self, weights: &[f32]) -> Result<PackedQ4Weight> {
+        if self.group_size % 2 != 0 {
+            return Err(anyhow::anyhow!(
+                "4-bit weights need an even group_size to pack two per byte, got {}",
+                self.group_size
+            ));
+        }
+        if weights.len() % self.group_size != 0 {
+            return Err(anyhow::anyhow!(
+                "Weight length is not a multiple of group_size"
+            ));
+        }
+
+        let group_results: Vec<_> = weights
+            .par_chunks(self.group_size)
+            .map(|group| {
+                let group_max = group.iter().map(|&x| x.abs()).fold(0.0f32, f32::max);
+                let scale = if group_max > 0.0 {
+                    group_max / 7.0
+                } else {
+                    1.0
+                };
+
+                let mut group_error = 0.0f32;
+                let mut quantize = |weight: f32| {
+                    let quantized = round_half_to_even(weight / scale).clamp(-7.0, 7.0);
+                    group_error = group_error.max((quantized * scale - weight).abs());
+                    (quantized as i8 + 8) as u8
+                };
+                let packed: Vec<u8> = group
+                    .chunks_exact(2)
+                    .map(|pair| quantize(pair[0]) | (quantize(pair[1]) << 4))
+                    .collect();
+
+                (packed, scale, group_error)
+            })
+            .collect();
+
+        let mut packed_data = Vec::with_capacity(weights.len() / 2);
+        let mut scales = Vec::with_capacity(group_results.len());
+        let mut max_error = 0.0f32;
+        for (packed, scale, group_error) in group_results {
+            packed_data.extend(packed);
+            scales.push(scale);
+            max_error = max_error.max(group_error);
+        }
+
+        Ok(PackedQ4Weight {
+            packed_data,
+            scales,
+            max_error,
+        })
+    }
+
     /// Write binary header
     fn write_header<W: Write>(&self, writer: &mut W, header_info: &HeaderInfo) -> Result<()> {
         // Magic number "ajc1" in ASCII
@@ -213,14 +427,26 @@ impl BinaryModelExporter {
         writer.write_u32::<LittleEndian>(self.config.n_layers)?;
         writer.write_u32::<LittleEndian>(self.config.n_heads)?;
         writer.write_u32::<LittleEndian>(self.config.n_kv_heads)?;
-        writer.write_u32::<LittleEndian>(self.config.vocab_size)?;
+        let vocab_size = self
+            .vocab_map
+            .as_ref()
+            .map_or(self.config.vocab_size, |vocab_map| vocab_map.len() as u32);
+        writer.write_u32::<LittleEndian>(vocab_size)?;
         writer.write_u32::<LittleEndian>(self.config.max_seq_len)?;
         writer.write_u32::<LittleEndian>(self.config.head_dim)?;
         writer.write_u32::<LittleEndian>(header_info.shared_classifier as u32)?;
         writer.write_u32::<LittleEndian>(self.group_size as u32)?;
 
+        // Classifier prescreen bits (0 = absent)
+        let prescreen_bits = if header_info.classifier_prescreen {
+            Self::PRESCREEN_BITS
+        } else {
+            0
+        };
+        writer.write_u32::<LittleEndian>(prescreen_bits)?;
+
         // Pad to header size
-        let current_pos = 4 + 4 + 10 * 4; // magic + version + 10 params
+        let current_pos = 4 + 4 + 11 * 4; // magic + version + 11 params
         let padding = Self::HEADER_SIZE - current_pos;
         let zeros = vec![0u8; padding];
         writer.write_all(&zeros)?;
@@ -232,7 +458,7 @@ impl BinaryModelExporter {
     fn write_norm_weights<W: Write>(
         &self,
         writer: &mut W,
-        tensor_reader: &mut TensorReader,
+        tensor_reader: &TensorReader,
     ) -> Result<()> {
         info!("Writing normalization weights...");
 
@@ -240,9 +466,7 @@ impl BinaryModelExporter {
         for layer_idx in 0..self.config.n_layers {
             let attn_norm_key = format!("model.layers.{layer_idx}.input_layernorm.weight");
             if let Some(attn_norm) = tensor_reader.load_tensor(&attn_norm_key)? {
-                for &value in &attn_norm {
-                    writer.write_f32::<LittleEndian>(value)?;
-                }
+                write_f32_slice(writer, &attn_norm)?;
             } else {
                 return Err(anyhow::anyhow!("Missing weight: {attn_norm_key}"));
             }
@@ -252,9 +476,7 @@ impl BinaryModelExporter {
         for layer_idx in 0..self.config.n_layers {
             let ffn_norm_key = format!("model.layers.{layer_idx}.post_attention_layernorm.weight");
             if let Some(ffn_norm) = tensor_reader.load_tensor(&ffn_norm_key)? {
-                for &value in &ffn_norm {
-                    writer.write_f32::<LittleEndian>(value)?;
-                }
+                write_f32_slice(writer, &ffn_norm)?;
             } else {
                 return Err(anyhow::anyhow!("Missing weight: {ffn_norm_key}"));
             }
@@ -262,52 +484,63 @@ impl BinaryModelExporter {
 
         // Final norm
         if let Some(final_norm) = tensor_reader.load_tensor(Self::FINAL_NORM_KEY)? {
-            for &value in &final_norm {
-                writer.write_f32::<LittleEndian>(value)?;
-            }
+            write_f32_slice(writer, &final_norm)?;
         } else {
             return Err(anyhow::anyhow!("Missing final norm"));
         }
 
-        // QK LayerNorm weights (Qwen3 specific)
+        // QK LayerNorm weights (Qwen3 specific), defaulting to ones if not present
+        let ones = vec![1.0f32; self.config.head_dim as usize];
         for layer_idx in 0..self.config.n_layers {
             let lq_key = format!("model.layers.{layer_idx}.self_attn.q_norm.weight");
-            if let Some(lq) = tensor_reader.load_tensor(&lq_key)? {
-                for &value in &lq {
-                    writer.write_f32::<LittleEndian>(value)?;
-                }
-            } else {
-                // Default to ones if not present
-                for _ in 0..self.config.head_dim as usize {
-                    writer.write_f32::<LittleEndian>(1.0)?;
-                }
-            }
+            let lq = tensor_reader.load_tensor(&lq_key)?;
+            write_f32_slice(writer, lq.as_deref().unwrap_or(&ones))?;
         }
 
         for layer_idx in 0..self.config.n_layers {
             let lk_key = format!("model.layers.{layer_idx}.self_attn.k_norm.weight");
-            if let Some(lk) = tensor_reader.load_tensor(&lk_key)? {
-                for &value in &lk {
-                    writer.write_f32::<LittleEndian>(value)?;
-                }
-            } else {
-                // Default to ones if not present
-                for _ in 0..self.config.head_dim as usize {
-                    writer.write_f32::<LittleEndian>(1.0)?;
-                }
-            }
+            let lk = tensor_reader.load_tensor(&lk_key)?;
+            write_f32_slice(writer, lk.as_deref().unwrap_or(&ones))?;
         }
 
         Ok(())
     }
 
-    /// Stream and quantize weights one by one to minimize memory usage
-    fn stream_and_quantize_weights<W: Write>(
+    /// Write the 4-bit classifier copy: packed values followed by scales
+    fn write_classifier_prescreen<W: Write>(
         &self,
         writer: &mut W,
-        tensor_reader: &mut TensorReader,
+        tensor_reader: &TensorReader,
         shared_classifier: bool,
     ) -> Result<()> {
+        let classifier_key = if shared_classifier {
+            Self::EMBED_TOKENS_KEY
+        } else {
+            Self::LM_HEAD_KEY
+        };
+        let classifier = self.weight_source(tensor_reader, classifier_key)?;
+
+        // Packed values chunk by chunk, then the scales of all groups
+        let chunk_len = self.chunk_len().min(classifier.len());
+        let mut chunk = vec![0.0f32; chunk_len];
+        let mut scales = Vec::with_capacity(classifier.len() / self.group_size);
+        let mut max_error = 0.0f32;
+        for start in (0..classifier.len()).step_by(chunk_len.max(1)) {
+            let weights = &mut chunk[..chunk_len.min(classifier.len() - start)];
+            classifier.read(start, weights);
+            let quantized = self.quantize_q4(weights)?;
+            writer.write_all(&quantized.packed_data)?;
+            scales.extend_from_slice(&quantized.scales);
+            max_error = max_error.max(quantized.max_error);
+        }
+        write_f32_slice(writer, &scales)?;
+
+        info!("Wrote 4-bit classifier prescreen copy with max error: {max_error:.8}");
+        Ok(())
+    }
+
+    /// Names of the quantized weight tensors, in file order
+    fn weight_tensor_names(&self, shared_classifier: bool) -> Vec<String> {
         // Build weight tensor list to match Python ordering EXACTLY
         // Python: embed_tokens, [all q_proj], [all k_proj], [all v_proj], [all o_proj], [all gate_proj], [all down_proj], [all up_proj], [lm_head if not shared]
         let estimated_capacity = 1  // embed_tokens
@@ -330,52 +563,198 @@ impl BinaryModelExporter {
             weight_tensors.push(Self::LM_HEAD_KEY.to_string());
         }
 
-        let progress = ProgressTracker::new(weight_tensors.len(), "Quantizing");
+        weight_tensors
+    }
 
-        // Process each weight tensor individually
-        let max_errors: Result<Vec<f32>> = weight_tensors
+    /// Quantize the weight tensors and write them in file order.
+    ///
+    /// Tensors are split into chunks of whole groups. Worker threads each convert a chunk
+    /// from the mapped BF16/F32 bytes into a scratch buffer and quantize it, at most
+    /// [`Self::PIPELINE_DEPTH`] chunks ahead of the writer. Memory use is therefore bounded
+    /// by the chunk size rather than by the largest tensor; only the scales of the tensor
+    /// being written are held until it is complete.
+    fn stream_and_quantize_weights<W: Write>(
+        &self,
+        writer: &mut W,
+        tensor_reader: &TensorReader,
+        shared_classifier: bool,
+    ) -> Result<()> {
+        let weight_tensors = self.weight_tensor_names(shared_classifier);
+        let sources = weight_tensors
             .iter()
-            .enumerate()
-            .map(|(i, tensor_name)| {
-                progress.set_current(i + 1);
+            .map(|tensor_name| self.weight_source(tensor_reader, tensor_name))
+            .collect::<Result<Vec<_>>>()?;
+
+        let chunk_len = self.chunk_len();
+        let mut jobs = Vec::new();
+        for (tensor, (source, tensor_name)) in sources.iter().zip(&weight_tensors).enumerate() {
+            let len = source.len();
+            if len == 0 {
+                warn!("Empty weight tensor: {tensor_name}");
+                continue;
+            }
+            if len % self.group_size != 0 {
+                anyhow::bail!("Weight tensor {tensor_name} length is not a multiple of group_size");
+            }
+            jobs.extend((0..len).step_by(chunk_len).map(|start| QuantizeJob {
+                tensor,
+                start,
+                len: chunk_len.min(len - start),
+                last: start + chunk_len >= len,
+            }));
+        }
+
+        let progress = ProgressTracker::new(jobs.len().max(1), "Quantizing");
+        let queue = TensorQueue::new(jobs.len(), Self::PIPELINE_DEPTH);
+        let workers = thread::available_parallelism()
+            .map_or(1, NonZeroUsize::get)
+            .min(Self::PIPELINE_DEPTH);
+
+        let max_error = thread::scope(|scope| {
+            let (sender, receiver) = mpsc::sync_channel(Self::PIPELINE_DEPTH);
+            for _ in 0..workers {
+                let sender = sender.clone();
+                let (queue, jobs, sources) = (&queue, &jobs, &sources);
+                scope.spawn(move || {
+                    let mut chunk = vec![0.0f32; chunk_len];
+                    while let Some(index) = queue.next() {
+                        let job = jobs[index];
+                        let weights = &mut chunk[..job.len];
+                        sources[job.tensor].read(job.start, weights);
+                        if sender.send((index, self.quantize_q80(weights))).is_err() {
+                            break;
+                        }
+                    }
+                });
+            }
+            drop(sender);
 
-                let weight_tensor = tensor_reader
-                    .load_tensor(tensor_name)?
-                    .ok_or_else(|| anyhow::anyhow!("Missing weight tensor: {tensor_name}"))?;
+            let written = Self::write_in_order(writer, receiver, &jobs, &queue, &progress);
+            // Stop the workers early if writing failed
+            queue.close();
+            written
+        })?;
 
-                if weight_tensor.is_empty() {
-                    warn!("Empty weight tensor: {tensor_name}");
-                    return Ok(0.0);
+        info!(
+            "Quantized {} weight tensors to Q8_0 with max error: {max_error:.8}",
+            weight_tensors.len()
+        );
+
+        Ok(())
+    }
+
+    /// Write quantized chunks as they arrive, in job order, each tensor's scales after its
+    /// last chunk; returns the overall max error
+    fn write_in_order<W: Write>(
+        writer: &mut W,
+        receiver: mpsc::Receiver<(usize, Result<QuantizedWeight>)>,
+        jobs: &[QuantizeJob],
+        queue: &TensorQueue,
+        progress: &ProgressTracker,
+    ) -> Result<f32> {
+        let mut pending = BTreeMap::new();
+        let mut written = 0;
+        let mut scales = Vec::new();
+        let mut max_error = 0.0f32;
+
+        for (index, quantized) in receiver {
+            pending.insert(index, quantized);
+            while let Some(quantized) = pending.remove(&written) {
+                let quantized = quantized?;
+                // SAFETY: i8 and u8 have the same size and alignment
+                let int8_bytes = unsafe {
+                    slice::from_raw_parts(
+                        quantized.int8_data.as_ptr() as *const u8,
+                        quantized.int8_data.len(),
+                    )
+                };
+                writer.write_all(int8_bytes)?;
+                scales.extend_from_slice(&quantized.scales);
+                max_error = max_error.max(quantized.max_error);
+
+                if jobs[written].last {
+                    write_f32_slice(writer, &scales)?;
+                    scales.clear();
                 }
+                written += 1;
+                queue.mark_written();
+                progress.set_current(written);
+            }
+        }
 
-                // Quantize this tensor
-                let quantized = self.quantize_q80(&weight_tensor)?;
+        if written != jobs.len() {
+            anyhow::bail!("Quantized {written} of {} weight chunks", jobs.len());
+        }
+        Ok(max_error)
+    }
+}
 
-                // Write quantized data using iterators
-                quantized
-                    .int8_data
-                    .iter()
-                    .try_for_each(|&value| writer.write_i8(value))?;
-                quantized
-                    .scales
-                    .iter()
-                    .try_for_each(|&scale| writer.write_f32::<LittleEndian>(scale))?;
+/// Hands out job indices in order to the pipeline workers, keeping them at most `depth`
+/// jobs ahead of the writer.
+#[derive(Debug)]
+struct TensorQueue {
+    state: Mutex<QueueState>,
+    changed: Condvar,
+    len: usize,
+    depth: usize,
+}
 
-                Ok(quantized.max_error)
-            })
-            .collect();
+#[derive(Debug, Default)]
+struct QueueState {
+    /// Next index to hand out
+    next: usize,
+    /// Number of tensors written so far
+    written: usize,
+    closed: bool,
+}
 
-        let max_errors = max_errors?;
+impl TensorQueue {
+    fn new(len: usize, depth: usize) -> Self {
+        Self {
+            state: Mutex::new(QueueState::default()),
+            changed: Condvar::new(),
+            len,
+            depth,
+        }
+    }
 
-        // Print overall max error
-        let overall_max_error = max_errors.iter().fold(0.0f32, |acc, &x| acc.max(x));
-        info!(
-            "Quantized {} weight tensors to Q8_0 with max error: {overall_max_error:.8}",
-            weight_tensors.len()
-        );
+    /// Waits until the next tensor may be started and returns its index, or None when all
+    /// tensors are taken or the queue was closed.
+    fn next(&self) -> Option<usize> {
+        let mut state = self.state.lock().unwrap();
+        loop {
+            if state.closed || state.next >= self.len {
+                return None;
+            }
+            if state.next < state.written + self.depth {
+                state.next += 1;
+                return Some(state.next - 1);
+            }
+            state = self.changed.wait(state).unwrap();
+        }
+    }
 
-        Ok(())
+    fn mark_written(&self) {
+        self.state.lock().unwrap().written += 1;
+        self.changed.notify_all();
+    }
+
+    fn close(&self) {
+        self.state.lock().unwrap().closed = true;
+        self.changed.notify_all();
+    }
+}
+
+/// Write f32 values as little-endian bytes, a buffer at a time
+fn write_f32_slice<W: Write>(writer: &mut W, values: &[f32]) -> Result<()> {
+    let mut buffer = [0u8; 4096];
+    for chunk in values.chunks(buffer.len() / 4) {
+        for (bytes, value) in buffer.chunks_exact_mut(4).zip(chunk) {
+            bytes.copy_from_slice(&value.to_le_bytes());
+        }
+        writer.write_all(&buffer[..chunk.len() * 4])?;
     }
+    Ok(())
 }
 
 /// Round half to even (banker's rounding) to match PyTorch's torch.round() behavior
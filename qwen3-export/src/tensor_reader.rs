@@ -1,96 +1,220 @@
+#[cfg(test)]
+#[path = "../tests/unit/tensor_reader_test.rs"]
+mod tensor_reader_test;
+
 use anyhow::{Context, Result};
 use memmap2::Mmap;
-use safetensors::SafeTensors;
+use safetensors::{Dtype, SafeTensors};
 use std::{
-    collections::{HashMap, VecDeque},
+    collections::{BTreeSet, HashMap},
     fs::File,
     mem,
+    ops::Range,
     path::{Path, PathBuf},
-    sync::{Arc, Mutex},
 };
 
-/// Memory-efficient tensor reader from SafeTensors files
+/// Shard map written next to sharded checkpoints
+const INDEX_FILE: &str = "model.safetensors.index.json";
+
+/// Memory-efficient tensor reader from SafeTensors files.
+///
+/// Every shard is memory-mapped and its header parsed once, into an index from tensor name
+/// to its location, so a lookup is a hash probe and a slice of the mapping.
 #[derive(Debug)]
 pub(crate) struct TensorReader {
-    safetensors_files: Vec<PathBuf>,   // Just store file paths, not data
-    mmap_cache: Arc<Mutex<MmapCache>>, // LRU cache for memory mappings
+    shards: Vec<Shard>,
+    tensors: HashMap<String, TensorEntry>,
+}
+
+#[derive(Debug)]
+struct Shard {
+    path: PathBuf,
+    mmap: Mmap,
+}
+
+/// Where a tensor lives: its shard, type, shape and bytes within the shard mapping
+#[derive(Debug, Clone)]
+struct TensorEntry {
+    shard: usize,
+    dtype: Dtype,
+    shape: Vec<usize>,
+    bytes: Range<usize>,
 }
 
 impl TensorReader {
+    /// Index the shards listed in `model.safetensors.index.json`, or all `.safetensors`
+    /// files of `model_path` if there is no index.
     pub fn new(model_path: &Path) -> Result<Self> {
-        let safetensors_files = std::fs::read_dir(model_path)
-            .with_context(|| format!("Failed to read directory: {}", model_path.display()))?
-            .filter_map(|entry| {
-                let entry = entry.ok()?;
-                let path = entry.path();
-
-                // Check if it's a .safetensors file
-                matches!(path.extension(), Some(ext) if ext == "safetensors").then_some(path)
-            })
-            .collect::<Vec<_>>();
+        let weight_map = Self::read_weight_map(model_path)?;
+        let safetensors_files = match &weight_map {
+            Some(weight_map) => weight_map
+                .values()
+                .collect::<BTreeSet<_>>()
+                .into_iter()
+                .map(|file| model_path.join(file))
+                .collect(),
+            None => {
+                let mut files = std::fs::read_dir(model_path)
+                    .with_context(|| format!("Failed to read directory: {}", model_path.display()))?
+                    .filter_map(|entry| {
+                        let entry = entry.ok()?;
+                        let path = entry.path();
+
+                        // Check if it's a .safetensors file
+                        matches!(path.extension(), Some(ext) if ext == "safetensors")
+                            .then_some(path)
+                    })
+                    .collect::<Vec<_>>();
+                files.sort();
+                files
+            }
+        };
 
         if safetensors_files.is_empty() {
             anyhow::bail!("No SafeTensors files found in {}", model_path.display());
         }
 
-        Ok(TensorReader {
-            safetensors_files,
-            mmap_cache: Arc::new(Mutex::new(MmapCache::new(10))), // Max 10 cached files
-        })
+        let mut reader = TensorReader {
+            shards: Vec::with_capacity(safetensors_files.len()),
+            tensors: HashMap::new(),
+        };
+        for path in safetensors_files {
+            reader.add_shard(path, weight_map.as_ref())?;
+        }
+
+        let missing = weight_map.as_ref().and_then(|weight_map| {
+            weight_map
+                .keys()
+                .find(|name| !reader.tensors.contains_key(*name))
+        });
+        if let Some(missing) = missing {
+            anyhow::bail!("Tensor {missing} listed in {INDEX_FILE} not found in its shard");
+        }
+
+        Ok(reader)
     }
 
-    /// Load a specific tensor by name, converting from BF16/F32 to F32
-    pub fn load_tensor(&self, tensor_name: &str) -> Result<Option<Vec<f32>>> {
-        self.safetensors_files
+    /// Read the tensor name to shard file map of a sharded checkpoint, if any
+    fn read_weight_map(model_path: &Path) -> Result<Option<HashMap<String, String>>> {
+        let index_path = model_path.join(INDEX_FILE);
+        if !index_path.exists() {
+            return Ok(None);
+        }
+
+        let content = std::fs::read_to_string(&index_path)
+            .with_context(|| format!("Failed to read {}", index_path.display()))?;
+        let index: serde_json::Value = serde_json::from_str(&content)
+            .with_context(|| format!("Failed to parse {}", index_path.display()))?;
+        let weight_map = index
+            .get("weight_map")
+            .and_then(|weight_map| weight_map.as_object())
+            .ok_or_else(|| anyhow::anyhow!("No weight_map in {}", index_path.display()))?;
+
+        weight_map
             .iter()
-            .find_map(|filename| {
-                // Use cached memory mapping
-                // TODO we deserialize here each time, might be not so efficient
-                let mmap = self.get_mmap(filename).ok()?;
-                let safetensors = SafeTensors::deserialize(&mmap)
-                    .with_context(|| format!("Failed to deserialize {}", filename.display()))
-                    .ok()?;
-
-                // Try to find the tensor in this file
-                safetensors
-                    .tensor(tensor_name)
-                    .ok()
-                    .and_then(|tensor_view| {
-                        Self::convert_tensor_to_f32(&tensor_view, tensor_name).ok()
-                    })
+            .map(|(name, file)| {
+                let file = file
+                    .as_str()
+                    .ok_or_else(|| anyhow::anyhow!("Invalid shard name for {name}"))?;
+                Ok((name.clone(), file.to_string()))
             })
-            .map_or(Ok(None), |data| Ok(Some(data)))
+            .collect::<Result<_>>()
+            .map(Some)
+    }
+
+    /// Map a shard and index its tensors. With a weight map, only the tensors it assigns to
+    /// this shard are taken; otherwise the first shard holding a name wins.
+    fn add_shard(
+        &mut self,
+        path: PathBuf,
+        weight_map: Option<&HashMap<String, String>>,
+    ) -> Result<()> {
+        let file =
+            File::open(&path).with_context(|| format!("Failed to open {}", path.display()))?;
+
+        // SAFETY: All file-backed memory map constructors are marked `unsafe` because of the potential for
+        // *Undefined Behavior* (UB) using the map if the underlying file is subsequently modified, in or
+        // out of process.
+        let mmap = unsafe { Mmap::map(&file) }
+            .with_context(|| format!("Failed to memory map {}", path.display()))?;
+
+        let shard = self.shards.len();
+        let file_name = path.file_name().and_then(|name| name.to_str());
+        let safetensors = SafeTensors::deserialize(&mmap)
+            .with_context(|| format!("Failed to deserialize {}", path.display()))?;
+        let base = mmap.as_ptr() as usize;
+
+        for (name, tensor_view) in safetensors.tensors() {
+            let listed_here = weight_map
+                .is_none_or(|weight_map| weight_map.get(&name).map(String::as_str) == file_name);
+            if !listed_here || self.tensors.contains_key(&name) {
+                continue;
+            }
+
+            let data = tensor_view.data();
+            let start = data.as_ptr() as usize - base;
+            let entry = TensorEntry {
+                shard,
+                dtype: tensor_view.dtype(),
+                shape: tensor_view.shape().to_vec(),
+                bytes: start..start + data.len(),
+            };
+            self.tensors.insert(name, entry);
+        }
+
+        self.shards.push(Shard { path, mmap });
+        Ok(())
+    }
+
+    /// Load a specific tensor by name, converting from BF16/F32 to F32
+    pub fn load_tensor(&self, tensor_name: &str) -> Result<Option<Vec<f32>>> {
+        let Some(tensor) = self.raw_tensor(tensor_name)? else {
+            return Ok(None);
+        };
+
+        let mut values = vec![0.0; tensor.len()];
+        tensor.read_f32(0, &mut values);
+        Ok(Some(values))
     }
 
-    /// Convert tensor data to f32 based on its data type
-    fn convert_tensor_to_f32(
-        tensor_view: &safetensors::tensor::TensorView,
+    /// Look up a tensor without converting it, to read it piece by piece from the mapping
+    pub fn raw_tensor(&self, tensor_name: &str) -> Result<Option<RawTensor<'_>>> {
+        let Some(entry) = self.tensors.get(tensor_name) else {
+            return Ok(None);
+        };
+
+        let shard = &self.shards[entry.shard];
+        let data = &shard.mmap[entry.bytes.clone()];
+        Self::validate_tensor(data, &entry.shape, entry.dtype, tensor_name)
+            .with_context(|| format!("Failed to load tensor from {}", shard.path.display()))?;
+        Ok(Some(RawTensor {
+            data,
+            dtype: entry.dtype,
+        }))
+    }
+
+    /// Check that the tensor is F32 or BF16 and its data matches its shape
+    fn validate_tensor(
+        tensor_data: &[u8],
+        shape: &[usize],
+        dtype: Dtype,
         tensor_name: &str,
-    ) -> Result<Vec<f32>> {
-        let tensor_data = tensor_view.data();
-        let shape = tensor_view.shape();
-        let dtype = tensor_view.dtype();
+    ) -> Result<()> {
         let expected_elements = shape.iter().product::<usize>();
 
         match dtype {
-            safetensors::Dtype::F32 => {
-                Self::validate_tensor_size(
-                    tensor_data.len(),
-                    expected_elements * mem::size_of::<f32>(),
-                    tensor_name,
-                    "F32",
-                )?;
-                Ok(Self::convert_f32_data(tensor_data))
-            }
-            safetensors::Dtype::BF16 => {
-                Self::validate_tensor_size(
-                    tensor_data.len(),
-                    expected_elements * 2,
-                    tensor_name,
-                    "BF16",
-                )?;
-                Ok(Self::convert_bf16_data(tensor_data))
-            }
+            Dtype::F32 => Self::validate_tensor_size(
+                tensor_data.len(),
+                expected_elements * mem::size_of::<f32>(),
+                tensor_name,
+                "F32",
+            ),
+            Dtype::BF16 => Self::validate_tensor_size(
+                tensor_data.len(),
+                expected_elements * 2,
+                tensor_name,
+                "BF16",
+            ),
             _ => anyhow::bail!("Unsupported tensor dtype {:?} for {}", dtype, tensor_name),
         }
     }
@@ -113,126 +237,55 @@ impl TensorReader {
         }
         Ok(())
     }
-
-    /// Convert F32 tensor data
-    fn convert_f32_data(data: &[u8]) -> Vec<f32> {
-        data.chunks_exact(mem::size_of::<f32>())
-            .map(|chunk| {
-                let bytes: [u8; 4] = chunk.try_into().expect("chunk size is guaranteed to be 4");
-                f32::from_le_bytes(bytes)
-            })
-            .collect()
-    }
-
-    /// Convert BF16 tensor data to F32
-    fn convert_bf16_data(data: &[u8]) -> Vec<f32> {
-        data.chunks_exact(2)
-            .map(|chunk| {
-                let [low, high] = chunk else {
-                    unreachable!("chunks_exact(2) guarantees 2 bytes")
-                };
-                // BF16 to F32: BF16 is the upper 16 bits of F32
-                let bf16_bits = u16::from_le_bytes([*low, *high]);
-                let f32_bits = (bf16_bits as u32) << 16;
-                f32::from_bits(f32_bits)
-            })
-            .collect()
-    }
-
-    /// Get or create a cached memory mapping for a file
-    fn get_mmap(&self, path: &Path) -> Result<Arc<Mmap>> {
-        let mut cache = self
-            .mmap_cache
-            .lock()
-            .map_err(|_| anyhow::anyhow!("Failed to acquire cache lock"))?;
-
-        if let Some(cached_mmap) = cache.get(path) {
-            return Ok(cached_mmap);
-        }
-
-        // Create new mapping
-        let file =
-            File::open(path).with_context(|| format!("Failed to open {}", path.display()))?;
-
-        // SAFETY: All file-backed memory map constructors are marked `unsafe` because of the potential for
-        // *Undefined Behavior* (UB) using the map if the underlying file is subsequently modified, in or
-        // out of process.
-        let mmap = Arc::new(
-            unsafe { Mmap::map(&file) }
-                .with_context(|| format!("Failed to memory map {}", path.display()))?,
-        );
-
-        // Cache it with LRU eviction
-        cache.insert(path.to_path_buf(), Arc::clone(&mmap));
-        Ok(mmap)
-    }
-
-    /// Clear the memory mapping cache to free memory
-    #[allow(dead_code)]
-    pub fn clear_cache(&self) -> Result<()> {
-        let mut cache = self
-            .mmap_cache
-            .lock()
-            .map_err(|_| anyhow::anyhow!("Failed to acquire cache lock"))?;
-        cache.clear();
-        Ok(())
-    }
 }
 
-/// Memory-efficient tensor reader with LRU cache
-#[derive(Debug)]
-struct MmapCache {
-    cache: HashMap<PathBuf, Arc<Mmap>>,
-    access_order: VecDeque<PathBuf>,
-    max_size: usize,
+/// The stored bytes of an F32 or BF16 tensor, converted to f32 as they are read
+#[derive(Debug, Clone, Copy)]
+pub(crate) struct RawTensor<'a> {
+    data: &'a [u8],
+    dtype: Dtype,
 }
 
-impl MmapCache {
-    fn new(max_size: usize) -> Self {
-        Self {
-            cache: HashMap::new(),
-            access_order: VecDeque::new(),
-            max_size,
-        }
+impl RawTensor<'_> {
+    /// Number of elements
+    pub fn len(&self) -> usize {
+        self.data.len() / self.element_size()
     }
 
-    fn get(&mut self, path: &Path) -> Option<Arc<Mmap>> {
-        if let Some(mmap) = self.cache.get(path) {
-            // Move to front (most recently used)
-            if let Some(pos) = self.access_order.iter().position(|p| p == path) {
-                self.access_order.remove(pos);
-            }
-            self.access_order.push_front(path.to_path_buf());
-            Some(Arc::clone(mmap))
-        } else {
-            None
+    /// Convert the elements from `start` on into `out`, which must fit within the tensor
+    pub fn read_f32(&self, start: usize, out: &mut [f32]) {
+        let size = self.element_size();
+        let bytes = &self.data[start * size..(start + out.len()) * size];
+        match self.dtype {
+            Dtype::BF16 => Self::convert_bf16_data(bytes, out),
+            _ => Self::convert_f32_data(bytes, out),
         }
     }
 
-    fn insert(&mut self, path: PathBuf, mmap: Arc<Mmap>) {
-        // Remove if already exists
-        if self.cache.contains_key(&path) {
-            if let Some(pos) = self.access_order.iter().position(|p| p == &path) {
-                self.access_order.remove(pos);
-            }
+    fn element_size(&self) -> usize {
+        match self.dtype {
+            Dtype::BF16 => 2,
+            _ => mem::size_of::<f32>(),
         }
+    }
 
-        // Evict least recently used if cache is full
-        while self.cache.len() >= self.max_size {
-            if let Some(lru_path) = self.access_order.pop_back() {
-                self.cache.remove(&lru_path);
-            } else {
-                break;
-            }
+    /// Convert F32 tensor data
+    fn convert_f32_data(data: &[u8], out: &mut [f32]) {
+        for (value, chunk) in out.iter_mut().zip(data.chunks_exact(mem::size_of::<f32>())) {
+            let bytes: [u8; 4] = chunk.try_into().expect("chunk size is guaranteed to be 4");
+            *value = f32::from_le_bytes(bytes);
         }
-
-        // Insert new mapping
-        self.cache.insert(path.clone(), mmap);
-        self.access_order.push_front(path);
     }
 
-    fn clear(&mut self) {
-        self.cache.clear();
-        self.access_order.clear();
+    /// Convert BF16 tensor data to F32
+    fn convert_bf16_data(data: &[u8], out: &mut [f32]) {
+        for (value, chunk) in out.iter_mut().zip(data.chunks_exact(2)) {
+            let [low, high] = chunk else {
+                unreachable!("chunks_exact(2) guarantees 2 bytes")
+            };
+            // BF16 to F32: BF16 is the upper 16 bits of F32
+            let bf16_bits = u16::from_le_bytes([*low, *high]);
+            *value = f32::from_bits((bf16_bits as u32) << 16);
+        }
     }
 }
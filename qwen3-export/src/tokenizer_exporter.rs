@@ -13,6 +13,8 @@ use std::{
     path::Path,
 };
 
+use crate::vocab_trimmer::{VocabKeepSpec, VocabMap};
+
 /// Tokenizer exporter for converting HuggingFace tokenizers to binary format
 #[derive(Debug)]
 pub struct TokenizerExporter;
@@ -20,7 +22,10 @@ pub struct TokenizerExporter;
 #[derive(Debug)]
 struct TokenData {
     vocab: HashMap<String, u32>,
-    merge_ranks: HashMap<String, usize>,
+    /// Ids listed in `added_tokens` (special and control tokens)
+    added_token_ids: Vec<u32>,
+    /// BPE merges as (left, right) token strings, in rank order
+    merges: Vec<(String, String)>,
     max_token_length: u32,
 }
 
@@ -85,6 +90,10 @@ impl UnicodeToByteMap {
 impl TokenizerExporter {
     const TOKENIZER_FILE_NAME: &'static str = "tokenizer.json";
     const DEFAULT_SCORE: f32 = -1e6;
+    /// Marks the token count that follows the header ("TOKS" in little-endian)
+    pub const TOKENS_MAGIC: u32 = 0x534B_4F54;
+    /// Marks the merge table that follows the tokens ("MRGS" in little-endian)
+    pub const MERGES_MAGIC: u32 = 0x5347_524D;
 
     /// Create a new TokenizerExporter
     pub const fn new() -> Self {
@@ -98,11 +107,43 @@ impl TokenizerExporter {
         output_path: &Path,
         bos_token_id: u32,
         eos_token_id: u32,
+    ) -> Result<()> {
+        self.export_tokenizer_with_vocab_map(
+            model_path,
+            output_path,
+            bos_token_id,
+            eos_token_id,
+            None,
+        )
+    }
+
+    /// Export tokenizer to binary format, keeping only the tokens of `vocab_map` (if any)
+    /// under their trimmed ids
+    pub fn export_tokenizer_with_vocab_map(
+        &self,
+        model_path: &Path,
+        output_path: &Path,
+        bos_token_id: u32,
+        eos_token_id: u32,
+        vocab_map: Option<&VocabMap>,
     ) -> Result<()> {
         let token_data = self.load_token_data(model_path)?;
-        let tokens_by_id = self.create_ordered_tokens(&token_data.vocab);
+        let mut tokens_by_id = self.create_ordered_tokens(&token_data.vocab);
         let u2b_map = UnicodeToByteMap::new();
 
+        let (bos_token_id, eos_token_id) = match vocab_map {
+            Some(vocab_map) => {
+                tokens_by_id.retain(|(id, _)| vocab_map.new_id(*id).is_some());
+                let remap = |id: u32| {
+                    vocab_map
+                        .new_id(id)
+                        .with_context(|| format!("Special token {id} was trimmed"))
+                };
+                (remap(bos_token_id)?, remap(eos_token_id)?)
+            }
+            None => (bos_token_id, eos_token_id),
+        };
+
         self.write_tokenizer_file(
             output_path,
             &token_data,
@@ -113,19 +154,55 @@ impl TokenizerExporter {
         )
     }
 
+    /// Choose the tokens to keep for `spec`; BOS, EOS and added tokens are always kept
+    pub fn plan_vocab_trim(
+        &self,
+        model_path: &Path,
+        spec: &VocabKeepSpec,
+        bos_token_id: u32,
+        eos_token_id: u32,
+    ) -> Result<VocabMap> {
+        let token_data = self.load_token_data(model_path)?;
+        let u2b_map = UnicodeToByteMap::new();
+
+        let tokens: Vec<(u32, Vec<u8>)> = self
+            .create_ordered_tokens(&token_data.vocab)
+            .into_iter()
+            .map(|(id, token)| (id, u2b_map.token_to_bytes(&token)))
+            .collect();
+        let merges: Vec<(Vec<u8>, Vec<u8>)> = token_data
+            .merges
+            .iter()
+            .map(|(left, right)| (u2b_map.token_to_bytes(left), u2b_map.token_to_bytes(right)))
+            .collect();
+
+        let mut required = token_data.added_token_ids.clone();
+        required.extend([bos_token_id, eos_token_id]);
+
+        let vocab_map = VocabMap::build(&tokens, &merges, &required, spec);
+        info!(
+            "✂️  Keeping {} of {} tokens",
+            vocab_map.len(),
+            token_data.vocab.len()
+        );
+        Ok(vocab_map)
+    }
+
     /// Load and process all token data
     fn load_token_data(&self, model_path: &Path) -> Result<TokenData> {
         let tokenizer_data = self.load_tokenizer_json(model_path)?;
         let vocab = self.extract_vocabulary(&tokenizer_data)?;
+        let added_token_ids = self.extract_added_token_ids(&tokenizer_data);
 
-        let merge_ranks = self.extract_merge_ranks(&tokenizer_data);
+        let merges = self.extract_merges(&tokenizer_data);
         let max_token_length = vocab.keys().map(|token| token.len()).max().unwrap_or(0) as u32;
 
         info!("📊 Found {} tokens in vocabulary", vocab.len());
 
         Ok(TokenData {
             vocab,
-            merge_ranks,
+            added_token_ids,
+            merges,
             max_token_length,
         })
     }
@@ -163,7 +240,11 @@ impl TokenizerExporter {
         tokens_by_id
     }
 
-    /// Write tokenizer binary file
+    /// Write tokenizer binary file: the header, the number of tokens, the tokens in id
+    /// order, then the merge table.
+    ///
+    /// The model's vocabulary is often padded beyond the tokenizer's, so the reader needs
+    /// the count to find the merge table.
     fn write_tokenizer_file(
         &self,
         output_path: &Path,
@@ -181,12 +262,21 @@ impl TokenizerExporter {
         writer.write_u32::<LittleEndian>(token_data.max_token_length)?;
         writer.write_u32::<LittleEndian>(bos_token_id)?;
         writer.write_u32::<LittleEndian>(eos_token_id)?;
+        writer.write_u32::<LittleEndian>(Self::TOKENS_MAGIC)?;
+        writer.write_u32::<LittleEndian>(tokens_by_id.len() as u32)?;
 
-        // Write tokens
+        // Write tokens, scored by the rank of the merge that produces them
+        let mut token_ranks: HashMap<String, usize> = HashMap::new();
+        for (rank, (left, right)) in token_data.merges.iter().enumerate() {
+            token_ranks.entry(format!("{left}{right}")).or_insert(rank);
+        }
         for (_, token) in tokens_by_id {
-            self.write_token(&mut writer, token, &token_data.merge_ranks, u2b_map)?;
+            self.write_token(&mut writer, token, &token_ranks, u2b_map)?;
         }
 
+        let merge_table = self.create_merge_table(token_data, tokens_by_id);
+        self.write_merge_table(&mut writer, &merge_table)?;
+
         writer.flush()?;
         info!("💾 Written tokenizer model to {tokenizer_output}");
         Ok(())
@@ -197,11 +287,11 @@ impl TokenizerExporter {
         &self,
         writer: &mut W,
         token: &str,
-        merge_ranks: &HashMap<String, usize>,
+        token_ranks: &HashMap<String, usize>,
         u2b_map: &UnicodeToByteMap,
     ) -> Result<()> {
         // Calculate pseudo-score
-        let score = merge_ranks
+        let score = token_ranks
             .get(token)
             .map(|&rank| -((rank + 1) as f32).ln())
             .unwrap_or(Self::DEFAULT_SCORE);
@@ -216,6 +306,46 @@ impl TokenizerExporter {
         Ok(())
     }
 
+    /// Resolve the merges to (left, right, merged) positions in the written token list, in
+    /// rank order. Merges involving a token that is missing (e.g. trimmed) are dropped.
+    fn create_merge_table(
+        &self,
+        token_data: &TokenData,
+        tokens_by_id: &[(u32, String)],
+    ) -> Vec<[u32; 3]> {
+        let positions: HashMap<&str, u32> = tokens_by_id
+            .iter()
+            .enumerate()
+            .map(|(position, (_, token))| (token.as_str(), position as u32))
+            .collect();
+
+        token_data
+            .merges
+            .iter()
+            .filter_map(|(left, right)| {
+                Some([
+                    *positions.get(left.as_str())?,
+                    *positions.get(right.as_str())?,
+                    *positions.get(format!("{left}{right}").as_str())?,
+                ])
+            })
+            .collect()
+    }
+
+    /// Write the merge table: magic, count, then (left, right, merged) token ids; the rank
+    /// of a merge is its index
+    fn write_merge_table<W: Write>(&self, writer: &mut W, merge_table: &[[u32; 3]]) -> Result<()> {
+        writer.write_u32::<LittleEndian>(Self::MERGES_MAGIC)?;
+        writer.write_u32::<LittleEndian>(merge_table.len() as u32)?;
+        for ids in merge_table {
+            for &id in ids {
+                writer.write_u32::<LittleEndian>(id)?;
+            }
+        }
+        info!("🔗 Written {} merges", merge_table.len());
+        Ok(())
+    }
+
     /// Extract vocabulary from tokenizer data
     fn extract_vocabulary(&self, tokenizer_data: &Value) -> Result<HashMap<String, u32>> {
         // Extract vocabulary from model/vocab
@@ -255,20 +385,41 @@ impl TokenizerExporter {
         Ok(vocab)
     }
 
-    /// Extract merge ranks from tokenizer data
-    fn extract_merge_ranks(&self, tokenizer_data: &Value) -> HashMap<String, usize> {
+    /// Extract the ids of added tokens from tokenizer data
+    fn extract_added_token_ids(&self, tokenizer_data: &Value) -> Vec<u32> {
+        tokenizer_data
+            .pointer("/added_tokens")
+            .and_then(|v| v.as_array())
+            .map(|added_tokens| {
+                added_tokens
+                    .iter()
+                    .filter_map(|token_obj| token_obj.pointer("/id").and_then(|v| v.as_u64()))
+                    .map(|id| id as u32)
+                    .collect()
+            })
+            .unwrap_or_default()
+    }
+
+    /// Extract merges from tokenizer data, in rank order. Accepts both the `"left right"`
+    /// and the `["left", "right"]` form.
+    fn extract_merges(&self, tokenizer_data: &Value) -> Vec<(String, String)> {
         tokenizer_data
             .pointer("/model/merges")
             .and_then(|m| m.as_array())
             .map(|merges| {
                 merges
                     .iter()
-                    .enumerate()
-                    .filter_map(|(rank, merge)| {
-                        merge
-                            .as_str()
-                            .map(|merge_str| (merge_str.to_string(), rank))
+                    .filter_map(|merge| match merge {
+                        Value::String(merge) => merge.split_once(' '),
+                        Value::Array(pair) => match pair.as_slice() {
+                            [Value::String(left), Value::String(right)] => {
+                                Some((left.as_str(), right.as_str()))
+                            }
+                            _ => None,
+                        },
+                        _ => None,
                     })
+                    .map(|(left, right)| (left.to_string(), right.to_string()))
                     .collect()
             })
             .unwrap_or_default()
@@ -0,0 +1,304 @@
+#[cfg(test)]
+#[path = "../tests/unit/vocab_trimmer_test.rs"]
+mod vocab_trimmer_test;
+
+use anyhow::{Context, Result};
+use std::{
+    collections::{HashMap, HashSet},
+    fs::File,
+    io::{BufRead, BufReader, BufWriter, Write},
+    ops::RangeInclusive,
+    path::Path,
+};
+
+/// Which tokens survive vocabulary trimming, by the characters they are made of.
+///
+/// Parsed from a comma-separated list of named scripts and explicit code point ranges,
+/// e.g. `ascii,latin1,punct` or `ascii,U+0100-U+017F`. A token is kept when its text
+/// consists only of characters in the listed ranges, including the parts of characters a
+/// byte-level token may start or end with.
+#[derive(Debug, Clone)]
+pub struct VocabKeepSpec {
+    ranges: Vec<RangeInclusive<char>>,
+}
+
+impl VocabKeepSpec {
+    /// Named character ranges accepted in a spec
+    const SCRIPTS: &'static [(&'static str, &'static [RangeInclusive<char>])] = &[
+        ("ascii", &['\0'..='\u{7f}']),
+        ("latin1", &['\u{a0}'..='\u{ff}']),
+        (
+            "latin-ext",
+            &['\u{100}'..='\u{24f}', '\u{1e00}'..='\u{1eff}'],
+        ),
+        ("greek", &['\u{370}'..='\u{3ff}']),
+        ("cyrillic", &['\u{400}'..='\u{52f}']),
+        // General punctuation, currency symbols, letterlike symbols
+        ("punct", &['\u{2000}'..='\u{206f}', '\u{20a0}'..='\u{214f}']),
+        (
+            "cjk",
+            &[
+                '\u{3000}'..='\u{30ff}',
+                '\u{4e00}'..='\u{9fff}',
+                '\u{ff00}'..='\u{ffef}',
+            ],
+        ),
+    ];
+
+    pub fn parse(spec: &str) -> Result<Self> {
+        let mut ranges = Vec::new();
+
+        for item in spec
+            .split(',')
+            .map(str::trim)
+            .filter(|item| !item.is_empty())
+        {
+            if let Some((_, script)) = Self::SCRIPTS.iter().find(|(name, _)| *name == item) {
+                ranges.extend(script.iter().cloned());
+                continue;
+            }
+
+            let (start, end) = item.split_once('-').unwrap_or((item, item));
+            let range = Self::parse_code_point(start)?..=Self::parse_code_point(end)?;
+            if range.is_empty() {
+                anyhow::bail!("Empty code point range in vocabulary spec: {item}");
+            }
+            ranges.push(range);
+        }
+
+        if ranges.is_empty() {
+            anyhow::bail!("Vocabulary spec '{spec}' selects no characters");
+        }
+        Ok(Self { ranges })
+    }
+
+    fn parse_code_point(text: &str) -> Result<char> {
+        let names: Vec<_> = Self::SCRIPTS.iter().map(|(name, _)| *name).collect();
+        let hex = text.strip_prefix("U+").with_context(|| {
+            format!(
+                "Unknown vocabulary spec item '{text}': expected one of {} or U+XXXX[-U+YYYY]",
+                names.join(", ")
+            )
+        })?;
+        u32::from_str_radix(hex, 16)
+            .ok()
+            .and_then(char::from_u32)
+            .with_context(|| format!("Invalid code point '{text}' in vocabulary spec"))
+    }
+
+    /// Returns true if `text` is made only of selected characters.
+    ///
+    /// A byte-level BPE token may begin with the continuation bytes of a character started
+    /// by the previous token, or end with the first bytes of one the next token completes.
+    /// Such partial characters count as selected when a selected character could have
+    /// been split there, so text in the selected scripts keeps its merged tokens.
+    pub fn keeps(&self, text: &[u8]) -> bool {
+        let continued = text
+            .iter()
+            .take(MAX_CHAR_LEN - 1)
+            .take_while(|&&byte| is_continuation(byte))
+            .count();
+        let (continued, text) = text.split_at(continued);
+        if !continued.is_empty() && !self.selects_suffix(continued) {
+            return false;
+        }
+
+        let (complete, partial) = match std::str::from_utf8(text) {
+            Ok(text) => (text, &[][..]),
+            // Only the last character is incomplete
+            Err(error) if error.error_len().is_none() => {
+                let (complete, partial) = text.split_at(error.valid_up_to());
+                (std::str::from_utf8(complete).unwrap_or_default(), partial)
+            }
+            Err(_) => return false,
+        };
+        complete
+            .chars()
+            .all(|c| self.ranges.iter().any(|range| range.contains(&c)))
+            && (partial.is_empty() || self.selects_prefix(partial))
+    }
+
+    /// Returns true if a selected character has a code point in `start..=end`.
+    fn selects_any(&self, start: u32, end: u32) -> bool {
+        self.ranges
+            .iter()
+            .any(|range| *range.start() as u32 <= end && start <= *range.end() as u32)
+    }
+
+    /// Returns true if a selected character's UTF-8 encoding starts with the incomplete
+    /// sequence `prefix`.
+    fn selects_prefix(&self, prefix: &[u8]) -> bool {
+        let len = match prefix[0] {
+            0xc0..=0xdf => 2,
+            0xe0..=0xef => 3,
+            _ => 4,
+        };
+        let bits = prefix[1..]
+            .iter()
+            .fold((prefix[0] & (0x7f >> len)) as u32, |bits, &byte| {
+                (bits << 6) | (byte & 0x3f) as u32
+            });
+        let missing_bits = 6 * (len - prefix.len()) as u32;
+        let start = bits << missing_bits;
+        self.selects_any(start, start | ((1 << missing_bits) - 1))
+    }
+
+    /// Returns true if a selected character's UTF-8 encoding ends with the continuation
+    /// bytes `suffix`, after at least one more byte.
+    fn selects_suffix(&self, suffix: &[u8]) -> bool {
+        let low_bits = suffix
+            .iter()
+            .fold(0u32, |bits, &byte| (bits << 6) | (byte & 0x3f) as u32);
+        let modulus = 1 << (6 * suffix.len());
+
+        // Code points encoded with 2, 3 and 4 bytes
+        [(2, 0x80, 0x7ff), (3, 0x800, 0xffff), (4, 0x10000, 0x10ffff)]
+            .into_iter()
+            .filter(|&(len, _, _)| len > suffix.len())
+            .any(|(_, min, max)| {
+                self.ranges.iter().any(|range| {
+                    let start = (*range.start() as u32).max(min);
+                    let end = (*range.end() as u32).min(max);
+                    // First code point from `start` with the given low bits
+                    let first = start + (low_bits + modulus - start % modulus) % modulus;
+                    start <= end && first <= end
+                })
+            })
+    }
+}
+
+/// Longest UTF-8 encoding of a character
+const MAX_CHAR_LEN: usize = 4;
+
+fn is_continuation(byte: u8) -> bool {
+    byte & 0xc0 == 0x80
+}
+
+/// Mapping from the trimmed vocabulary to the original one.
+///
+/// Token `i` of the trimmed vocabulary is original token `kept_ids()[i]`; ids keep their
+/// relative order.
+#[derive(Debug, Clone, PartialEq, Eq)]
+pub struct VocabMap {
+    kept: Vec<u32>,
+}
+
+impl VocabMap {
+    pub fn new(mut kept: Vec<u32>) -> Self {
+        kept.sort_unstable();
+        kept.dedup();
+        Self { kept }
+    }
+
+    /// Selects the tokens to keep.
+    ///
+    /// `tokens` holds the raw bytes of each original token, `merges` the BPE merge pairs.
+    /// Besides the tokens chosen by `spec`, this keeps every `required` id (special tokens),
+    /// every single-byte token so any text can still be spelled out, and both halves of
+    /// each kept merge so every kept token stays reachable by BPE.
+    pub fn build(
+        tokens: &[(u32, Vec<u8>)],
+        merges: &[(Vec<u8>, Vec<u8>)],
+        required: &[u32],
+        spec: &VocabKeepSpec,
+    ) -> Self {
+        let ids: HashMap<&[u8], u32> = tokens
+            .iter()
+            .map(|(id, bytes)| (bytes.as_slice(), *id))
+            .collect();
+        let parents: HashMap<Vec<u8>, (&[u8], &[u8])> = merges
+            .iter()
+            .map(|(left, right)| {
+                (
+                    [left.as_slice(), right].concat(),
+                    (left.as_slice(), right.as_slice()),
+                )
+            })
+            .collect();
+
+        let mut kept: HashSet<u32> = required.iter().copied().collect();
+        let mut pending: Vec<&[u8]> = Vec::new();
+        for (id, bytes) in tokens {
+            if bytes.len() == 1 || spec.keeps(bytes) {
+                kept.insert(*id);
+                pending.push(bytes);
+            }
+        }
+
+        // Close the kept set under merge ancestry
+        while let Some(bytes) = pending.pop() {
+            let Some((left, right)) = parents.get(bytes) else {
+                continue;
+            };
+            for half in [*left, *right] {
+                if ids.get(half).is_some_and(|&id| kept.insert(id)) {
+                    pending.push(half);
+                }
+            }
+        }
+
+        Self::new(kept.into_iter().collect())
+    }
+
+    /// Number of tokens in the trimmed vocabulary
+    pub fn len(&self) -> usize {
+        self.kept.len()
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.kept.is_empty()
+    }
+
+    /// Original ids of the kept tokens, in trimmed-id order
+    pub fn kept_ids(&self) -> &[u32] {
+        &self.kept
+    }
+
+    /// Trimmed id of an original token, if it was kept
+    pub fn new_id(&self, original_id: u32) -> Option<u32> {
+        self.kept
+            .binary_search(&original_id)
+            .ok()
+            .map(|index| index as u32)
+    }
+
+    /// Gathers the kept rows of a `[vocab, row_len]` matrix such as the embedding table.
+    pub fn select_rows(&self, weights: &[f32], row_len: usize) -> Result<Vec<f32>> {
+        let rows = weights.len() / row_len;
+        if let Some(&last) = self.kept.last().filter(|&&last| last as usize >= rows) {
+            anyhow::bail!("Kept token {last} is outside the {rows}-row vocabulary tensor");
+        }
+
+        Ok(self
+            .kept
+            .iter()
+            .flat_map(|&id| &weights[id as usize * row_len..(id as usize + 1) * row_len])
+            .copied()
+            .collect())
+    }
+
+    /// Writes the mapping as text, one original id per line (line `i` is trimmed id `i`).
+    pub fn write(&self, path: &Path) -> Result<()> {
+        let mut writer = BufWriter::new(File::create(path)?);
+        for id in &self.kept {
+            writeln!(writer, "{id}")?;
+        }
+        writer.flush()?;
+        Ok(())
+    }
+
+    pub fn read(path: &Path) -> Result<Self> {
+        let file = File::open(path)
+            .with_context(|| format!("Failed to open vocabulary map {}", path.display()))?;
+        let kept = BufReader::new(file)
+            .lines()
+            .map(|line| {
+                let line = line?;
+                line.trim()
+                    .parse::<u32>()
+                    .with_context(|| format!("Invalid token id '{line}' in vocabulary map"))
+            })
+            .collect::<Result<_>>()?;
+        Ok(Self::new(kept))
+    }
+}
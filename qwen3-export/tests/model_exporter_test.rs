@@ -508,3 +508,42 @@ fn test_minimum_group_size_enforcement() {
         );
     }
 }
+
+/// Test 4-bit packing of the classifier prescreen copy
+#[test]
+fn test_quantize_q4_packing() {
+    let config = create_test_config();
+    let exporter = BinaryModelExporter::new(config, 4);
+
+    let weights = vec![7.0, -7.0, 0.0, 3.5, 1.0, 1.0, -1.0, 0.0];
+    let result = exporter.quantize_q4(&weights).unwrap();
+
+    assert_eq!(result.packed_data.len(), 4); // Two values per byte
+    assert_eq!(result.scales, vec![1.0, 1.0 / 7.0]);
+
+    // Low nibble holds the even element, values are offset by 8
+    assert_eq!(result.packed_data[0], 15 | (1 << 4));
+    assert_eq!(result.packed_data[1], 8 | (12 << 4));
+    assert_eq!(result.packed_data[2], 15 | (15 << 4));
+    assert_eq!(result.packed_data[3], 1 | (8 << 4));
+
+    // Round half to even on 3.5 gives the worst error of half a step
+    assert!((result.max_error - 0.5).abs() < 1e-6);
+
+    let error = exporter.quantize_q4(&[1.0; 6]).unwrap_err();
+    assert!(error.to_string().contains("multiple of group_size"));
+}
+
+/// An odd group size cannot be packed two values per byte, whatever the weight length
+#[test]
+fn test_quantize_q4_odd_group_size() {
+    let config = ModelConfig {
+        dim: 5,
+        ..create_test_config()
+    };
+    let exporter = BinaryModelExporter::new(config, 5);
+
+    let error = exporter.quantize_q4(&[1.0; 10]).unwrap_err().to_string();
+    assert!(error.contains("even group_size"), "{error}");
+    assert!(!error.contains("multiple of group_size"), "{error}");
+}
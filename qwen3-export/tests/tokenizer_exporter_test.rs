@@ -16,6 +16,31 @@ fn create_tokenizer_file(temp_dir: &TempDir, tokenizer_data: &Value) -> std::io:
     Ok(())
 }
 
+/// Reads the token count that follows the header
+fn read_token_count(file: &mut File) -> std::io::Result<u32> {
+    assert_eq!(
+        file.read_u32::<LittleEndian>()?,
+        TokenizerExporter::TOKENS_MAGIC
+    );
+    file.read_u32::<LittleEndian>()
+}
+
+/// Reads the merge table that follows the tokens
+fn read_merge_table(file: &mut File) -> std::io::Result<Vec<[u32; 3]>> {
+    assert_eq!(
+        file.read_u32::<LittleEndian>()?,
+        TokenizerExporter::MERGES_MAGIC
+    );
+    let count = file.read_u32::<LittleEndian>()?;
+    let mut merges = Vec::new();
+    for _ in 0..count {
+        let mut ids = [0u32; 3];
+        file.read_u32_into::<LittleEndian>(&mut ids)?;
+        merges.push(ids);
+    }
+    Ok(merges)
+}
+
 /// Test complete tokenizer export pipeline
 #[test]
 fn test_complete_tokenizer_export() -> std::io::Result<()> {
@@ -23,7 +48,7 @@ fn test_complete_tokenizer_export() -> std::io::Result<()> {
     let exporter = TokenizerExporter::new();
 
     // Create a complete tokenizer.json with vocabulary and merges
-    // Include tokens that actually match the merge patterns to test score calculation
+    // Include the tokens produced by the merges to test score calculation
     let tokenizer_data = json!({
          "added_tokens": [
             {
@@ -50,13 +75,16 @@ fn test_complete_tokenizer_export() -> std::io::Result<()> {
                 "hello": 1,
                 "world": 2,
                 "!": 3,
-                "h e": 4,      // This token matches merge[0], should get score -ln(1) = 0
-                "l l": 5,      // This token matches merge[1], should get score -ln(2) ≈ -0.693
-                "other": 6     // This token has no merge, should get DEFAULT_SCORE
+                "he": 4,       // Produced by merge[0], should get score -ln(1) = 0
+                "ll": 5,       // Produced by merge[1], should get score -ln(2) ≈ -0.693
+                "other": 6,    // Produced by no merge, should get DEFAULT_SCORE
+                "h": 7,
+                "e": 8,
+                "l": 9
             },
             "merges": [
                 "h e",         // rank 0
-                "l l"          // rank 1
+                ["l", "l"]     // rank 1, in the newer pair form
             ]
         }
     });
@@ -90,15 +118,19 @@ fn test_complete_tokenizer_export() -> std::io::Result<()> {
     assert_eq!(max_token_length, 15); // Length of "<|startoftext|>" is 15
     assert_eq!(bos_token_id, 100);
     assert_eq!(eos_token_id, 101);
+    assert_eq!(read_token_count(&mut file)?, 11);
 
     // Read and verify tokens (should be ordered by ID)
     let expected_tokens = vec![
         (1, "hello", DEFAULT_SCORE),             // No merge rank
         (2, "world", DEFAULT_SCORE),             // No merge rank
         (3, "!", DEFAULT_SCORE),                 // No merge rank
-        (4, "h e", 0.0),                         // Merge rank 0: -ln(1) = 0
-        (5, "l l", -((1 + 1) as f32).ln()),      // Merge rank 1: -ln(2) ≈ -0.693
+        (4, "he", 0.0),                          // Merge rank 0: -ln(1) = 0
+        (5, "ll", -((1 + 1) as f32).ln()),       // Merge rank 1: -ln(2) ≈ -0.693
         (6, "other", DEFAULT_SCORE),             // No merge rank
+        (7, "h", DEFAULT_SCORE),                 // No merge rank
+        (8, "e", DEFAULT_SCORE),                 // No merge rank
+        (9, "l", DEFAULT_SCORE),                 // No merge rank
         (100, "<|endoftext|>", DEFAULT_SCORE),   // Special token, no merge rank
         (101, "<|startoftext|>", DEFAULT_SCORE), // Special token, no merge rank
     ];
@@ -134,6 +166,12 @@ fn test_complete_tokenizer_export() -> std::io::Result<()> {
         assert_eq!(token_bytes.len(), expected_token.len());
     }
 
+    // Merges by position in the token list: "h" + "e" -> "he", "l" + "l" -> "ll"
+    assert_eq!(read_merge_table(&mut file)?, vec![[6, 7, 3], [8, 8, 4]]);
+
+    let mut buffer = [0u8; 1];
+    assert_eq!(file.read(&mut buffer)?, 0);
+
     Ok(())
 }
 
@@ -168,8 +206,10 @@ fn test_export_empty_vocabulary() -> std::io::Result<()> {
     assert_eq!(max_token_length, 0);
     assert_eq!(bos_token_id, 0);
     assert_eq!(eos_token_id, 0);
+    assert_eq!(read_token_count(&mut file)?, 0);
 
-    // Should be no more data (empty vocabulary)
+    // Should be no more data than an empty merge table (empty vocabulary)
+    assert!(read_merge_table(&mut file)?.is_empty());
     let mut buffer = [0u8; 1];
     assert_eq!(file.read(&mut buffer)?, 0);
 
@@ -208,6 +248,7 @@ fn test_unicode_character_export() -> std::io::Result<()> {
     file.read_u32::<LittleEndian>()?; // max_token_length
     file.read_u32::<LittleEndian>()?; // bos_token_id
     file.read_u32::<LittleEndian>()?; // eos_token_id
+    assert_eq!(read_token_count(&mut file)?, 4);
 
     // Read each token and verify it's properly encoded
     for _ in 0..4 {
@@ -331,6 +372,7 @@ fn test_merge_ranks_and_scores() -> std::io::Result<()> {
     file.read_u32::<LittleEndian>()?;
     file.read_u32::<LittleEndian>()?;
     file.read_u32::<LittleEndian>()?;
+    assert_eq!(read_token_count(&mut file)?, 3);
 
     // Read tokens and check scores
     let mut scores = Vec::new();
@@ -343,12 +385,15 @@ fn test_merge_ranks_and_scores() -> std::io::Result<()> {
         file.read_exact(&mut token_bytes)?;
     }
 
-    // All tokens should have the default score since none of them appear in merges
-    // (merges contain "h e" and "l l", not "hello", "world", "unknown")
+    // All tokens should have the default score since no merge produces them
+    // (merges produce "he" and "ll", not "hello", "world", "unknown")
     for score in scores {
         assert_eq!(score, DEFAULT_SCORE);
     }
 
+    // The merges reference tokens missing from the vocabulary and are dropped
+    assert!(read_merge_table(&mut file)?.is_empty());
+
     Ok(())
 }
 
@@ -387,3 +432,64 @@ fn test_large_vocabulary() -> std::io::Result<()> {
 
     Ok(())
 }
+
+/// Test exporting a trimmed vocabulary
+#[test]
+fn test_trimmed_tokenizer_export() -> std::io::Result<()> {
+    use qwen3_export::VocabKeepSpec;
+
+    let temp_dir = TempDir::new()?;
+    let exporter = TokenizerExporter::new();
+
+    // "Ġ" is the GPT-2 byte mapping of a space
+    let tokenizer_data = json!({
+        "added_tokens": [
+            {"id": 7, "content": "<|im_end|>", "special": true}
+        ],
+        "model": {
+            "vocab": {
+                "a": 0,
+                "b": 1,
+                "Ġ": 2,
+                "Ġa": 3,
+                "Ðº": 4,
+                "ab": 5,
+                "ĠÐº": 6
+            },
+            "merges": ["Ġ a", "a b", "Ġ Ðº"]
+        }
+    });
+    create_tokenizer_file(&temp_dir, &tokenizer_data)?;
+
+    let spec = VocabKeepSpec::parse("ascii").unwrap();
+    let vocab_map = exporter
+        .plan_vocab_trim(temp_dir.path(), &spec, 7, 7)
+        .unwrap();
+    // The Cyrillic tokens "к" and " к" are dropped, the special token is kept
+    assert_eq!(vocab_map.kept_ids(), &[0, 1, 2, 3, 5, 7]);
+
+    let output_path = temp_dir.path().join("output");
+    exporter
+        .export_tokenizer_with_vocab_map(temp_dir.path(), &output_path, 7, 7, Some(&vocab_map))
+        .unwrap();
+
+    let mut file = File::open(output_path.with_extension("tokenizer"))?;
+    let _max_token_length = file.read_u32::<LittleEndian>()?;
+    assert_eq!(file.read_u32::<LittleEndian>()?, 5); // BOS remapped
+    assert_eq!(file.read_u32::<LittleEndian>()?, 5); // EOS remapped
+    assert_eq!(read_token_count(&mut file)? as usize, vocab_map.len());
+
+    let mut tokens = Vec::new();
+    for _ in 0..vocab_map.len() {
+        let _score = file.read_f32::<LittleEndian>()?;
+        let mut token = vec![0u8; file.read_u32::<LittleEndian>()? as usize];
+        file.read_exact(&mut token)?;
+        tokens.push(String::from_utf8(token).unwrap());
+    }
+    assert_eq!(tokens, vec!["a", "b", " ", " a", "ab", "<|im_end|>"]);
+
+    // Merges use the trimmed ids; " " + "к" lost its tokens and is dropped
+    assert_eq!(read_merge_table(&mut file)?, vec![[2, 0, 3], [0, 1, 4]]);
+
+    Ok(())
+}
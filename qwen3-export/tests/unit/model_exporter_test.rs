@@ -218,3 +218,268 @@ fn test_minimum_group_size_enforcement() {
     // Should succeed because the exporter adjusted to use MIN_GROUP_SIZE = 4
     assert!(result.is_ok());
 }
+
+/// Writes `tensors` as an F32 safetensors file
+fn write_safetensors(path: &Path, tensors: &[(String, Vec<f32>)]) {
+    let mut header = serde_json::Map::new();
+    let mut data = Vec::new();
+    for (name, values) in tensors {
+        let start = data.len();
+        data.extend(values.iter().flat_map(|value| value.to_le_bytes()));
+        header.insert(
+            name.clone(),
+            serde_json::json!({
+                "dtype": "F32",
+                "shape": [values.len()],
+                "data_offsets": [start, data.len()],
+            }),
+        );
+    }
+    let header = serde_json::to_vec(&header).unwrap();
+    let mut file = File::create(path).unwrap();
+    file.write_all(&(header.len() as u64).to_le_bytes())
+        .unwrap();
+    file.write_all(&header).unwrap();
+    file.write_all(&data).unwrap();
+}
+
+#[test]
+fn test_pipelined_export_writes_tensors_in_order() {
+    let config = ModelConfig {
+        dim: 8,
+        hidden_dim: 16,
+        n_layers: 3,
+        n_heads: 2,
+        n_kv_heads: 2,
+        vocab_size: 5,
+        max_seq_len: 32,
+        head_dim: 4,
+        norm_eps: 1e-6,
+        bos_token_id: 0,
+        eos_token_id: 1,
+    };
+    let exporter = BinaryModelExporter::new(config.clone(), 4);
+
+    // Distinct values per tensor, so any reordering changes the output
+    let mut tensors = Vec::new();
+    let mut tensor = |name: String, len: usize| {
+        let seed = tensors.len() as f32;
+        let values: Vec<f32> = (0..len)
+            .map(|i| ((i as f32 + seed) * 0.37).sin() * (seed + 1.0))
+            .collect();
+        tensors.push((name, values));
+    };
+    let (dim, vocab) = (config.dim as usize, config.vocab_size as usize);
+    for layer in 0..config.n_layers {
+        tensor(format!("model.layers.{layer}.input_layernorm.weight"), dim);
+        tensor(
+            format!("model.layers.{layer}.post_attention_layernorm.weight"),
+            dim,
+        );
+    }
+    tensor(BinaryModelExporter::FINAL_NORM_KEY.to_string(), dim);
+    tensor(
+        BinaryModelExporter::EMBED_TOKENS_KEY.to_string(),
+        vocab * dim,
+    );
+    tensor(BinaryModelExporter::LM_HEAD_KEY.to_string(), vocab * dim);
+    for pattern in BinaryModelExporter::LAYER_WEIGHT_PATTERNS {
+        for layer in 0..config.n_layers {
+            tensor(format!("model.layers.{layer}.{pattern}"), dim * 4);
+        }
+    }
+
+    let dir = tempfile::tempdir().unwrap();
+    write_safetensors(&dir.path().join("model.safetensors"), &tensors);
+    let output = dir.path().join("model.bin");
+    exporter.export_binary_model(dir.path(), &output).unwrap();
+
+    // Expected layout: header, fp32 norms, then each Q8_0 tensor followed by its scales
+    let find = |name: &str| &tensors.iter().find(|(n, _)| n == name).unwrap().1;
+    let mut expected = Vec::new();
+    for kind in ["input_layernorm", "post_attention_layernorm"] {
+        for layer in 0..config.n_layers {
+            let norm = find(&format!("model.layers.{layer}.{kind}.weight"));
+            expected.extend(norm.iter().flat_map(|v| v.to_le_bytes()));
+        }
+    }
+    let final_norm = find(BinaryModelExporter::FINAL_NORM_KEY);
+    expected.extend(final_norm.iter().flat_map(|v| v.to_le_bytes()));
+    let ones = 2 * config.n_layers as usize * config.head_dim as usize;
+    expected.extend((0..ones).flat_map(|_| 1.0f32.to_le_bytes()));
+    for name in exporter.weight_tensor_names(false) {
+        let quantized = exporter.quantize_q80(find(&name)).unwrap();
+        expected.extend(quantized.int8_data.iter().map(|&v| v as u8));
+        expected.extend(quantized.scales.iter().flat_map(|v| v.to_le_bytes()));
+    }
+
+    let written = std::fs::read(&output).unwrap();
+    assert_eq!(
+        written.len(),
+        BinaryModelExporter::HEADER_SIZE + expected.len()
+    );
+    assert!(written[BinaryModelExporter::HEADER_SIZE..] == expected[..]);
+}
+
+#[test]
+fn test_tensor_queue_stays_within_depth() {
+    let queue = TensorQueue::new(5, 2);
+    assert_eq!(queue.next(), Some(0));
+    assert_eq!(queue.next(), Some(1));
+
+    // A third tensor may only start once the first one is written
+    thread::scope(|scope| {
+        let waiting = scope.spawn(|| queue.next());
+        queue.mark_written();
+        assert_eq!(waiting.join().unwrap(), Some(2));
+    });
+
+    queue.close();
+    assert_eq!(queue.next(), None);
+}
+
+/// Writes a one-layer model whose embedding table spans several quantization chunks
+fn write_large_vocab_model(dir: &Path, config: &ModelConfig, lm_head_offset: f32) {
+    let (dim, vocab) = (config.dim as usize, config.vocab_size as usize);
+    let values = |seed: f32, len: usize| -> Vec<f32> {
+        (0..len)
+            .map(|i| (i as f32 * 0.013 + seed).sin() * 3.0)
+            .collect()
+    };
+    let embed = values(0.5, vocab * dim);
+    let lm_head: Vec<f32> = embed.iter().map(|v| v + lm_head_offset).collect();
+
+    let mut tensors = vec![
+        (BinaryModelExporter::EMBED_TOKENS_KEY.to_string(), embed),
+        (BinaryModelExporter::LM_HEAD_KEY.to_string(), lm_head),
+        (
+            BinaryModelExporter::FINAL_NORM_KEY.to_string(),
+            values(1.0, dim),
+        ),
+    ];
+    for kind in ["input_layernorm", "post_attention_layernorm"] {
+        tensors.push((format!("model.layers.0.{kind}.weight"), values(2.0, dim)));
+    }
+    for (i, pattern) in BinaryModelExporter::LAYER_WEIGHT_PATTERNS
+        .iter()
+        .enumerate()
+    {
+        tensors.push((
+            format!("model.layers.0.{pattern}"),
+            values(i as f32, dim * 4),
+        ));
+    }
+    write_safetensors(&dir.join("model.safetensors"), &tensors);
+}
+
+fn large_vocab_config() -> ModelConfig {
+    ModelConfig {
+        dim: 12,
+        hidden_dim: 16,
+        n_layers: 1,
+        n_heads: 3,
+        n_kv_heads: 3,
+        vocab_size: 140_000,
+        max_seq_len: 32,
+        head_dim: 4,
+        norm_eps: 1e-6,
+        bos_token_id: 0,
+        eos_token_id: 1,
+    }
+}
+
+/// Byte offset of the weights after the header and the fp32 norms of `config`
+fn weights_offset(config: &ModelConfig) -> usize {
+    let (dim, head_dim, layers) = (
+        config.dim as usize,
+        config.head_dim as usize,
+        config.n_layers as usize,
+    );
+    BinaryModelExporter::HEADER_SIZE + ((2 * layers + 1) * dim + 2 * layers * head_dim) * 4
+}
+
+#[test]
+fn test_chunked_export_matches_whole_tensor_quantization() {
+    let config = large_vocab_config();
+    let dir = tempfile::tempdir().unwrap();
+    // lm_head equals the embeddings, so the classifier is detected as shared
+    write_large_vocab_model(dir.path(), &config, 0.0);
+
+    // Trimming keeps enough rows to span two chunks that split a row
+    let vocab_map = VocabMap::new((0..config.vocab_size).filter(|id| id % 50 != 7).collect());
+    let exporter = BinaryModelExporter::new(config.clone(), 4)
+        .with_vocab_map(Some(vocab_map.clone()))
+        .with_classifier_prescreen(true);
+    assert!(vocab_map.len() * config.dim as usize > BinaryModelExporter::CHUNK_WEIGHTS);
+    assert!(BinaryModelExporter::CHUNK_WEIGHTS % config.dim as usize != 0);
+
+    let output = dir.path().join("model.bin");
+    exporter.export_binary_model(dir.path(), &output).unwrap();
+
+    let reader = TensorReader::new(dir.path()).unwrap();
+    let load = |name: &str| reader.load_tensor(name).unwrap().unwrap();
+    let embed = vocab_map
+        .select_rows(
+            &load(BinaryModelExporter::EMBED_TOKENS_KEY),
+            config.dim as usize,
+        )
+        .unwrap();
+
+    let mut expected = Vec::new();
+    for name in exporter.weight_tensor_names(true) {
+        let weights = if name == BinaryModelExporter::EMBED_TOKENS_KEY {
+            embed.clone()
+        } else {
+            load(&name)
+        };
+        let quantized = exporter.quantize_q80(&weights).unwrap();
+        expected.extend(quantized.int8_data.iter().map(|&v| v as u8));
+        expected.extend(quantized.scales.iter().flat_map(|v| v.to_le_bytes()));
+    }
+    let prescreen = exporter.quantize_q4(&embed).unwrap();
+    expected.extend(&prescreen.packed_data);
+    expected.extend(prescreen.scales.iter().flat_map(|v| v.to_le_bytes()));
+
+    let written = std::fs::read(&output).unwrap();
+    let offset = weights_offset(&config);
+    assert_eq!(written.len(), offset + expected.len());
+    assert!(written[offset..] == expected[..]);
+}
+
+#[test]
+fn test_tie_word_embeddings_decides_shared_classifier() {
+    let config = ModelConfig {
+        vocab_size: 16,
+        ..large_vocab_config()
+    };
+    let exporter = BinaryModelExporter::new(config.clone(), 4);
+    let dir = tempfile::tempdir().unwrap();
+    let output = dir.path().join("model.bin");
+    let shared_flag = |path: &Path| {
+        let header = std::fs::read(path).unwrap();
+        u32::from_le_bytes(header[40..44].try_into().unwrap())
+    };
+
+    // Without the config flag, differing tensors mean separate classifier weights
+    write_large_vocab_model(dir.path(), &config, 0.25);
+    exporter.export_binary_model(dir.path(), &output).unwrap();
+    assert_eq!(shared_flag(&output), 0);
+
+    // The config flag wins over comparing the tensors
+    std::fs::write(
+        dir.path().join("config.json"),
+        r#"{"tie_word_embeddings": true}"#,
+    )
+    .unwrap();
+    exporter.export_binary_model(dir.path(), &output).unwrap();
+    assert_eq!(shared_flag(&output), 1);
+
+    write_large_vocab_model(dir.path(), &config, 0.0);
+    std::fs::write(
+        dir.path().join("config.json"),
+        r#"{"tie_word_embeddings": false}"#,
+    )
+    .unwrap();
+    exporter.export_binary_model(dir.path(), &output).unwrap();
+    assert_eq!(shared_flag(&output), 0);
+}
@@ -0,0 +1,118 @@
+use super::*;
+use std::io::Write;
+
+/// Writes `(name, dtype, shape, bytes)` tensors as a safetensors file
+fn write_safetensors(path: &Path, tensors: &[(&str, &str, Vec<usize>, Vec<u8>)]) {
+    let mut header = serde_json::Map::new();
+    let mut data = Vec::new();
+    for (name, dtype, shape, bytes) in tensors {
+        let start = data.len();
+        data.extend_from_slice(bytes);
+        header.insert(
+            name.to_string(),
+            serde_json::json!({
+                "dtype": dtype,
+                "shape": shape,
+                "data_offsets": [start, data.len()],
+            }),
+        );
+    }
+    let header = serde_json::to_vec(&header).unwrap();
+    let mut file = File::create(path).unwrap();
+    file.write_all(&(header.len() as u64).to_le_bytes())
+        .unwrap();
+    file.write_all(&header).unwrap();
+    file.write_all(&data).unwrap();
+}
+
+fn f32_bytes(values: &[f32]) -> Vec<u8> {
+    values
+        .iter()
+        .flat_map(|value| value.to_le_bytes())
+        .collect()
+}
+
+#[test]
+fn test_loads_tensors_from_all_shards() {
+    let dir = tempfile::tempdir().unwrap();
+    write_safetensors(
+        &dir.path().join("model-00001-of-00002.safetensors"),
+        &[
+            ("a", "F32", vec![2], f32_bytes(&[1.0, -2.0])),
+            ("b", "F32", vec![1], f32_bytes(&[3.5])),
+        ],
+    );
+    // BF16 1.0 and -0.5 are the upper halves of their F32 bits
+    let bf16: Vec<u8> = [0x3F80u16, 0xBF00]
+        .iter()
+        .flat_map(|bits| bits.to_le_bytes())
+        .collect();
+    write_safetensors(
+        &dir.path().join("model-00002-of-00002.safetensors"),
+        &[("c", "BF16", vec![2], bf16)],
+    );
+
+    let reader = TensorReader::new(dir.path()).unwrap();
+    assert_eq!(reader.load_tensor("a").unwrap(), Some(vec![1.0, -2.0]));
+    assert_eq!(reader.load_tensor("b").unwrap(), Some(vec![3.5]));
+    assert_eq!(reader.load_tensor("c").unwrap(), Some(vec![1.0, -0.5]));
+    assert_eq!(reader.load_tensor("missing").unwrap(), None);
+}
+
+#[test]
+fn test_index_file_selects_shards() {
+    let dir = tempfile::tempdir().unwrap();
+    write_safetensors(
+        &dir.path().join("first.safetensors"),
+        &[
+            ("a", "F32", vec![1], f32_bytes(&[1.0])),
+            ("b", "F32", vec![1], f32_bytes(&[2.0])),
+        ],
+    );
+    write_safetensors(
+        &dir.path().join("second.safetensors"),
+        &[("b", "F32", vec![1], f32_bytes(&[20.0]))],
+    );
+    // Not listed in the index, so never read
+    std::fs::write(
+        dir.path().join("stale.safetensors"),
+        b"not a safetensors file",
+    )
+    .unwrap();
+    let index = serde_json::json!({
+        "metadata": {"total_size": 12},
+        "weight_map": {"a": "first.safetensors", "b": "second.safetensors"},
+    });
+    std::fs::write(dir.path().join(INDEX_FILE), index.to_string()).unwrap();
+
+    let reader = TensorReader::new(dir.path()).unwrap();
+    assert_eq!(reader.load_tensor("a").unwrap(), Some(vec![1.0]));
+    assert_eq!(reader.load_tensor("b").unwrap(), Some(vec![20.0]));
+}
+
+#[test]
+fn test_index_file_must_match_shards() {
+    let dir = tempfile::tempdir().unwrap();
+    write_safetensors(
+        &dir.path().join("model.safetensors"),
+        &[("a", "F32", vec![1], f32_bytes(&[1.0]))],
+    );
+    let index = serde_json::json!({
+        "weight_map": {"a": "model.safetensors", "b": "model.safetensors"},
+    });
+    std::fs::write(dir.path().join(INDEX_FILE), index.to_string()).unwrap();
+
+    assert!(TensorReader::new(dir.path()).is_err());
+}
+
+#[test]
+fn test_unsupported_dtype_is_an_error() {
+    let dir = tempfile::tempdir().unwrap();
+    write_safetensors(
+        &dir.path().join("model.safetensors"),
+        &[("a", "I8", vec![2], vec![1, 2])],
+    );
+
+    let reader = TensorReader::new(dir.path()).unwrap();
+    assert!(reader.load_tensor("a").is_err());
+}
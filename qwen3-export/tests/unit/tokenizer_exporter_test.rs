@@ -150,50 +150,55 @@ mod tokenizer_exporter_tests {
     }
 
     #[test]
-    fn test_extract_merge_ranks() {
+    fn test_extract_merges() {
         let exporter = TokenizerExporter::new();
         let tokenizer_data = json!({
             "model": {
                 "merges": [
                     "h e",
                     "l l",
-                    "o !",
-                    "he ll"
+                    ["o", "!"],
+                    ["he", "ll"]
                 ]
             }
         });
 
-        let merge_ranks = exporter.extract_merge_ranks(&tokenizer_data);
+        let merges = exporter.extract_merges(&tokenizer_data);
 
-        assert_eq!(merge_ranks.len(), 4);
-        assert_eq!(merge_ranks.get("h e"), Some(&0));
-        assert_eq!(merge_ranks.get("l l"), Some(&1));
-        assert_eq!(merge_ranks.get("o !"), Some(&2));
-        assert_eq!(merge_ranks.get("he ll"), Some(&3));
+        let pair = |left: &str, right: &str| (left.to_string(), right.to_string());
+        assert_eq!(
+            merges,
+            vec![
+                pair("h", "e"),
+                pair("l", "l"),
+                pair("o", "!"),
+                pair("he", "ll")
+            ]
+        );
     }
 
     #[test]
-    fn test_extract_merge_ranks_empty() {
+    fn test_extract_merges_empty() {
         let exporter = TokenizerExporter::new();
         let tokenizer_data = json!({
             "model": {}
         });
 
-        let merge_ranks = exporter.extract_merge_ranks(&tokenizer_data);
+        let merges = exporter.extract_merges(&tokenizer_data);
 
-        assert!(merge_ranks.is_empty());
+        assert!(merges.is_empty());
     }
 
     #[test]
-    fn test_extract_merge_ranks_missing() {
+    fn test_extract_merges_missing() {
         let exporter = TokenizerExporter::new();
         let tokenizer_data = json!({
             "other": "data"
         });
 
-        let merge_ranks = exporter.extract_merge_ranks(&tokenizer_data);
+        let merges = exporter.extract_merges(&tokenizer_data);
 
-        assert!(merge_ranks.is_empty());
+        assert!(merges.is_empty());
     }
 }
 
@@ -315,10 +320,10 @@ mod load_token_data_tests {
         assert_eq!(token_data.vocab.get("!"), Some(&3));
         assert_eq!(token_data.vocab.get("<special>"), Some(&100));
 
-        // Check merge ranks
-        assert_eq!(token_data.merge_ranks.len(), 2);
-        assert_eq!(token_data.merge_ranks.get("h e"), Some(&0));
-        assert_eq!(token_data.merge_ranks.get("l l"), Some(&1));
+        // Check merges, in rank order
+        assert_eq!(token_data.merges.len(), 2);
+        assert_eq!(token_data.merges[0], ("h".to_string(), "e".to_string()));
+        assert_eq!(token_data.merges[1], ("l".to_string(), "l".to_string()));
 
         // Check max token length (should be len of "<special>" = 9)
         assert_eq!(token_data.max_token_length, 9);
@@ -0,0 +1,91 @@
+//! Unit tests for vocabulary trimming
+
+use super::{VocabKeepSpec, VocabMap};
+use tempfile::TempDir;
+
+fn tokens(texts: &[&str]) -> Vec<(u32, Vec<u8>)> {
+    texts
+        .iter()
+        .enumerate()
+        .map(|(id, text)| (id as u32, text.as_bytes().to_vec()))
+        .collect()
+}
+
+#[test]
+fn test_spec_parsing() {
+    let spec = VocabKeepSpec::parse("ascii, latin1").unwrap();
+    assert!(spec.keeps(b"hello world"));
+    assert!(spec.keeps("Grüße".as_bytes()));
+    assert!(!spec.keeps("привет".as_bytes()));
+
+    // Partial characters, as byte-level tokens split them: "ü" is C3 BC
+    assert!(spec.keeps(&[b'G', 0xC3]));
+    assert!(spec.keeps(&[0xBC, b'e']));
+    assert!(!spec.keeps(&[b'p', 0xD0])); // Start of a Cyrillic letter
+    assert!(!spec.keeps(&[0xBC, 0xBC, b'e'])); // Ends a character of 3+ bytes
+    assert!(!spec.keeps(&[b'a', 0xFF]));
+
+    // "日" is E6 97 A5, "😀" is F0 9F 98 80
+    let spec = VocabKeepSpec::parse("cjk").unwrap();
+    assert!(spec.keeps(&[0xE6, 0x97]));
+    assert!(spec.keeps(&[0x97, 0xA5, 0xE6]));
+    assert!(spec.keeps(&[0xA5]));
+    assert!(!spec.keeps(&[0xF0, 0x9F]));
+    assert!(!spec.keeps(&[0x9F, 0x98, 0x80]));
+    assert!(VocabKeepSpec::parse("U+1F600").unwrap().keeps(&[0x9F, 0x98, 0x80]));
+
+    let spec = VocabKeepSpec::parse("U+0430-U+044F,U+0020").unwrap();
+    assert!(spec.keeps("при вет".as_bytes()));
+    assert!(!spec.keeps(b"a"));
+
+    assert!(VocabKeepSpec::parse("klingon").is_err());
+    assert!(VocabKeepSpec::parse("U+0100-U+00FF").is_err());
+    assert!(VocabKeepSpec::parse("U+ZZZZ").is_err());
+    assert!(VocabKeepSpec::parse("").is_err());
+}
+
+#[test]
+fn test_build_keeps_bytes_specials_and_merge_parents() {
+    let tokens = tokens(&["a", "b", "ab", "abж", "ж", "жж", "<|end|>", "xyz"]);
+    // "abж" is built from "ab" + "ж", but "ж" itself is outside the spec
+    let merges = vec![
+        (b"a".to_vec(), b"b".to_vec()),
+        (b"ab".to_vec(), "ж".as_bytes().to_vec()),
+        ("ж".as_bytes().to_vec(), "ж".as_bytes().to_vec()),
+    ];
+    let spec = VocabKeepSpec::parse("U+0061-U+0062,U+0436").unwrap();
+
+    let vocab_map = VocabMap::build(&tokens, &merges, &[6], &spec);
+    // "xyz" is outside the spec and not needed by any kept merge
+    assert_eq!(vocab_map.kept_ids(), &[0, 1, 2, 3, 4, 5, 6]);
+
+    let spec = VocabKeepSpec::parse("U+0061-U+0062").unwrap();
+    let vocab_map = VocabMap::build(&tokens, &merges, &[6], &spec);
+    assert_eq!(vocab_map.kept_ids(), &[0, 1, 2, 6]);
+    assert_eq!(vocab_map.new_id(6), Some(3));
+    assert_eq!(vocab_map.new_id(3), None);
+}
+
+#[test]
+fn test_select_rows() {
+    let vocab_map = VocabMap::new(vec![2, 0]);
+    let weights: Vec<f32> = (0..6).map(|v| v as f32).collect();
+
+    assert_eq!(
+        vocab_map.select_rows(&weights, 2).unwrap(),
+        vec![0.0, 1.0, 4.0, 5.0]
+    );
+    assert!(VocabMap::new(vec![3]).select_rows(&weights, 2).is_err());
+}
+
+#[test]
+fn test_write_and_read() {
+    let temp_dir = TempDir::new().unwrap();
+    let path = temp_dir.path().join("model.vocab-map");
+
+    let vocab_map = VocabMap::new(vec![7, 1, 42]);
+    vocab_map.write(&path).unwrap();
+
+    assert_eq!(std::fs::read_to_string(&path).unwrap(), "1\n7\n42\n");
+    assert_eq!(VocabMap::read(&path).unwrap(), vocab_map);
+}
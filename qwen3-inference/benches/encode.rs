@@ -0,0 +1,167 @@
+//! Micro-benchmark of `Tokenizer::encode` on a 10 KB prompt, and of
+//! `Tokenizer::encode_batch` against one `encode` per document on a corpus.
+//!
+//! Uses the tokenizer of the checkpoint in `QWEN3_CHECKPOINT` if set, otherwise a
+//! synthetic vocabulary of Qwen3 size (byte tokens plus letter n-grams). The corpus is the
+//! non-empty lines of `QWEN3_CORPUS` if set, otherwise 8 MB of synthetic documents.
+//!
+//! ```bash
+//! QWEN3_CHECKPOINT=/path/to/model.bin QWEN3_CORPUS=/path/to/corpus.txt \
+//!     cargo bench -p qwen3-inference --bench encode
+//! ```
+
+use qwen3_inference::{PromptTemplates, Tokenizer, read_checkpoint_config};
+use std::hint::black_box;
+use std::time::{Duration, Instant};
+
+const VOCAB_SIZE: usize = 151_936;
+const PROMPT_BYTES: usize = 10 * 1024;
+const CORPUS_DOCUMENTS: usize = 4096;
+const DOCUMENT_BYTES: usize = 2 * 1024;
+const SPECIAL_TOKENS: [&str; 2] = ["<|im_start|>", "<|im_end|>"];
+
+/// Byte tokens, the chat markers, then all strings of 2 to 4 characters over `a-z` and
+/// space in order of length, shorter ones merging first.
+fn synthetic_tokenizer() -> Tokenizer {
+    let alphabet: Vec<u8> = (b'a'..=b'z').chain([b' ']).collect();
+    let mut vocab: Vec<Vec<u8>> = (0..=255u8).map(|b| vec![b]).collect();
+    vocab.extend(SPECIAL_TOKENS.map(|token| token.as_bytes().to_vec()));
+    let mut layer: Vec<Vec<u8>> = alphabet.iter().map(|&c| vec![c]).collect();
+    while vocab.len() < VOCAB_SIZE {
+        layer = layer
+            .iter()
+            .flat_map(|prefix| {
+                alphabet.iter().map(move |&c| {
+                    let mut token = prefix.clone();
+                    token.push(c);
+                    token
+                })
+            })
+            .collect();
+        let take = layer.len().min(VOCAB_SIZE - vocab.len());
+        vocab.extend(layer[..take].iter().cloned());
+    }
+    // Special tokens get the exporter's score for tokens no merge produces
+    let merge_scores = (0..vocab.len())
+        .map(|id| match id {
+            256..=257 => -1e6,
+            _ => -(id as f32),
+        })
+        .collect();
+
+    Tokenizer::from_vocab(vocab, merge_scores, 12, 0, 1, PromptTemplates::default())
+}
+
+/// Pseudo-random English-like words, with a chat turn ending now and then
+fn prompt(seed: u32, bytes: usize) -> String {
+    const WORDS: [&str; 16] = [
+        "the",
+        "model",
+        "token",
+        "inference",
+        "quantized",
+        "weights",
+        "and",
+        "of",
+        "cache",
+        "attention",
+        "layer",
+        "is",
+        "a",
+        "memory",
+        "fast",
+        "small",
+    ];
+    let mut state: u32 = 0x2545_F491 ^ seed;
+    let mut text = String::with_capacity(bytes + 32);
+    while text.len() < bytes {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        text.push_str(WORDS[state as usize % WORDS.len()]);
+        text.push_str(if state % 97 == 0 {
+            "<|im_end|>\n<|im_start|>"
+        } else {
+            " "
+        });
+    }
+    text
+}
+
+fn main() {
+    let start = Instant::now();
+    let tokenizer = match std::env::var("QWEN3_CHECKPOINT") {
+        Ok(path) => {
+            let config = read_checkpoint_config(&path).expect("Failed to read checkpoint");
+            Tokenizer::new(&path, config.vocab_size).expect("Failed to load tokenizer")
+        }
+        Err(_) => synthetic_tokenizer(),
+    };
+    println!(
+        "tokenizer: {} tokens, indexed in {:.1} ms",
+        tokenizer.vocab_size,
+        start.elapsed().as_secs_f64() * 1e3
+    );
+
+    let text = prompt(0, PROMPT_BYTES);
+    let mut runs = 0u32;
+    let mut tokens = 0;
+    let start = Instant::now();
+    while runs == 0 || (start.elapsed() < Duration::from_secs(2) && runs < 1000) {
+        tokens = black_box(tokenizer.encode(black_box(&text))).len();
+        runs += 1;
+    }
+    let per_run = start.elapsed() / runs;
+
+    println!(
+        "encode {} bytes -> {} tokens: {:.3} ms/run over {} runs ({:.1} MB/s)",
+        text.len(),
+        tokens,
+        per_run.as_secs_f64() * 1e3,
+        runs,
+        text.len() as f64 / per_run.as_secs_f64() / 1e6
+    );
+
+    let corpus: Vec<String> = match std::env::var("QWEN3_CORPUS") {
+        Ok(path) => std::fs::read_to_string(path)
+            .expect("Failed to read corpus")
+            .lines()
+            .filter(|line| !line.trim().is_empty())
+            .map(str::to_string)
+            .collect(),
+        Err(_) => (1..=CORPUS_DOCUMENTS as u32)
+            .map(|seed| prompt(seed, DOCUMENT_BYTES))
+            .collect(),
+    };
+    let documents: Vec<&str> = corpus.iter().map(String::as_str).collect();
+    let bytes: usize = documents.iter().map(|document| document.len()).sum();
+
+    // Second runs, with warm word caches
+    let mut sequential = Duration::ZERO;
+    let mut batch = Duration::ZERO;
+    let mut tokens = 0;
+    for _ in 0..2 {
+        let start = Instant::now();
+        for document in &documents {
+            black_box(tokenizer.encode(black_box(document)));
+        }
+        sequential = start.elapsed();
+
+        let start = Instant::now();
+        tokens = black_box(tokenizer.encode_batch(black_box(&documents)))
+            .iter()
+            .map(Vec::len)
+            .sum();
+        batch = start.elapsed();
+    }
+
+    println!(
+        "corpus of {} documents, {:.1} MB -> {} tokens: encode {:.1} MB/s, encode_batch {:.1} MB/s on {} threads",
+        documents.len(),
+        bytes as f64 / 1e6,
+        tokens,
+        bytes as f64 / sequential.as_secs_f64() / 1e6,
+        bytes as f64 / batch.as_secs_f64() / 1e6,
+        rayon::current_num_threads()
+    );
+}
@@ -0,0 +1,205 @@
+//! Chat templates tokenized once at load, so rendering a prompt only encodes the user and
+//! system text.
+//!
+//! A template such as `<|im_start|>user\n%s<|im_end|>\n<|im_start|>assistant\n` is split at
+//! its `%s` slots. Within the text between slots, everything from the first to the last
+//! special token is tokenized up front. Special tokens always end a word, so the token ids
+//! concatenate to exactly the encoding of the whole rendered prompt; only the plain text
+//! next to a slot (`user\n` above) is encoded together with the slot's value.
+
+#[cfg(test)]
+#[path = "../tests/unit/chat_template_test.rs"]
+mod tests;
+
+use crate::lru_cache::LruCache;
+use crate::tokenizer::{PromptTemplates, Tokenizer};
+use std::sync::Mutex;
+
+/// Placeholder for a prompt in a template
+const SLOT: &str = "%s";
+
+/// Number of tokenized system prompts kept
+const SYSTEM_CACHE_CAPACITY: usize = 4;
+
+#[derive(Debug, Clone, PartialEq)]
+enum Piece {
+    /// Pre-tokenized template text
+    Tokens(Vec<usize>),
+    /// Template text encoded together with the neighbouring slot values
+    Text(String),
+    /// Placeholder for the value with this index
+    Slot(usize),
+}
+
+/// A chat template split into pre-tokenized parts and slots.
+#[derive(Debug, Clone, PartialEq, Default)]
+pub(crate) struct ChatTemplate {
+    pieces: Vec<Piece>,
+    slots: usize,
+}
+
+impl ChatTemplate {
+    pub fn new(template: &str, tokenizer: &Tokenizer) -> Self {
+        let mut pieces = Vec::new();
+        let literals: Vec<&str> = template.split(SLOT).collect();
+        for (index, literal) in literals.iter().enumerate() {
+            if index > 0 {
+                pieces.push(Piece::Slot(index - 1));
+            }
+
+            let first = tokenizer.find_special_token(literal, 0);
+            let Some(first) = first else {
+                pieces.push(Piece::Text(literal.to_string()));
+                continue;
+            };
+            let mut last = first;
+            while let Some(next) = tokenizer.find_special_token(literal, last.end) {
+                last = next;
+            }
+            pieces.push(Piece::Text(literal[..first.start].to_string()));
+            pieces.push(Piece::Tokens(
+                tokenizer.encode(&literal[first.start..last.end]),
+            ));
+            pieces.push(Piece::Text(literal[last.end..].to_string()));
+        }
+        pieces.retain(|piece| !matches!(piece, Piece::Text(text) if text.is_empty()));
+
+        Self {
+            pieces,
+            slots: literals.len() - 1,
+        }
+    }
+
+    /// Number of `%s` placeholders
+    pub fn slots(&self) -> usize {
+        self.slots
+    }
+
+    /// Encodes the template with `values[i]` in slot `i` (an empty string if missing).
+    ///
+    /// `cached` is consulted for text that contains the value of slot `cache_slot`, so a
+    /// system prompt is only encoded the first time it is used.
+    pub fn encode(
+        &self,
+        tokenizer: &Tokenizer,
+        values: &[&str],
+        cache_slot: Option<usize>,
+        cached: &Mutex<LruCache<Vec<usize>>>,
+    ) -> Vec<usize> {
+        let mut tokens = Vec::new();
+        let mut text = String::new();
+        let mut cacheable = false;
+
+        let flush = |text: &mut String, cacheable: &mut bool, tokens: &mut Vec<usize>| {
+            if text.is_empty() {
+                return;
+            }
+            if !std::mem::take(cacheable) {
+                tokens.extend(tokenizer.encode(text));
+            } else {
+                let mut cache = cached.lock().unwrap();
+                match cache.get(text) {
+                    Some(encoded) => tokens.extend_from_slice(encoded),
+                    None => {
+                        let encoded = tokenizer.encode(text);
+                        tokens.extend_from_slice(&encoded);
+                        cache.insert(text, encoded);
+                    }
+                }
+            }
+            text.clear();
+        };
+
+        for piece in &self.pieces {
+            match piece {
+                Piece::Tokens(ids) => {
+                    flush(&mut text, &mut cacheable, &mut tokens);
+                    tokens.extend_from_slice(ids);
+                }
+                Piece::Text(literal) => text.push_str(literal),
+                Piece::Slot(slot) => {
+                    text.push_str(values.get(*slot).copied().unwrap_or(""));
+                    cacheable |= cache_slot == Some(*slot);
+                }
+            }
+        }
+        flush(&mut text, &mut cacheable, &mut tokens);
+        tokens
+    }
+}
+
+/// The tokenized variants of [`PromptTemplates`]
+#[derive(Debug)]
+pub(crate) struct ChatTemplates {
+    user: ChatTemplate,
+    system: ChatTemplate,
+    user_thinking: Option<ChatTemplate>,
+    system_thinking: Option<ChatTemplate>,
+    /// Encoded text around recently used system prompts
+    system_prompts: Mutex<LruCache<Vec<usize>>>,
+}
+
+impl Default for ChatTemplates {
+    fn default() -> Self {
+        Self {
+            user: ChatTemplate::default(),
+            system: ChatTemplate::default(),
+            user_thinking: None,
+            system_thinking: None,
+            system_prompts: Mutex::new(LruCache::new(SYSTEM_CACHE_CAPACITY)),
+        }
+    }
+}
+
+impl ChatTemplates {
+    pub fn new(templates: &PromptTemplates, tokenizer: &Tokenizer) -> Self {
+        let tokenize = |template: &str| ChatTemplate::new(template, tokenizer);
+        Self {
+            user: tokenize(&templates.user),
+            system: tokenize(&templates.system),
+            user_thinking: templates.user_thinking.as_deref().map(tokenize),
+            system_thinking: templates.system_thinking.as_deref().map(tokenize),
+            system_prompts: Mutex::new(LruCache::new(SYSTEM_CACHE_CAPACITY)),
+        }
+    }
+
+    /// Encodes a prompt like [`Tokenizer::prompt_template`] would render it.
+    ///
+    /// A system template with two slots takes the system and the user prompt in turn; with
+    /// a single slot, it takes both, separated by a newline.
+    pub fn encode(
+        &self,
+        tokenizer: &Tokenizer,
+        system_prompt: Option<&str>,
+        user_prompt: &str,
+        enable_thinking: bool,
+    ) -> Vec<usize> {
+        let thinking = match system_prompt {
+            Some(_) => &self.system_thinking,
+            None => &self.user_thinking,
+        };
+        let template = match (thinking.as_ref().filter(|_| enable_thinking), system_prompt) {
+            (Some(template), _) => template,
+            (None, Some(_)) => &self.system,
+            (None, None) => &self.user,
+        };
+
+        match system_prompt {
+            Some(system_prompt) if template.slots() >= 2 => template.encode(
+                tokenizer,
+                &[system_prompt, user_prompt],
+                Some(0),
+                &self.system_prompts,
+            ),
+            Some(system_prompt) => {
+                let combined = format!("{system_prompt}\n{user_prompt}");
+                let values = vec![combined.as_str(); template.slots()];
+                template.encode(tokenizer, &values, None, &self.system_prompts)
+            }
+            None => {
+                let values = vec![user_prompt; template.slots()];
+                template.encode(tokenizer, &values, None, &self.system_prompts)
+            }
+        }
+    }
+}
@@ -1,5 +1,8 @@
+use std::fs::File;
 use std::io::Cursor;
+use std::path::Path;
 
+use crate::gguf::{self, GgufFile};
 use crate::utils::MemoryMapper;
 use anyhow::{Context, Error, Result};
 use byteorder::{LittleEndian, ReadBytesExt};
@@ -10,8 +13,12 @@ const CHECKPOINT_MAGIC: i32 = 0x616a6331;
 const CHECKPOINT_VERSION: i32 = 1;
 /// Size of the checkpoint header in bytes
 const HEADER_SIZE: usize = 256;
-/// Size of config structure in bytes (12 i32 fields)
-const CONFIG_SIZE: usize = 48;
+/// Size of config structure in bytes (13 i32 fields)
+const CONFIG_SIZE: usize = 52;
+/// Bits per weight of the classifier prescreen copy, when present
+const PRESCREEN_BITS: i32 = 4;
+/// RoPE base frequency of Qwen3, which exported checkpoints do not store
+pub(crate) const ROPE_BASE_FREQ: f32 = 1e6;
 
 /// Configuration struct for transformer models.
 #[derive(Debug, Clone)]
@@ -26,6 +33,10 @@ pub struct ModelConfig {
     pub vocab_size: usize,
     pub group_size: usize,
     pub shared_classifier: bool,
+    /// A 4-bit classifier copy follows the Q8 weights
+    pub classifier_prescreen: bool,
+    /// Base frequency of the rotary position embedding
+    pub rope_theta: f32,
 }
 
 /// Configuration struct for reading model parameters from checkpoint files.
@@ -43,6 +54,7 @@ struct Config {
     pub head_dim: i32,
     pub shared_classifier: i32,
     pub group_size: i32,
+    pub prescreen_bits: i32,
 }
 
 impl TryInto<ModelConfig> for Config {
@@ -62,13 +74,16 @@ impl TryInto<ModelConfig> for Config {
             vocab_size: self.vocab_size as usize,
             group_size: self.group_size as usize,
             shared_classifier: self.shared_classifier != 0,
+            classifier_prescreen: self.prescreen_bits != 0,
+            rope_theta: ROPE_BASE_FREQ,
         })
     }
 }
 
 /// Reads and validates the model configuration from checkpoint data (mapper).
 ///
-/// The configuration is stored as 12 consecutive i32 values in little-endian format.
+/// The configuration is stored as 13 consecutive i32 values in little-endian format; the
+/// last one (classifier prescreen bits) is zero padding in checkpoints that predate it.
 /// This function performs bounds checking and validates the magic number and version.
 pub fn read_config(mapper: &mut MemoryMapper) -> Result<ModelConfig> {
     let data = mapper.get_bytes(CONFIG_SIZE)?;
@@ -105,6 +120,7 @@ pub fn read_config(mapper: &mut MemoryMapper) -> Result<ModelConfig> {
         head_dim: read_i32!("head dimension"),
         shared_classifier: read_i32!("shared classifier flag"),
         group_size: read_i32!("group size"),
+        prescreen_bits: read_i32!("classifier prescreen bits"),
     };
 
     // prepare to load model weights (skip header).
@@ -113,6 +129,17 @@ pub fn read_config(mapper: &mut MemoryMapper) -> Result<ModelConfig> {
     config.try_into()
 }
 
+/// Reads only the model configuration of a checkpoint or GGUF file, without loading weights.
+pub fn read_checkpoint_config(checkpoint_path: &str) -> Result<ModelConfig> {
+    if gguf::is_gguf_file(checkpoint_path) {
+        return GgufFile::open(Path::new(checkpoint_path))?.model_config();
+    }
+
+    let file = File::open(checkpoint_path)
+        .with_context(|| format!("Failed to open checkpoint: {checkpoint_path}"))?;
+    read_config(&mut MemoryMapper::new(file)?)
+}
+
 /// Validates the model configuration to ensure it's supported.
 fn validate_config(config: &Config) -> Result<()> {
     match config.magic_number {
@@ -150,5 +177,13 @@ fn validate_config(config: &Config) -> Result<()> {
         }
     }
 
+    if config.prescreen_bits != 0 && config.prescreen_bits != PRESCREEN_BITS {
+        anyhow::bail!(
+            "Unsupported classifier prescreen: expected {} bits, got {}",
+            PRESCREEN_BITS,
+            config.prescreen_bits
+        );
+    }
+
     Ok(())
 }
@@ -0,0 +1,91 @@
+//! Streaming detokenization: turns the bytes of generated tokens into valid UTF-8 text.
+//!
+//! A byte-level BPE token may hold only part of a multi-byte character, e.g. the first
+//! bytes of an emoji. [`Detokenizer`] holds such a partial character back until the tokens
+//! that complete it arrive, so every piece of text it returns is valid UTF-8 on its own.
+
+#[cfg(test)]
+#[path = "../tests/unit/detokenizer_test.rs"]
+mod tests;
+
+/// Longest UTF-8 encoding of a character
+const MAX_CHAR_LEN: usize = 4;
+
+/// Incremental UTF-8 decoder for token bytes.
+///
+/// Complete characters are returned as soon as they arrive; when a token is valid UTF-8
+/// on its own and nothing is held back, its text is borrowed without copying. Bytes that
+/// can never form a character are replaced by U+FFFD, as `String::from_utf8_lossy` does.
+/// Buffers are reused, so after warm-up no push allocates.
+#[derive(Debug, Default)]
+pub struct Detokenizer {
+    /// Start of a character whose remaining bytes have not arrived yet
+    pending: Vec<u8>,
+    /// Held-back bytes followed by the pushed bytes, when they must be decoded together
+    joined: Vec<u8>,
+    /// Text returned by the last push that could not be borrowed
+    text: String,
+}
+
+impl Detokenizer {
+    pub fn new() -> Self {
+        Self {
+            pending: Vec::with_capacity(MAX_CHAR_LEN),
+            ..Default::default()
+        }
+    }
+
+    /// Feeds the bytes of the next token(s) and returns the text completed by them.
+    pub fn push<'a>(&'a mut self, bytes: &'a [u8]) -> &'a str {
+        if self.pending.is_empty() {
+            match std::str::from_utf8(bytes) {
+                Ok(text) => return text,
+                // Only the last character is incomplete: return the rest as-is
+                Err(error) if error.error_len().is_none() => {
+                    let (complete, partial) = bytes.split_at(error.valid_up_to());
+                    self.pending.extend_from_slice(partial);
+                    return std::str::from_utf8(complete).unwrap_or_default();
+                }
+                Err(_) => {}
+            }
+        }
+
+        self.joined.clear();
+        self.joined.append(&mut self.pending);
+        self.joined.extend_from_slice(bytes);
+        self.text.clear();
+
+        let mut chunks = self.joined.utf8_chunks().peekable();
+        while let Some(chunk) = chunks.next() {
+            self.text.push_str(chunk.valid());
+            let invalid = chunk.invalid();
+            if invalid.is_empty() {
+                continue;
+            }
+            // Only an incomplete character at the very end may still be completed
+            let incomplete = std::str::from_utf8(invalid).is_err_and(|e| e.error_len().is_none());
+            if chunks.peek().is_none() && incomplete {
+                self.pending.extend_from_slice(invalid);
+            } else {
+                self.text.push(char::REPLACEMENT_CHARACTER);
+            }
+        }
+        &self.text
+    }
+
+    /// Ends the stream: a character still incomplete is returned as U+FFFD, and the
+    /// detokenizer is ready for a new stream.
+    pub fn finish(&mut self) -> &str {
+        self.text.clear();
+        if !self.pending.is_empty() {
+            self.pending.clear();
+            self.text.push(char::REPLACEMENT_CHARACTER);
+        }
+        &self.text
+    }
+
+    /// Drops any held-back bytes, e.g. when a stream is abandoned.
+    pub fn reset(&mut self) {
+        self.pending.clear();
+    }
+}
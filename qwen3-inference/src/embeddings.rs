@@ -0,0 +1,227 @@
+//! Text embeddings: pooled final-norm hidden states, without the classification head.
+//!
+//! Short texts are packed into one batch, each attending only to its own tokens, so a
+//! whole list of texts shares the weight reads of a few batched passes.
+
+use crate::tensor::{QuantizedTensor, quantize};
+use crate::tokenizer::Tokenizer;
+use crate::transformer::Transformer;
+use anyhow::Result;
+use log::{info, warn};
+use serde_json::json;
+use std::str::FromStr;
+use std::time::Instant;
+
+/// Maximum number of tokens run through the model in one packed batch
+const PACKED_TOKENS: usize = 256;
+
+/// How the hidden states of a text are reduced to one vector
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Default)]
+pub enum Pooling {
+    /// Average over all tokens
+    #[default]
+    Mean,
+    /// Hidden state of the last token, which has attended to the whole text
+    Last,
+}
+
+impl FromStr for Pooling {
+    type Err = String;
+
+    fn from_str(s: &str) -> Result<Self, Self::Err> {
+        match s {
+            "mean" => Ok(Pooling::Mean),
+            "last" => Ok(Pooling::Last),
+            _ => Err(format!("Unknown pooling: {s} (expected mean or last)")),
+        }
+    }
+}
+
+#[derive(Debug, Clone, Copy, Default)]
+pub struct EmbeddingOptions {
+    pub pooling: Pooling,
+    /// Scale each embedding to unit L2 norm
+    pub normalize: bool,
+}
+
+/// An embedding quantized to int8 with a single scale: `value = q * scale`
+#[derive(Debug, Clone, PartialEq)]
+pub struct QuantizedEmbedding {
+    pub values: Vec<i8>,
+    pub scale: f32,
+}
+
+impl QuantizedEmbedding {
+    pub fn new(embedding: &[f32]) -> Self {
+        let mut quantized = QuantizedTensor::new(embedding.len(), embedding.len());
+        quantize(&mut quantized, embedding, embedding.len(), embedding.len());
+        Self {
+            values: quantized.q.into_owned(),
+            scale: quantized.s[0],
+        }
+    }
+}
+
+/// Embeds each sequence of token ids into one vector of the model dimension.
+///
+/// Sequences longer than the context are truncated to it. Consecutive sequences are packed
+/// into batches of up to [`PACKED_TOKENS`] tokens; a longer sequence is run on its own in
+/// batches of that size.
+pub fn embed_sequences(
+    transformer: &mut Transformer,
+    sequences: &[Vec<usize>],
+    options: EmbeddingOptions,
+) -> Result<Vec<Vec<f32>>> {
+    if let Some(index) = sequences.iter().position(Vec::is_empty) {
+        anyhow::bail!("Cannot embed sequence {index}: it has no tokens");
+    }
+
+    let dim = transformer.config.dim;
+    let seq_len = transformer.config.seq_len;
+    let capacity = PACKED_TOKENS.min(seq_len);
+    let sequences: Vec<&[usize]> = sequences
+        .iter()
+        .map(|sequence| &sequence[..sequence.len().min(seq_len)])
+        .collect();
+
+    // Every pass below is at most `capacity` rows, so the batch buffers are allocated once
+    transformer.reserve_batch(capacity);
+    let mut embeddings: Vec<Vec<f32>> = Vec::with_capacity(sequences.len());
+    let mut rest = &sequences[..];
+    while let Some(&first) = rest.first() {
+        if first.len() > capacity {
+            let mut pooled = vec![0.0; dim];
+            for (chunk_idx, chunk) in first.chunks(capacity).enumerate() {
+                let hidden = transformer.hidden_states(chunk, chunk_idx * capacity);
+                pool_rows(&mut pooled, hidden, options.pooling);
+            }
+            embeddings.push(finish(pooled, first.len(), options));
+            rest = &rest[1..];
+            continue;
+        }
+
+        // Take as many of the following sequences as fit one batch
+        let mut total = 0;
+        let count = rest
+            .iter()
+            .take_while(|sequence| {
+                total += sequence.len();
+                total <= capacity
+            })
+            .count();
+        let (pack, remaining) = rest.split_at(count);
+
+        let hidden = transformer.hidden_states_packed(pack);
+        let mut offset = 0;
+        for sequence in pack {
+            let rows = &hidden[offset * dim..(offset + sequence.len()) * dim];
+            let mut pooled = vec![0.0; dim];
+            pool_rows(&mut pooled, rows, options.pooling);
+            embeddings.push(finish(pooled, sequence.len(), options));
+            offset += sequence.len();
+        }
+        rest = remaining;
+    }
+
+    Ok(embeddings)
+}
+
+/// Adds the hidden state rows of a sequence to `pooled` (mean), or keeps the last one.
+fn pool_rows(pooled: &mut [f32], rows: &[f32], pooling: Pooling) {
+    match pooling {
+        Pooling::Mean => {
+            for row in rows.chunks_exact(pooled.len()) {
+                pooled
+                    .iter_mut()
+                    .zip(row)
+                    .for_each(|(sum, &value)| *sum += value);
+            }
+        }
+        Pooling::Last => pooled.copy_from_slice(&rows[rows.len() - pooled.len()..]),
+    }
+}
+
+fn finish(mut pooled: Vec<f32>, len: usize, options: EmbeddingOptions) -> Vec<f32> {
+    if options.pooling == Pooling::Mean {
+        let scale = 1.0 / len as f32;
+        pooled.iter_mut().for_each(|value| *value *= scale);
+    }
+    if options.normalize {
+        let norm = pooled.iter().map(|value| value * value).sum::<f32>().sqrt();
+        if norm > 0.0 {
+            pooled.iter_mut().for_each(|value| *value /= norm);
+        }
+    }
+    pooled
+}
+
+/// Embeds each text and prints one JSON object per text, in order.
+///
+/// Texts are tokenized without a chat template. With `int8`, embeddings are printed as
+/// int8 values with their scale.
+pub fn embed(
+    transformer: &mut Transformer,
+    tokenizer: &Tokenizer,
+    texts: &[String],
+    options: EmbeddingOptions,
+    int8: bool,
+) -> Result<()> {
+    if texts.is_empty() {
+        anyhow::bail!("Please provide at least one text to embed");
+    }
+
+    let texts: Vec<&str> = texts.iter().map(String::as_str).collect();
+    let sequences: Vec<Vec<usize>> = tokenizer
+        .encode_batch(&texts)
+        .into_iter()
+        .map(|tokens| tokens.into_iter().map(|token| token as usize).collect())
+        .collect();
+    let seq_len = transformer.config.seq_len;
+    let truncated = sequences
+        .iter()
+        .filter(|tokens| tokens.len() > seq_len)
+        .count();
+    if truncated > 0 {
+        warn!(
+            "{truncated} texts are longer than the context of {seq_len} tokens and were truncated"
+        );
+    }
+
+    let start = Instant::now();
+    let embeddings = embed_sequences(transformer, &sequences, options)?;
+    let elapsed = start.elapsed().as_secs_f64();
+
+    for (index, (tokens, embedding)) in sequences.iter().zip(&embeddings).enumerate() {
+        let tokens = tokens.len().min(seq_len);
+        if int8 {
+            let quantized = QuantizedEmbedding::new(embedding);
+            println!(
+                "{}",
+                json!({
+                    "index": index,
+                    "tokens": tokens,
+                    "embedding": quantized.values,
+                    "scale": quantized.scale,
+                })
+            );
+        } else {
+            println!(
+                "{}",
+                json!({"index": index, "tokens": tokens, "embedding": embedding})
+            );
+        }
+    }
+
+    let total_tokens: usize = sequences
+        .iter()
+        .map(|tokens| tokens.len().min(seq_len))
+        .sum();
+    info!(
+        "[Embedded {} texts ({} tokens) in {:.2}s, {:.1} tokens/s]",
+        texts.len(),
+        total_tokens,
+        elapsed,
+        total_tokens as f64 / elapsed
+    );
+    Ok(())
+}
@@ -1,4 +1,8 @@
+use crate::detokenizer::Detokenizer;
+use crate::grammar::{Constraint, ConstraintState, TokenMask};
 use crate::sampler::Sampler;
+use crate::stop_sequences::{StopMatcher, StopSequences};
+use crate::thinking::{ThinkingTracker, thinking_switch};
 use crate::tokenizer::Tokenizer;
 use crate::transformer::Transformer;
 use anyhow::Result;
@@ -6,11 +10,25 @@ use log::info;
 use std::io::{self, Write};
 use std::time::Instant;
 
+/// Options that apply to every reply of a [`generate`] or [`chat`] session
+#[derive(Debug, Default, Clone, Copy)]
+pub struct GenerationOptions<'a> {
+    /// Restriction on the generated tokens
+    pub constraint: Option<&'a Constraint>,
+    /// Replies end as soon as their text contains one of these
+    pub stop_sequences: Option<&'a StopSequences>,
+    /// Use the thinking chat templates unless a request says `/think` or `/no_think`
+    pub enable_thinking: bool,
+    /// Maximum number of tokens inside `<think>`, after which `</think>` is forced
+    pub thinking_budget: Option<usize>,
+}
+
 pub fn generate(
     transformer: &mut Transformer,
     tokenizer: &Tokenizer,
     sampler: &mut Sampler,
     prompt: Option<&str>,
+    options: GenerationOptions,
 ) -> Result<()> {
     let prompt = prompt.unwrap_or("");
     let prompt_tokens = tokenizer.encode(prompt);
@@ -20,28 +38,42 @@ pub fn generate(
     }
 
     let seq_len = transformer.config.seq_len;
-    let mut state = GenerationState::new(prompt_tokens[0]);
+    let mut state = GenerationState::new(prompt_tokens[0], tokenizer, options);
+
+    // Fill the KV cache for the prompt in batches; the last prompt token is fed by the
+    // generation loop, which predicts the first new token from it
+    let prefill_len = (prompt_tokens.len() - 1).min(seq_len);
+    transformer.prefill(&prompt_tokens[..prefill_len], 0);
 
     while state.pos < seq_len {
+        // Echo the prompt; generated text goes through stop sequence matching
+        if state.pos < prompt_tokens.len() {
+            state.echo(tokenizer, state.token)?;
+        } else if state.emit(tokenizer, state.token)? {
+            break;
+        }
+
         let next_token = if state.pos < prompt_tokens.len() - 1 {
             // Still processing prompt tokens
             prompt_tokens[state.pos + 1]
         } else {
             // Generate new tokens
             state.metrics.start_generation();
-            let next = generate_next_token(transformer, sampler, state.token, state.pos)?;
-            state.metrics.increment_token();
+            let next =
+                generate_next_token(transformer, sampler, state.token, state.pos, state.mask())?;
+            let next = state.accept(next);
 
             if is_termination_token(next, tokenizer) {
                 break;
             }
+            state.advance_constraint(next, tokenizer);
             next
         };
 
-        output_token(tokenizer, state.token)?;
         state.advance(next_token);
     }
 
+    state.finish_reply()?;
     state.metrics.report_and_reset();
     println!();
     Ok(())
@@ -53,16 +85,18 @@ pub fn chat(
     sampler: &mut Sampler,
     cli_user_prompt: Option<&str>,
     system_prompt: Option<&str>,
+    options: GenerationOptions,
 ) -> Result<()> {
     let stdin = io::stdin();
     let seq_len = transformer.config.seq_len;
-    let mut state = GenerationState::new(0);
+    let mut state = GenerationState::new(0, tokenizer, options);
     let mut user_turn = true;
     let mut next_token = 0;
 
     loop {
         // Reset context if window exceeded
         if state.pos >= seq_len {
+            state.finish_reply()?;
             state.reset(0);
             user_turn = true;
             println!();
@@ -116,18 +150,28 @@ fn handle_user_turn(
         return Ok(false);
     }
 
-    let rendered_prompt = render_prompt(state.pos, system_prompt, &user_prompt, tokenizer);
-    let prompt_tokens = tokenizer.encode(&rendered_prompt);
+    let thinking = thinking_switch(&user_prompt).unwrap_or(state.enable_thinking);
+    // The system prompt only goes into the first turn of a context
+    let system_prompt = system_prompt.filter(|_| state.pos == 0);
+    let prompt_tokens = tokenizer.encode_chat_prompt(system_prompt, &user_prompt, thinking);
 
-    // Process prompt tokens
-    for &token in &prompt_tokens {
-        if state.pos >= transformer.config.seq_len {
-            break;
-        }
+    // Each assistant reply starts matching the constraint and stop sequences from scratch
+    state.start_reply();
 
-        *next_token = generate_next_token(transformer, sampler, token, state.pos)?;
-        state.advance(token);
-    }
+    // Prefill the prompt in batches, up to the end of the context window; the prediction
+    // after its last token is the first token of the reply
+    let available = transformer.config.seq_len - state.pos;
+    let prompt_tokens = &prompt_tokens[..prompt_tokens.len().min(available)];
+    let Some((&last, prompt_prefix)) = prompt_tokens.split_last() else {
+        return Ok(true);
+    };
+
+    transformer.prefill(prompt_prefix, state.pos);
+    state.pos += prompt_prefix.len();
+
+    let next = generate_next_token(transformer, sampler, last, state.pos, state.mask())?;
+    *next_token = state.accept(next);
+    state.advance(last);
 
     Ok(true)
 }
@@ -141,6 +185,7 @@ fn handle_assistant_turn(
     user_turn: &mut bool,
 ) -> Result<bool> {
     if is_termination_token(*next_token, tokenizer) {
+        state.finish_reply()?;
         state.metrics.report_and_reset();
         println!();
         *user_turn = true;
@@ -148,10 +193,17 @@ fn handle_assistant_turn(
     }
 
     state.metrics.start_generation();
-    output_token(tokenizer, *next_token)?;
+    if state.emit(tokenizer, *next_token)? {
+        // A stop sequence ends the reply like an end-of-sequence token would
+        state.metrics.report_and_reset();
+        println!();
+        *user_turn = true;
+        return Ok(true);
+    }
+    state.advance_constraint(*next_token, tokenizer);
 
-    *next_token = generate_next_token(transformer, sampler, *next_token, state.pos)?;
-    state.metrics.increment_token();
+    let next = generate_next_token(transformer, sampler, *next_token, state.pos, state.mask())?;
+    *next_token = state.accept(next);
     state.advance(*next_token);
 
     Ok(false)
@@ -162,15 +214,42 @@ fn generate_next_token(
     sampler: &mut Sampler,
     token: usize,
     pos: usize,
+    mask: Option<&TokenMask>,
 ) -> Result<usize> {
-    let logits = transformer.forward(token, pos);
-    let mut logits_copy = logits.to_vec();
-    Ok(sampler.sample(&mut logits_copy))
+    if let Some(mask) = mask {
+        let logits = match mask.sparse_tokens() {
+            // Few allowed tokens: compute only their rows of the classification head
+            Some(tokens) => transformer.forward_rows(token, pos, tokens),
+            // Otherwise mask the full logits; the fused greedy argmax cannot be masked
+            None => {
+                let logits = transformer.forward(token, pos);
+                mask.apply(logits);
+                logits
+            }
+        };
+        return Ok(sampler.sample(logits));
+    }
+
+    // Two-stage classifier: exact logits for the prescreened candidates only
+    if transformer.has_prescreen() {
+        return Ok(sampler.sample(transformer.forward_prescreened(token, pos)));
+    }
+
+    if sampler.is_greedy() {
+        return Ok(transformer.forward_argmax(token, pos));
+    }
+
+    // Sample directly from the run state logits buffer, no per-token copy
+    Ok(sampler.sample(transformer.forward(token, pos)))
 }
 
-fn output_token(tokenizer: &Tokenizer, token: usize) -> Result<()> {
-    print!("{}", tokenizer.decode(token));
-    io::stdout().flush()?;
+fn output_text(text: &str) -> Result<()> {
+    if text.is_empty() {
+        return Ok(());
+    }
+    let mut stdout = io::stdout().lock();
+    stdout.write_all(text.as_bytes())?;
+    stdout.flush()?;
     Ok(())
 }
 
@@ -192,24 +271,12 @@ fn get_user_input(stdin: &io::Stdin, pos: usize, cli_user_prompt: Option<&str>)
     }
 }
 
-fn render_prompt(
-    pos: usize,
-    system_prompt: Option<&str>,
-    user_prompt: &str,
-    tokenizer: &Tokenizer,
-) -> String {
-    match (pos, system_prompt) {
-        (0, Some(sys_prompt)) => tokenizer
-            .system_prompt_template
-            .replace("%s", &format!("{sys_prompt}\n{user_prompt}")),
-        _ => tokenizer.prompt_template.replace("%s", user_prompt),
-    }
-}
-
 /// Tracks token generation performance metrics
 struct TokenMetrics {
     start_time: Option<Instant>,
     generated_count: usize,
+    /// Generated tokens that were part of a think block
+    reasoning_count: usize,
 }
 
 impl TokenMetrics {
@@ -217,6 +284,7 @@ impl TokenMetrics {
         Self {
             start_time: None,
             generated_count: 0,
+            reasoning_count: 0,
         }
     }
 
@@ -226,8 +294,11 @@ impl TokenMetrics {
         }
     }
 
-    fn increment_token(&mut self) {
+    fn increment_token(&mut self, reasoning: bool) {
         self.generated_count += 1;
+        if reasoning {
+            self.reasoning_count += 1;
+        }
     }
 
     fn report_and_reset(&mut self) {
@@ -241,25 +312,113 @@ impl TokenMetrics {
                     duration.as_secs_f64(),
                     tps
                 );
+                if self.reasoning_count > 0 {
+                    info!(
+                        "[Reasoning: {} tokens, answer: {} tokens]",
+                        self.reasoning_count,
+                        self.generated_count - self.reasoning_count
+                    );
+                }
             }
         }
         self.generated_count = 0;
+        self.reasoning_count = 0;
     }
 }
 
 /// Represents the current generation state
-struct GenerationState {
+struct GenerationState<'g> {
     pos: usize,
     token: usize,
     metrics: TokenMetrics,
+    constraint: Option<&'g Constraint>,
+    /// Progress through the constraint for the reply being generated
+    constraint_state: Option<ConstraintState<'g>>,
+    /// Stop sequence matching over the reply being generated
+    stop_matcher: Option<StopMatcher<'g>>,
+    /// Turns output token bytes into valid UTF-8, holding back partial characters
+    detokenizer: Detokenizer,
+    /// Default for requests without a thinking switch
+    enable_thinking: bool,
+    /// Think block tracking, if the vocabulary has think tags
+    thinking: Option<ThinkingTracker>,
 }
 
-impl GenerationState {
-    fn new(initial_token: usize) -> Self {
+impl<'g> GenerationState<'g> {
+    fn new(initial_token: usize, tokenizer: &Tokenizer, options: GenerationOptions<'g>) -> Self {
         Self {
             pos: 0,
             token: initial_token,
             metrics: TokenMetrics::new(),
+            constraint: options.constraint,
+            constraint_state: options.constraint.map(ConstraintState::new),
+            stop_matcher: options.stop_sequences.map(StopMatcher::new),
+            detokenizer: Detokenizer::new(),
+            enable_thinking: options.enable_thinking,
+            thinking: ThinkingTracker::new(tokenizer, options.thinking_budget),
+        }
+    }
+
+    /// Tokens allowed for the next generated token, if constrained
+    fn mask(&self) -> Option<&'g TokenMask> {
+        self.constraint_state.as_ref().map(ConstraintState::mask)
+    }
+
+    fn start_reply(&mut self) {
+        self.constraint_state = self.constraint.map(ConstraintState::new);
+        if let Some(stop_matcher) = &mut self.stop_matcher {
+            stop_matcher.reset();
+        }
+        self.detokenizer.reset();
+        if let Some(thinking) = &mut self.thinking {
+            thinking.reset();
+        }
+    }
+
+    /// Takes a generated token into account; returns the token to continue with, which is
+    /// `</think>` instead once the thinking budget is spent.
+    fn accept(&mut self, token: usize) -> usize {
+        let (token, reasoning) = match &mut self.thinking {
+            Some(thinking) => thinking.next(token),
+            None => (token, false),
+        };
+        self.metrics.increment_token(reasoning);
+        token
+    }
+
+    /// Outputs a generated token; returns true if it completed a stop sequence.
+    ///
+    /// Bytes that may begin a stop sequence are held back until they can be ruled out, so a
+    /// stop sequence never reaches the output.
+    fn emit(&mut self, tokenizer: &Tokenizer, token: usize) -> Result<bool> {
+        let bytes = tokenizer.decode(token);
+        let (released, stopped) = match &mut self.stop_matcher {
+            Some(stop_matcher) => stop_matcher.push(bytes),
+            None => (bytes, false),
+        };
+        output_text(self.detokenizer.push(released))?;
+        if stopped {
+            output_text(self.detokenizer.finish())?;
+        }
+        Ok(stopped)
+    }
+
+    /// Outputs a prompt token, which is not matched against stop sequences.
+    fn echo(&mut self, tokenizer: &Tokenizer, token: usize) -> Result<()> {
+        output_text(self.detokenizer.push(tokenizer.decode(token)))
+    }
+
+    /// Outputs whatever was held back for a possible stop sequence or a partial character.
+    fn finish_reply(&mut self) -> Result<()> {
+        if let Some(stop_matcher) = &mut self.stop_matcher {
+            output_text(self.detokenizer.push(stop_matcher.finish()))?;
+        }
+        output_text(self.detokenizer.finish())
+    }
+
+    fn advance_constraint(&mut self, token: usize, tokenizer: &Tokenizer) {
+        if let Some(constraint_state) = &mut self.constraint_state {
+            constraint_state.advance(token, tokenizer.decode(token));
         }
     }
 
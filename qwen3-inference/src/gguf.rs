@@ -0,0 +1,765 @@
+//! GGUF checkpoints, as written by llama.cpp, used in place of an exported checkpoint.
+//!
+//! The file is mapped while loading: its metadata gives the model dimensions and the
+//! tokenizer, and its tensor directory locates every weight. The matmul kernels work on
+//! int8 weights with the f32 scales of a tensor stored apart from its values, while GGUF
+//! interleaves an f16 scale with each block, so every matrix is converted into owned
+//! buffers with groups of 32, the Q8_0 block size, and the mapping is dropped afterwards:
+//!
+//! - Q8_0: the int8 values are copied and the scale widened, which loses nothing.
+//! - Q4_0, Q4_K, Q5_K, Q6_K, F16, BF16 and F32: decoded and quantized to 8 bits again.
+//!   Rounding to 8 bits adds an error of at most 1/254 of each group's largest magnitude
+//!   on top of the file's own quantization error, so logits differ slightly from llama.cpp.
+//!
+//! The converted weights take 9 bits per weight in RAM (int8 plus an f32 scale per 32),
+//! about twice the size of a 4-bit K-quant file, and the embedding table is also held as
+//! f32.
+
+#[cfg(test)]
+#[path = "../tests/unit/gguf_test.rs"]
+mod tests;
+
+use crate::configuration::{ModelConfig, ROPE_BASE_FREQ};
+use crate::hf_model;
+use crate::tensor::{QuantizedTensor, quantize_group};
+use crate::transformer::TransformerWeights;
+use crate::utils::MemoryMapper;
+use anyhow::{Context, Result};
+use byteorder::{LittleEndian, ReadBytesExt};
+use log::warn;
+use rayon::prelude::*;
+use serde_json::json;
+use std::borrow::Cow;
+use std::collections::HashMap;
+use std::fs::{self, File};
+use std::io::{Cursor, Read};
+use std::path::Path;
+
+/// "GGUF" in little-endian
+const GGUF_MAGIC: u32 = 0x4655_4747;
+/// Oldest supported version; version 1 used 32-bit counts
+const MIN_VERSION: u32 = 2;
+/// Alignment of the tensor data unless `general.alignment` says otherwise
+const DEFAULT_ALIGNMENT: usize = 32;
+/// The only supported `general.architecture`, also the prefix of its metadata keys
+const ARCHITECTURE: &str = "qwen3";
+/// Group size of the loaded weights: the number of values in a Q8_0 block
+pub(crate) const GROUP_SIZE: usize = 32;
+/// Values in a K-quant super-block
+const QK_K: usize = 256;
+/// Token type of control tokens such as `<|im_start|>`
+const TOKEN_TYPE_CONTROL: i64 = 3;
+/// Token type of user-defined tokens such as `<think>`
+const TOKEN_TYPE_USER_DEFINED: i64 = 4;
+
+/// Token used as BOS when the metadata has no `tokenizer.ggml.bos_token_id`
+const BOS_TOKEN: &str = "<|endoftext|>";
+/// Token used as EOS when the metadata has no `tokenizer.ggml.eos_token_id`
+const EOS_TOKEN: &str = "<|im_end|>";
+
+const TOKEN_EMBEDDING: &str = "token_embd.weight";
+const CLASSIFIER: &str = "output.weight";
+
+/// Returns true if `path` is a GGUF file rather than an exported checkpoint.
+pub fn is_gguf_file(path: &str) -> bool {
+    let mut magic = [0; 4];
+    File::open(path)
+        .and_then(|mut file| file.read_exact(&mut magic))
+        .is_ok_and(|_| u32::from_le_bytes(magic) == GGUF_MAGIC)
+}
+
+/// A metadata value; integers of every width are widened to `i64`.
+#[derive(Debug, Clone, PartialEq)]
+enum Value {
+    Int(i64),
+    Float(f64),
+    Bool(bool),
+    String(String),
+    Array(Vec<Value>),
+}
+
+impl Value {
+    fn as_i64(&self) -> Option<i64> {
+        match self {
+            Self::Int(value) => Some(*value),
+            _ => None,
+        }
+    }
+
+    fn as_usize(&self) -> Option<usize> {
+        self.as_i64().and_then(|value| usize::try_from(value).ok())
+    }
+
+    fn as_f64(&self) -> Option<f64> {
+        match self {
+            Self::Float(value) => Some(*value),
+            Self::Int(value) => Some(*value as f64),
+            _ => None,
+        }
+    }
+
+    fn as_str(&self) -> Option<&str> {
+        match self {
+            Self::String(value) => Some(value),
+            _ => None,
+        }
+    }
+
+    fn as_array(&self) -> Option<&[Value]> {
+        match self {
+            Self::Array(values) => Some(values),
+            _ => None,
+        }
+    }
+}
+
+/// Tensor data types, by their `ggml_type` id
+#[allow(non_camel_case_types)]
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+enum BlockType {
+    F32,
+    F16,
+    BF16,
+    Q4_0,
+    Q8_0,
+    Q4_K,
+    Q5_K,
+    Q6_K,
+}
+
+impl BlockType {
+    fn from_id(id: u32) -> Result<Self> {
+        Ok(match id {
+            0 => Self::F32,
+            1 => Self::F16,
+            2 => Self::Q4_0,
+            8 => Self::Q8_0,
+            12 => Self::Q4_K,
+            13 => Self::Q5_K,
+            14 => Self::Q6_K,
+            30 => Self::BF16,
+            _ => anyhow::bail!(
+                "Unsupported GGUF tensor type {id} (supported: F32, F16, BF16, Q4_0, Q8_0, Q4_K, Q5_K, Q6_K)"
+            ),
+        })
+    }
+
+    /// Number of values in a block and its size in bytes
+    fn layout(self) -> (usize, usize) {
+        match self {
+            Self::F32 => (1, 4),
+            Self::F16 | Self::BF16 => (1, 2),
+            Self::Q4_0 => (32, 18),
+            Self::Q8_0 => (32, 34),
+            Self::Q4_K => (QK_K, 144),
+            Self::Q5_K => (QK_K, 176),
+            Self::Q6_K => (QK_K, 210),
+        }
+    }
+
+    /// Decodes the whole blocks in `data` into `out`.
+    fn decode(self, data: &[u8], out: &mut [f32]) {
+        let (block_values, block_bytes) = self.layout();
+        debug_assert_eq!(data.len() / block_bytes * block_values, out.len());
+
+        for (block, out) in data
+            .chunks_exact(block_bytes)
+            .zip(out.chunks_exact_mut(block_values))
+        {
+            match self {
+                Self::F32 => out[0] = f32::from_le_bytes([block[0], block[1], block[2], block[3]]),
+                Self::F16 => out[0] = f16_to_f32(read_u16(block, 0)),
+                Self::BF16 => out[0] = f32::from_bits((read_u16(block, 0) as u32) << 16),
+                Self::Q4_0 => decode_q4_0(block, out),
+                Self::Q8_0 => decode_q8_0(block, out),
+                Self::Q4_K => decode_q4_k(block, out),
+                Self::Q5_K => decode_q5_k(block, out),
+                Self::Q6_K => decode_q6_k(block, out),
+            }
+        }
+    }
+}
+
+/// Location of a tensor in the file
+#[derive(Debug, Clone)]
+struct TensorInfo {
+    /// Dimensions, innermost (the row length) first
+    dims: Vec<usize>,
+    type_id: u32,
+    /// Offset from the start of the tensor data
+    offset: usize,
+}
+
+/// A mapped GGUF file with its metadata and tensor directory.
+#[derive(Debug)]
+pub(crate) struct GgufFile {
+    mapper: MemoryMapper,
+    metadata: HashMap<String, Value>,
+    tensors: HashMap<String, TensorInfo>,
+    /// Offset of the tensor data in the file
+    data_start: usize,
+}
+
+impl GgufFile {
+    pub fn open(path: &Path) -> Result<Self> {
+        let file = File::open(path)
+            .with_context(|| format!("Failed to open GGUF file: {}", path.display()))?;
+        let mapper = MemoryMapper::new(file)?;
+        let (metadata, tensors, data_start) = read_header(mapper.bytes())
+            .with_context(|| format!("Invalid GGUF file: {}", path.display()))?;
+
+        Ok(Self {
+            mapper,
+            metadata,
+            tensors,
+            data_start,
+        })
+    }
+
+    /// Reads the model configuration from the metadata.
+    ///
+    /// The vocabulary size is taken from the embedding, which may be padded beyond the
+    /// tokenizer's vocabulary; the classifier is shared when there is no `output.weight`.
+    pub fn model_config(&self) -> Result<ModelConfig> {
+        let architecture = self
+            .metadata
+            .get("general.architecture")
+            .and_then(Value::as_str)
+            .unwrap_or_default();
+        if architecture != ARCHITECTURE {
+            anyhow::bail!(
+                "Unsupported GGUF architecture {architecture:?}, expected {ARCHITECTURE:?}"
+            );
+        }
+
+        let key = |name: &str| format!("{ARCHITECTURE}.{name}");
+        let dim = self.metadata_usize(&key("embedding_length"))?;
+        let n_heads = self.metadata_usize(&key("attention.head_count"))?;
+        let n_kv_heads = self.metadata_usize(&key("attention.head_count_kv"))?;
+        if n_heads == 0 || n_kv_heads == 0 {
+            anyhow::bail!("Invalid number of heads: {n_heads} query, {n_kv_heads} key/value");
+        }
+        let head_dim = self
+            .metadata
+            .get(&key("attention.key_length"))
+            .and_then(Value::as_usize)
+            .unwrap_or(dim / n_heads);
+        let vocab_size = self
+            .tensors
+            .get(TOKEN_EMBEDDING)
+            .and_then(|info| info.dims.last().copied())
+            .with_context(|| format!("Tensor {TOKEN_EMBEDDING} not found in GGUF file"))?;
+
+        let config = ModelConfig {
+            dim,
+            hidden_dim: self.metadata_usize(&key("feed_forward_length"))?,
+            n_layers: self.metadata_usize(&key("block_count"))?,
+            n_heads,
+            n_kv_heads,
+            head_dim,
+            seq_len: self.metadata_usize(&key("context_length"))?,
+            vocab_size,
+            group_size: GROUP_SIZE,
+            shared_classifier: !self.tensors.contains_key(CLASSIFIER),
+            classifier_prescreen: false,
+            rope_theta: self
+                .metadata
+                .get(&key("rope.freq_base"))
+                .and_then(Value::as_f64)
+                .map_or(ROPE_BASE_FREQ, |base| base as f32),
+        };
+
+        let dimensions = [
+            ("dim", config.dim),
+            ("hidden_dim", config.hidden_dim),
+            ("n_layers", config.n_layers),
+            ("head_dim", config.head_dim),
+            ("seq_len", config.seq_len),
+            ("vocab_size", config.vocab_size),
+        ];
+        for (name, value) in dimensions {
+            if value == 0 {
+                anyhow::bail!("Invalid {name}: must be positive");
+            }
+        }
+        Ok(config)
+    }
+
+    /// Loads the weights in the engine's layout: norms and the token embedding as f32,
+    /// every matrix as int8 with groups of [`GROUP_SIZE`].
+    pub fn load_weights(&self, config: &ModelConfig) -> Result<TransformerWeights> {
+        let ModelConfig {
+            dim,
+            hidden_dim,
+            n_layers,
+            n_heads,
+            n_kv_heads,
+            head_dim,
+            vocab_size,
+            shared_classifier,
+            ..
+        } = *config;
+
+        let all_heads_dim = n_heads * head_dim;
+        let kv_dim = n_kv_heads * head_dim;
+
+        // Per-layer tensors are separate in GGUF; norms are concatenated over the layers
+        let layer_name = |layer: usize, name: &str| format!("blk.{layer}.{name}.weight");
+        let layer_norms = |name: &str, len: usize| -> Result<Cow<'static, [f32]>> {
+            let norms = (0..n_layers)
+                .map(|layer| self.f32_tensor(&layer_name(layer, name), &[len]))
+                .collect::<Result<Vec<_>>>()?;
+            Ok(Cow::Owned(norms.concat()))
+        };
+        let layer_matrices = |name: &str, rows: usize, cols: usize| {
+            (0..n_layers)
+                .map(|layer| self.q8_tensor(&layer_name(layer, name), rows, cols))
+                .collect::<Result<Vec<_>>>()
+        };
+
+        let classifier = if shared_classifier {
+            TOKEN_EMBEDDING
+        } else {
+            CLASSIFIER
+        };
+
+        Ok(TransformerWeights {
+            token_embedding_table: self.f32_tensor(TOKEN_EMBEDDING, &[dim, vocab_size])?,
+            rms_att_weight: layer_norms("attn_norm", dim)?,
+            rms_ffn_weight: layer_norms("ffn_norm", dim)?,
+            wq: layer_matrices("attn_q", all_heads_dim, dim)?,
+            wk: layer_matrices("attn_k", kv_dim, dim)?,
+            wv: layer_matrices("attn_v", kv_dim, dim)?,
+            wo: layer_matrices("attn_output", dim, all_heads_dim)?,
+            q_ln_weights: layer_norms("attn_q_norm", head_dim)?,
+            k_ln_weights: layer_norms("attn_k_norm", head_dim)?,
+            w1: layer_matrices("ffn_gate", hidden_dim, dim)?,
+            w2: layer_matrices("ffn_down", dim, hidden_dim)?,
+            w3: layer_matrices("ffn_up", hidden_dim, dim)?,
+            rms_final_weight: Cow::Owned(self.f32_tensor("output_norm.weight", &[dim])?),
+            wcls: self.q8_tensor(classifier, vocab_size, dim)?,
+            wcls_q4: None,
+        })
+    }
+
+    /// Exports the tokenizer and chat template next to the checkpoint `output`.
+    ///
+    /// The metadata holds the vocabulary and merges in Hugging Face's byte-level form, so
+    /// they are written as `tokenizer.json` and `tokenizer_config.json` in the directory
+    /// of `output` and exported from there like a model directory.
+    pub fn export_tokenizer(&self, output: &Path) -> Result<()> {
+        let tokenizer_model = self
+            .metadata
+            .get("tokenizer.ggml.model")
+            .and_then(Value::as_str)
+            .unwrap_or_default();
+        if tokenizer_model != "gpt2" {
+            anyhow::bail!(
+                "Unsupported GGUF tokenizer {tokenizer_model:?}, expected byte-level BPE (\"gpt2\")"
+            );
+        }
+
+        let tokens = self
+            .metadata
+            .get("tokenizer.ggml.tokens")
+            .and_then(Value::as_array)
+            .context("GGUF metadata tokenizer.ggml.tokens is missing")?;
+        let token_types = self
+            .metadata
+            .get("tokenizer.ggml.token_type")
+            .and_then(Value::as_array)
+            .unwrap_or_default();
+
+        let mut vocab = serde_json::Map::new();
+        let mut added_tokens = Vec::new();
+        for (id, token) in tokens.iter().enumerate() {
+            let token = token
+                .as_str()
+                .with_context(|| format!("Token {id} of the GGUF vocabulary is not a string"))?;
+            vocab.insert(token.to_string(), json!(id));
+
+            let token_type = token_types.get(id).and_then(Value::as_i64);
+            if let Some(token_type @ (TOKEN_TYPE_CONTROL | TOKEN_TYPE_USER_DEFINED)) = token_type {
+                added_tokens.push(json!({
+                    "id": id,
+                    "content": token,
+                    "special": token_type == TOKEN_TYPE_CONTROL,
+                }));
+            }
+        }
+        let merges: Vec<&str> = self
+            .metadata
+            .get("tokenizer.ggml.merges")
+            .and_then(Value::as_array)
+            .unwrap_or_default()
+            .iter()
+            .filter_map(Value::as_str)
+            .collect();
+
+        let dir = output
+            .parent()
+            .context("Exported tokenizer needs a directory")?;
+        let tokenizer = json!({
+            "added_tokens": added_tokens,
+            "model": {"vocab": vocab, "merges": merges},
+        });
+        fs::write(dir.join("tokenizer.json"), tokenizer.to_string())?;
+        if let Some(template) = self
+            .metadata
+            .get("tokenizer.chat_template")
+            .and_then(Value::as_str)
+        {
+            let tokenizer_config = json!({"chat_template": template});
+            fs::write(
+                dir.join("tokenizer_config.json"),
+                tokenizer_config.to_string(),
+            )?;
+        }
+
+        // Without the metadata, fall back to the ids of Qwen's own BOS/EOS tokens
+        let token_id = |key: &str, fallback: &str| -> Result<u32> {
+            if let Ok(id) = self.metadata_usize(key) {
+                return Ok(id as u32);
+            }
+            let id = tokens
+                .iter()
+                .position(|token| token.as_str() == Some(fallback))
+                .with_context(|| {
+                    format!("GGUF metadata {key} is missing and the vocabulary has no {fallback}")
+                })?;
+            warn!("GGUF metadata {key} is missing, using {fallback} ({id})");
+            Ok(id as u32)
+        };
+        hf_model::export_tokenizer_files(
+            dir,
+            output,
+            token_id("tokenizer.ggml.bos_token_id", BOS_TOKEN)?,
+            token_id("tokenizer.ggml.eos_token_id", EOS_TOKEN)?,
+        )
+    }
+
+    fn metadata_usize(&self, key: &str) -> Result<usize> {
+        self.metadata
+            .get(key)
+            .and_then(Value::as_usize)
+            .with_context(|| format!("GGUF metadata {key} is missing"))
+    }
+
+    /// Returns the type and the bytes of a tensor, checking its dimensions (innermost
+    /// first, as stored).
+    fn tensor_data(&self, name: &str, dims: &[usize]) -> Result<(BlockType, &[u8])> {
+        let info = self
+            .tensors
+            .get(name)
+            .with_context(|| format!("Tensor {name} not found in GGUF file"))?;
+        if info.dims != dims {
+            anyhow::bail!(
+                "Tensor {name} has dimensions {:?}, expected {dims:?}",
+                info.dims
+            );
+        }
+
+        let block_type =
+            BlockType::from_id(info.type_id).with_context(|| format!("Cannot load {name}"))?;
+        let (block_values, block_bytes) = block_type.layout();
+        if dims[0] % block_values != 0 {
+            anyhow::bail!(
+                "Tensor {name}: rows of {} values do not split into blocks of {block_values}",
+                dims[0]
+            );
+        }
+
+        let len = dims.iter().product::<usize>() / block_values * block_bytes;
+        let start = self.data_start.saturating_add(info.offset);
+        let data = self
+            .mapper
+            .bytes()
+            .get(start..start.saturating_add(len))
+            .with_context(|| format!("Tensor {name} extends past the end of the file"))?;
+        Ok((block_type, data))
+    }
+
+    /// Decodes a tensor to f32, a row at a time in parallel
+    fn f32_tensor(&self, name: &str, dims: &[usize]) -> Result<Vec<f32>> {
+        let (block_type, data) = self.tensor_data(name, dims)?;
+        let (block_values, block_bytes) = block_type.layout();
+        let row_len = dims[0];
+
+        let mut values = vec![0.0; dims.iter().product()];
+        values
+            .par_chunks_mut(row_len)
+            .zip(data.par_chunks(row_len / block_values * block_bytes))
+            .for_each(|(out, row)| block_type.decode(row, out));
+        Ok(values)
+    }
+
+    /// Loads a `rows` × `cols` matrix as int8 with groups of [`GROUP_SIZE`].
+    fn q8_tensor(&self, name: &str, rows: usize, cols: usize) -> Result<QuantizedTensor> {
+        let (block_type, data) = self.tensor_data(name, &[cols, rows])?;
+        if cols % GROUP_SIZE != 0 {
+            anyhow::bail!(
+                "Tensor {name}: rows of {cols} values do not split into groups of {GROUP_SIZE}"
+            );
+        }
+
+        let mut q = vec![0i8; rows * cols];
+        let mut s = vec![0.0f32; rows * cols / GROUP_SIZE];
+        if block_type == BlockType::Q8_0 {
+            // Same grouping: copy the int8 values and widen the scale
+            let (_, block_bytes) = block_type.layout();
+            q.par_chunks_mut(GROUP_SIZE)
+                .zip(s.par_iter_mut())
+                .zip(data.par_chunks(block_bytes))
+                .for_each(|((q, scale), block)| {
+                    *scale = f16_to_f32(read_u16(block, 0));
+                    for (q, &byte) in q.iter_mut().zip(&block[2..]) {
+                        *q = byte as i8;
+                    }
+                });
+        } else {
+            // Decode whole blocks and requantize whole groups
+            let (block_values, block_bytes) = block_type.layout();
+            let chunk = block_values.max(GROUP_SIZE);
+            q.par_chunks_mut(chunk)
+                .zip(s.par_chunks_mut(chunk / GROUP_SIZE))
+                .zip(data.par_chunks(chunk / block_values * block_bytes))
+                .for_each(|((q, s), blocks)| {
+                    let mut values = [0.0f32; QK_K];
+                    let values = &mut values[..chunk];
+                    block_type.decode(blocks, values);
+                    for ((q, scale), x) in q
+                        .chunks_exact_mut(GROUP_SIZE)
+                        .zip(s.iter_mut())
+                        .zip(values.chunks_exact(GROUP_SIZE))
+                    {
+                        *scale = quantize_group(q, x);
+                    }
+                });
+        }
+
+        Ok(QuantizedTensor {
+            q: Cow::Owned(q),
+            s: Cow::Owned(s),
+        })
+    }
+}
+
+type Header = (HashMap<String, Value>, HashMap<String, TensorInfo>, usize);
+
+/// Reads the metadata and the tensor directory, and finds the start of the tensor data.
+fn read_header(data: &[u8]) -> Result<Header> {
+    let mut reader = Cursor::new(data);
+
+    let magic = reader.read_u32::<LittleEndian>()?;
+    if magic != GGUF_MAGIC {
+        anyhow::bail!("Invalid GGUF magic number: {magic:#x}");
+    }
+    let version = reader.read_u32::<LittleEndian>()?;
+    if version < MIN_VERSION {
+        anyhow::bail!("Unsupported GGUF version {version}, expected {MIN_VERSION} or later");
+    }
+    let tensor_count = reader.read_u64::<LittleEndian>()?;
+    let metadata_count = reader.read_u64::<LittleEndian>()?;
+
+    let mut metadata = HashMap::new();
+    for _ in 0..metadata_count {
+        let key = read_string(&mut reader)?;
+        let value_type = reader.read_u32::<LittleEndian>()?;
+        let value = read_value(&mut reader, value_type)
+            .with_context(|| format!("Failed to read metadata {key}"))?;
+        metadata.insert(key, value);
+    }
+
+    let mut tensors = HashMap::new();
+    for _ in 0..tensor_count {
+        let name = read_string(&mut reader)?;
+        let n_dims = reader.read_u32::<LittleEndian>()?;
+        let dims = (0..n_dims)
+            .map(|_| reader.read_u64::<LittleEndian>().map(|dim| dim as usize))
+            .collect::<std::io::Result<Vec<_>>>()
+            .with_context(|| format!("Failed to read dimensions of {name}"))?;
+        let type_id = reader.read_u32::<LittleEndian>()?;
+        let offset = reader.read_u64::<LittleEndian>()? as usize;
+        tensors.insert(
+            name,
+            TensorInfo {
+                dims,
+                type_id,
+                offset,
+            },
+        );
+    }
+
+    let alignment = metadata
+        .get("general.alignment")
+        .and_then(Value::as_usize)
+        .filter(|&alignment| alignment > 0)
+        .unwrap_or(DEFAULT_ALIGNMENT);
+    let data_start = (reader.position() as usize).next_multiple_of(alignment);
+    Ok((metadata, tensors, data_start))
+}
+
+fn read_string(reader: &mut Cursor<&[u8]>) -> Result<String> {
+    let len = reader.read_u64::<LittleEndian>()? as usize;
+    let remaining = reader.get_ref().len() - reader.position() as usize;
+    if len > remaining {
+        anyhow::bail!("String of {len} bytes extends past the end of the file");
+    }
+    let mut bytes = vec![0; len];
+    reader.read_exact(&mut bytes)?;
+    String::from_utf8(bytes).context("Invalid UTF-8 string")
+}
+
+fn read_value(reader: &mut Cursor<&[u8]>, value_type: u32) -> Result<Value> {
+    Ok(match value_type {
+        0 => Value::Int(reader.read_u8()?.into()),
+        1 => Value::Int(reader.read_i8()?.into()),
+        2 => Value::Int(reader.read_u16::<LittleEndian>()?.into()),
+        3 => Value::Int(reader.read_i16::<LittleEndian>()?.into()),
+        4 => Value::Int(reader.read_u32::<LittleEndian>()?.into()),
+        5 => Value::Int(reader.read_i32::<LittleEndian>()?.into()),
+        6 => Value::Float(reader.read_f32::<LittleEndian>()?.into()),
+        7 => Value::Bool(reader.read_u8()? != 0),
+        8 => Value::String(read_string(reader)?),
+        9 => {
+            let element_type = reader.read_u32::<LittleEndian>()?;
+            let count = reader.read_u64::<LittleEndian>()? as usize;
+            let remaining = reader.get_ref().len() - reader.position() as usize;
+            let mut values = Vec::with_capacity(count.min(remaining));
+            for _ in 0..count {
+                values.push(read_value(reader, element_type)?);
+            }
+            Value::Array(values)
+        }
+        10 => Value::Int(reader.read_u64::<LittleEndian>()? as i64),
+        11 => Value::Int(reader.read_i64::<LittleEndian>()?),
+        12 => Value::Float(reader.read_f64::<LittleEndian>()?),
+        _ => anyhow::bail!("Unknown metadata type {value_type}"),
+    })
+}
+
+fn read_u16(data: &[u8], offset: usize) -> u16 {
+    u16::from_le_bytes([data[offset], data[offset + 1]])
+}
+
+/// Converts IEEE half precision bits to f32
+fn f16_to_f32(bits: u16) -> f32 {
+    let sign = ((bits & 0x8000) as u32) << 16;
+    let exponent = ((bits >> 10) & 0x1f) as u32;
+    let mantissa = (bits & 0x3ff) as u32;
+    match exponent {
+        // Zero and subnormals: mantissa × 2^-24
+        0 => {
+            let magnitude = mantissa as f32 / (1u32 << 24) as f32;
+            f32::from_bits(sign | magnitude.to_bits())
+        }
+        // Infinity and NaN
+        0x1f => f32::from_bits(sign | 0x7f80_0000 | (mantissa << 13)),
+        _ => f32::from_bits(sign | ((exponent + 127 - 15) << 23) | (mantissa << 13)),
+    }
+}
+
+/// Q4_0: an f16 scale, then 32 4-bit values offset by 8; low nibbles hold the first half
+fn decode_q4_0(block: &[u8], out: &mut [f32]) {
+    let d = f16_to_f32(read_u16(block, 0));
+    let (low, high) = out.split_at_mut(16);
+    for ((&byte, low), high) in block[2..18].iter().zip(low).zip(high) {
+        *low = ((byte & 0xf) as i32 - 8) as f32 * d;
+        *high = ((byte >> 4) as i32 - 8) as f32 * d;
+    }
+}
+
+/// Q8_0: an f16 scale, then 32 int8 values
+fn decode_q8_0(block: &[u8], out: &mut [f32]) {
+    let d = f16_to_f32(read_u16(block, 0));
+    for (out, &byte) in out.iter_mut().zip(&block[2..34]) {
+        *out = byte as i8 as f32 * d;
+    }
+}
+
+/// Scale and minimum of sub-block `j` of a Q4_K/Q5_K block, 6-bit values packed in 12 bytes
+fn scale_min_k4(j: usize, scales: &[u8]) -> (f32, f32) {
+    let (scale, min) = if j < 4 {
+        (scales[j] & 63, scales[j + 4] & 63)
+    } else {
+        (
+            (scales[j + 4] & 0xf) | ((scales[j - 4] >> 6) << 4),
+            (scales[j + 4] >> 4) | ((scales[j] >> 6) << 4),
+        )
+    };
+    (scale as f32, min as f32)
+}
+
+/// Q4_K: f16 scale and minimum, the 6-bit scales and minimums of 8 sub-blocks of 32, then
+/// 4-bit values; each 32 bytes hold two sub-blocks, the first in the low nibbles
+fn decode_q4_k(block: &[u8], out: &mut [f32]) {
+    let d = f16_to_f32(read_u16(block, 0));
+    let dmin = f16_to_f32(read_u16(block, 2));
+    let scales = &block[4..16];
+    let qs = &block[16..144];
+
+    for (pair, (qs, out)) in qs
+        .chunks_exact(32)
+        .zip(out.chunks_exact_mut(64))
+        .enumerate()
+    {
+        let (scale_low, min_low) = scale_min_k4(2 * pair, scales);
+        let (scale_high, min_high) = scale_min_k4(2 * pair + 1, scales);
+        let (low, high) = out.split_at_mut(32);
+        for ((&byte, low), high) in qs.iter().zip(low).zip(high) {
+            *low = d * scale_low * (byte & 0xf) as f32 - dmin * min_low;
+            *high = d * scale_high * (byte >> 4) as f32 - dmin * min_high;
+        }
+    }
+}
+
+/// Q5_K: like Q4_K, with the fifth bit of every value in 32 bytes ahead of the low bits;
+/// bit `2 * pair` and `2 * pair + 1` of each byte belong to the two sub-blocks of a pair
+fn decode_q5_k(block: &[u8], out: &mut [f32]) {
+    let d = f16_to_f32(read_u16(block, 0));
+    let dmin = f16_to_f32(read_u16(block, 2));
+    let scales = &block[4..16];
+    let qh = &block[16..48];
+    let qs = &block[48..176];
+
+    for (pair, (qs, out)) in qs
+        .chunks_exact(32)
+        .zip(out.chunks_exact_mut(64))
+        .enumerate()
+    {
+        let (scale_low, min_low) = scale_min_k4(2 * pair, scales);
+        let (scale_high, min_high) = scale_min_k4(2 * pair + 1, scales);
+        let (low, high) = out.split_at_mut(32);
+        for (((&byte, &bits), low), high) in qs.iter().zip(qh).zip(low).zip(high) {
+            let low_bit = (bits >> (2 * pair)) & 1;
+            let high_bit = (bits >> (2 * pair + 1)) & 1;
+            *low = d * scale_low * ((byte & 0xf) | (low_bit << 4)) as f32 - dmin * min_low;
+            *high = d * scale_high * ((byte >> 4) | (high_bit << 4)) as f32 - dmin * min_high;
+        }
+    }
+}
+
+/// Q6_K: low 4 bits, high 2 bits, 16 int8 scales of sub-blocks of 16, then an f16 scale.
+/// Each half of 128 values takes 64 bytes of low bits and 32 bytes of high bits.
+fn decode_q6_k(block: &[u8], out: &mut [f32]) {
+    let d = f16_to_f32(read_u16(block, 208));
+
+    for (half, out) in out.chunks_exact_mut(128).enumerate() {
+        let ql = &block[64 * half..64 * half + 64];
+        let qh = &block[128 + 32 * half..128 + 32 * half + 32];
+        let scales = &block[192 + 8 * half..192 + 8 * half + 8];
+        let scale = |index: usize| d * scales[index] as i8 as f32;
+
+        for (l, &high) in qh.iter().enumerate() {
+            let sub_block = l / 16;
+            let q1 = ((ql[l] & 0xf) | ((high & 3) << 4)) as i32 - 32;
+            let q2 = ((ql[l + 32] & 0xf) | (((high >> 2) & 3) << 4)) as i32 - 32;
+            let q3 = ((ql[l] >> 4) | (((high >> 4) & 3) << 4)) as i32 - 32;
+            let q4 = ((ql[l + 32] >> 4) | (((high >> 6) & 3) << 4)) as i32 - 32;
+            out[l] = scale(sub_block) * q1 as f32;
+            out[l + 32] = scale(sub_block + 2) * q2 as f32;
+            out[l + 64] = scale(sub_block + 4) * q3 as f32;
+            out[l + 96] = scale(sub_block + 6) * q4 as f32;
+        }
+    }
+}
@@ -0,0 +1,901 @@
+//! Constrained decoding with compiled grammars.
+//!
+//! A small regular expression language (or a JSON schema translated into it, see
+//! [`crate::json_schema`]) is compiled into a byte-level DFA:
+//!
+//! 1. The pattern is parsed into an AST over byte sets (UTF-8 literals become byte sequences).
+//! 2. The AST is compiled into a Thompson NFA, then determinized by subset construction.
+//! 3. For every DFA state, the vocabulary tokens whose bytes keep the automaton alive are
+//!    precomputed as a bitset, once per grammar.
+//!
+//! During generation, constraining a step is a single masked pass over the logits, and
+//! advancing the grammar is a table walk over the sampled token's bytes.
+
+#[cfg(test)]
+#[path = "../tests/unit/grammar_test.rs"]
+mod tests;
+
+use crate::tokenizer::Tokenizer;
+use anyhow::{Context, Result};
+use rayon::prelude::*;
+use std::collections::HashMap;
+
+/// Upper bound on NFA states, guards against huge counted repetitions
+const MAX_NFA_STATES: usize = 200_000;
+
+/// Upper bound on DFA states, guards against exponential determinization
+const MAX_DFA_STATES: usize = 20_000;
+
+/// DFA state with no way to reach a match
+const DEAD_STATE: u32 = 0;
+
+/// DFA state where matching starts
+const START_STATE: u32 = 1;
+
+/// Bitmap over the 256 byte values
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Hash, Default)]
+struct ByteSet([u64; 4]);
+
+impl ByteSet {
+    fn single(byte: u8) -> Self {
+        let mut set = Self::default();
+        set.insert(byte);
+        set
+    }
+
+    fn range(lo: u8, hi: u8) -> Self {
+        let mut set = Self::default();
+        for byte in lo..=hi {
+            set.insert(byte);
+        }
+        set
+    }
+
+    fn insert(&mut self, byte: u8) {
+        self.0[(byte >> 6) as usize] |= 1 << (byte & 63);
+    }
+
+    fn contains(&self, byte: u8) -> bool {
+        self.0[(byte >> 6) as usize] & (1 << (byte & 63)) != 0
+    }
+
+    fn union(mut self, other: Self) -> Self {
+        self.0.iter_mut().zip(other.0).for_each(|(a, b)| *a |= b);
+        self
+    }
+
+    fn complement(mut self) -> Self {
+        self.0.iter_mut().for_each(|word| *word = !*word);
+        self
+    }
+}
+
+/// Regular expression AST over bytes
+#[derive(Debug, Clone)]
+enum Node {
+    Bytes(ByteSet),
+    Concat(Vec<Node>),
+    Alternate(Vec<Node>),
+    Repeat {
+        node: Box<Node>,
+        min: u32,
+        max: Option<u32>,
+    },
+}
+
+impl Node {
+    fn literal(bytes: &[u8]) -> Self {
+        Node::Concat(
+            bytes
+                .iter()
+                .map(|&b| Node::Bytes(ByteSet::single(b)))
+                .collect(),
+        )
+    }
+}
+
+/// Recursive-descent parser for the supported regex syntax:
+/// literals, `.`, escapes (`\d \w \s \D \W \S \n \r \t \xHH \uHHHH`), character classes,
+/// groups `( )` / `(?: )`, alternation `|` and quantifiers `* + ? {m} {m,} {m,n}`.
+/// Patterns are implicitly anchored at both ends. `.` and negated classes match single bytes,
+/// so spell out UTF-8 sequences where the output must stay valid text.
+struct Parser<'a> {
+    chars: Vec<char>,
+    pos: usize,
+    pattern: &'a str,
+}
+
+impl<'a> Parser<'a> {
+    fn parse(pattern: &'a str) -> Result<Node> {
+        let mut parser = Self {
+            chars: pattern.chars().collect(),
+            pos: 0,
+            pattern,
+        };
+
+        // Anchors are implicit, accept them for familiarity
+        if parser.peek() == Some('^') {
+            parser.pos += 1;
+        }
+        if parser.chars.last() == Some(&'$') && !parser.pattern.ends_with("\\$") {
+            parser.chars.pop();
+        }
+
+        let node = parser.parse_alternation()?;
+        if parser.pos < parser.chars.len() {
+            anyhow::bail!(
+                "Unexpected '{}' at position {} in grammar pattern '{}'",
+                parser.chars[parser.pos],
+                parser.pos,
+                parser.pattern
+            );
+        }
+        Ok(node)
+    }
+
+    fn peek(&self) -> Option<char> {
+        self.chars.get(self.pos).copied()
+    }
+
+    fn next(&mut self) -> Result<char> {
+        let c = self
+            .peek()
+            .with_context(|| format!("Unexpected end of grammar pattern '{}'", self.pattern))?;
+        self.pos += 1;
+        Ok(c)
+    }
+
+    fn parse_alternation(&mut self) -> Result<Node> {
+        let mut alternatives = vec![self.parse_concat()?];
+        while self.peek() == Some('|') {
+            self.pos += 1;
+            alternatives.push(self.parse_concat()?);
+        }
+        Ok(if alternatives.len() == 1 {
+            alternatives.pop().unwrap()
+        } else {
+            Node::Alternate(alternatives)
+        })
+    }
+
+    fn parse_concat(&mut self) -> Result<Node> {
+        let mut items = Vec::new();
+        while let Some(c) = self.peek() {
+            if c == '|' || c == ')' {
+                break;
+            }
+            let atom = self.parse_atom()?;
+            items.push(self.parse_quantifiers(atom)?);
+        }
+        Ok(Node::Concat(items))
+    }
+
+    fn parse_quantifiers(&mut self, mut node: Node) -> Result<Node> {
+        loop {
+            let (min, max) = match self.peek() {
+                Some('*') => (0, None),
+                Some('+') => (1, None),
+                Some('?') => (0, Some(1)),
+                Some('{') => {
+                    self.pos += 1;
+                    self.parse_counted_repeat()?
+                }
+                _ => return Ok(node),
+            };
+            self.pos += 1;
+            // Lazy/possessive suffixes do not change the matched language
+            if matches!(self.peek(), Some('?') | Some('+')) {
+                self.pos += 1;
+            }
+            node = Node::Repeat {
+                node: Box::new(node),
+                min,
+                max,
+            };
+        }
+    }
+
+    fn parse_number(&mut self) -> Option<u32> {
+        let start = self.pos;
+        while self.peek().is_some_and(|c| c.is_ascii_digit()) {
+            self.pos += 1;
+        }
+        self.chars[start..self.pos]
+            .iter()
+            .collect::<String>()
+            .parse()
+            .ok()
+    }
+
+    fn parse_counted_repeat(&mut self) -> Result<(u32, Option<u32>)> {
+        let min = self
+            .parse_number()
+            .with_context(|| format!("Invalid repetition in grammar pattern '{}'", self.pattern))?;
+        let max = if self.peek() == Some(',') {
+            self.pos += 1;
+            self.parse_number()
+        } else {
+            Some(min)
+        };
+        if self.next()? != '}' || max.is_some_and(|max| max < min) {
+            anyhow::bail!("Invalid repetition in grammar pattern '{}'", self.pattern);
+        }
+        // Step back so the quantifier loop consumes exactly one closing character
+        self.pos -= 1;
+        Ok((min, max))
+    }
+
+    fn parse_atom(&mut self) -> Result<Node> {
+        match self.next()? {
+            '(' => {
+                if self.chars[self.pos..].starts_with(&['?', ':']) {
+                    self.pos += 2;
+                }
+                let node = self.parse_alternation()?;
+                if self.next()? != ')' {
+                    anyhow::bail!("Unbalanced '(' in grammar pattern '{}'", self.pattern);
+                }
+                Ok(node)
+            }
+            '[' => self.parse_class(),
+            '.' => Ok(Node::Bytes(ByteSet::single(b'\n').complement())),
+            '\\' => match self.parse_escape()? {
+                Escape::Set(set) => Ok(Node::Bytes(set)),
+                Escape::Char(c) => Ok(Node::literal(c.encode_utf8(&mut [0; 4]).as_bytes())),
+            },
+            c @ ('*' | '+' | '?' | '{' | ')') => anyhow::bail!(
+                "Unexpected '{c}' at position {} in grammar pattern '{}'",
+                self.pos - 1,
+                self.pattern
+            ),
+            c => Ok(Node::literal(c.encode_utf8(&mut [0; 4]).as_bytes())),
+        }
+    }
+
+    fn parse_hex(&mut self, digits: usize) -> Result<u32> {
+        let hex: String = (0..digits).map(|_| self.next()).collect::<Result<_>>()?;
+        u32::from_str_radix(&hex, 16)
+            .with_context(|| format!("Invalid hex escape in grammar pattern '{}'", self.pattern))
+    }
+
+    fn parse_escape(&mut self) -> Result<Escape> {
+        let digit = ByteSet::range(b'0', b'9');
+        let word = digit
+            .union(ByteSet::range(b'a', b'z'))
+            .union(ByteSet::range(b'A', b'Z'))
+            .union(ByteSet::single(b'_'));
+        let space = b" \t\n\r\x0b\x0c"
+            .iter()
+            .fold(ByteSet::default(), |set, &b| set.union(ByteSet::single(b)));
+
+        Ok(match self.next()? {
+            'd' => Escape::Set(digit),
+            'w' => Escape::Set(word),
+            's' => Escape::Set(space),
+            'D' => Escape::Set(digit.complement()),
+            'W' => Escape::Set(word.complement()),
+            'S' => Escape::Set(space.complement()),
+            'n' => Escape::Char('\n'),
+            'r' => Escape::Char('\r'),
+            't' => Escape::Char('\t'),
+            'x' => {
+                let byte = self.parse_hex(2)? as u8;
+                Escape::Set(ByteSet::single(byte))
+            }
+            'u' => {
+                let code = self.parse_hex(4)?;
+                Escape::Char(char::from_u32(code).with_context(|| {
+                    format!("Invalid \\u escape in grammar pattern '{}'", self.pattern)
+                })?)
+            }
+            c if c.is_ascii_alphanumeric() => anyhow::bail!(
+                "Unsupported escape '\\{c}' in grammar pattern '{}'",
+                self.pattern
+            ),
+            c => Escape::Char(c),
+        })
+    }
+
+    /// Parses a `[...]` class. Non-ASCII characters are allowed as single members of
+    /// non-negated classes; byte ranges must be ASCII or `\xHH`.
+    fn parse_class(&mut self) -> Result<Node> {
+        let negated = self.peek() == Some('^');
+        if negated {
+            self.pos += 1;
+        }
+
+        let mut set = ByteSet::default();
+        let mut multibyte = Vec::new();
+        let mut first = true;
+
+        loop {
+            let c = self.next()?;
+            if c == ']' && !first {
+                break;
+            }
+            first = false;
+
+            let lo = match c {
+                '\\' => match self.parse_escape()? {
+                    Escape::Set(escaped) => {
+                        // `\xHH` is a single byte and may start a range
+                        if escaped.0.iter().map(|w| w.count_ones()).sum::<u32>() == 1 {
+                            ClassItem::Byte((0..=255u8).find(|&b| escaped.contains(b)).unwrap())
+                        } else {
+                            set = set.union(escaped);
+                            continue;
+                        }
+                    }
+                    Escape::Char(c) => ClassItem::from_char(c),
+                },
+                c => ClassItem::from_char(c),
+            };
+
+            let is_range = self.peek() == Some('-') && self.chars.get(self.pos + 1) != Some(&']');
+            match (lo, is_range) {
+                (ClassItem::Byte(lo), true) => {
+                    self.pos += 1;
+                    let hi = match self.next()? {
+                        '\\' => match self.parse_escape()? {
+                            Escape::Set(escaped)
+                                if escaped.0.iter().map(|w| w.count_ones()).sum::<u32>() == 1 =>
+                            {
+                                (0..=255u8).find(|&b| escaped.contains(b)).unwrap()
+                            }
+                            Escape::Char(c) if c.is_ascii() => c as u8,
+                            _ => anyhow::bail!(
+                                "Invalid class range in grammar pattern '{}'",
+                                self.pattern
+                            ),
+                        },
+                        c if c.is_ascii() => c as u8,
+                        _ => anyhow::bail!(
+                            "Non-ASCII class ranges are not supported in grammar pattern '{}'",
+                            self.pattern
+                        ),
+                    };
+                    if hi < lo {
+                        anyhow::bail!("Invalid class range in grammar pattern '{}'", self.pattern);
+                    }
+                    set = set.union(ByteSet::range(lo, hi));
+                }
+                (ClassItem::Byte(byte), false) => set.insert(byte),
+                (ClassItem::Multibyte(bytes), false) => multibyte.push(bytes),
+                (ClassItem::Multibyte(_), true) => anyhow::bail!(
+                    "Non-ASCII class ranges are not supported in grammar pattern '{}'",
+                    self.pattern
+                ),
+            }
+        }
+
+        if negated {
+            if !multibyte.is_empty() {
+                anyhow::bail!(
+                    "Non-ASCII characters in negated classes are not supported in grammar pattern '{}'",
+                    self.pattern
+                );
+            }
+            return Ok(Node::Bytes(set.complement()));
+        }
+
+        if multibyte.is_empty() {
+            Ok(Node::Bytes(set))
+        } else {
+            let mut alternatives: Vec<Node> = multibyte.iter().map(|b| Node::literal(b)).collect();
+            alternatives.push(Node::Bytes(set));
+            Ok(Node::Alternate(alternatives))
+        }
+    }
+}
+
+/// Single bytes and multi-byte characters matched by one atom of the pattern language:
+/// `.`, a character class, an escape or a literal character.
+///
+/// Lets [`crate::json_schema`] confine a string `pattern` to what may appear unescaped in
+/// JSON text.
+pub(crate) fn atom_members(atom: &str) -> Result<(Vec<u8>, Vec<Vec<u8>>)> {
+    let mut parser = Parser {
+        chars: atom.chars().collect(),
+        pos: 0,
+        pattern: atom,
+    };
+    let node = parser.parse_atom()?;
+    if parser.pos < parser.chars.len() {
+        anyhow::bail!("Expected a single character or class, got '{atom}'");
+    }
+
+    let alternatives = match node {
+        Node::Alternate(alternatives) => alternatives,
+        node => vec![node],
+    };
+    let mut bytes = ByteSet::default();
+    let mut multibyte = Vec::new();
+    for node in alternatives {
+        match node {
+            Node::Bytes(set) => bytes = bytes.union(set),
+            Node::Concat(nodes) => {
+                // A literal: one single-byte set per byte
+                let literal = nodes
+                    .iter()
+                    .map(|node| match node {
+                        Node::Bytes(set)
+                            if set.0.iter().map(|w| w.count_ones()).sum::<u32>() == 1 =>
+                        {
+                            (0..=255u8).find(|&b| set.contains(b))
+                        }
+                        _ => None,
+                    })
+                    .collect::<Option<Vec<u8>>>()
+                    .with_context(|| format!("Unsupported atom '{atom}'"))?;
+                match literal[..] {
+                    [byte] => bytes.insert(byte),
+                    _ => multibyte.push(literal),
+                }
+            }
+            _ => anyhow::bail!("Unsupported atom '{atom}'"),
+        }
+    }
+    Ok((
+        (0..=255u8).filter(|&b| bytes.contains(b)).collect(),
+        multibyte,
+    ))
+}
+
+enum Escape {
+    Set(ByteSet),
+    Char(char),
+}
+
+enum ClassItem {
+    Byte(u8),
+    Multibyte(Vec<u8>),
+}
+
+impl ClassItem {
+    fn from_char(c: char) -> Self {
+        if c.is_ascii() {
+            ClassItem::Byte(c as u8)
+        } else {
+            ClassItem::Multibyte(c.encode_utf8(&mut [0; 4]).as_bytes().to_vec())
+        }
+    }
+}
+
+/// Thompson NFA state
+#[derive(Debug)]
+enum NfaState {
+    /// Consumes one byte from the set and moves on
+    Byte(ByteSet, usize),
+    /// Epsilon transitions
+    Split(Vec<usize>),
+    Match,
+}
+
+#[derive(Debug, Default)]
+struct Nfa {
+    states: Vec<NfaState>,
+}
+
+impl Nfa {
+    fn build(root: &Node) -> Result<(Self, usize)> {
+        let mut nfa = Self::default();
+        let accept = nfa.push(NfaState::Match)?;
+        let start = nfa.compile(root, accept)?;
+        Ok((nfa, start))
+    }
+
+    fn push(&mut self, state: NfaState) -> Result<usize> {
+        if self.states.len() >= MAX_NFA_STATES {
+            anyhow::bail!("Grammar is too large: more than {MAX_NFA_STATES} NFA states");
+        }
+        self.states.push(state);
+        Ok(self.states.len() - 1)
+    }
+
+    /// Compiles `node` so that it continues to `next` once matched; returns its entry state.
+    fn compile(&mut self, node: &Node, next: usize) -> Result<usize> {
+        match node {
+            Node::Bytes(set) => self.push(NfaState::Byte(*set, next)),
+            Node::Concat(items) => items
+                .iter()
+                .rev()
+                .try_fold(next, |next, item| self.compile(item, next)),
+            Node::Alternate(alternatives) => {
+                let starts = alternatives
+                    .iter()
+                    .map(|alt| self.compile(alt, next))
+                    .collect::<Result<Vec<_>>>()?;
+                self.push(NfaState::Split(starts))
+            }
+            Node::Repeat { node, min, max } => {
+                let mut entry = match max {
+                    None => {
+                        // Loop: split into (body -> split) or next
+                        let split = self.push(NfaState::Split(Vec::new()))?;
+                        let body = self.compile(node, split)?;
+                        self.states[split] = NfaState::Split(vec![body, next]);
+                        split
+                    }
+                    Some(max) => (0..max - min).try_fold(next, |rest, _| {
+                        let body = self.compile(node, rest)?;
+                        self.push(NfaState::Split(vec![body, next]))
+                    })?,
+                };
+                for _ in 0..*min {
+                    entry = self.compile(node, entry)?;
+                }
+                Ok(entry)
+            }
+        }
+    }
+
+    /// Epsilon closure of `seeds`, as the sorted set of byte-consuming and match states.
+    fn closure(&self, seeds: impl IntoIterator<Item = usize>, visited: &mut [bool]) -> Vec<u32> {
+        let mut stack: Vec<usize> = seeds.into_iter().collect();
+        let mut set = Vec::new();
+        let mut touched = Vec::new();
+
+        while let Some(id) = stack.pop() {
+            if visited[id] {
+                continue;
+            }
+            visited[id] = true;
+            touched.push(id);
+            match &self.states[id] {
+                NfaState::Split(targets) => stack.extend(targets.iter().rev()),
+                NfaState::Byte(..) | NfaState::Match => set.push(id as u32),
+            }
+        }
+
+        touched.into_iter().for_each(|id| visited[id] = false);
+        set.sort_unstable();
+        set
+    }
+}
+
+/// Byte-level DFA with a dense transition table.
+#[derive(Debug)]
+struct Dfa {
+    /// `transitions[state * 256 + byte]`
+    transitions: Vec<u32>,
+    accepting: Vec<bool>,
+}
+
+impl Dfa {
+    fn from_nfa(nfa: &Nfa, start: usize) -> Result<Self> {
+        // Partition bytes into classes that every NFA byte set treats identically
+        let mut byte_sets: Vec<ByteSet> = nfa
+            .states
+            .iter()
+            .filter_map(|state| match state {
+                NfaState::Byte(set, _) => Some(*set),
+                _ => None,
+            })
+            .collect();
+        byte_sets.sort_unstable_by_key(|set| set.0);
+        byte_sets.dedup();
+
+        let mut class_of_signature: HashMap<Vec<bool>, usize> = HashMap::new();
+        let mut class_of_byte = [0usize; 256];
+        let mut class_representatives = Vec::new();
+        for byte in 0..=255u8 {
+            let signature: Vec<bool> = byte_sets.iter().map(|set| set.contains(byte)).collect();
+            let next_class = class_of_signature.len();
+            let class = *class_of_signature.entry(signature).or_insert_with(|| {
+                class_representatives.push(byte);
+                next_class
+            });
+            class_of_byte[byte as usize] = class;
+        }
+
+        // Subset construction; state 0 is the dead (empty) set
+        let mut visited = vec![false; nfa.states.len()];
+        let mut ids: HashMap<Vec<u32>, u32> = HashMap::new();
+        let mut sets: Vec<Vec<u32>> = vec![Vec::new()];
+        ids.insert(Vec::new(), DEAD_STATE);
+
+        let start_set = nfa.closure([start], &mut visited);
+        ids.insert(start_set.clone(), START_STATE);
+        sets.push(start_set);
+
+        let mut transitions = vec![DEAD_STATE; 2 * 256];
+        let mut current = START_STATE as usize;
+        while current < sets.len() {
+            let mut class_targets = Vec::with_capacity(class_representatives.len());
+            for &byte in &class_representatives {
+                let seeds = sets[current]
+                    .iter()
+                    .filter_map(|&id| match &nfa.states[id as usize] {
+                        NfaState::Byte(set, next) if set.contains(byte) => Some(*next),
+                        _ => None,
+                    });
+                let target_set = nfa.closure(seeds, &mut visited);
+
+                let target = match ids.get(&target_set) {
+                    Some(&id) => id,
+                    None => {
+                        if sets.len() >= MAX_DFA_STATES {
+                            anyhow::bail!(
+                                "Grammar is too complex: more than {MAX_DFA_STATES} DFA states"
+                            );
+                        }
+                        let id = sets.len() as u32;
+                        ids.insert(target_set.clone(), id);
+                        sets.push(target_set);
+                        transitions.extend_from_slice(&[DEAD_STATE; 256]);
+                        id
+                    }
+                };
+                class_targets.push(target);
+            }
+
+            let row = &mut transitions[current * 256..(current + 1) * 256];
+            for (byte, target) in row.iter_mut().enumerate() {
+                *target = class_targets[class_of_byte[byte]];
+            }
+            current += 1;
+        }
+
+        let accepting = sets
+            .iter()
+            .map(|set| {
+                set.iter()
+                    .any(|&id| matches!(nfa.states[id as usize], NfaState::Match))
+            })
+            .collect();
+
+        Ok(Self {
+            transitions,
+            accepting,
+        })
+    }
+
+    fn num_states(&self) -> usize {
+        self.accepting.len()
+    }
+
+    /// Walks `bytes` from `state`, stopping early once the automaton is dead.
+    #[inline]
+    fn walk(&self, mut state: u32, bytes: &[u8]) -> u32 {
+        for &byte in bytes {
+            state = self.transitions[state as usize * 256 + byte as usize];
+            if state == DEAD_STATE {
+                break;
+            }
+        }
+        state
+    }
+}
+
+/// Bitset of allowed vocabulary tokens.
+///
+/// Small sets also keep the sorted token list, which lets decoding compute only those
+/// rows of the classification head (see [`crate::Transformer::forward_rows`]).
+#[derive(Debug, Clone)]
+pub struct TokenMask {
+    words: Vec<u64>,
+    count: usize,
+    sparse: Option<Vec<u32>>,
+}
+
+impl TokenMask {
+    fn new(vocab_size: usize) -> Self {
+        Self {
+            words: vec![0; vocab_size.div_ceil(64)],
+            count: 0,
+            sparse: None,
+        }
+    }
+
+    /// Builds a mask allowing exactly `tokens`.
+    pub fn from_tokens(vocab_size: usize, tokens: &[usize]) -> Result<Self> {
+        let mut mask = Self::new(vocab_size);
+        for &token in tokens {
+            if token >= vocab_size {
+                anyhow::bail!("Token {token} is outside the vocabulary (size {vocab_size})");
+            }
+            mask.insert(token);
+        }
+        mask.finish();
+        Ok(mask)
+    }
+
+    /// Keeps the token list when it takes no more memory than the bitset.
+    fn finish(&mut self) {
+        if self.count * 32 <= self.words.len() * 64 {
+            let tokens = (0..self.words.len() * 64).filter(|&token| self.contains(token));
+            self.sparse = Some(tokens.map(|token| token as u32).collect());
+        }
+    }
+
+    fn insert(&mut self, token: usize) {
+        let word = &mut self.words[token / 64];
+        let bit = 1u64 << (token % 64);
+        if *word & bit == 0 {
+            *word |= bit;
+            self.count += 1;
+        }
+    }
+
+    pub fn contains(&self, token: usize) -> bool {
+        self.words
+            .get(token / 64)
+            .is_some_and(|word| word & (1 << (token % 64)) != 0)
+    }
+
+    /// Number of allowed tokens
+    pub fn count(&self) -> usize {
+        self.count
+    }
+
+    /// Sorted allowed tokens, if the set is small
+    pub fn sparse_tokens(&self) -> Option<&[u32]> {
+        self.sparse.as_deref()
+    }
+
+    /// Sets the logits of disallowed tokens to negative infinity.
+    ///
+    /// Works one 64-bit word (64 logits) at a time: fully allowed blocks are skipped,
+    /// fully disallowed blocks are filled, and mixed blocks use a branch-free select
+    /// that the compiler vectorizes.
+    pub fn apply(&self, logits: &mut [f32]) {
+        for (block, &word) in logits.chunks_mut(64).zip(&self.words) {
+            match word {
+                u64::MAX => {}
+                0 => block.fill(f32::NEG_INFINITY),
+                _ => block.iter_mut().enumerate().for_each(|(lane, logit)| {
+                    let allowed = (word >> lane) & 1 != 0;
+                    *logit = if allowed { *logit } else { f32::NEG_INFINITY };
+                }),
+            }
+        }
+    }
+}
+
+/// A compiled grammar: DFA plus the precomputed allowed-token mask of each state.
+///
+/// Compile once and share it (e.g. behind an `Arc`) across turns and requests.
+#[derive(Debug)]
+pub struct Grammar {
+    dfa: Dfa,
+    masks: Vec<TokenMask>,
+    eos_token_id: usize,
+}
+
+impl Grammar {
+    /// Compiles a regular expression over the output text.
+    pub fn from_regex(pattern: &str, tokenizer: &Tokenizer) -> Result<Self> {
+        let ast = Parser::parse(pattern)?;
+        let (nfa, start) = Nfa::build(&ast)?;
+        let dfa = Dfa::from_nfa(&nfa, start)?;
+        let masks = Self::compute_masks(&dfa, tokenizer);
+
+        Ok(Self {
+            dfa,
+            masks,
+            eos_token_id: tokenizer.eos_token_id as usize,
+        })
+    }
+
+    /// Compiles a JSON schema (see [`crate::json_schema`] for the supported subset).
+    pub fn from_json_schema(schema: &str, tokenizer: &Tokenizer) -> Result<Self> {
+        let pattern = crate::json_schema::schema_to_regex(schema)?;
+        Self::from_regex(&pattern, tokenizer)
+    }
+
+    /// Number of DFA states
+    pub fn num_states(&self) -> usize {
+        self.dfa.num_states()
+    }
+
+    /// Precomputes, for every DFA state, which tokens keep the automaton alive.
+    ///
+    /// End-of-sequence is allowed in accepting states. Control tokens are never allowed
+    /// as text. A state no token can extend (possible when the vocabulary cannot spell
+    /// the next required bytes) allows end-of-sequence so generation cannot get stuck.
+    fn compute_masks(dfa: &Dfa, tokenizer: &Tokenizer) -> Vec<TokenMask> {
+        let vocab_size = tokenizer.vocab_size;
+        let eos = tokenizer.eos_token_id as usize;
+
+        (0..dfa.num_states() as u32)
+            .into_par_iter()
+            .map(|state| {
+                let mut mask = TokenMask::new(vocab_size);
+                if state != DEAD_STATE {
+                    for token in 0..vocab_size {
+                        let bytes = tokenizer.decode(token);
+                        if bytes.is_empty() || tokenizer.is_special_token(token) {
+                            continue;
+                        }
+                        if dfa.walk(state, bytes) != DEAD_STATE {
+                            mask.insert(token);
+                        }
+                    }
+                }
+                if eos < vocab_size && (dfa.accepting[state as usize] || mask.count() == 0) {
+                    mask.insert(eos);
+                }
+                mask.finish();
+                mask
+            })
+            .collect()
+    }
+}
+
+/// Position of a generation inside a [`Grammar`].
+#[derive(Debug, Clone)]
+pub struct GrammarState<'a> {
+    grammar: &'a Grammar,
+    state: u32,
+}
+
+impl<'a> GrammarState<'a> {
+    pub fn new(grammar: &'a Grammar) -> Self {
+        Self {
+            grammar,
+            state: START_STATE,
+        }
+    }
+
+    /// Tokens allowed at the current position
+    pub fn mask(&self) -> &'a TokenMask {
+        &self.grammar.masks[self.state as usize]
+    }
+
+    /// Masks disallowed tokens out of `logits`.
+    pub fn apply(&self, logits: &mut [f32]) {
+        self.mask().apply(logits);
+    }
+
+    /// Advances over a sampled token.
+    pub fn advance(&mut self, token: usize, bytes: &[u8]) {
+        if token != self.grammar.eos_token_id {
+            self.state = self.grammar.dfa.walk(self.state, bytes);
+        }
+    }
+
+    /// True if the text generated so far is a complete match
+    pub fn is_accepting(&self) -> bool {
+        self.grammar.dfa.accepting[self.state as usize]
+    }
+}
+
+/// Restriction on the tokens a generation may produce.
+#[derive(Debug)]
+pub enum Constraint {
+    /// Output must match a compiled grammar
+    Grammar(Grammar),
+    /// Every output token must come from a fixed set
+    Tokens(TokenMask),
+}
+
+/// Per-reply progress through a [`Constraint`].
+#[derive(Debug, Clone)]
+pub enum ConstraintState<'a> {
+    Grammar(GrammarState<'a>),
+    Tokens(&'a TokenMask),
+}
+
+impl<'a> ConstraintState<'a> {
+    pub fn new(constraint: &'a Constraint) -> Self {
+        match constraint {
+            Constraint::Grammar(grammar) => Self::Grammar(GrammarState::new(grammar)),
+            Constraint::Tokens(mask) => Self::Tokens(mask),
+        }
+    }
+
+    /// Tokens allowed at the current position
+    pub fn mask(&self) -> &'a TokenMask {
+        match self {
+            Self::Grammar(state) => state.mask(),
+            Self::Tokens(mask) => mask,
+        }
+    }
+
+    /// Advances over a sampled token.
+    pub fn advance(&mut self, token: usize, bytes: &[u8]) {
+        if let Self::Grammar(state) = self {
+            state.advance(token, bytes);
+        }
+    }
+}
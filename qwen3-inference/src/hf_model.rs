@@ -0,0 +1,137 @@
+//! Hugging Face model directories used directly as checkpoints.
+//!
+//! A directory with `config.json`, safetensors weights and `tokenizer.json` is exported on
+//! the fly by the exporter: the weights are quantized in parallel straight from the
+//! mapped BF16/F32 tensors into a checkpoint held in memory. With a cache path the
+//! checkpoint is written to that file instead and mapped like any other, so later loads
+//! skip quantization and the weights stay file-backed.
+
+use anyhow::{Context, Result};
+use log::{info, warn};
+use qwen3_export::{
+    BinaryModelExporter, ChatTemplateExporter, ExportOptions, TokenizerExporter, load_hf_config,
+};
+use std::fs;
+use std::path::{Path, PathBuf};
+use std::sync::atomic::{AtomicUsize, Ordering};
+use std::time::SystemTime;
+
+/// Returns true if `path` is a Hugging Face model directory rather than a checkpoint file.
+pub fn is_hf_model_dir(path: &str) -> bool {
+    Path::new(path).join("config.json").is_file()
+}
+
+fn weight_exporter(model_dir: &str, classifier_prescreen: bool) -> Result<BinaryModelExporter> {
+    let config = load_hf_config(model_dir)?;
+    Ok(
+        BinaryModelExporter::new(config, ExportOptions::default().group_size)
+            .with_classifier_prescreen(classifier_prescreen),
+    )
+}
+
+/// Quantizes the weights of `model_dir` into a checkpoint at `output`.
+pub(crate) fn export_weights(
+    model_dir: &str,
+    output: &Path,
+    classifier_prescreen: bool,
+) -> Result<()> {
+    weight_exporter(model_dir, classifier_prescreen)?
+        .export_binary_model(Path::new(model_dir), output)
+}
+
+/// Quantizes the weights of `model_dir` into a checkpoint held in memory.
+pub(crate) fn quantize_weights(model_dir: &str, classifier_prescreen: bool) -> Result<Vec<u8>> {
+    let mut checkpoint = Vec::new();
+    weight_exporter(model_dir, classifier_prescreen)?
+        .write_binary_model(Path::new(model_dir), &mut checkpoint)?;
+    Ok(checkpoint)
+}
+
+/// Exports the tokenizer and chat templates of `model_dir` next to the checkpoint `output`.
+pub(crate) fn export_tokenizer(model_dir: &str, output: &Path) -> Result<()> {
+    let config = load_hf_config(model_dir)?;
+    export_tokenizer_files(
+        Path::new(model_dir),
+        output,
+        config.bos_token_id,
+        config.eos_token_id,
+    )
+}
+
+/// Exports `tokenizer.json` and the chat template of `tokenizer_config.json` in `dir`.
+pub(crate) fn export_tokenizer_files(
+    dir: &Path,
+    output: &Path,
+    bos_token_id: u32,
+    eos_token_id: u32,
+) -> Result<()> {
+    TokenizerExporter::new().export_tokenizer(dir, output, bos_token_id, eos_token_id)?;
+
+    // Models without a chat template can still be used for generation
+    if let Err(e) = ChatTemplateExporter::new().export_templates(dir, output) {
+        warn!("No chat templates: {e:#}");
+    }
+    Ok(())
+}
+
+/// Returns true if the checkpoint `cache` was written after every file of `model_dir`.
+pub(crate) fn is_cache_fresh(model_dir: &str, cache: &Path) -> bool {
+    let modified = |path: &Path| fs::metadata(path).and_then(|metadata| metadata.modified());
+    let Ok(cached) = modified(cache) else {
+        return false;
+    };
+
+    let Ok(entries) = fs::read_dir(model_dir) else {
+        return false;
+    };
+    entries
+        .filter_map(|entry| entry.ok())
+        .all(|entry| modified(&entry.path()).is_ok_and(|source: SystemTime| source <= cached))
+}
+
+/// Writes a checkpoint to `cache` via a temporary file, so an interrupted export never
+/// leaves a truncated cache behind.
+pub(crate) fn export_weights_to_cache(
+    model_dir: &str,
+    cache: &Path,
+    classifier_prescreen: bool,
+) -> Result<()> {
+    let partial = PathBuf::from(format!("{}.partial", cache.display()));
+    export_weights(model_dir, &partial, classifier_prescreen)?;
+    fs::rename(&partial, cache)
+        .with_context(|| format!("Failed to write checkpoint cache {}", cache.display()))?;
+    info!("💾 Cached the quantized checkpoint at {}", cache.display());
+    Ok(())
+}
+
+/// A scratch directory for the exported tokenizer files, removed when dropped.
+#[derive(Debug)]
+pub(crate) struct TemporaryExport {
+    dir: PathBuf,
+}
+
+impl TemporaryExport {
+    pub fn new() -> Result<Self> {
+        static COUNTER: AtomicUsize = AtomicUsize::new(0);
+        let dir = std::env::temp_dir().join(format!(
+            "qwen3-export-{}-{}",
+            std::process::id(),
+            COUNTER.fetch_add(1, Ordering::Relaxed)
+        ));
+        fs::create_dir_all(&dir).with_context(|| format!("Failed to create {}", dir.display()))?;
+        Ok(Self { dir })
+    }
+
+    /// Path of the exported checkpoint; its tokenizer and templates go next to it
+    pub fn checkpoint_path(&self) -> PathBuf {
+        self.dir.join("model.bin")
+    }
+}
+
+impl Drop for TemporaryExport {
+    fn drop(&mut self) {
+        if let Err(e) = fs::remove_dir_all(&self.dir) {
+            warn!("Failed to remove {}: {e}", self.dir.display());
+        }
+    }
+}
@@ -0,0 +1,359 @@
+//! Translation of JSON schemas into the regex language of [`crate::grammar`].
+//!
+//! Supported subset:
+//! - `type`: `object`, `array`, `string`, `number`, `integer`, `boolean`, `null`
+//!   (or a list of them)
+//! - `properties` / `required`: `required` properties come first in their declared order,
+//!   then the optional ones alphabetically, each of which may be left out
+//! - `items`, `minItems`, `maxItems`, `minLength`, `maxLength`
+//! - `pattern`, applied to the string as written: `.` is any string character, and `"`,
+//!   `\` and control characters matched by a class or escape must appear JSON-escaped
+//! - `enum`, `const`, `anyOf`, `oneOf`
+//!
+//! Output is compact JSON with at most one optional space around separators. Numbers have
+//! a bounded number of digits so a constrained generation always terminates.
+
+#[cfg(test)]
+#[path = "../tests/unit/json_schema_test.rs"]
+mod tests;
+
+use anyhow::{Context, Result};
+use serde_json::Value;
+
+/// Optional whitespace between JSON tokens
+const WS: &str = "[ ]?";
+
+/// One JSON string character: printable ASCII other than quotes and backslashes,
+/// an escape sequence, or a well-formed multi-byte UTF-8 sequence
+const STRING_CHAR: &str = concat!(
+    r#"([^"\\\x00-\x1f\x80-\xff]|\\["\\/bfnrt]|\\u[0-9a-fA-F]{4}"#,
+    r"|[\xc2-\xdf][\x80-\xbf]",
+    r"|\xe0[\xa0-\xbf][\x80-\xbf]|[\xe1-\xec\xee\xef][\x80-\xbf]{2}|\xed[\x80-\x9f][\x80-\xbf]",
+    r"|\xf0[\x90-\xbf][\x80-\xbf]{2}|[\xf1-\xf3][\x80-\xbf]{3}|\xf4[\x80-\x8f][\x80-\xbf]{2})"
+);
+
+const INTEGER: &str = r"-?(0|[1-9][0-9]{0,15})";
+const NUMBER: &str = r"-?(0|[1-9][0-9]{0,15})(\.[0-9]{1,15})?([eE][+-]?[0-9]{1,3})?";
+
+/// Maximum nesting of objects and arrays
+const MAX_DEPTH: usize = 32;
+
+/// Translates a JSON schema document into a grammar pattern.
+pub fn schema_to_regex(schema: &str) -> Result<String> {
+    let schema: Value = serde_json::from_str(schema).context("Failed to parse JSON schema")?;
+    value_regex(&schema, 0)
+}
+
+/// Escapes regex metacharacters in a literal.
+pub fn escape_regex(literal: &str) -> String {
+    let mut escaped = String::with_capacity(literal.len());
+    for c in literal.chars() {
+        if "\\.^$|?*+()[]{}-".contains(c) {
+            escaped.push('\\');
+        }
+        escaped.push(c);
+    }
+    escaped
+}
+
+/// Regex matching exactly the compact serialization of `value`.
+fn literal_regex(value: &Value) -> Result<String> {
+    Ok(escape_regex(&serde_json::to_string(value)?))
+}
+
+fn alternation(alternatives: Vec<String>) -> String {
+    format!("({})", alternatives.join("|"))
+}
+
+fn value_regex(schema: &Value, depth: usize) -> Result<String> {
+    if depth > MAX_DEPTH {
+        anyhow::bail!("JSON schema is nested deeper than {MAX_DEPTH} levels");
+    }
+
+    // `true` accepts anything, which is not a regular language; be explicit about it
+    let schema = match schema {
+        Value::Object(object) => object,
+        _ => anyhow::bail!("Unsupported JSON schema: {schema}"),
+    };
+
+    if let Some(value) = schema.get("const") {
+        return literal_regex(value);
+    }
+    if let Some(values) = schema.get("enum") {
+        let values = values.as_array().context("'enum' must be an array")?;
+        return Ok(alternation(
+            values.iter().map(literal_regex).collect::<Result<_>>()?,
+        ));
+    }
+    for key in ["anyOf", "oneOf"] {
+        if let Some(schemas) = schema.get(key) {
+            let schemas = schemas
+                .as_array()
+                .with_context(|| format!("'{key}' must be an array"))?;
+            return Ok(alternation(
+                schemas
+                    .iter()
+                    .map(|s| value_regex(s, depth + 1))
+                    .collect::<Result<_>>()?,
+            ));
+        }
+    }
+
+    match schema.get("type") {
+        Some(Value::String(kind)) => type_regex(kind, schema, depth),
+        Some(Value::Array(kinds)) => Ok(alternation(
+            kinds
+                .iter()
+                .map(|kind| {
+                    let kind = kind.as_str().context("'type' entries must be strings")?;
+                    type_regex(kind, schema, depth)
+                })
+                .collect::<Result<_>>()?,
+        )),
+        None if schema.contains_key("properties") => type_regex("object", schema, depth),
+        _ => anyhow::bail!(
+            "JSON schema must specify a 'type': {}",
+            Value::from(schema.clone())
+        ),
+    }
+}
+
+fn type_regex(kind: &str, schema: &serde_json::Map<String, Value>, depth: usize) -> Result<String> {
+    let bound = |key: &str| schema.get(key).and_then(Value::as_u64).map(|v| v as u32);
+
+    Ok(match kind {
+        "object" => object_regex(schema, depth)?,
+        "array" => {
+            let items = match schema.get("items") {
+                Some(items) => value_regex(items, depth + 1)?,
+                None => anyhow::bail!("Array schemas must specify 'items'"),
+            };
+            array_regex(&items, bound("minItems").unwrap_or(0), bound("maxItems"))
+        }
+        "string" => match schema.get("pattern").and_then(Value::as_str) {
+            Some(pattern) => format!("\"({})\"", string_pattern_regex(pattern)?),
+            None => {
+                let min = bound("minLength").unwrap_or(0);
+                let max = bound("maxLength").map_or(String::new(), |max| max.to_string());
+                format!("\"{STRING_CHAR}{{{min},{max}}}\"")
+            }
+        },
+        "number" => NUMBER.to_string(),
+        "integer" => INTEGER.to_string(),
+        "boolean" => "(true|false)".to_string(),
+        "null" => "null".to_string(),
+        _ => anyhow::bail!("Unsupported JSON schema type '{kind}'"),
+    })
+}
+
+/// Translates a string `pattern` so that it only produces valid JSON string content.
+///
+/// `.` becomes one [`STRING_CHAR`]. Classes, escapes and literals keep their bytes except
+/// `"`, `\` and control bytes, which are replaced by their JSON escapes.
+fn string_pattern_regex(pattern: &str) -> Result<String> {
+    let pattern = pattern.strip_prefix('^').unwrap_or(pattern);
+    // `\$` is a literal dollar sign, `\\$` a backslash followed by the anchor
+    let pattern = match pattern.strip_suffix('$') {
+        Some(rest) if rest.chars().rev().take_while(|&c| c == '\\').count() % 2 == 0 => rest,
+        _ => pattern,
+    };
+
+    let chars: Vec<char> = pattern.chars().collect();
+    let mut regex = String::with_capacity(pattern.len());
+    let mut pos = 0;
+    while pos < chars.len() {
+        let end = match chars[pos] {
+            c @ ('(' | ')' | '|' | '*' | '+' | '?') => {
+                regex.push(c);
+                pos += 1;
+                continue;
+            }
+            '{' => {
+                // Counted repetition, copied up to its closing brace
+                let end = chars[pos..]
+                    .iter()
+                    .position(|&c| c == '}')
+                    .map_or(chars.len(), |len| pos + len + 1);
+                regex.extend(&chars[pos..end]);
+                pos = end;
+                continue;
+            }
+            '.' => {
+                regex.push_str(STRING_CHAR);
+                pos += 1;
+                continue;
+            }
+            '[' => class_end(&chars, pos)?,
+            '\\' => match chars.get(pos + 1) {
+                Some('x') => pos + 4,
+                Some('u') => pos + 6,
+                _ => pos + 2,
+            }
+            .min(chars.len()),
+            c if c != '"' && !c.is_control() => {
+                regex.push(c);
+                pos += 1;
+                continue;
+            }
+            _ => pos + 1,
+        };
+        let atom: String = chars[pos..end].iter().collect();
+        regex.push_str(&string_atom_regex(&atom)?);
+        pos = end;
+    }
+    Ok(regex)
+}
+
+/// Position after the `[...]` class starting at `start`
+fn class_end(chars: &[char], start: usize) -> Result<usize> {
+    let mut pos = start + 1;
+    if chars.get(pos) == Some(&'^') {
+        pos += 1;
+    }
+    // A leading `]` is a member
+    if chars.get(pos) == Some(&']') {
+        pos += 1;
+    }
+    loop {
+        match chars.get(pos) {
+            Some('\\') => pos += 2,
+            Some(']') => return Ok(pos + 1),
+            Some(_) => pos += 1,
+            None => anyhow::bail!("Unterminated character class in pattern"),
+        }
+    }
+}
+
+/// Regex for one atom of a string pattern, with the bytes JSON requires escaped replaced
+/// by their escape sequences
+fn string_atom_regex(atom: &str) -> Result<String> {
+    let (bytes, multibyte) = crate::grammar::atom_members(atom)
+        .with_context(|| format!("Invalid string pattern atom '{atom}'"))?;
+    let (unescaped, escaped): (Vec<u8>, Vec<u8>) = bytes
+        .into_iter()
+        .partition(|&b| b != b'"' && b != b'\\' && b >= 0x20);
+
+    let mut alternatives = Vec::new();
+    if !unescaped.is_empty() {
+        alternatives.push(byte_class(&unescaped));
+    }
+    alternatives.extend(multibyte.iter().map(|bytes| {
+        bytes
+            .iter()
+            .map(|b| format!("\\x{b:02x}"))
+            .collect::<String>()
+    }));
+    alternatives.extend(escaped.into_iter().map(|b| match b {
+        b'"' => r#"\\""#.to_string(),
+        b'\\' => r"\\\\".to_string(),
+        b'\n' => r"\\n".to_string(),
+        b'\r' => r"\\r".to_string(),
+        b'\t' => r"\\t".to_string(),
+        0x08 => r"\\b".to_string(),
+        0x0c => r"\\f".to_string(),
+        b => format!(r"\\u00{b:02x}"),
+    }));
+
+    match alternatives.len() {
+        0 => anyhow::bail!("String pattern atom '{atom}' matches no character"),
+        1 => Ok(alternatives.pop().unwrap()),
+        _ => Ok(format!("(?:{})", alternatives.join("|"))),
+    }
+}
+
+/// Class of `bytes` (sorted), with runs written as ranges
+fn byte_class(bytes: &[u8]) -> String {
+    let mut class = String::from("[");
+    let mut start = 0;
+    while start < bytes.len() {
+        let mut end = start;
+        while end + 1 < bytes.len() && bytes[end + 1] == bytes[end] + 1 {
+            end += 1;
+        }
+        class.push_str(&format!("\\x{:02x}", bytes[start]));
+        if end > start {
+            class.push_str(&format!("-\\x{:02x}", bytes[end]));
+        }
+        start = end + 1;
+    }
+    class.push(']');
+    class
+}
+
+fn object_regex(schema: &serde_json::Map<String, Value>, depth: usize) -> Result<String> {
+    let empty = serde_json::Map::new();
+    let properties = match schema.get("properties") {
+        Some(properties) => properties
+            .as_object()
+            .context("'properties' must be an object")?,
+        None => &empty,
+    };
+
+    // Required properties keep their declared order; map keys come back sorted
+    let required: Vec<&str> = schema
+        .get("required")
+        .and_then(Value::as_array)
+        .map(|required| required.iter().filter_map(Value::as_str).collect())
+        .unwrap_or_default();
+    for name in &required {
+        if !properties.contains_key(*name) {
+            anyhow::bail!("Required property '{name}' is not declared in 'properties'");
+        }
+    }
+    let optional: Vec<&str> = properties
+        .keys()
+        .map(String::as_str)
+        .filter(|name| !required.contains(name))
+        .collect();
+
+    let member = |name: &str| -> Result<String> {
+        let key = literal_regex(&Value::from(name))?;
+        let value = value_regex(&properties[name], depth + 1)?;
+        Ok(format!("{key}{WS}:{WS}{value}"))
+    };
+    let separator = format!("{WS},{WS}");
+    let required = required
+        .into_iter()
+        .map(member)
+        .collect::<Result<Vec<_>>>()?;
+    let optional = optional
+        .into_iter()
+        .map(member)
+        .collect::<Result<Vec<_>>>()?;
+
+    // Optional members after the first one present: each is left out or preceded by a comma
+    let rest = |members: &[String]| -> String {
+        members
+            .iter()
+            .map(|member| format!("({separator}{member})?"))
+            .collect()
+    };
+    let body = if !required.is_empty() {
+        format!("{}{}", required.join(&separator), rest(&optional))
+    } else if !optional.is_empty() {
+        // Any optional member can be the first one present, or none is
+        let first = (0..optional.len())
+            .map(|i| format!("{}{}", optional[i], rest(&optional[i + 1..])))
+            .collect();
+        format!("{}?", alternation(first))
+    } else {
+        String::new()
+    };
+
+    Ok(format!(r"\{{{WS}{body}{WS}\}}"))
+}
+
+fn array_regex(items: &str, min: u32, max: Option<u32>) -> String {
+    let separated = format!("{WS},{WS}{items}");
+    let rest = |min: u32| match max {
+        Some(max) => format!("({separated}){{{min},{}}}", max.saturating_sub(1)),
+        None => format!("({separated}){{{min},}}"),
+    };
+
+    let body = match (min, max) {
+        (_, Some(0)) => String::new(),
+        (0, _) => format!("({items}{})?", rest(0)),
+        (min, _) => format!("{items}{}", rest(min - 1)),
+    };
+    format!(r"\[{WS}{body}{WS}\]")
+}
@@ -2,26 +2,56 @@
 //!
 //! This crate will provide inference functionality for Qwen3 models in the future.
 
+mod chat_template;
 mod configuration;
+mod detokenizer;
+mod embeddings;
 mod generation;
+mod gguf;
+mod grammar;
+mod hf_model;
+mod json_schema;
+mod lru_cache;
+mod perplexity;
+mod pretokenizer;
 mod sampler;
+mod scoring;
+mod special_tokens;
+mod stop_sequences;
 mod tensor;
+mod thinking;
 mod tokenizer;
+mod tokenizer_validation;
 mod transformer;
 mod utils;
 
-use anyhow::Result;
-use log::debug;
-use std::time::{SystemTime, UNIX_EPOCH};
+use anyhow::{Context, Result};
+use log::{debug, info, warn};
+use std::time::{Instant, SystemTime, UNIX_EPOCH};
 
-use crate::generation::{chat, generate};
-use crate::sampler::Sampler;
-use crate::tokenizer::Tokenizer;
-use crate::transformer::TransformerBuilder;
+use crate::generation::chat;
+
+pub use crate::configuration::{ModelConfig, read_checkpoint_config};
+pub use crate::detokenizer::Detokenizer;
+pub use crate::embeddings::{EmbeddingOptions, Pooling, QuantizedEmbedding, embed_sequences};
+pub use crate::generation::{GenerationOptions, generate};
+pub use crate::gguf::is_gguf_file;
+pub use crate::grammar::{Constraint, ConstraintState, Grammar, GrammarState, TokenMask};
+pub use crate::hf_model::is_hf_model_dir;
+pub use crate::perplexity::{PerplexityReport, evaluate_perplexity};
+pub use crate::sampler::Sampler;
+pub use crate::scoring::{ContinuationScore, TokenScore, score_continuations};
+pub use crate::stop_sequences::{StopMatcher, StopSequences};
+pub use crate::tokenizer::{PromptTemplates, Tokenizer};
+pub use crate::tokenizer_validation::{InflatedLine, RoundTripReport, validate_round_trip};
+pub use crate::transformer::{PREFILL_BATCH, PrescreenStats, Transformer, TransformerBuilder};
 
 #[derive(Debug, Clone)]
 pub struct InferenceConfig {
+    /// Checkpoint file, GGUF file or Hugging Face model directory
     pub checkpoint_path: String,
+    /// Where to keep the quantized checkpoint of a Hugging Face model directory
+    pub checkpoint_cache: Option<String>,
     pub temperature: f32,
     pub topp: f32,
     pub ctx_length: Option<usize>,
@@ -29,7 +59,31 @@ pub struct InferenceConfig {
     pub prompt: Option<String>,
     pub system_prompt: Option<String>,
     pub enable_thinking: bool,
+    /// Maximum number of tokens spent inside `<think>` per reply
+    pub thinking_budget: Option<usize>,
     pub seed: u64,
+    /// Regex the generated text must match
+    pub grammar: Option<String>,
+    /// Path to a JSON schema the generated text must conform to
+    pub json_schema: Option<String>,
+    /// Tokens (exact vocabulary strings) the generated text may consist of
+    pub allowed_tokens: Option<Vec<String>>,
+    /// Strings that end a reply as soon as they are generated
+    pub stop_sequences: Vec<String>,
+    /// Candidates rescored exactly by the two-stage classifier, if enabled
+    pub prescreen_top_k: Option<usize>,
+    /// Compare the two-stage classifier against the exact one and report the agreement
+    pub prescreen_verify: bool,
+    /// Continuations of the prompt to score in score mode
+    pub continuations: Vec<String>,
+    /// Alternatives reported per scored token
+    pub top_logprobs: usize,
+    /// How embed mode reduces hidden states to one vector per text
+    pub pooling: Pooling,
+    /// Scale embeddings to unit L2 norm
+    pub normalize_embeddings: bool,
+    /// Print embeddings quantized to int8
+    pub int8_embeddings: bool,
 }
 
 impl InferenceConfig {
@@ -41,6 +95,7 @@ impl InferenceConfig {
 #[derive(Debug, Default)]
 pub struct InferenceConfigBuilder {
     checkpoint_path: Option<String>,
+    checkpoint_cache: Option<String>,
     temperature: Option<f32>,
     topp: Option<f32>,
     ctx_length: Option<usize>,
@@ -48,7 +103,19 @@ pub struct InferenceConfigBuilder {
     prompt: Option<String>,
     system_prompt: Option<String>,
     enable_thinking: Option<bool>,
+    thinking_budget: Option<usize>,
     seed: Option<u64>,
+    grammar: Option<String>,
+    json_schema: Option<String>,
+    allowed_tokens: Option<Vec<String>>,
+    stop_sequences: Vec<String>,
+    prescreen_top_k: Option<usize>,
+    prescreen_verify: Option<bool>,
+    continuations: Vec<String>,
+    top_logprobs: Option<usize>,
+    pooling: Option<String>,
+    normalize_embeddings: Option<bool>,
+    int8_embeddings: Option<bool>,
 }
 
 impl InferenceConfigBuilder {
@@ -56,6 +123,10 @@ impl InferenceConfigBuilder {
         self.checkpoint_path = path.cloned();
         self
     }
+    pub fn checkpoint_cache(mut self, path: Option<&String>) -> Self {
+        self.checkpoint_cache = path.cloned();
+        self
+    }
     pub fn temperature(mut self, temperature: Option<f32>) -> Self {
         self.temperature = temperature;
         self
@@ -84,13 +155,85 @@ impl InferenceConfigBuilder {
         self.enable_thinking = enable;
         self
     }
+    pub fn thinking_budget(mut self, budget: Option<usize>) -> Self {
+        self.thinking_budget = budget;
+        self
+    }
     pub fn seed(mut self, seed: Option<u64>) -> Self {
         self.seed = seed;
         self
     }
+    pub fn grammar(mut self, grammar: Option<&String>) -> Self {
+        self.grammar = grammar.cloned();
+        self
+    }
+    pub fn json_schema(mut self, path: Option<&String>) -> Self {
+        self.json_schema = path.cloned();
+        self
+    }
+    /// Comma-separated list of allowed tokens, e.g. `yes,no`
+    pub fn allowed_tokens(mut self, tokens: Option<&String>) -> Self {
+        self.allowed_tokens = tokens.map(|list| list.split(',').map(str::to_string).collect());
+        self
+    }
+    /// Stop sequences, with `\n`, `\r`, `\t` and `\\` escapes interpreted
+    pub fn stop_sequences<'a>(mut self, stops: impl IntoIterator<Item = &'a String>) -> Self {
+        self.stop_sequences = stops
+            .into_iter()
+            .map(|s| stop_sequences::unescape(s))
+            .collect();
+        self
+    }
+    pub fn prescreen_top_k(mut self, top_k: Option<usize>) -> Self {
+        self.prescreen_top_k = top_k;
+        self
+    }
+    pub fn prescreen_verify(mut self, verify: Option<bool>) -> Self {
+        self.prescreen_verify = verify;
+        self
+    }
+    pub fn continuations<'a>(
+        mut self,
+        continuations: impl IntoIterator<Item = &'a String>,
+    ) -> Self {
+        self.continuations = continuations.into_iter().cloned().collect();
+        self
+    }
+    pub fn top_logprobs(mut self, top_logprobs: Option<usize>) -> Self {
+        self.top_logprobs = top_logprobs;
+        self
+    }
+    /// `mean` or `last`
+    pub fn pooling(mut self, pooling: Option<&String>) -> Self {
+        self.pooling = pooling.cloned();
+        self
+    }
+    pub fn normalize_embeddings(mut self, normalize: Option<bool>) -> Self {
+        self.normalize_embeddings = normalize;
+        self
+    }
+    pub fn int8_embeddings(mut self, int8: Option<bool>) -> Self {
+        self.int8_embeddings = int8;
+        self
+    }
     pub fn build(self) -> Result<InferenceConfig, String> {
+        let constraints = [
+            self.grammar.is_some(),
+            self.json_schema.is_some(),
+            self.allowed_tokens.is_some(),
+        ];
+        if constraints.iter().filter(|&&set| set).count() > 1 {
+            return Err(
+                "grammar, json_schema and allowed_tokens are mutually exclusive".to_string(),
+            );
+        }
+        if self.prescreen_top_k == Some(0) {
+            return Err("prescreen_top_k must be positive".to_string());
+        }
+
         Ok(InferenceConfig {
             checkpoint_path: self.checkpoint_path.ok_or("checkpoint_path is required")?,
+            checkpoint_cache: self.checkpoint_cache,
             temperature: self.temperature.unwrap_or(1.0),
             topp: self.topp.unwrap_or(0.9),
             ctx_length: self.ctx_length,
@@ -98,12 +241,29 @@ impl InferenceConfigBuilder {
             prompt: self.prompt,
             system_prompt: self.system_prompt,
             enable_thinking: self.enable_thinking.unwrap_or(false),
+            thinking_budget: self.thinking_budget,
             seed: self.seed.unwrap_or_else(|| {
                 SystemTime::now()
                     .duration_since(UNIX_EPOCH)
                     .unwrap()
                     .as_secs()
             }),
+            grammar: self.grammar,
+            json_schema: self.json_schema,
+            allowed_tokens: self.allowed_tokens,
+            stop_sequences: self.stop_sequences,
+            prescreen_top_k: self.prescreen_top_k,
+            prescreen_verify: self.prescreen_verify.unwrap_or(false),
+            continuations: self.continuations,
+            top_logprobs: self.top_logprobs.unwrap_or(5),
+            pooling: self
+                .pooling
+                .as_deref()
+                .map(str::parse)
+                .transpose()?
+                .unwrap_or_default(),
+            normalize_embeddings: self.normalize_embeddings.unwrap_or(false),
+            int8_embeddings: self.int8_embeddings.unwrap_or(false),
         })
     }
 }
@@ -112,8 +272,14 @@ impl InferenceConfigBuilder {
 pub fn run_inference(inference_config: InferenceConfig) -> Result<()> {
     debug!("{inference_config:#?}");
 
+    let prescreen_verification = inference_config
+        .prescreen_verify
+        .then_some((inference_config.temperature, inference_config.topp));
     let mut transformer = TransformerBuilder::new(&inference_config.checkpoint_path)
+        .with_checkpoint_cache(inference_config.checkpoint_cache.as_deref())
         .with_ctx_length(inference_config.ctx_length)
+        .with_prescreen(inference_config.prescreen_top_k)
+        .with_prescreen_verification(prescreen_verification)
         .build()?;
 
     debug!("{transformer:#?}");
@@ -123,11 +289,14 @@ pub fn run_inference(inference_config: InferenceConfig) -> Result<()> {
     let tokenizer = Tokenizer::new(
         &inference_config.checkpoint_path,
         transformer_config.vocab_size,
-        inference_config.enable_thinking,
     )?;
 
     debug!("{tokenizer:#?}");
 
+    if inference_config.enable_thinking && !tokenizer.supports_thinking() {
+        warn!("The model has no thinking prompt templates, thinking stays off");
+    }
+
     let mut sampler = Sampler::new(
         transformer_config.vocab_size,
         inference_config.temperature,
@@ -135,19 +304,252 @@ pub fn run_inference(inference_config: InferenceConfig) -> Result<()> {
         inference_config.seed,
     );
 
+    let constraint = load_constraint(&inference_config, &tokenizer)?;
+    let stop_sequences = if inference_config.stop_sequences.is_empty() {
+        None
+    } else {
+        Some(StopSequences::new(&inference_config.stop_sequences)?)
+    };
+    let options = GenerationOptions {
+        constraint: constraint.as_ref(),
+        stop_sequences: stop_sequences.as_ref(),
+        enable_thinking: inference_config.enable_thinking,
+        thinking_budget: inference_config.thinking_budget,
+    };
+
     let prompt = inference_config.prompt.as_deref();
     let system_prompt = inference_config.system_prompt.as_deref();
 
     // Run
-    match inference_config.mode.as_str() {
-        "generate" => generate(&mut transformer, &tokenizer, &mut sampler, prompt),
+    let result = match inference_config.mode.as_str() {
+        "generate" => generate(&mut transformer, &tokenizer, &mut sampler, prompt, options),
         "chat" => chat(
             &mut transformer,
             &tokenizer,
             &mut sampler,
             prompt,
             system_prompt,
+            options,
+        ),
+        "score" => scoring::score(
+            &mut transformer,
+            &tokenizer,
+            prompt,
+            &inference_config.continuations,
+            inference_config.top_logprobs,
+        ),
+        "embed" => embeddings::embed(
+            &mut transformer,
+            &tokenizer,
+            &embedding_texts(prompt)?,
+            EmbeddingOptions {
+                pooling: inference_config.pooling,
+                normalize: inference_config.normalize_embeddings,
+            },
+            inference_config.int8_embeddings,
         ),
         _ => anyhow::bail!("Unknown mode: {inference_config:?}"),
+    };
+
+    if let Some(stats) = transformer.prescreen_stats() {
+        report_prescreen_stats(stats);
+    }
+    result
+}
+
+/// Texts for embed mode: the non-empty lines of the prompt, or of stdin without one.
+fn embedding_texts(prompt: Option<&str>) -> Result<Vec<String>> {
+    let input = match prompt {
+        Some(prompt) => prompt.to_string(),
+        None => std::io::read_to_string(std::io::stdin()).context("Failed to read stdin")?,
+    };
+    Ok(input
+        .lines()
+        .filter(|line| !line.trim().is_empty())
+        .map(str::to_string)
+        .collect())
+}
+
+/// Logs how often the two-stage classifier matched the exact one, and what it saved.
+fn report_prescreen_stats(stats: &PrescreenStats) {
+    if stats.steps == 0 {
+        return;
     }
+
+    let per_token_ms =
+        |time: std::time::Duration, steps: usize| time.as_secs_f64() * 1e3 / steps as f64;
+    let two_stage_ms = per_token_ms(stats.two_stage_time, stats.steps);
+    if stats.verified_steps == 0 {
+        info!(
+            "[Prescreen over {} tokens: {:.3} ms/token in the two-stage classifier]",
+            stats.steps, two_stage_ms
+        );
+        return;
+    }
+
+    let percent = |hits: usize| 100.0 * hits as f64 / stats.verified_steps as f64;
+    let exact_ms = per_token_ms(stats.exact_time, stats.verified_steps);
+    info!(
+        "[Prescreen over {} tokens: top-p set covered {:.1}%, argmax covered {:.1}%, \
+         mean probability missed {:.4}]",
+        stats.verified_steps,
+        percent(stats.topp_hits),
+        percent(stats.argmax_hits),
+        stats.missed_mass / stats.verified_steps as f64
+    );
+    info!(
+        "[Classifier: {:.3} ms/token exact, {:.3} ms/token two-stage, {:.3} ms/token saved]",
+        exact_ms,
+        two_stage_ms,
+        exact_ms - two_stage_ms
+    );
+}
+
+/// Builds the output constraint, if any, once for the whole session.
+fn load_constraint(
+    inference_config: &InferenceConfig,
+    tokenizer: &Tokenizer,
+) -> Result<Option<Constraint>> {
+    if let Some(tokens) = &inference_config.allowed_tokens {
+        // End-of-sequence stays allowed so replies can finish
+        let mut ids = vec![tokenizer.eos_token_id as usize];
+        for text in tokens {
+            let id = tokenizer
+                .str_lookup(text)
+                .with_context(|| format!("'{text}' is not a single token in the vocabulary"))?;
+            ids.push(id);
+        }
+        let mask = TokenMask::from_tokens(tokenizer.vocab_size, &ids)?;
+        return Ok(Some(Constraint::Tokens(mask)));
+    }
+
+    let start = Instant::now();
+    let grammar = match (&inference_config.grammar, &inference_config.json_schema) {
+        (Some(pattern), _) => Grammar::from_regex(pattern, tokenizer)?,
+        (None, Some(path)) => {
+            let schema = std::fs::read_to_string(path)
+                .with_context(|| format!("Failed to read JSON schema {path}"))?;
+            Grammar::from_json_schema(&schema, tokenizer)?
+        }
+        (None, None) => return Ok(None),
+    };
+
+    info!(
+        "Compiled grammar: {} states in {:.2}s",
+        grammar.num_states(),
+        start.elapsed().as_secs_f64()
+    );
+    Ok(Some(Constraint::Grammar(grammar)))
+}
+
+/// Evaluates the perplexity of a checkpoint on a text file, in windows of `ctx_length`
+/// tokens (the model context if not given) spread over `sessions` parallel sessions.
+pub fn run_perplexity_evaluation(
+    checkpoint_path: &str,
+    text_path: &str,
+    ctx_length: Option<usize>,
+    sessions: usize,
+) -> Result<()> {
+    let mut transformer = TransformerBuilder::new(checkpoint_path)
+        .with_ctx_length(ctx_length)
+        .build()?;
+    let tokenizer = Tokenizer::new(checkpoint_path, transformer.config.vocab_size)?;
+    let text = std::fs::read_to_string(text_path)
+        .with_context(|| format!("Failed to read text {text_path}"))?;
+
+    perplexity::perplexity(&mut transformer, &tokenizer, &text, sessions)
+}
+
+/// Checks that the checkpoint's tokenizer round-trips every line of a corpus file.
+///
+/// With a `reference_path` (typically the untrimmed checkpoint), also compares the token
+/// counts line by line and fails if the corpus takes more than `max_inflation_percent`
+/// more tokens. Lines that needed byte-fallback tokens are listed either way.
+pub fn run_tokenizer_validation(
+    checkpoint_path: &str,
+    corpus_path: &str,
+    reference_path: Option<&str>,
+    max_inflation_percent: f64,
+) -> Result<()> {
+    /// Lines listed in the log and in errors
+    const SHOWN_LINES: usize = 10;
+
+    let load_tokenizer = |path: &str| -> Result<Tokenizer> {
+        let config = read_checkpoint_config(path)?;
+        Tokenizer::new(path, config.vocab_size)
+    };
+    let list_lines = |lines: &[usize]| {
+        let shown: Vec<String> = lines
+            .iter()
+            .take(SHOWN_LINES)
+            .map(usize::to_string)
+            .collect();
+        let more = if lines.len() > shown.len() {
+            ", ..."
+        } else {
+            ""
+        };
+        format!("{}{}", shown.join(", "), more)
+    };
+
+    let tokenizer = load_tokenizer(checkpoint_path)?;
+    let reference = reference_path.map(load_tokenizer).transpose()?;
+    let corpus = std::fs::read_to_string(corpus_path)
+        .with_context(|| format!("Failed to read corpus {corpus_path}"))?;
+
+    let report = validate_round_trip(&tokenizer, reference.as_ref(), &corpus);
+
+    info!(
+        "Checked {} lines: {} tokens, vocabulary of {}",
+        report.lines, report.tokens, tokenizer.vocab_size
+    );
+    if let (Some(reference), Some(reference_tokens), Some(inflation)) =
+        (&reference, report.reference_tokens, report.inflation())
+    {
+        info!(
+            "Reference: {} tokens, vocabulary of {} ({:+.2}% tokens, {} lines longer)",
+            reference_tokens,
+            reference.vocab_size,
+            100.0 * inflation,
+            report.inflated_lines.len()
+        );
+
+        let mut worst: Vec<&InflatedLine> = report.inflated_lines.iter().collect();
+        worst.sort_by(|a, b| b.inflation().total_cmp(&a.inflation()));
+        for line in worst.iter().take(SHOWN_LINES) {
+            info!(
+                "  line {}: {} tokens vs {} ({:+.0}%)",
+                line.line,
+                line.tokens,
+                line.reference_tokens,
+                100.0 * line.inflation()
+            );
+        }
+    }
+    if !report.fallback_lines.is_empty() {
+        warn!(
+            "{} lines need byte-fallback tokens (lines {})",
+            report.fallback_lines.len(),
+            list_lines(&report.fallback_lines)
+        );
+    }
+
+    if !report.failed_lines.is_empty() {
+        anyhow::bail!(
+            "{} of {} lines do not round-trip (lines {})",
+            report.failed_lines.len(),
+            report.lines,
+            list_lines(&report.failed_lines)
+        );
+    }
+    if !report.is_ok(max_inflation_percent / 100.0) {
+        anyhow::bail!(
+            "The corpus takes {:+.2}% tokens against the reference, over the limit of {}%",
+            100.0 * report.inflation().unwrap_or_default(),
+            max_inflation_percent
+        );
+    }
+
+    info!("✅ All lines round-trip");
+    Ok(())
 }
@@ -0,0 +1,159 @@
+//! A small least-recently-used cache keyed by strings.
+
+#[cfg(test)]
+#[path = "../tests/unit/lru_cache_test.rs"]
+mod tests;
+
+use std::collections::HashMap;
+use std::hash::{BuildHasher, RandomState};
+
+/// No neighbour in the recency list
+const NONE: usize = usize::MAX;
+
+/// Fixed-capacity map that evicts the least recently used entry when full.
+///
+/// Entries live in a slab linked into a recency list, most recent first, so lookups,
+/// inserts and evictions are O(1). The index maps a hash of the key to its slot and the
+/// key is stored once, in the slot; two keys with the same hash replace each other, which
+/// a cache can afford. An evicted slot is reused with its key buffer and, through
+/// [`Self::insert_with`], its value, so a warm cache only allocates when a key or value
+/// outgrows the slot it lands in. The slab grows with use up to `capacity`, so an unused
+/// cache costs nothing.
+#[derive(Debug)]
+pub(crate) struct LruCache<V> {
+    index: HashMap<u64, usize>,
+    hasher: RandomState,
+    entries: Vec<Entry<V>>,
+    capacity: usize,
+    /// Most recently used entry
+    head: usize,
+    /// Least recently used entry, evicted next
+    tail: usize,
+}
+
+#[derive(Debug)]
+struct Entry<V> {
+    key: String,
+    hash: u64,
+    value: V,
+    prev: usize,
+    next: usize,
+}
+
+impl<V> LruCache<V> {
+    pub fn new(capacity: usize) -> Self {
+        assert!(capacity > 0, "LRU cache capacity must be positive");
+        Self {
+            index: HashMap::new(),
+            hasher: RandomState::new(),
+            entries: Vec::new(),
+            capacity,
+            head: NONE,
+            tail: NONE,
+        }
+    }
+
+    #[cfg(test)]
+    pub fn len(&self) -> usize {
+        self.entries.len()
+    }
+
+    /// Returns the value for `key` and marks it as most recently used.
+    pub fn get(&mut self, key: &str) -> Option<&V> {
+        let slot = *self.index.get(&self.hasher.hash_one(key))?;
+        if self.entries[slot].key != key {
+            return None;
+        }
+        self.unlink(slot);
+        self.push_front(slot);
+        Some(&self.entries[slot].value)
+    }
+
+    /// Inserts or replaces the value for `key`, evicting the least recently used entry
+    /// if the cache is full.
+    pub fn insert(&mut self, key: &str, value: V) {
+        match self.claim(key) {
+            Some(slot) => self.entries[slot].value = value,
+            None => self.push_entry(key, value),
+        }
+    }
+
+    /// Like [`Self::insert`], but `fill` writes the value in place: into the value being
+    /// replaced or evicted, whose allocation it can reuse, or into a default one.
+    pub fn insert_with(&mut self, key: &str, fill: impl FnOnce(&mut V))
+    where
+        V: Default,
+    {
+        match self.claim(key) {
+            Some(slot) => fill(&mut self.entries[slot].value),
+            None => {
+                let mut value = V::default();
+                fill(&mut value);
+                self.push_entry(key, value);
+            }
+        }
+    }
+
+    /// Finds the slot for `key` and marks it as most recently used: the slot already
+    /// indexed under its hash, or the least recently used one if the cache is full, which
+    /// then takes `key`. Returns None if the slab has room for a new entry instead.
+    fn claim(&mut self, key: &str) -> Option<usize> {
+        let hash = self.hasher.hash_one(key);
+        let slot = match self.index.get(&hash) {
+            Some(&slot) => slot,
+            None if self.entries.len() < self.capacity => return None,
+            None => {
+                let slot = self.tail;
+                self.index.remove(&self.entries[slot].hash);
+                self.index.insert(hash, slot);
+                slot
+            }
+        };
+
+        let entry = &mut self.entries[slot];
+        if entry.key != key {
+            entry.key.clear();
+            entry.key.push_str(key);
+            entry.hash = hash;
+        }
+        self.unlink(slot);
+        self.push_front(slot);
+        Some(slot)
+    }
+
+    fn push_entry(&mut self, key: &str, value: V) {
+        let hash = self.hasher.hash_one(key);
+        let slot = self.entries.len();
+        self.entries.push(Entry {
+            key: key.to_string(),
+            hash,
+            value,
+            prev: NONE,
+            next: NONE,
+        });
+        self.index.insert(hash, slot);
+        self.push_front(slot);
+    }
+
+    fn unlink(&mut self, slot: usize) {
+        let (prev, next) = (self.entries[slot].prev, self.entries[slot].next);
+        match prev {
+            NONE => self.head = next,
+            prev => self.entries[prev].next = next,
+        }
+        match next {
+            NONE => self.tail = prev,
+            next => self.entries[next].prev = prev,
+        }
+    }
+
+    fn push_front(&mut self, slot: usize) {
+        self.entries[slot].prev = NONE;
+        self.entries[slot].next = self.head;
+        match self.head {
+            NONE => self.tail = slot,
+            head => self.entries[head].prev = slot,
+        }
+        self.head = slot;
+    }
+}
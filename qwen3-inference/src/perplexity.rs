@@ -0,0 +1,160 @@
+//! Perplexity of a checkpoint on a text corpus, for comparing quantization formats.
+//!
+//! The corpus is tokenized once and cut into non-overlapping windows of the context length.
+//! Each window starts from an empty KV cache and is run through [`Transformer::forward_batch`]
+//! in batches, every token but the first being predicted from the ones before it in the
+//! window. Windows are spread over several sessions sharing the weights; each window's loss
+//! is computed by a single session and the losses are added up in window order, so the
+//! result is the same for any number of sessions or threads.
+
+use crate::scoring::log_sum_exp;
+use crate::tokenizer::Tokenizer;
+use crate::transformer::{PREFILL_BATCH, Transformer};
+use crate::utils::peak_memory_bytes;
+use anyhow::Result;
+use log::info;
+use rayon::prelude::*;
+use serde_json::json;
+use std::time::Instant;
+
+#[derive(Debug, Clone, PartialEq)]
+pub struct PerplexityReport {
+    pub windows: usize,
+    pub window_len: usize,
+    /// Predicted tokens: every token of the evaluated windows but their first
+    pub tokens: usize,
+    /// Negative log-likelihood of the predicted tokens, in nats
+    pub nll: f64,
+}
+
+impl PerplexityReport {
+    pub fn perplexity(&self) -> f64 {
+        (self.nll / self.tokens.max(1) as f64).exp()
+    }
+}
+
+/// Evaluates the perplexity of `tokens` in windows of `window_len` tokens, using up to
+/// `sessions` sessions in parallel.
+///
+/// `window_len` must fit the model context. A trailing window shorter than two tokens
+/// predicts nothing and is skipped.
+pub fn evaluate_perplexity(
+    transformer: &mut Transformer,
+    tokens: &[usize],
+    window_len: usize,
+    sessions: usize,
+) -> Result<PerplexityReport> {
+    if window_len < 2 || window_len > transformer.config.seq_len {
+        anyhow::bail!(
+            "Window of {} tokens must be between 2 and the context of {}",
+            window_len,
+            transformer.config.seq_len
+        );
+    }
+
+    let windows: Vec<&[usize]> = tokens
+        .chunks(window_len)
+        .filter(|window| window.len() >= 2)
+        .collect();
+    if windows.is_empty() {
+        anyhow::bail!("Corpus of {} tokens is too short to evaluate", tokens.len());
+    }
+
+    let sessions = sessions.clamp(1, windows.len());
+    let mut extra_sessions = (1..sessions)
+        .map(|_| transformer.new_session())
+        .collect::<Result<Vec<_>>>()?;
+    let mut sessions: Vec<&mut Transformer> = std::iter::once(transformer)
+        .chain(extra_sessions.iter_mut())
+        .collect();
+
+    // Each session takes a contiguous run of windows; results come back in window order
+    let per_session = windows.len().div_ceil(sessions.len());
+    let losses: Vec<Vec<f64>> = sessions
+        .par_iter_mut()
+        .zip(windows.par_chunks(per_session))
+        .map(|(session, group)| {
+            group
+                .iter()
+                .map(|window| window_nll(session, window))
+                .collect()
+        })
+        .collect();
+
+    Ok(PerplexityReport {
+        windows: windows.len(),
+        window_len,
+        tokens: windows.iter().map(|window| window.len() - 1).sum(),
+        nll: losses.iter().flatten().sum(),
+    })
+}
+
+/// Negative log-likelihood of `window[1..]`, each token predicted from the ones before it.
+fn window_nll(session: &mut Transformer, window: &[usize]) -> f64 {
+    let vocab_size = session.config.vocab_size;
+    let (inputs, targets) = (&window[..window.len() - 1], &window[1..]);
+
+    let mut nll = 0.0;
+    for (chunk_idx, chunk) in inputs.chunks(PREFILL_BATCH).enumerate() {
+        let start = chunk_idx * PREFILL_BATCH;
+        let logits = session.forward_batch(chunk, start);
+        for (row, &target) in logits.chunks_exact(vocab_size).zip(&targets[start..]) {
+            nll += f64::from(log_sum_exp(row) - row[target]);
+        }
+    }
+    nll
+}
+
+/// Evaluates the perplexity of a text and prints the result as one JSON object.
+///
+/// The text is tokenized line by line, without a chat template. Only deterministic values
+/// go to stdout, so the output of two checkpoints can be diffed; throughput and peak memory
+/// are logged.
+pub fn perplexity(
+    transformer: &mut Transformer,
+    tokenizer: &Tokenizer,
+    text: &str,
+    sessions: usize,
+) -> Result<()> {
+    let lines: Vec<&str> = text.split_inclusive('\n').collect();
+    let tokens: Vec<usize> = tokenizer
+        .encode_batch(&lines)
+        .into_iter()
+        .flatten()
+        .map(|token| token as usize)
+        .collect();
+    let window_len = transformer.config.seq_len;
+
+    let start = Instant::now();
+    let report = evaluate_perplexity(transformer, &tokens, window_len, sessions)?;
+    let elapsed = start.elapsed().as_secs_f64();
+
+    println!(
+        "{}",
+        json!({
+            "tokens": report.tokens,
+            "windows": report.windows,
+            "window": report.window_len,
+            "nll": report.nll,
+            "perplexity": report.perplexity(),
+        })
+    );
+
+    info!(
+        "Perplexity {:.4} over {} tokens ({} windows of {})",
+        report.perplexity(),
+        report.tokens,
+        report.windows,
+        report.window_len
+    );
+    info!(
+        "[Evaluated in {:.2}s: {:.1} tokens/s with {} sessions]",
+        elapsed,
+        report.tokens as f64 / elapsed,
+        sessions.clamp(1, report.windows)
+    );
+    if let Some(bytes) = peak_memory_bytes() {
+        info!("[Peak memory: {:.1} MiB]", bytes as f64 / (1024.0 * 1024.0));
+    }
+    Ok(())
+}
@@ -1,4 +1,15 @@
+#[cfg(test)]
+#[path = "../tests/unit/sampler_test.rs"]
+mod tests;
+
 use crate::transformer::softmax;
+use rayon::prelude::*;
+
+/// Number of logits scored by one parallel task in the Gumbel-max sampler.
+const GUMBEL_CHUNK_SIZE: usize = 4096;
+
+/// Golden-ratio increment of the SplitMix64 sequence.
+const SPLITMIX64_GAMMA: u64 = 0x9E3779B97F4A7C15;
 
 /// Stores a probability and its associated index (token id).
 #[derive(Clone, Debug)]
@@ -10,13 +21,18 @@ pub struct ProbIndex {
 /// Top-p/temperature sampler for language model logits.
 ///
 /// This struct implements temperature scaling, top-p (nucleus) sampling,
-/// and multinomial sampling, using a simple xorshift RNG for reproducibility.
+/// and Gumbel-max multinomial sampling. Top-p draws from a simple xorshift RNG,
+/// while Gumbel-max uses a counter-based RNG so results do not depend on the thread count.
 #[derive(Debug)]
 pub struct Sampler {
     pub probindex: Vec<ProbIndex>,
     pub temperature: f32,
     pub topp: f32,
     pub rng_state: u64,
+    /// Seed of the counter-based RNG used by Gumbel-max sampling
+    pub rng_seed: u64,
+    /// Number of Gumbel-max draws so far (the counter of the counter-based RNG)
+    pub gumbel_step: u64,
 }
 
 impl Sampler {
@@ -46,9 +62,16 @@ impl Sampler {
             temperature,
             topp: topp.clamp(0.0, 1.0),
             rng_state: rng_seed,
+            rng_seed,
+            gumbel_step: 0,
         }
     }
 
+    /// Returns true if sampling reduces to `argmax(logits)` (temperature 0).
+    pub fn is_greedy(&self) -> bool {
+        self.temperature == 0.0
+    }
+
     /// Xorshift-based random number generator.
     fn random_u32(&mut self) -> u32 {
         self.rng_state ^= self.rng_state >> 12;
@@ -72,16 +95,44 @@ impl Sampler {
             .unwrap_or_default()
     }
 
-    /// Multinomial sampling from a probability distribution.
-    fn sample_mult(logits: &[f32], coin: f32) -> usize {
-        let mut cdf = 0.0;
-        for (i, &prob) in logits.iter().enumerate() {
-            cdf += prob;
-            if coin < cdf {
-                return i;
-            }
-        }
-        logits.len().saturating_sub(1)
+    /// Multinomial sampling with the Gumbel-max trick.
+    ///
+    /// `argmax(logit / temperature + g)` with `g ~ Gumbel(0, 1)` is distributed exactly as
+    /// `softmax(logits / temperature)`, so one parallel pass over vocabulary chunks replaces
+    /// temperature scaling, softmax and the serial CDF walk. The noise of each logit is derived
+    /// from `(rng_seed, gumbel_step, index)` only, and ties are broken by the lowest index,
+    /// which makes the result independent of how rayon splits the work.
+    fn sample_gumbel(&mut self, logits: &[f32]) -> usize {
+        let key = counter_random_u64(self.rng_seed, self.gumbel_step);
+        self.gumbel_step += 1;
+        let inv_temperature = self.temperature.recip();
+
+        let (_, best_idx) = logits
+            .par_chunks(GUMBEL_CHUNK_SIZE)
+            .enumerate()
+            .map(|(chunk_idx, chunk)| {
+                let chunk_start = chunk_idx * GUMBEL_CHUNK_SIZE;
+                chunk.iter().enumerate().fold(
+                    (f32::NEG_INFINITY, chunk_start),
+                    |best, (i, &logit)| {
+                        let idx = chunk_start + i;
+                        let score = logit * inv_temperature + gumbel_noise(key, idx as u64);
+                        if score > best.0 { (score, idx) } else { best }
+                    },
+                )
+            })
+            .reduce(
+                || (f32::NEG_INFINITY, usize::MAX),
+                |a, b| {
+                    if b.0 > a.0 || (b.0 == a.0 && b.1 < a.1) {
+                        b
+                    } else {
+                        a
+                    }
+                },
+            );
+
+        best_idx.min(logits.len().saturating_sub(1))
     }
 
     /// Top-p (nucleus) sampling: sample from the smallest set of tokens whose cumulative probability exceeds `topp`.
@@ -126,10 +177,13 @@ impl Sampler {
     /// Samples a token index from logits using temperature and top-p.
     ///
     /// - If temperature is 0, returns the argmax (greedy).
-    /// - Otherwise, applies temperature scaling, softmax, and top-p or multinomial sampling.
+    /// - If top-p is disabled, draws from the full distribution with Gumbel-max sampling.
+    /// - Otherwise, applies temperature scaling, softmax, and top-p sampling.
     pub fn sample(&mut self, logits: &mut [f32]) -> usize {
         if self.temperature == 0.0 {
             Self::sample_argmax(logits)
+        } else if self.topp <= 0.0 || self.topp >= 1.0 {
+            self.sample_gumbel(logits)
         } else {
             // Apply temperature
             for logit in logits.iter_mut() {
@@ -140,12 +194,26 @@ impl Sampler {
             softmax(logits);
 
             let coin = self.random_f32();
-
-            if self.topp <= 0.0 || self.topp >= 1.0 {
-                Self::sample_mult(logits, coin)
-            } else {
-                self.sample_topp(logits, coin)
-            }
+            self.sample_topp(logits, coin)
         }
     }
 }
+
+/// Counter-based random number generator: element `counter` of the SplitMix64 sequence
+/// starting at `key`. It needs no sequential state, so any element can be drawn in any order.
+#[inline]
+fn counter_random_u64(key: u64, counter: u64) -> u64 {
+    let mut z = key.wrapping_add(counter.wrapping_add(1).wrapping_mul(SPLITMIX64_GAMMA));
+    z = (z ^ (z >> 30)).wrapping_mul(0xBF58476D1CE4E5B9);
+    z = (z ^ (z >> 27)).wrapping_mul(0x94D049BB133111EB);
+    z ^ (z >> 31)
+}
+
+/// Standard Gumbel noise `-ln(-ln(u))` for the given logit index, with `u` in (0, 1).
+#[inline]
+fn gumbel_noise(key: u64, index: u64) -> f32 {
+    // 23 random bits keep `u` exactly representable in f32 and strictly below 1.0
+    let bits = counter_random_u64(key, index) >> 41;
+    let u = (bits as f32 + 0.5) / 8388608.0;
+    -(-u.ln()).ln()
+}
@@ -0,0 +1,196 @@
+//! Sequence scoring: log-probabilities of given continuations of a context.
+//!
+//! Continuations are teacher-forced through [`Transformer::forward_batch`], so scoring
+//! never samples. The context is prefilled once and its KV cache is shared by every
+//! continuation; a continuation that starts with the same tokens as the previous one also
+//! reuses those positions and their scores.
+
+use crate::tokenizer::Tokenizer;
+use crate::transformer::{PREFILL_BATCH, Transformer};
+use anyhow::Result;
+use log::info;
+use serde_json::json;
+use std::time::Instant;
+
+/// Log-probability of one continuation token, with the most likely alternatives.
+#[derive(Debug, Clone, PartialEq)]
+pub struct TokenScore {
+    pub token: usize,
+    pub logprob: f32,
+    /// The `top_k` most likely tokens at this position with their log-probabilities,
+    /// most likely first
+    pub top: Vec<(usize, f32)>,
+}
+
+#[derive(Debug, Clone, PartialEq)]
+pub struct ContinuationScore {
+    pub tokens: Vec<TokenScore>,
+}
+
+impl ContinuationScore {
+    /// Log-probability of the whole continuation given the context
+    pub fn logprob(&self) -> f32 {
+        self.tokens.iter().map(|token| token.logprob).sum()
+    }
+}
+
+/// Scores each continuation (token ids) as a continuation of `context`.
+///
+/// `context` must not be empty: its last token predicts the first continuation token.
+pub fn score_continuations(
+    transformer: &mut Transformer,
+    context: &[usize],
+    continuations: &[Vec<usize>],
+    top_k: usize,
+) -> Result<Vec<ContinuationScore>> {
+    let Some((&last_context_token, context_prefix)) = context.split_last() else {
+        anyhow::bail!("Scoring needs a non-empty context");
+    };
+
+    let seq_len = transformer.config.seq_len;
+    let vocab_size = transformer.config.vocab_size;
+    let longest = continuations.iter().map(Vec::len).max().unwrap_or(0);
+    if context.len() + longest > seq_len + 1 {
+        anyhow::bail!(
+            "Context of {} tokens and continuation of {} tokens exceed the context of {}",
+            context.len(),
+            longest,
+            seq_len
+        );
+    }
+
+    // Positions of the context prefix are computed once for all continuations
+    transformer.prefill(context_prefix, 0);
+    let start_pos = context_prefix.len();
+
+    let mut scores: Vec<ContinuationScore> = Vec::with_capacity(continuations.len());
+    let mut previous: &[usize] = &[];
+    for continuation in continuations {
+        // Row `i` feeds the token before continuation token `i` and predicts token `i`
+        let inputs: Vec<usize> = std::iter::once(last_context_token)
+            .chain(continuation.iter().copied())
+            .take(continuation.len())
+            .collect();
+
+        // Positions (and scores) shared with the previous continuation are already cached
+        let shared = continuation
+            .iter()
+            .zip(previous)
+            .take_while(|(a, b)| a == b)
+            .count();
+        let mut tokens: Vec<TokenScore> = match scores.last() {
+            Some(last) => last.tokens[..shared].to_vec(),
+            None => Vec::new(),
+        };
+
+        for chunk_start in (shared..continuation.len()).step_by(PREFILL_BATCH) {
+            let chunk_end = (chunk_start + PREFILL_BATCH).min(continuation.len());
+            let chunk = &inputs[chunk_start..chunk_end];
+            let logits = transformer.forward_batch(chunk, start_pos + chunk_start);
+
+            for (row, &target) in logits
+                .chunks_exact(vocab_size)
+                .zip(&continuation[chunk_start..chunk_end])
+            {
+                tokens.push(score_token(row, target, top_k));
+            }
+        }
+
+        scores.push(ContinuationScore { tokens });
+        previous = continuation;
+    }
+
+    Ok(scores)
+}
+
+/// Log-softmax of `logits` at `target`, plus the `top_k` most likely tokens.
+fn score_token(logits: &[f32], target: usize, top_k: usize) -> TokenScore {
+    let log_sum = log_sum_exp(logits);
+
+    // Small sorted list of the best tokens so far, most likely first
+    let mut top: Vec<(usize, f32)> = Vec::with_capacity(top_k + 1);
+    for (token, &logit) in logits.iter().enumerate() {
+        if top.len() == top_k && top.last().is_none_or(|&(_, worst)| logit <= worst) {
+            continue;
+        }
+        let index = top.partition_point(|&(_, value)| value >= logit);
+        top.insert(index, (token, logit));
+        top.truncate(top_k);
+    }
+
+    TokenScore {
+        token: target,
+        logprob: logits[target] - log_sum,
+        top: top
+            .into_iter()
+            .map(|(token, logit)| (token, logit - log_sum))
+            .collect(),
+    }
+}
+
+/// `ln(sum(exp(logits)))`, the normaliser of the log-softmax, computed stably.
+pub(crate) fn log_sum_exp(logits: &[f32]) -> f32 {
+    let max = logits
+        .iter()
+        .fold(f32::NEG_INFINITY, |acc, &val| acc.max(val));
+    max + logits
+        .iter()
+        .map(|&val| (val - max).exp())
+        .sum::<f32>()
+        .ln()
+}
+
+/// Scores continuations of a text context and prints one JSON object per continuation.
+///
+/// Context and continuations are tokenized separately, without a chat template.
+pub fn score(
+    transformer: &mut Transformer,
+    tokenizer: &Tokenizer,
+    context: Option<&str>,
+    continuations: &[String],
+    top_k: usize,
+) -> Result<()> {
+    if continuations.is_empty() {
+        anyhow::bail!("Please provide at least one continuation to score");
+    }
+
+    let context_tokens = tokenizer.encode(context.unwrap_or(""));
+    let continuation_tokens: Vec<Vec<usize>> = continuations
+        .iter()
+        .map(|continuation| tokenizer.encode(continuation))
+        .collect();
+
+    let start = Instant::now();
+    let scores = score_continuations(transformer, &context_tokens, &continuation_tokens, top_k)?;
+    let elapsed = start.elapsed().as_secs_f64();
+
+    let text = |token: usize| String::from_utf8_lossy(tokenizer.decode(token)).into_owned();
+    for (continuation, score) in continuations.iter().zip(&scores) {
+        let tokens: Vec<_> = score
+            .tokens
+            .iter()
+            .map(|token| {
+                let top: Vec<_> = token
+                    .top
+                    .iter()
+                    .map(|&(id, logprob)| json!({"token": text(id), "logprob": logprob}))
+                    .collect();
+                json!({"token": text(token.token), "logprob": token.logprob, "top": top})
+            })
+            .collect();
+        println!(
+            "{}",
+            json!({"continuation": continuation, "logprob": score.logprob(), "tokens": tokens})
+        );
+    }
+
+    let scored_tokens: usize = scores.iter().map(|score| score.tokens.len()).sum();
+    info!(
+        "[Scored {} continuations ({} tokens) after a {}-token context in {:.2}s]",
+        scores.len(),
+        scored_tokens,
+        context_tokens.len(),
+        elapsed
+    );
+    Ok(())
+}
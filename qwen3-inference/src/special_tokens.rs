@@ -0,0 +1,179 @@
+//! Aho-Corasick matcher that finds special tokens such as `<|im_start|>` in text.
+
+#[cfg(test)]
+#[path = "../tests/unit/special_tokens_test.rs"]
+mod tests;
+
+use std::collections::VecDeque;
+
+/// The empty prefix: start state of the automaton
+const ROOT: u32 = 0;
+
+/// A special token found in text, as a byte range and its id
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub(crate) struct SpecialTokenMatch {
+    pub start: usize,
+    pub end: usize,
+    pub id: usize,
+}
+
+/// Automaton over the bytes of all special tokens.
+///
+/// A scan tracks the longest suffix of the text read so far that is a prefix of some
+/// token, so all tokens are looked for in one pass over the text, without allocating.
+#[derive(Debug)]
+pub(crate) struct SpecialTokenMatcher {
+    states: Vec<State>,
+    /// Bytes that start some token; the scan skips all others while at the root
+    first_bytes: [bool; 256],
+}
+
+#[derive(Debug, Default)]
+struct State {
+    /// Outgoing edges, sorted by byte
+    next: Vec<(u8, u32)>,
+    /// State of the longest proper suffix of this prefix that is also a prefix
+    fail: u32,
+    /// Length in bytes of this prefix
+    depth: u32,
+    /// Longest token ending here, as (length, id), including tokens that end in a suffix
+    output: Option<(u32, usize)>,
+}
+
+impl SpecialTokenMatcher {
+    /// Builds the automaton for `(bytes, id)` tokens; empty tokens are ignored and the
+    /// first id wins for duplicates.
+    pub fn new<'a>(tokens: impl IntoIterator<Item = (&'a [u8], usize)>) -> Self {
+        let mut matcher = Self {
+            states: vec![State::default()],
+            first_bytes: [false; 256],
+        };
+
+        for (bytes, id) in tokens {
+            let Some(&first) = bytes.first() else {
+                continue;
+            };
+            matcher.first_bytes[first as usize] = true;
+            let mut state = ROOT;
+            for &byte in bytes {
+                state = match matcher.edge(state, byte) {
+                    Some(next) => next,
+                    None => matcher.add_state(state, byte),
+                };
+            }
+            let output = &mut matcher.states[state as usize].output;
+            output.get_or_insert((bytes.len() as u32, id));
+        }
+
+        matcher.link_suffixes();
+        matcher
+    }
+
+    /// Finds the first special token at or after byte offset `from`: the one that starts
+    /// first, and the longest of those, as Hugging Face matches added tokens.
+    pub fn find(&self, text: &[u8], from: usize) -> Option<SpecialTokenMatch> {
+        let mut best: Option<SpecialTokenMatch> = None;
+        let mut state = ROOT;
+        let mut pos = from;
+
+        while pos < text.len() {
+            if state == ROOT {
+                // Nothing in progress: jump to the next byte that can start a token
+                let skip = text[pos..]
+                    .iter()
+                    .position(|&byte| self.first_bytes[byte as usize]);
+                match skip {
+                    Some(skip) => pos += skip,
+                    None => break,
+                }
+            }
+
+            state = self.step(state, text[pos]);
+            pos += 1;
+
+            let current = &self.states[state as usize];
+            if let Some((len, id)) = current.output {
+                let start = pos - len as usize;
+                if best.is_none_or(|best| start <= best.start) {
+                    best = Some(SpecialTokenMatch {
+                        start,
+                        end: pos,
+                        id,
+                    });
+                }
+            }
+            // Done once no token in progress can start at or before the best match
+            if best.is_some_and(|best| pos - (current.depth as usize) > best.start) {
+                return best;
+            }
+        }
+
+        best
+    }
+
+    /// Follows the edge for `byte`, falling back along suffix links
+    fn step(&self, mut state: u32, byte: u8) -> u32 {
+        loop {
+            if let Some(next) = self.edge(state, byte) {
+                return next;
+            }
+            if state == ROOT {
+                return ROOT;
+            }
+            state = self.states[state as usize].fail;
+        }
+    }
+
+    fn edge(&self, state: u32, byte: u8) -> Option<u32> {
+        let next = &self.states[state as usize].next;
+        next.binary_search_by_key(&byte, |&(b, _)| b)
+            .ok()
+            .map(|index| next[index].1)
+    }
+
+    fn add_state(&mut self, parent: u32, byte: u8) -> u32 {
+        let id = self.states.len() as u32;
+        let depth = self.states[parent as usize].depth + 1;
+        self.states.push(State {
+            depth,
+            ..Default::default()
+        });
+        let next = &mut self.states[parent as usize].next;
+        let index = next.partition_point(|&(b, _)| b < byte);
+        next.insert(index, (byte, id));
+        id
+    }
+
+    /// Sets suffix links breadth-first, so the links of shorter prefixes are ready, and
+    /// inherits outputs from suffixes for states that do not end a token themselves.
+    fn link_suffixes(&mut self) {
+        let mut queue: VecDeque<u32> = self.states[ROOT as usize]
+            .next
+            .iter()
+            .map(|&(_, child)| child)
+            .collect();
+
+        while let Some(state) = queue.pop_front() {
+            let edges = self.states[state as usize].next.clone();
+            for (byte, child) in edges {
+                let mut fail = self.states[state as usize].fail;
+                let child_fail = loop {
+                    if let Some(next) = self.edge(fail, byte) {
+                        break next;
+                    }
+                    if fail == ROOT {
+                        break ROOT;
+                    }
+                    fail = self.states[fail as usize].fail;
+                };
+                let inherited = self.states[child_fail as usize].output;
+                let child_state = &mut self.states[child as usize];
+                child_state.fail = child_fail;
+                if child_state.output.is_none() {
+                    child_state.output = inherited;
+                }
+                queue.push_back(child);
+            }
+        }
+    }
+}
@@ -0,0 +1,181 @@
+//! Stop sequences: ends generation as soon as the output contains one of a set of strings.
+//!
+//! The patterns are compiled into an Aho-Corasick automaton over bytes with a dense
+//! transition table, so matching costs one table lookup per output byte regardless of the
+//! number of patterns. [`StopMatcher`] is fed token bytes incrementally and holds back any
+//! bytes that could still turn out to be the start of a stop sequence.
+
+#[cfg(test)]
+#[path = "../tests/unit/stop_sequences_test.rs"]
+mod tests;
+
+use anyhow::Result;
+use std::collections::VecDeque;
+
+const ROOT: u32 = 0;
+
+/// Compiled set of stop sequences.
+#[derive(Debug, Clone)]
+pub struct StopSequences {
+    /// Dense transition table, `transitions[state * 256 + byte]`
+    transitions: Vec<u32>,
+    /// Length of the longest pattern prefix each state stands for
+    depth: Vec<u32>,
+    /// Length of the longest pattern ending in each state, 0 if none
+    matched: Vec<u32>,
+}
+
+impl StopSequences {
+    pub fn new<P: AsRef<[u8]>>(patterns: &[P]) -> Result<Self> {
+        if patterns.iter().any(|pattern| pattern.as_ref().is_empty()) {
+            anyhow::bail!("Stop sequences must not be empty");
+        }
+
+        // Trie of the patterns; missing edges are filled in below
+        let mut transitions = vec![ROOT; 256];
+        let mut depth = vec![0];
+        let mut matched = vec![0];
+        for pattern in patterns {
+            let pattern = pattern.as_ref();
+            let mut state = ROOT;
+            for &byte in pattern {
+                let index = state as usize * 256 + byte as usize;
+                if transitions[index] == ROOT {
+                    let next = depth.len() as u32;
+                    transitions[index] = next;
+                    transitions.extend_from_slice(&[ROOT; 256]);
+                    depth.push(depth[state as usize] + 1);
+                    matched.push(0);
+                }
+                state = transitions[index];
+            }
+            matched[state as usize] = pattern.len() as u32;
+        }
+
+        // Breadth-first over the trie: a missing edge follows the failure link, i.e. the
+        // same edge of the longest proper suffix that is also a trie state
+        let mut failure = vec![ROOT; depth.len()];
+        let mut queue: VecDeque<u32> = transitions[..256]
+            .iter()
+            .copied()
+            .filter(|&child| child != ROOT)
+            .collect();
+        while let Some(state) = queue.pop_front() {
+            let state = state as usize;
+            let fail = failure[state] as usize;
+            if matched[state] == 0 {
+                matched[state] = matched[fail];
+            }
+            for byte in 0..256 {
+                let child = transitions[state * 256 + byte];
+                let fallback = transitions[fail * 256 + byte];
+                if child != ROOT {
+                    failure[child as usize] = fallback;
+                    queue.push_back(child);
+                } else {
+                    transitions[state * 256 + byte] = fallback;
+                }
+            }
+        }
+
+        Ok(Self {
+            transitions,
+            depth,
+            matched,
+        })
+    }
+
+    /// Number of automaton states
+    pub fn num_states(&self) -> usize {
+        self.depth.len()
+    }
+}
+
+/// Incremental stop sequence detection over a stream of token bytes.
+#[derive(Debug)]
+pub struct StopMatcher<'a> {
+    sequences: &'a StopSequences,
+    state: u32,
+    /// Bytes that may be the start of a stop sequence, not yet released
+    held: Vec<u8>,
+    /// Bytes released by the last [`Self::push`] or [`Self::finish`]
+    released: Vec<u8>,
+}
+
+impl<'a> StopMatcher<'a> {
+    pub fn new(sequences: &'a StopSequences) -> Self {
+        let max_depth = sequences.depth.iter().copied().max().unwrap_or(0) as usize;
+        Self {
+            sequences,
+            state: ROOT,
+            held: Vec::with_capacity(max_depth),
+            released: Vec::new(),
+        }
+    }
+
+    /// Feeds the bytes of the next token.
+    ///
+    /// Returns the bytes that are now safe to output, and whether a stop sequence was
+    /// completed. On a match, the returned bytes end right before the stop sequence and
+    /// generation should end.
+    pub fn push(&mut self, bytes: &[u8]) -> (&[u8], bool) {
+        self.released.clear();
+
+        for &byte in bytes {
+            self.state = self.sequences.transitions[self.state as usize * 256 + byte as usize];
+            self.held.push(byte);
+
+            let matched = self.sequences.matched[self.state as usize] as usize;
+            if matched > 0 {
+                let keep = self.held.len() - matched;
+                self.released.extend_from_slice(&self.held[..keep]);
+                self.reset();
+                return (&self.released, true);
+            }
+        }
+
+        // Only the current partial match can still grow into a stop sequence
+        let partial = self.sequences.depth[self.state as usize] as usize;
+        let cut = self.held.len() - partial;
+        self.released.extend(self.held.drain(..cut));
+        (&self.released, false)
+    }
+
+    /// Releases any held-back bytes at the end of a reply and resets the matcher.
+    pub fn finish(&mut self) -> &[u8] {
+        self.released.clear();
+        self.released.append(&mut self.held);
+        self.reset();
+        &self.released
+    }
+
+    pub fn reset(&mut self) {
+        self.state = ROOT;
+        self.held.clear();
+    }
+}
+
+/// Interprets the escapes `\n`, `\r`, `\t` and `\\` in a stop sequence given on the
+/// command line; other backslashes are kept as-is.
+pub fn unescape(text: &str) -> String {
+    let mut result = String::with_capacity(text.len());
+    let mut chars = text.chars();
+    while let Some(c) = chars.next() {
+        if c != '\\' {
+            result.push(c);
+            continue;
+        }
+        match chars.next() {
+            Some('n') => result.push('\n'),
+            Some('r') => result.push('\r'),
+            Some('t') => result.push('\t'),
+            Some('\\') => result.push('\\'),
+            Some(other) => {
+                result.push('\\');
+                result.push(other);
+            }
+            None => result.push('\\'),
+        }
+    }
+    result
+}
@@ -1,6 +1,18 @@
+#[cfg(test)]
+#[path = "../tests/unit/tensor_test.rs"]
+mod tests;
+
 use rayon::prelude::*;
 use std::borrow::Cow;
 
+/// Number of output rows handled by one parallel task in [`matmul_argmax`] and
+/// [`matmul_rows`].
+const ARGMAX_ROW_BLOCK: usize = 256;
+
+/// Number of weight rows applied to a whole batch by one parallel task in
+/// [`matmul_batch`]; small enough for the rows to stay in cache across the batch.
+const BATCH_ROW_BLOCK: usize = 64;
+
 #[derive(Debug, Clone)]
 pub struct QuantizedTensor {
     pub q: Cow<'static, [i8]>,
@@ -26,6 +38,14 @@ impl QuantizedTensor {
     }
 }
 
+/// 4-bit weights: two values per byte (low nibble first) stored with a +8 offset,
+/// with one scale per group.
+#[derive(Debug, Clone)]
+pub struct Q4Tensor {
+    pub q: &'static [u8],
+    pub s: &'static [f32],
+}
+
 pub fn matmul(
     xout: &mut [f32],
     x: &QuantizedTensor,
@@ -49,6 +69,168 @@ pub fn matmul(
         });
 }
 
+/// Computes `argmax(W · x)` without materialising the output vector.
+///
+/// Each parallel task keeps a running `(max, index)` over its block of rows and the
+/// per-block winners are reduced. Ties resolve to the highest index, matching a
+/// `max_by` scan over the full output.
+pub fn matmul_argmax(
+    x: &QuantizedTensor,
+    w: &QuantizedTensor,
+    n: usize,
+    d: usize,
+    group_size: usize,
+) -> usize {
+    let pick = |a: (f32, usize), b: (f32, usize)| {
+        if b.0 > a.0 || (b.0 == a.0 && b.1 > a.1) {
+            b
+        } else {
+            a
+        }
+    };
+
+    let (_, best_idx) = (0..d.div_ceil(ARGMAX_ROW_BLOCK))
+        .into_par_iter()
+        .map(|block_idx| {
+            let block_start = block_idx * ARGMAX_ROW_BLOCK;
+            let block_end = (block_start + ARGMAX_ROW_BLOCK).min(d);
+            (block_start..block_end).fold((f32::NEG_INFINITY, 0), |best, row_idx| {
+                let mut value = 0.0;
+                compute_matmul_row(&mut value, x, w, row_idx, n, group_size);
+                pick(best, (value, row_idx))
+            })
+        })
+        .reduce(|| (f32::NEG_INFINITY, 0), pick);
+
+    best_idx
+}
+
+/// Computes only the given output rows of `W · x`; every other output is set to
+/// negative infinity, so the result can be sampled from directly.
+///
+/// `rows` must be sorted ascending. Work is split over fixed blocks of the output so
+/// writes stay disjoint without a scratch buffer; blocks without selected rows are
+/// just filled.
+pub fn matmul_rows(
+    xout: &mut [f32],
+    x: &QuantizedTensor,
+    w: &QuantizedTensor,
+    n: usize,
+    rows: &[u32],
+    group_size: usize,
+) {
+    debug_assert!(rows.windows(2).all(|pair| pair[0] < pair[1]));
+
+    xout.par_chunks_mut(ARGMAX_ROW_BLOCK)
+        .enumerate()
+        .for_each(|(block_idx, block)| {
+            block.fill(f32::NEG_INFINITY);
+
+            let block_start = (block_idx * ARGMAX_ROW_BLOCK) as u32;
+            let block_end = block_start + block.len() as u32;
+            let first = rows.partition_point(|&row| row < block_start);
+            let last = rows.partition_point(|&row| row < block_end);
+
+            for &row in &rows[first..last] {
+                let out_val = &mut block[(row - block_start) as usize];
+                compute_matmul_row(out_val, x, w, row as usize, n, group_size);
+            }
+        });
+}
+
+/// Computes `W · x` for a batch of activations.
+///
+/// `x` holds the vectors of `n` values back to back and `xout` receives one row of `d`
+/// outputs per vector. Work is split over blocks of weight rows, and each task applies
+/// its block to every vector of the batch while the rows are still in cache, so the
+/// weights are read from memory once per batch instead of once per token.
+pub fn matmul_batch(
+    xout: &mut [f32],
+    x: &QuantizedTensor,
+    w: &QuantizedTensor,
+    n: usize,
+    d: usize,
+    group_size: usize,
+) {
+    let batch = x.q.len() / n;
+    assert!(
+        xout.len() >= batch * d,
+        "Output slice length must be at least batch * d: {} >= {}",
+        xout.len(),
+        batch * d
+    );
+    if batch == 0 {
+        return;
+    }
+
+    let blocks: Vec<Vec<f32>> = (0..d.div_ceil(BATCH_ROW_BLOCK))
+        .into_par_iter()
+        .map(|block_idx| {
+            let rows = block_idx * BATCH_ROW_BLOCK..((block_idx + 1) * BATCH_ROW_BLOCK).min(d);
+            let mut block = Vec::with_capacity(batch * rows.len());
+            for (x_q, x_s) in x.q.chunks_exact(n).zip(x.s.chunks_exact(n / group_size)) {
+                block.extend(
+                    rows.clone()
+                        .map(|row_idx| dot_row(x_q, x_s, w, row_idx, n, group_size)),
+                );
+            }
+            block
+        })
+        .collect();
+
+    // Blocks hold their outputs vector by vector; scatter them into the output rows
+    for (block_idx, block) in blocks.iter().enumerate() {
+        let start = block_idx * BATCH_ROW_BLOCK;
+        let len = block.len() / batch;
+        for (out_row, values) in xout.chunks_exact_mut(d).zip(block.chunks_exact(len)) {
+            out_row[start..start + len].copy_from_slice(values);
+        }
+    }
+}
+
+/// Computes `W · x` for 4-bit weights `w` (d rows of n values) and Q8 activations `x`.
+pub fn matmul_q4(
+    xout: &mut [f32],
+    x: &QuantizedTensor,
+    w: &Q4Tensor,
+    n: usize,
+    d: usize,
+    group_size: usize,
+) {
+    debug_assert_eq!(n % group_size, 0, "n must be divisible by group_size");
+    debug_assert_eq!(
+        group_size % 2,
+        0,
+        "group_size must be even for 4-bit weights"
+    );
+
+    xout[..d]
+        .par_iter_mut()
+        .enumerate()
+        .for_each(|(row_idx, out_val)| {
+            let packed_row = &w.q[row_idx * n / 2..(row_idx + 1) * n / 2];
+            let row_scales = &w.s[row_idx * n / group_size..(row_idx + 1) * n / group_size];
+
+            *out_val =
+                x.q.chunks_exact(group_size)
+                    .zip(packed_row.chunks_exact(group_size / 2))
+                    .zip(row_scales.iter().zip(x.s.iter()))
+                    .map(|((x_group, w_group), (&weight_scale, &input_scale))| {
+                        let dot: i32 = x_group
+                            .chunks_exact(2)
+                            .zip(w_group)
+                            .map(|(x_pair, &packed)| {
+                                let lo = (packed & 0x0F) as i32 - 8;
+                                let hi = (packed >> 4) as i32 - 8;
+                                x_pair[0] as i32 * lo + x_pair[1] as i32 * hi
+                            })
+                            .sum();
+                        dot as f32 * weight_scale * input_scale
+                    })
+                    .sum();
+        });
+}
+
 #[inline]
 fn compute_matmul_row(
     out_val: &mut f32,
@@ -58,28 +240,41 @@ fn compute_matmul_row(
     n: usize,
     group_size: usize,
 ) {
+    *out_val = dot_row(&x.q, &x.s, w, row_idx, n, group_size);
+}
+
+/// Dot product of weight row `row_idx` with one quantized activation vector.
+#[inline]
+fn dot_row(
+    x_q: &[i8],
+    x_s: &[f32],
+    w: &QuantizedTensor,
+    row_idx: usize,
+    n: usize,
+    group_size: usize,
+) -> f32 {
     debug_assert_eq!(n % group_size, 0, "n must be divisible by group_size");
 
     let weight_row_offset = row_idx * n;
     let num_groups = n / group_size;
 
-    *out_val = (0..num_groups)
+    (0..num_groups)
         .map(|group_idx| {
             let group_start = group_idx * group_size;
             let weight_group_offset = weight_row_offset + group_start;
 
-            let quantized_dot_product: i32 = x.q[group_start..group_start + group_size]
+            let quantized_dot_product: i32 = x_q[group_start..group_start + group_size]
                 .iter()
                 .zip(&w.q[weight_group_offset..weight_group_offset + group_size])
                 .map(|(&x_quant, &w_quant)| x_quant as i32 * w_quant as i32)
                 .sum();
 
             let weight_scale = w.s[weight_group_offset / group_size];
-            let input_scale = x.s[group_idx];
+            let input_scale = x_s[group_idx];
 
             quantized_dot_product as f32 * weight_scale * input_scale
         })
-        .sum();
+        .sum()
 }
 
 /// Dequantizes a quantized tensor into a float buffer.
@@ -118,29 +313,30 @@ pub fn quantize(qx: &mut QuantizedTensor, x: &[f32], size: usize, group_size: us
     debug_assert_eq!(qx.q.len(), size);
     debug_assert_eq!(qx.s.len(), size / group_size);
 
-    const Q_MAX: f32 = 127.0;
-    let num_groups = size / group_size;
-
     // Get separate mutable references to avoid borrowing conflicts
     let q_data = qx.q.to_mut();
     let s_data = qx.s.to_mut();
 
-    for group in 0..num_groups {
-        let group_start = group * group_size;
-        let group_end = group_start + group_size;
+    for ((q_group, scale), x_group) in q_data
+        .chunks_exact_mut(group_size)
+        .zip(s_data.iter_mut())
+        .zip(x[..size].chunks_exact(group_size))
+    {
+        *scale = quantize_group(q_group, x_group);
+    }
+}
 
-        // Find the maximum absolute value in the group
-        let wmax = x[group_start..group_end]
-            .iter()
-            .fold(0.0f32, |acc, &val| acc.max(val.abs()));
+/// Quantizes one group of values to i8 and returns its scale.
+pub(crate) fn quantize_group(q: &mut [i8], x: &[f32]) -> f32 {
+    const Q_MAX: f32 = 127.0;
 
-        let scale = wmax / Q_MAX;
-        s_data[group] = scale;
+    // Find the maximum absolute value in the group
+    let wmax = x.iter().fold(0.0f32, |acc, &val| acc.max(val.abs()));
+    let scale = wmax / Q_MAX;
 
-        // Quantize the group
-        for (i, &val) in x[group_start..group_end].iter().enumerate() {
-            let quant_value = if scale != 0.0 { val / scale } else { 0.0 };
-            q_data[group_start + i] = quant_value.round() as i8;
-        }
+    for (q_val, &val) in q.iter_mut().zip(x) {
+        let quant_value = if scale != 0.0 { val / scale } else { 0.0 };
+        *q_val = quant_value.round() as i8;
     }
+    scale
 }
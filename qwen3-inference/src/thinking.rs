@@ -0,0 +1,87 @@
+//! Thinking mode: tracks the `<think>` block of a reply and caps how long it may run.
+//!
+//! Qwen3 reasons inside `<think>...</think>` before answering. [`ThinkingTracker`] follows
+//! the generated tokens, counts those spent reasoning, and once the budget is used up
+//! replaces the next token with `</think>` so the model moves on to the answer.
+
+#[cfg(test)]
+#[path = "../tests/unit/thinking_test.rs"]
+mod tests;
+
+use crate::tokenizer::Tokenizer;
+
+const THINK_OPEN: &str = "<think>";
+const THINK_CLOSE: &str = "</think>";
+
+/// Per-request thinking switches recognized in user messages, as in Qwen3's chat template
+const THINK_SWITCH: &str = "/think";
+const NO_THINK_SWITCH: &str = "/no_think";
+
+#[derive(Debug)]
+pub struct ThinkingTracker {
+    open_token: usize,
+    close_token: usize,
+    /// Maximum number of tokens between `<think>` and `</think>`
+    budget: Option<usize>,
+    in_block: bool,
+    /// Tokens generated inside the current think block
+    block_tokens: usize,
+}
+
+impl ThinkingTracker {
+    /// Returns `None` if the vocabulary has no think tags.
+    pub fn new(tokenizer: &Tokenizer, budget: Option<usize>) -> Option<Self> {
+        Some(Self {
+            open_token: tokenizer.str_lookup(THINK_OPEN)?,
+            close_token: tokenizer.str_lookup(THINK_CLOSE)?,
+            budget,
+            in_block: false,
+            block_tokens: 0,
+        })
+    }
+
+    /// Follows the next generated token.
+    ///
+    /// Returns the token to use instead, which is `</think>` once the budget is spent, and
+    /// whether it is part of the reasoning (think tags included).
+    pub fn next(&mut self, token: usize) -> (usize, bool) {
+        let budget_spent = self
+            .budget
+            .is_some_and(|budget| self.block_tokens >= budget);
+        let token = if self.in_block && budget_spent {
+            self.close_token
+        } else {
+            token
+        };
+
+        let reasoning = self.in_block || token == self.open_token;
+        if token == self.open_token {
+            self.in_block = true;
+            self.block_tokens = 0;
+        } else if token == self.close_token {
+            self.in_block = false;
+        } else if self.in_block {
+            self.block_tokens += 1;
+        }
+        (token, reasoning)
+    }
+
+    /// Forgets the previous reply.
+    pub fn reset(&mut self) {
+        self.in_block = false;
+        self.block_tokens = 0;
+    }
+}
+
+/// Returns the thinking switch in a user message, if any: `/think` turns thinking on for
+/// that request and `/no_think` turns it off. The last switch wins.
+pub fn thinking_switch(user_prompt: &str) -> Option<bool> {
+    user_prompt
+        .split_whitespace()
+        .rev()
+        .find_map(|word| match word {
+            THINK_SWITCH => Some(true),
+            NO_THINK_SWITCH => Some(false),
+            _ => None,
+        })
+}
@@ -2,15 +2,32 @@
 //!
 //! This module provides a simple byte-level BPE tokenizer that matches the behavior of C reference implementations.
 //!
-//! - Loads vocabulary and merge scores from a binary file.
-//! - Encodes text into token IDs using special token and character lookup, then applies BPE merges.
-//! - Decodes token IDs back to strings, handling both valid and invalid UTF-8.
+//! - Loads vocabulary, merge scores and the ranked merge table from a binary file.
+//! - Encodes text into token IDs: special tokens are matched literally, the rest is split
+//!   into words like Qwen2's pre-tokenizer and each word is merged from its bytes.
+//! - Decodes token IDs back to their raw bytes, which concatenate into UTF-8 text.
 
-use anyhow::Result;
+#[cfg(test)]
+#[path = "../tests/unit/tokenizer_test.rs"]
+mod tests;
+
+use crate::chat_template::ChatTemplates;
+use crate::gguf::{self, GgufFile};
+use crate::hf_model::{self, TemporaryExport};
+use crate::lru_cache::LruCache;
+use crate::pretokenizer;
+use crate::special_tokens::{SpecialTokenMatch, SpecialTokenMatcher};
+use anyhow::{Context, Result};
 use byteorder::{LittleEndian, ReadBytesExt};
-use std::borrow::Cow;
+use log::warn;
+use rayon::prelude::*;
+use std::cmp::Ordering;
+use std::collections::{BinaryHeap, HashMap};
 use std::fs::File;
+use std::hash::{BuildHasherDefault, Hasher};
 use std::io::Read;
+use std::path::Path;
+use std::sync::Mutex;
 
 /// Tokenizer for byte-level BPE models.
 ///
@@ -29,17 +46,55 @@ pub struct Tokenizer {
     pub bos_token_id: u32,
     /// End-of-sequence token ID
     pub eos_token_id: u32,
-    /// Prompt template for user prompts
-    pub prompt_template: String,
-    /// Prompt template for system prompts
-    pub system_prompt_template: String,
+    /// Chat prompt templates
+    pub templates: PromptTemplates,
+    /// The chat prompt templates, tokenized when the tokenizer is created
+    chat_templates: ChatTemplates,
+    /// Id of each token by its bytes (the first one, for duplicates)
+    token_ids: HashMap<Vec<u8>, u32>,
+    /// Finds the special tokens that split the text before BPE
+    special_tokens: SpecialTokenMatcher,
+    /// Token of each single byte, the starting point of byte-level BPE
+    byte_tokens: [Option<u32>; 256],
+    /// Word caches and buffers, one per rayon worker and one for other threads
+    scratch: Vec<Mutex<EncodeScratch>>,
+    /// Merged token and its score for each pair of tokens that merges, keyed by
+    /// [`pair_key`]: from the exported merge table, or derived from the vocabulary
+    merges: MergeMap,
+}
+
+/// Chat prompt templates, with `%s` placeholders for the system and user prompts.
+///
+/// All variants are loaded up front so thinking can be switched per request.
+#[derive(Debug, Clone, Default)]
+pub struct PromptTemplates {
+    pub user: String,
+    pub system: String,
+    /// Thinking variants, absent for models without thinking support
+    pub user_thinking: Option<String>,
+    pub system_thinking: Option<String>,
 }
 
 impl Tokenizer {
     /// Loads a tokenizer from a checkpoint path and vocabulary size.
     ///
-    /// Reads the vocabulary, merge scores, and prompt templates from disk.
-    pub fn new(checkpoint_path: &str, vocab_size: usize, enable_thinking: bool) -> Result<Self> {
+    /// Reads the vocabulary, merge scores, and prompt templates from disk. For a Hugging
+    /// Face model directory or a GGUF file, they are exported from its `tokenizer.json` or
+    /// metadata first.
+    pub fn new(checkpoint_path: &str, vocab_size: usize) -> Result<Self> {
+        if hf_model::is_hf_model_dir(checkpoint_path) {
+            let export = TemporaryExport::new()?;
+            let exported = export.checkpoint_path();
+            hf_model::export_tokenizer(checkpoint_path, &exported)?;
+            return Self::new(&exported.to_string_lossy(), vocab_size);
+        }
+        if gguf::is_gguf_file(checkpoint_path) {
+            let export = TemporaryExport::new()?;
+            let exported = export.checkpoint_path();
+            GgufFile::open(Path::new(checkpoint_path))?.export_tokenizer(&exported)?;
+            return Self::new(&exported.to_string_lossy(), vocab_size);
+        }
+
         let tokenizer_path = format!("{checkpoint_path}.tokenizer");
         let file = File::open(&tokenizer_path)?;
         let mut reader = std::io::BufReader::new(file);
@@ -49,13 +104,82 @@ impl Tokenizer {
         let bos_token_id = reader.read_u32::<LittleEndian>()?;
         let eos_token_id = reader.read_u32::<LittleEndian>()?;
 
+        let (vocab, merge_scores) = Self::read_vocab(&mut reader, vocab_size)?;
+
+        // Files from older exporters end after the tokens and have no merge table
+        let merge_table = Self::read_merge_table(&mut reader)?;
+
+        // Load prompt templates (for chat/instruction mode)
+        let required_template = |with_system| {
+            Self::load_prompt_template(checkpoint_path, with_system, false).unwrap_or_else(|| {
+                eprintln!(
+                    "Warning: Could not load prompt template {}",
+                    Self::template_path(checkpoint_path, with_system, false)
+                );
+                String::new()
+            })
+        };
+        let templates = PromptTemplates {
+            user: required_template(false),
+            system: required_template(true),
+            user_thinking: Self::load_prompt_template(checkpoint_path, false, true),
+            system_thinking: Self::load_prompt_template(checkpoint_path, true, true),
+        };
+
+        Ok(Self::index(
+            vocab,
+            merge_scores,
+            merge_table.as_deref(),
+            max_token_length,
+            bos_token_id,
+            eos_token_id,
+            templates,
+        ))
+    }
+
+    /// Reads the tokens, padded with empty ones or cut to the model's `vocab_size`.
+    ///
+    /// Current files give the number of tokens after the header, which is often below the
+    /// model's padded vocabulary size. Older files have no count: `vocab_size` tokens are
+    /// read and those past the end of the file are left empty.
+    fn read_vocab(reader: &mut impl Read, vocab_size: usize) -> Result<(Vec<Vec<u8>>, Vec<f32>)> {
         let mut vocab = Vec::with_capacity(vocab_size);
         let mut merge_scores = Vec::with_capacity(vocab_size);
 
-        // Read vocabulary: (score, length, bytes) for each token
+        let first = reader.read_u32::<LittleEndian>().ok();
+        if first == Some(TOKENS_MAGIC) {
+            let count = reader.read_u32::<LittleEndian>()? as usize;
+            for id in 0..count {
+                let score = reader.read_f32::<LittleEndian>()?;
+                let mut token = vec![0u8; reader.read_u32::<LittleEndian>()? as usize];
+                reader
+                    .read_exact(&mut token)
+                    .with_context(|| format!("Tokenizer file ends inside token {id}"))?;
+                merge_scores.push(score);
+                vocab.push(token);
+            }
+            if count > vocab_size {
+                warn!(
+                    "Ignoring {} tokens beyond the model's vocabulary",
+                    count - vocab_size
+                );
+                vocab.truncate(vocab_size);
+                merge_scores.truncate(vocab_size);
+            }
+            vocab.resize(vocab_size, Vec::new());
+            merge_scores.resize(vocab_size, 0.0);
+            return Ok((vocab, merge_scores));
+        }
+
+        // The first word was already the score of the first token
+        let mut first_score = first.map(f32::from_bits);
         for _i in 0..vocab_size {
             // Read score
-            let score = match reader.read_f32::<LittleEndian>() {
+            let score = match first_score.take() {
+                Some(score) => Ok(score),
+                None => reader.read_f32::<LittleEndian>(),
+            };
+            let score = match score {
                 Ok(s) => s,
                 Err(_) => {
                     // If reading fails, push empty token and zero score
@@ -82,22 +206,128 @@ impl Tokenizer {
                 Err(_) => vocab.push(Vec::new()),
             }
         }
+        Ok((vocab, merge_scores))
+    }
 
-        // Load prompt templates (for chat/instruction mode)
-        let prompt_template = Self::load_prompt_template(checkpoint_path, false, enable_thinking)?;
-        let system_prompt_template =
-            Self::load_prompt_template(checkpoint_path, true, enable_thinking)?;
+    /// Reads the merge table that follows the tokens, if any: a magic number, the number
+    /// of merges, then `(left, right, merged)` ids in rank order.
+    fn read_merge_table(reader: &mut impl Read) -> Result<Option<Vec<[u32; 3]>>> {
+        match reader.read_u32::<LittleEndian>() {
+            Ok(MERGES_MAGIC) => {}
+            Ok(_) => {
+                warn!("Ignoring unknown data after the tokenizer vocabulary");
+                return Ok(None);
+            }
+            Err(_) => return Ok(None),
+        }
+
+        let count = reader.read_u32::<LittleEndian>()? as usize;
+        let mut ids = vec![0u32; count * 3];
+        reader.read_u32_into::<LittleEndian>(&mut ids)?;
+        Ok(Some(
+            ids.chunks_exact(3)
+                .map(|ids| [ids[0], ids[1], ids[2]])
+                .collect(),
+        ))
+    }
+
+    /// Creates a tokenizer from its vocabulary and merge scores, indexing the vocabulary
+    /// for lookups and merges.
+    ///
+    /// Without a merge table, any pair of tokens whose bytes concatenate to a token merges
+    /// into it, with that token's score.
+    pub fn from_vocab(
+        vocab: Vec<Vec<u8>>,
+        merge_scores: Vec<f32>,
+        max_token_length: u32,
+        bos_token_id: u32,
+        eos_token_id: u32,
+        templates: PromptTemplates,
+    ) -> Self {
+        Self::index(
+            vocab,
+            merge_scores,
+            None,
+            max_token_length,
+            bos_token_id,
+            eos_token_id,
+            templates,
+        )
+    }
 
-        Ok(Self {
+    /// Creates a tokenizer that merges exactly the `(left, right, merged)` entries of
+    /// `merge_table`, earlier entries first, as Hugging Face's BPE does.
+    pub fn from_merge_table(
+        vocab: Vec<Vec<u8>>,
+        merge_scores: Vec<f32>,
+        merge_table: &[[u32; 3]],
+        max_token_length: u32,
+        bos_token_id: u32,
+        eos_token_id: u32,
+        templates: PromptTemplates,
+    ) -> Self {
+        Self::index(
             vocab,
             merge_scores,
-            vocab_size,
+            Some(merge_table),
             max_token_length,
             bos_token_id,
             eos_token_id,
-            prompt_template,
-            system_prompt_template,
-        })
+            templates,
+        )
+    }
+
+    fn index(
+        vocab: Vec<Vec<u8>>,
+        merge_scores: Vec<f32>,
+        merge_table: Option<&[[u32; 3]]>,
+        max_token_length: u32,
+        bos_token_id: u32,
+        eos_token_id: u32,
+        templates: PromptTemplates,
+    ) -> Self {
+        let mut token_ids: HashMap<Vec<u8>, u32> = HashMap::with_capacity(vocab.len());
+        for (id, token) in vocab.iter().enumerate() {
+            if !token.is_empty() {
+                token_ids.entry(token.clone()).or_insert(id as u32);
+            }
+        }
+
+        let merges = match merge_table {
+            Some(merge_table) => ranked_merges(merge_table, vocab.len()),
+            None => derived_merges(&token_ids, &merge_scores, vocab.len()),
+        };
+
+        // Special tokens split the text
+        let special_tokens = SpecialTokenMatcher::new(
+            vocab
+                .iter()
+                .enumerate()
+                .filter(|&(id, token)| is_added_token(token, merge_scores.get(id).copied()))
+                .map(|(id, token)| (token.as_slice(), id)),
+        );
+
+        let byte_tokens = std::array::from_fn(|byte| token_ids.get(&[byte as u8][..]).copied());
+
+        let mut tokenizer = Self {
+            vocab_size: vocab.len(),
+            vocab,
+            merge_scores,
+            max_token_length,
+            bos_token_id,
+            eos_token_id,
+            templates,
+            token_ids,
+            special_tokens,
+            byte_tokens,
+            scratch: (0..=rayon::current_num_threads())
+                .map(|_| Mutex::new(EncodeScratch::new()))
+                .collect(),
+            merges,
+            chat_templates: ChatTemplates::default(),
+        };
+        tokenizer.chat_templates = ChatTemplates::new(&tokenizer.templates, &tokenizer);
+        tokenizer
     }
 
     /// Loads a prompt template from disk, with support for system and "thinking" variants.
@@ -105,164 +335,472 @@ impl Tokenizer {
         checkpoint_path: &str,
         with_system: bool,
         enable_thinking: bool,
-    ) -> Result<String> {
+    ) -> Option<String> {
+        std::fs::read_to_string(Self::template_path(
+            checkpoint_path,
+            with_system,
+            enable_thinking,
+        ))
+        .ok()
+    }
+
+    fn template_path(checkpoint_path: &str, with_system: bool, enable_thinking: bool) -> String {
         let suffix = match (with_system, enable_thinking) {
             (true, true) => ".template.with-system-and-thinking",
             (true, false) => ".template.with-system",
             (false, true) => ".template.with-thinking",
             (false, false) => ".template",
         };
+        format!("{checkpoint_path}{suffix}")
+    }
 
-        let template_path = format!("{checkpoint_path}{suffix}");
-
-        match std::fs::read_to_string(&template_path) {
-            Ok(content) => Ok(content),
-            Err(_) => {
-                eprintln!("Warning: Could not load prompt template {template_path}");
-                Ok(String::new())
-            }
+    /// Returns the prompt template to use; falls back to the non-thinking variant when the
+    /// model has no thinking template.
+    pub fn prompt_template(&self, with_system: bool, enable_thinking: bool) -> &str {
+        let templates = &self.templates;
+        let thinking = match with_system {
+            true => &templates.system_thinking,
+            false => &templates.user_thinking,
+        };
+        match (thinking.as_deref().filter(|_| enable_thinking), with_system) {
+            (Some(template), _) => template,
+            (None, true) => &templates.system,
+            (None, false) => &templates.user,
         }
     }
 
-    /// Decodes a token ID to a string (may be invalid UTF-8).
+    /// Encodes a chat prompt: the template [`Self::prompt_template`] selects, with the
+    /// prompts in its slots.
     ///
-    /// Returns a borrowed str if valid UTF-8, otherwise an owned String.
-    pub fn decode(&self, token: usize) -> Cow<str> {
-        if token < self.vocab.len() {
-            // Try to interpret as valid UTF-8 first (no allocation needed)
-            match std::str::from_utf8(&self.vocab[token]) {
-                Ok(valid_str) => Cow::Borrowed(valid_str),
-                Err(_) => {
-                    // SAFETY: For incomplete UTF-8 sequences (like partial emoji bytes),
-                    // we need to preserve the exact bytes. Use unsafe since we know
-                    // these bytes come from a trusted tokenizer file and will be
-                    // combined with other tokens to form valid UTF-8 during generation.
-                    let string = unsafe { String::from_utf8_unchecked(self.vocab[token].clone()) };
-                    Cow::Owned(string)
-                }
-            }
-        } else {
-            Cow::Borrowed("")
-        }
+    /// Gives the ids of encoding the rendered template, but only the prompts and the plain
+    /// text around them go through BPE; the rest of the template was tokenized at load and
+    /// the text around a recently used system prompt is cached.
+    pub fn encode_chat_prompt(
+        &self,
+        system_prompt: Option<&str>,
+        user_prompt: &str,
+        enable_thinking: bool,
+    ) -> Vec<usize> {
+        self.chat_templates
+            .encode(self, system_prompt, user_prompt, enable_thinking)
+    }
+
+    /// Returns true if the model has thinking prompt templates.
+    pub fn supports_thinking(&self) -> bool {
+        self.templates.user_thinking.is_some()
+    }
+
+    /// Decodes a token ID to its raw bytes.
+    ///
+    /// Byte-level BPE tokens are not always valid UTF-8 on their own (e.g. a token may hold
+    /// the first bytes of an emoji), so the bytes are returned as-is and consecutive tokens
+    /// combine into valid UTF-8. Borrows from the vocabulary, so decoding never allocates.
+    pub fn decode(&self, token: usize) -> &[u8] {
+        self.vocab.get(token).map_or(&[], |bytes| bytes.as_slice())
+    }
+
+    /// Returns true for added/control tokens such as `<|im_end|>` or `<think>`, the tokens
+    /// that split the text when encoding.
+    pub fn is_special_token(&self, token: usize) -> bool {
+        is_added_token(self.decode(token), self.merge_scores.get(token).copied())
     }
 
     /// Looks up a string in the vocabulary and returns its token ID, if present.
-    fn str_lookup(&self, s: &str) -> Option<usize> {
-        // Validate vocab_size matches actual vocab length (safety check)
-        debug_assert_eq!(self.vocab.len(), self.vocab_size, "Vocab size mismatch");
-        // Convert string to bytes and compare with vocab bytes
-        let s_bytes = s.as_bytes();
-        self.vocab
-            .iter()
-            .position(|token| token.as_slice() == s_bytes)
+    pub fn str_lookup(&self, s: &str) -> Option<usize> {
+        self.token_ids.get(s.as_bytes()).map(|&id| id as usize)
     }
 
     /// Encodes a string into a sequence of token IDs using BPE.
     ///
-    /// 1. Looks up special tokens (e.g., <bos>, <eos>) and single characters.
-    /// 2. Applies BPE merges: repeatedly merges the pair of tokens with the highest merge score,
-    ///    replacing them with the merged token, until no more merges are possible.
-    /// 3. Returns the resulting token ID sequence.
-    ///
-    /// # Arguments
-    /// * `text` - The input string to encode.
-    ///
-    /// # Returns
-    /// A vector of token IDs.
+    /// 1. Splits out special tokens written literally (e.g. `<|im_start|>`).
+    /// 2. Splits the text in between into words with Qwen2's pre-tokenizer, so merges never
+    ///    cross a word boundary.
+    /// 3. Encodes each word from its bytes with [`Self::apply_merges`]; recently seen words
+    ///    come from a cache.
     pub fn encode(&self, text: &str) -> Vec<usize> {
-        let mut tokens = Vec::new();
-        let chars: Vec<char> = text.chars().collect();
-        let mut i = 0;
-
-        while i < chars.len() {
-            let mut found_special = false;
-
-            // Check for special tokens (use max_token_length for buffer bounds)
-            if chars[i] == '<' {
-                let mut end_pos = None;
-                let search_limit = chars.len().min(i + self.max_token_length as usize);
-                for j in i + 1..search_limit {
-                    if chars[j] == '>' {
-                        end_pos = Some(j);
-                        break;
-                    }
-                }
+        let tokens = self.with_scratch(|scratch| {
+            let mut tokens = Vec::new();
+            self.encode_into(text, scratch, &mut tokens);
+            tokens
+        });
+        tokens.into_iter().map(|token| token as usize).collect()
+    }
 
-                if let Some(end) = end_pos {
-                    let special_token: String = chars[i..=end].iter().collect();
-                    if let Some(token_id) = self.str_lookup(&special_token) {
-                        tokens.push(token_id);
-                        i = end + 1;
-                        found_special = true;
-                    }
+    /// Encodes many texts in parallel, each like [`Self::encode`].
+    ///
+    /// Texts are spread over the rayon pool, each worker with its own word cache and merge
+    /// buffers. Texts longer than [`PARALLEL_CHUNK_BYTES`] are also cut into chunks at
+    /// word boundaries that are encoded in parallel.
+    pub fn encode_batch(&self, texts: &[&str]) -> Vec<Vec<u32>> {
+        texts
+            .par_iter()
+            .map(|text| {
+                if text.len() > PARALLEL_CHUNK_BYTES {
+                    return self.encode_chunked(text);
                 }
+                self.with_scratch(|scratch| {
+                    let mut tokens = Vec::new();
+                    self.encode_into(text, scratch, &mut tokens);
+                    tokens
+                })
+            })
+            .collect()
+    }
+
+    /// Encodes a long text as chunks in parallel: special tokens are split out first,
+    /// then the text in between is cut with [`pretokenizer::chunks`], which only cuts
+    /// between words, so the result matches encoding the text in one piece.
+    fn encode_chunked(&self, text: &str) -> Vec<u32> {
+        let mut pieces: Vec<Result<&str, u32>> = Vec::new();
+        let mut segment_start = 0;
+        while let Some(found) = self.special_tokens.find(text.as_bytes(), segment_start) {
+            pieces.extend(
+                pretokenizer::chunks(&text[segment_start..found.start], PARALLEL_CHUNK_BYTES)
+                    .map(Ok),
+            );
+            pieces.push(Err(found.id as u32));
+            segment_start = found.end;
+        }
+        pieces.extend(pretokenizer::chunks(&text[segment_start..], PARALLEL_CHUNK_BYTES).map(Ok));
+
+        pieces
+            .par_iter()
+            .map(|piece| match *piece {
+                Ok(segment) => self.with_scratch(|scratch| {
+                    let mut tokens = Vec::new();
+                    self.encode_segment(segment, scratch, &mut tokens);
+                    tokens
+                }),
+                Err(special) => vec![special],
+            })
+            .collect::<Vec<_>>()
+            .concat()
+    }
+
+    /// Finds the first special token in `text` at or after byte offset `from`.
+    pub(crate) fn find_special_token(&self, text: &str, from: usize) -> Option<SpecialTokenMatch> {
+        self.special_tokens.find(text.as_bytes(), from)
+    }
+
+    /// Encodes `text` as described for [`Self::encode`], appending its tokens to `tokens`.
+    /// Runs `encode` with the scratch of the current rayon worker, or of the calling thread
+    /// outside the pool.
+    ///
+    /// If that scratch is busy, e.g. several threads outside the pool encode at once, a
+    /// fresh one is used: its word cache starts empty and only grows with this call.
+    fn with_scratch<R>(&self, encode: impl FnOnce(&mut EncodeScratch) -> R) -> R {
+        let slot = rayon::current_thread_index().map_or(0, |index| index + 1);
+        match self.scratch.get(slot).map(Mutex::try_lock) {
+            Some(Ok(mut scratch)) => encode(&mut scratch),
+            _ => encode(&mut EncodeScratch::new()),
+        }
+    }
+
+    fn encode_into(&self, text: &str, scratch: &mut EncodeScratch, tokens: &mut Vec<u32>) {
+        let mut segment_start = 0;
+
+        // Special tokens are whole UTF-8 strings, so their ends are char boundaries
+        while let Some(found) = self.special_tokens.find(text.as_bytes(), segment_start) {
+            self.encode_segment(&text[segment_start..found.start], scratch, tokens);
+            tokens.push(found.id as u32);
+            segment_start = found.end;
+        }
+        self.encode_segment(&text[segment_start..], scratch, tokens);
+    }
+
+    /// Encodes text without special tokens, word by word.
+    fn encode_segment(&self, text: &str, scratch: &mut EncodeScratch, tokens: &mut Vec<u32>) {
+        for word in pretokenizer::words(text) {
+            if word.len() > MAX_CACHED_WORD_LEN {
+                self.encode_word(word, scratch, tokens);
+                continue;
+            }
+            if let Some(cached) = scratch.words.get(word) {
+                tokens.extend_from_slice(cached);
+                continue;
             }
 
-            if !found_special {
-                let char_str = chars[i].to_string();
-                if let Some(token_id) = self.str_lookup(&char_str) {
-                    tokens.push(token_id);
-                } else {
-                    // Print a warning for unknown characters (not present in vocab)
-                    println!(
-                        "Warning: unknown character '{}' in input, skipping.",
-                        chars[i]
-                    );
-                }
-                i += 1;
+            let start = tokens.len();
+            self.encode_word(word, scratch, tokens);
+            scratch.words.insert_with(word, |cached| {
+                cached.clear();
+                cached.extend_from_slice(&tokens[start..]);
+            });
+        }
+    }
+
+    /// Byte-level BPE of one word: starts from one token per byte, so every character
+    /// can be encoded even when it is not a token itself.
+    fn encode_word(&self, word: &str, scratch: &mut EncodeScratch, tokens: &mut Vec<u32>) {
+        scratch.tokens.clear();
+        scratch.tokens.extend(word.bytes().filter_map(|byte| {
+            let token = self.byte_tokens[byte as usize];
+            if token.is_none() {
+                warn!("Byte 0x{byte:02x} is not in the vocabulary, skipping");
+            }
+            token
+        }));
+        self.apply_merges(scratch);
+        tokens.extend(
+            scratch
+                .tokens
+                .iter()
+                .copied()
+                .filter(|&token| token != REMOVED),
+        );
+    }
+
+    /// Applies BPE merges to `scratch.tokens`: repeatedly merges the adjacent pair with
+    /// the highest merge score (the leftmost one on ties) until no pair forms a vocabulary
+    /// token. Merged-away tokens are left in place as [`REMOVED`].
+    ///
+    /// The tokens form a doubly linked list over their original positions and candidate
+    /// pairs wait in a max-heap. A merge only links its neighbours and pushes the two new
+    /// pairs; heap entries made stale by earlier merges are skipped when popped. This takes
+    /// O(n log n) instead of rescanning every pair after each merge.
+    fn apply_merges(&self, scratch: &mut EncodeScratch) {
+        let EncodeScratch {
+            tokens,
+            prev,
+            next,
+            heap,
+            ..
+        } = scratch;
+        let len = tokens.len() as u32;
+        // `prev[i]` / `next[i]`: neighbours of node `i`, `NONE` / `len` at the ends
+        prev.clear();
+        prev.extend((0..len).map(|i| i.wrapping_sub(1)));
+        next.clear();
+        next.extend(1..=len);
+        heap.clear();
+
+        let candidate = |tokens: &[u32], left: u32, right: u32| {
+            let (left_token, right_token) = (tokens[left as usize], tokens[right as usize]);
+            let &(merged, score) = self.merges.get(&pair_key(left_token, right_token))?;
+            Some(MergeCandidate {
+                score,
+                left,
+                right,
+                left_token,
+                right_token,
+                merged,
+            })
+        };
+        heap.extend((1..len).filter_map(|right| candidate(tokens, right - 1, right)));
+
+        while let Some(best) = heap.pop() {
+            let (left, right) = (best.left as usize, best.right as usize);
+            // Skip pairs whose nodes were merged away or changed since they were pushed
+            if tokens[left] != best.left_token
+                || next[left] != best.right
+                || tokens[right] != best.right_token
+            {
+                continue;
+            }
+
+            tokens[left] = best.merged;
+            tokens[right] = REMOVED;
+            let after = next[right];
+            next[left] = after;
+            if after < len {
+                prev[after as usize] = best.left;
+                heap.extend(candidate(tokens, best.left, after));
             }
+            if prev[left] != NONE {
+                heap.extend(candidate(tokens, prev[left], best.left));
+            }
+        }
+    }
+}
+
+/// Reusable buffers for encoding: a word cache and the working memory of
+/// [`Tokenizer::apply_merges`], so encoding a word does not allocate once warm.
+struct EncodeScratch {
+    /// Recently encoded words
+    words: LruCache<Vec<u32>>,
+    tokens: Vec<u32>,
+    prev: Vec<u32>,
+    next: Vec<u32>,
+    heap: BinaryHeap<MergeCandidate>,
+}
+
+impl EncodeScratch {
+    fn new() -> Self {
+        Self {
+            words: LruCache::new(WORD_CACHE_CAPACITY),
+            tokens: Vec::new(),
+            prev: Vec::new(),
+            next: Vec::new(),
+            heap: BinaryHeap::new(),
         }
+    }
+}
 
-        // Merge tokens using BPE (Byte Pair Encoding)
-        // Repeatedly merge the pair with the highest merge score until no merges remain.
-        loop {
-            let mut best_score = -1e10;
-            let mut best_id = None;
-            let mut best_idx = None;
-
-            for i in 0..tokens.len().saturating_sub(1) {
-                // Concatenate the raw bytes of the two tokens
-                let mut merged_bytes = self.vocab[tokens[i]].clone();
-                merged_bytes.extend_from_slice(&self.vocab[tokens[i + 1]]);
-
-                if let Some(id) = self
-                    .vocab
-                    .iter()
-                    .position(|token| token.as_slice() == merged_bytes.as_slice())
-                {
-                    if self.merge_scores[id] > best_score {
-                        best_score = self.merge_scores[id];
-                        best_id = Some(id);
-                        best_idx = Some(i);
-                    }
-                }
+/// Score the exporter gives tokens that no merge produces
+const DEFAULT_SCORE: f32 = -1e6;
+
+/// Number of encoded words kept by the tokenizer
+const WORD_CACHE_CAPACITY: usize = 8192;
+
+/// Longer words are encoded without going through the cache
+const MAX_CACHED_WORD_LEN: usize = 64;
+
+/// [`Tokenizer::encode_batch`] splits texts longer than this into chunks of about this
+/// size, so one long document also keeps all threads busy
+const PARALLEL_CHUNK_BYTES: usize = 64 * 1024;
+
+/// Returns true if a token with these bytes and merge score is an added token.
+///
+/// The exporter gives tokens without a BPE merge rank the default score; apart from the
+/// single-byte base tokens, those are the added tokens. Older exporters gave every
+/// multi-byte token the default score, so the `<...>` form is required as well.
+fn is_added_token(token: &[u8], score: Option<f32>) -> bool {
+    token.len() > 1
+        && token.starts_with(b"<")
+        && token.ends_with(b">")
+        && score.is_some_and(|score| score <= DEFAULT_SCORE)
+}
+
+/// Merges of the exported merge table, scored so that lower ranks merge first. Entries
+/// outside the vocabulary, e.g. from a table that does not match it, are skipped.
+fn ranked_merges(merge_table: &[[u32; 3]], vocab_size: usize) -> MergeMap {
+    let mut merges = MergeMap::with_capacity_and_hasher(merge_table.len(), Default::default());
+    let mut skipped = 0;
+    for (rank, &[left, right, merged]) in merge_table.iter().enumerate() {
+        if [left, right, merged]
+            .iter()
+            .any(|&id| id as usize >= vocab_size)
+        {
+            skipped += 1;
+            continue;
+        }
+        merges
+            .entry(pair_key(left, right))
+            .or_insert((merged, -(rank as f32)));
+    }
+    if skipped > 0 {
+        warn!("Skipped {skipped} merges with tokens outside the vocabulary");
+    }
+    merges
+}
+
+/// Merges guessed from the vocabulary alone: every way of splitting a token into two
+/// tokens is a possible merge, scored with the token's score.
+fn derived_merges(
+    token_ids: &HashMap<Vec<u8>, u32>,
+    merge_scores: &[f32],
+    vocab_size: usize,
+) -> MergeMap {
+    let mut merges = MergeMap::with_capacity_and_hasher(vocab_size, Default::default());
+    for (token, &id) in token_ids {
+        let Some(&score) = merge_scores.get(id as usize) else {
+            continue;
+        };
+        if score <= MIN_MERGE_SCORE {
+            continue;
+        }
+        for split in 1..token.len() {
+            if let (Some(&left), Some(&right)) = (
+                token_ids.get(&token[..split]),
+                token_ids.get(&token[split..]),
+            ) {
+                merges.insert(pair_key(left, right), (id, score));
             }
+        }
+    }
+    merges
+}
 
-            let (id, idx) = match (best_id, best_idx) {
-                (Some(id), Some(idx)) => (id, idx),
-                _ => break,
-            };
+/// Merged token and score by [`pair_key`]
+type MergeMap = HashMap<u64, (u32, f32), BuildHasherDefault<IdHasher>>;
+
+/// Marks the token count after the header of the tokenizer file ("TOKS")
+const TOKENS_MAGIC: u32 = 0x534B_4F54;
+
+/// Marks the merge table after the vocabulary in the tokenizer file ("MRGS")
+const MERGES_MAGIC: u32 = 0x5347_524D;
+
+/// Key of the pair of tokens `(left, right)` in the merge table
+fn pair_key(left: u32, right: u32) -> u64 {
+    ((left as u64) << 32) | right as u64
+}
+
+/// Hasher for the merge table: its keys are already well-spread integers, so a single
+/// multiply replaces SipHash on the hot path of [`Tokenizer::encode`].
+#[derive(Default)]
+struct IdHasher(u64);
 
-            tokens[idx] = id;
-            tokens.remove(idx + 1);
+impl Hasher for IdHasher {
+    fn finish(&self) -> u64 {
+        // The multiply leaves the low bits depending on the low key bits only
+        self.0 ^ (self.0 >> 32)
+    }
+
+    fn write(&mut self, bytes: &[u8]) {
+        for &byte in bytes {
+            self.write_u64(byte as u64);
         }
+    }
+
+    fn write_u64(&mut self, value: u64) {
+        self.0 = (self.0.rotate_left(5) ^ value).wrapping_mul(0x517c_c1b7_2722_0a95);
+    }
+}
+
+/// No link: the left end of the merge list
+const NONE: u32 = u32::MAX;
+
+/// Marks a token merged into its left neighbour
+const REMOVED: u32 = u32::MAX;
 
-        tokens
+/// Pairs whose merged token scores at or below this are never merged
+const MIN_MERGE_SCORE: f32 = -1e10;
+
+/// A pair of adjacent tokens that can be merged, ordered by merge priority
+struct MergeCandidate {
+    score: f32,
+    left: u32,
+    right: u32,
+    left_token: u32,
+    right_token: u32,
+    merged: u32,
+}
+
+impl Ord for MergeCandidate {
+    /// Higher scores first, then the leftmost pair
+    fn cmp(&self, other: &Self) -> Ordering {
+        self.score
+            .total_cmp(&other.score)
+            .then_with(|| other.left.cmp(&self.left))
+    }
+}
+
+impl PartialOrd for MergeCandidate {
+    fn partial_cmp(&self, other: &Self) -> Option<Ordering> {
+        Some(self.cmp(other))
     }
 }
 
+impl PartialEq for MergeCandidate {
+    fn eq(&self, other: &Self) -> bool {
+        self.cmp(other) == Ordering::Equal
+    }
+}
+
+impl Eq for MergeCandidate {}
+
 impl std::fmt::Debug for Tokenizer {
     fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
-        let bos_token = (self.bos_token_id, self.decode(self.bos_token_id as usize));
-        let eos_token = (self.eos_token_id, self.decode(self.eos_token_id as usize));
+        let decode = |token: u32| String::from_utf8_lossy(self.decode(token as usize));
+        let bos_token = (self.bos_token_id, decode(self.bos_token_id));
+        let eos_token = (self.eos_token_id, decode(self.eos_token_id));
 
         f.debug_struct("Tokenizer")
             .field("vocab_size", &self.vocab_size)
             .field("max_token_length", &self.max_token_length)
             .field("bos_token_id", &bos_token)
             .field("eos_token_id", &eos_token)
-            .field("prompt_template", &self.prompt_template)
-            .field("system_prompt_template", &self.system_prompt_template)
+            .field("templates", &self.templates)
             .finish_non_exhaustive()
     }
 }
@@ -0,0 +1,131 @@
+//! Validation of a tokenizer against a text corpus.
+//!
+//! Used to check that a trimmed vocabulary (`export --vocab-keep`) still covers the text
+//! a deployment sees. Characters without a token of their own fall back to byte tokens,
+//! so a trimmed vocabulary rarely breaks the round trip (only when a byte token itself was
+//! dropped); what it costs is extra tokens. The report therefore compares token counts
+//! against a reference tokenizer line by line, and lists the lines that needed
+//! byte-fallback tokens.
+
+#[cfg(test)]
+#[path = "../tests/unit/tokenizer_validation_test.rs"]
+mod tests;
+
+use crate::tokenizer::Tokenizer;
+
+/// A line that takes more tokens than with the reference tokenizer
+#[derive(Debug, Clone, PartialEq)]
+pub struct InflatedLine {
+    /// 1-based line number
+    pub line: usize,
+    pub tokens: usize,
+    pub reference_tokens: usize,
+}
+
+impl InflatedLine {
+    /// Extra tokens as a fraction of the reference count (0.5 for 50% more)
+    pub fn inflation(&self) -> f64 {
+        self.tokens as f64 / self.reference_tokens.max(1) as f64 - 1.0
+    }
+}
+
+/// Outcome of validating a tokenizer on a corpus
+#[derive(Debug, Default)]
+pub struct RoundTripReport {
+    /// Non-empty lines checked
+    pub lines: usize,
+    /// 1-based numbers of the lines that did not decode back to the original text
+    pub failed_lines: Vec<usize>,
+    /// Tokens produced for the whole corpus
+    pub tokens: usize,
+    /// Tokens the reference tokenizer produced for the same lines, if given
+    pub reference_tokens: Option<usize>,
+    /// Lines that take more tokens than with the reference, in corpus order
+    pub inflated_lines: Vec<InflatedLine>,
+    /// 1-based numbers of the lines encoded with byte-fallback tokens (tokens that are not
+    /// valid UTF-8 on their own); with a reference, only those needing more of them than
+    /// the reference does
+    pub fallback_lines: Vec<usize>,
+}
+
+impl RoundTripReport {
+    /// Extra tokens over the whole corpus as a fraction of the reference count, if a
+    /// reference was given.
+    pub fn inflation(&self) -> Option<f64> {
+        self.reference_tokens
+            .map(|reference| self.tokens as f64 / reference.max(1) as f64 - 1.0)
+    }
+
+    /// True if every line round-trips and the corpus takes at most `max_inflation` (a
+    /// fraction) more tokens than with the reference.
+    pub fn is_ok(&self, max_inflation: f64) -> bool {
+        self.failed_lines.is_empty()
+            && self
+                .inflation()
+                .is_none_or(|inflation| inflation <= max_inflation)
+    }
+}
+
+/// Encodes and decodes every non-empty line of `corpus`, comparing the token counts with
+/// `reference` when given.
+pub fn validate_round_trip(
+    tokenizer: &Tokenizer,
+    reference: Option<&Tokenizer>,
+    corpus: &str,
+) -> RoundTripReport {
+    let mut report = RoundTripReport {
+        reference_tokens: reference.map(|_| 0),
+        ..Default::default()
+    };
+    let mut decoded = Vec::new();
+
+    for (index, line) in corpus.lines().enumerate() {
+        if line.is_empty() {
+            continue;
+        }
+        report.lines += 1;
+
+        let tokens = tokenizer.encode(line);
+        report.tokens += tokens.len();
+
+        decoded.clear();
+        for &token in &tokens {
+            decoded.extend_from_slice(tokenizer.decode(token));
+        }
+        if decoded != line.as_bytes() {
+            report.failed_lines.push(index + 1);
+        }
+
+        let fallback = fallback_tokens(tokenizer, &tokens);
+        let reference_fallback = match reference {
+            Some(reference) => {
+                let reference_tokens = reference.encode(line);
+                if let Some(count) = &mut report.reference_tokens {
+                    *count += reference_tokens.len();
+                }
+                if tokens.len() > reference_tokens.len() {
+                    report.inflated_lines.push(InflatedLine {
+                        line: index + 1,
+                        tokens: tokens.len(),
+                        reference_tokens: reference_tokens.len(),
+                    });
+                }
+                fallback_tokens(reference, &reference_tokens)
+            }
+            None => 0,
+        };
+        if fallback > reference_fallback {
+            report.fallback_lines.push(index + 1);
+        }
+    }
+
+    report
+}
+
+/// Counts the tokens that hold only part of a character.
+fn fallback_tokens(tokenizer: &Tokenizer, tokens: &[usize]) -> usize {
+    tokens
+        .iter()
+        .filter(|&&token| std::str::from_utf8(tokenizer.decode(token)).is_err())
+        .count()
+}
@@ -1,15 +1,22 @@
-use crate::configuration::{ModelConfig, read_config};
-use crate::tensor::{QuantizedTensor, dequantize, quantize};
+use crate::configuration::{ModelConfig, read_checkpoint_config, read_config};
+use crate::gguf::{self, GgufFile};
+use crate::hf_model;
+use crate::tensor::{Q4Tensor, QuantizedTensor, dequantize, matmul_q4, quantize};
 use crate::utils::MemoryMapper;
 use anyhow::{Context, Result};
+use log::info;
 use rayon::prelude::*;
+use std::borrow::Cow;
 use std::fs::File;
+use std::path::Path;
+use std::sync::Arc;
+use std::time::{Duration, Instant};
 
 /// Epsilon value for numerical stability in normalization
 const EPSILON: f32 = 1e-6;
 
-/// Base frequency for RoPE (Rotary Position Embedding)
-const ROPE_BASE_FREQ: f32 = 1e6;
+/// Number of positions [`Transformer::prefill`] runs through the model at once
+pub const PREFILL_BATCH: usize = 32;
 
 /// Main Transformer model implementing a decoder-only architecture with the following components:
 ///
@@ -41,12 +48,19 @@ const ROPE_BASE_FREQ: f32 = 1e6;
 /// - **Parallel Processing**: Leverages Rayon for parallel attention head computation
 pub struct Transformer {
     pub config: ModelConfig,
+    model: Arc<Model>,
+    prescreen: Option<PrescreenHead>,
+    state: RunState,
+    batch: BatchState,
+}
+
+/// The read-only weights of a [`Transformer`], shared by all sessions created from it.
+struct Model {
     token_embedding: TokenEmbedding,
     blocks: Vec<TransformerBlock>,
     final_norm: RMSNorm,
     lm_head: Linear,
-    state: RunState,
-    _mapper: MemoryMapper,
+    _mapper: Option<MemoryMapper>, // Keeps borrowed weights alive; None if all are owned
 }
 
 impl Transformer {
@@ -63,29 +77,239 @@ impl Transformer {
     /// - `pos`: Current position in sequence (for RoPE and KV cache indexing)
     ///
     /// **Returns:**
-    /// - Probability distribution over vocabulary (logits) for next token prediction
-    pub fn forward(&mut self, token: usize, pos: usize) -> &[f32] {
+    /// - Logits over the vocabulary for next token prediction. The slice borrows the
+    ///   run state buffer mutably, so samplers can transform it in place without a copy;
+    ///   it is overwritten by the next forward pass.
+    pub fn forward(&mut self, token: usize, pos: usize) -> &mut [f32] {
+        self.forward_hidden(token, pos);
+
+        // Classification head
+        self.model
+            .lm_head
+            .forward(&mut self.state.logits, &self.state.xq);
+
+        &mut self.state.logits
+    }
+
+    /// Forward pass that computes logits only for the given tokens.
+    ///
+    /// Other logits are set to negative infinity. `tokens` must be sorted ascending; used
+    /// when decoding is restricted to a small set of tokens, where computing the whole
+    /// classification head would dominate the step.
+    pub fn forward_rows(&mut self, token: usize, pos: usize, tokens: &[u32]) -> &mut [f32] {
+        self.forward_hidden(token, pos);
+        self.model
+            .lm_head
+            .forward_rows(&mut self.state.logits, &self.state.xq, tokens);
+
+        &mut self.state.logits
+    }
+
+    /// Greedy decoding fast path: runs the forward pass and returns `argmax(logits)`.
+    ///
+    /// The argmax is fused into the classification head, so the vocabulary-sized
+    /// logits buffer is neither written nor scanned again.
+    pub fn forward_argmax(&mut self, token: usize, pos: usize) -> usize {
+        self.forward_hidden(token, pos);
+        self.model.lm_head.forward_argmax(&self.state.xq)
+    }
+
+    /// Two-stage forward pass: approximate logits from the 4-bit classifier copy select the
+    /// top-K candidates, and only those are recomputed exactly with the Q8 classifier.
+    ///
+    /// Other logits are set to negative infinity. Falls back to [`Self::forward`] when the
+    /// prescreen is not enabled, see [`TransformerBuilder::with_prescreen`].
+    pub fn forward_prescreened(&mut self, token: usize, pos: usize) -> &mut [f32] {
+        self.forward_hidden(token, pos);
+
+        match &mut self.prescreen {
+            Some(prescreen) => {
+                prescreen.forward(&self.model.lm_head, &mut self.state.logits, &self.state.xq)
+            }
+            None => self
+                .model
+                .lm_head
+                .forward(&mut self.state.logits, &self.state.xq),
+        }
+
+        &mut self.state.logits
+    }
+
+    /// Runs `tokens` through the model at positions `start_pos..`, filling the KV cache
+    /// without computing any logits.
+    ///
+    /// Positions are processed in batches of [`PREFILL_BATCH`], so each weight matrix is
+    /// read once per batch rather than once per token. Generation then continues with
+    /// [`Self::forward`] at `start_pos + tokens.len()`.
+    pub fn prefill(&mut self, tokens: &[usize], start_pos: usize) {
+        for (chunk_idx, chunk) in tokens.chunks(PREFILL_BATCH).enumerate() {
+            self.forward_batch_hidden(chunk, start_pos + chunk_idx * PREFILL_BATCH);
+        }
+    }
+
+    /// Batched forward pass over the consecutive positions `start_pos..`, one per token.
+    ///
+    /// Returns the logits of every position, one row of `vocab_size` per token: row `i`
+    /// predicts the token after `tokens[i]`, exactly as [`Self::forward`] would. The buffer
+    /// holds a row per token, so callers split long inputs into batches of about
+    /// [`PREFILL_BATCH`] tokens.
+    pub fn forward_batch(&mut self, tokens: &[usize], start_pos: usize) -> &mut [f32] {
+        self.forward_batch_hidden(tokens, start_pos);
+        quantize(
+            &mut self.batch.xq,
+            &self.batch.x,
+            self.batch.x.len(),
+            self.model.lm_head.group_size,
+        );
+
+        let logits_len = tokens.len() * self.config.vocab_size;
+        self.batch.logits.resize(logits_len, 0.0);
+        self.model
+            .lm_head
+            .forward_batch(&mut self.batch.logits, &self.batch.xq);
+
+        &mut self.batch.logits
+    }
+
+    /// Returns true if [`Self::forward_prescreened`] uses the two-stage classifier.
+    pub fn has_prescreen(&self) -> bool {
+        self.prescreen.is_some()
+    }
+
+    /// Use of the two-stage classifier, if enabled, with its agreement with the exact one
+    /// when verification is enabled.
+    pub fn prescreen_stats(&self) -> Option<&PrescreenStats> {
+        self.prescreen.as_ref().map(|prescreen| &prescreen.stats)
+    }
+
+    /// Runs every layer up to the classification head, leaving the quantized
+    /// final hidden state in `state.xq`.
+    fn forward_hidden(&mut self, token: usize, pos: usize) {
         // Token embedding
-        self.token_embedding.forward(token, &mut self.state.x);
+        self.model.token_embedding.forward(token, &mut self.state.x);
 
         // Process through transformer blocks
-        for block in &self.blocks {
+        for block in &self.model.blocks {
             block.forward(pos, &mut self.state);
         }
 
         // Final normalization
-        self.final_norm.forward_inplace(&mut self.state.x);
+        self.model.final_norm.forward_inplace(&mut self.state.x);
 
-        // Classification head
         quantize(
             &mut self.state.xq,
             &self.state.x,
             self.state.x.len(),
-            self.lm_head.group_size,
+            self.model.lm_head.group_size,
         );
-        self.lm_head.forward(&mut self.state.logits, &self.state.xq);
+    }
 
-        &self.state.logits
+    /// Batched forward pass over the consecutive positions `start_pos..` without the
+    /// classification head.
+    ///
+    /// Returns the final-norm hidden states, one row of `dim` per token; used for
+    /// embeddings. The buffer is overwritten by the next batched pass.
+    pub fn hidden_states(&mut self, tokens: &[usize], start_pos: usize) -> &[f32] {
+        self.forward_batch_hidden(tokens, start_pos);
+        &self.batch.x
+    }
+
+    /// Runs several independent sequences through the model as one packed batch.
+    ///
+    /// Each sequence starts at position 0 and attends only to its own tokens, but all of
+    /// them share the weight reads of a single batch, which is much faster than running
+    /// many short sequences one by one. They are stored one after the other in the KV
+    /// cache, so their total length must fit the context. Returns the final-norm hidden
+    /// states of all tokens, in order, one row of `dim` per token.
+    pub fn hidden_states_packed(&mut self, sequences: &[&[usize]]) -> &[f32] {
+        let len = sequences.iter().map(|sequence| sequence.len()).sum();
+        self.prepare_batch(len, 0);
+
+        let dim = self.config.dim;
+        let mut rows = self.batch.x.chunks_exact_mut(dim).enumerate();
+        for sequence in sequences {
+            for (pos, (&token, (row, x))) in sequence.iter().zip(rows.by_ref()).enumerate() {
+                self.batch.pos[row] = pos;
+                self.batch.attend_from[row] = row - pos;
+                self.model.token_embedding.forward(token, x);
+            }
+        }
+
+        self.run_batch(0);
+        &self.batch.x
+    }
+
+    /// Sizes the batch buffers for passes of up to `rows` tokens, so that batches of any
+    /// length up to it reuse them instead of reallocating.
+    pub fn reserve_batch(&mut self, rows: usize) {
+        let rows = rows.min(self.config.seq_len);
+        if rows > self.batch.capacity {
+            let len = self.batch.len;
+            self.batch = BatchState::new(rows, &self.config);
+            self.batch.resize(len, &self.config);
+        }
+    }
+
+    /// Batched counterpart of [`Self::forward_hidden`] over the consecutive positions
+    /// `start_pos..` of one sequence, leaving the final hidden states in `batch.x`.
+    fn forward_batch_hidden(&mut self, tokens: &[usize], start_pos: usize) {
+        self.prepare_batch(tokens.len(), start_pos);
+        let dim = self.config.dim;
+        for (row, (&token, x)) in tokens
+            .iter()
+            .zip(self.batch.x.chunks_exact_mut(dim))
+            .enumerate()
+        {
+            self.batch.pos[row] = start_pos + row;
+            self.batch.attend_from[row] = 0;
+            self.model.token_embedding.forward(token, x);
+        }
+
+        self.run_batch(start_pos);
+    }
+
+    /// Checks that a batch of `len` rows fits the KV cache at `start_pos` and sizes the
+    /// batch buffers, reallocating them only to grow past the largest batch so far.
+    fn prepare_batch(&mut self, len: usize, start_pos: usize) {
+        assert!(
+            start_pos + len <= self.config.seq_len,
+            "Batch of {} tokens at position {} exceeds the context of {}",
+            len,
+            start_pos,
+            self.config.seq_len
+        );
+
+        self.reserve_batch(len);
+        self.batch.resize(len, &self.config);
+    }
+
+    /// Runs every layer over the batch rows, whose token embeddings are in `batch.x`, whose
+    /// K/V go to the cache rows `start_pos..` and whose positions are set in `batch.pos`
+    /// and `batch.attend_from`.
+    fn run_batch(&mut self, start_pos: usize) {
+        let dim = self.config.dim;
+        for block in &self.model.blocks {
+            block.forward_batch(start_pos, &mut self.batch, &mut self.state);
+        }
+
+        for x in self.batch.x.chunks_exact_mut(dim) {
+            self.model.final_norm.forward_inplace(x);
+        }
+    }
+
+    /// Creates another session on the same weights, with its own empty KV cache.
+    ///
+    /// Only the run state is allocated; the weights are shared, so several sessions can
+    /// evaluate independent sequences in parallel. The session has no two-stage
+    /// classifier, [`Self::forward_prescreened`] falls back to the exact one.
+    pub fn new_session(&self) -> Result<Transformer> {
+        Ok(Transformer {
+            config: self.config.clone(),
+            model: Arc::clone(&self.model),
+            prescreen: None,
+            state: RunState::new(&self.config)?,
+            batch: BatchState::new(0, &self.config),
+        })
     }
 
     pub fn get_config(&self) -> &ModelConfig {
@@ -111,10 +335,11 @@ impl std::fmt::Debug for Transformer {
 
         f.debug_struct("Transformer")
             .field("config", &self.config)
-            .field("token_embedding", &self.token_embedding)
-            .field("blocks", &BlocksSummary(&self.blocks))
-            .field("final_norm", &self.final_norm)
-            .field("lm_head", &self.lm_head)
+            .field("token_embedding", &self.model.token_embedding)
+            .field("blocks", &BlocksSummary(&self.model.blocks))
+            .field("final_norm", &self.model.final_norm)
+            .field("lm_head", &self.model.lm_head)
+            .field("prescreen", &self.prescreen)
             .finish()
     }
 }
@@ -225,23 +450,34 @@ impl std::fmt::Debug for RMSNorm {
 /// - Enables attention to naturally focus on relative distances
 pub struct RoPE {
     pub head_dim: usize,
+    /// Rotation frequency of each dimension pair, precomputed once
+    pub inv_freqs: Vec<f32>,
 }
 
 impl RoPE {
-    pub fn new(head_dim: usize) -> Self {
-        Self { head_dim }
+    pub fn new(head_dim: usize, base_freq: f32) -> Self {
+        let head_dim_half = head_dim / 2;
+        let inv_freqs = (0..head_dim_half)
+            .map(|dim_idx| base_freq.powf(-(dim_idx as f32) / head_dim_half as f32))
+            .collect();
+
+        Self {
+            head_dim,
+            inv_freqs,
+        }
     }
 
-    pub fn compute_freqs(&self, pos: usize) -> Vec<(f32, f32)> {
-        let head_dim_half = self.head_dim / 2;
+    /// Writes the `(cos, sin)` rotation of every dimension pair at `pos` into `freqs`.
+    pub fn compute_freqs(&self, pos: usize, freqs: &mut [(f32, f32)]) {
+        debug_assert_eq!(freqs.len(), self.inv_freqs.len());
 
-        (0..head_dim_half)
-            .map(|dim_idx| {
-                let freq = ROPE_BASE_FREQ.powf(-(dim_idx as f32) / head_dim_half as f32);
-                let angle = pos as f32 * freq;
-                (angle.cos(), angle.sin())
-            })
-            .collect()
+        freqs
+            .iter_mut()
+            .zip(&self.inv_freqs)
+            .for_each(|(freq, &inv_freq)| {
+                let angle = pos as f32 * inv_freq;
+                *freq = (angle.cos(), angle.sin());
+            });
     }
 
     pub fn apply(&self, slice: &mut [f32], freqs: &[(f32, f32)]) {
@@ -307,6 +543,41 @@ impl Linear {
             self.group_size,
         );
     }
+
+    /// Applies the layer to a batch of inputs, see [`crate::tensor::matmul_batch`].
+    pub fn forward_batch(&self, output: &mut [f32], input: &QuantizedTensor) {
+        crate::tensor::matmul_batch(
+            output,
+            input,
+            &self.weight,
+            self.in_features,
+            self.out_features,
+            self.group_size,
+        );
+    }
+
+    /// Computes only the selected output rows, see [`crate::tensor::matmul_rows`].
+    pub fn forward_rows(&self, output: &mut [f32], input: &QuantizedTensor, rows: &[u32]) {
+        crate::tensor::matmul_rows(
+            &mut output[..self.out_features],
+            input,
+            &self.weight,
+            self.in_features,
+            rows,
+            self.group_size,
+        );
+    }
+
+    /// Returns the index of the largest output without materialising the outputs.
+    pub fn forward_argmax(&self, input: &QuantizedTensor) -> usize {
+        crate::tensor::matmul_argmax(
+            input,
+            &self.weight,
+            self.in_features,
+            self.out_features,
+            self.group_size,
+        )
+    }
 }
 
 impl std::fmt::Debug for Linear {
@@ -319,6 +590,190 @@ impl std::fmt::Debug for Linear {
     }
 }
 
+/// Two-stage classification head.
+///
+/// **Stage 1**: approximate logits from a 4-bit copy of the classifier (half the memory
+/// traffic of the Q8 weights) select the `top_k` most likely tokens.
+/// **Stage 2**: only those rows are recomputed exactly from the Q8 classifier, so the
+/// sampled distribution is exact whenever the candidates cover its support.
+pub struct PrescreenHead {
+    pub weight: Q4Tensor,
+    pub in_features: usize,
+    pub out_features: usize,
+    pub group_size: usize,
+    pub top_k: usize,
+    /// Candidate token IDs, sorted ascending after selection
+    /// Capacity: [vocab_size]
+    candidates: Vec<u32>,
+    stats: PrescreenStats,
+    verification: Option<PrescreenVerification>,
+}
+
+/// Use of the two-stage classifier, accumulated over decode steps.
+///
+/// The agreement with the exact classifier is only measured with verification, see
+/// [`TransformerBuilder::with_prescreen_verification`].
+#[derive(Debug, Clone, Default)]
+pub struct PrescreenStats {
+    /// Decode steps through the two-stage classifier
+    pub steps: usize,
+    /// Total time spent in the two-stage classifier
+    pub two_stage_time: Duration,
+    /// Decode steps also run through the exact classifier
+    pub verified_steps: usize,
+    /// Verified steps where the exact top-p set was contained in the candidates
+    pub topp_hits: usize,
+    /// Verified steps where the exact argmax was among the candidates
+    pub argmax_hits: usize,
+    /// Exact probability of the tokens outside the candidates, summed over verified steps:
+    /// the total variation distance between the two-stage and the exact distribution
+    pub missed_mass: f64,
+    /// Total time spent in the full Q8 classifier
+    pub exact_time: Duration,
+}
+
+/// Runs the full Q8 classifier next to the two-stage one and compares them.
+struct PrescreenVerification {
+    temperature: f32,
+    topp: f32,
+    /// Exact logits, Shape: [vocab_size]
+    exact: Vec<f32>,
+    /// Token IDs ordered by exact logit, Shape: [vocab_size]
+    order: Vec<u32>,
+}
+
+impl PrescreenHead {
+    pub fn new(
+        weight: Q4Tensor,
+        in_features: usize,
+        out_features: usize,
+        group_size: usize,
+        top_k: usize,
+    ) -> Self {
+        Self {
+            weight,
+            in_features,
+            out_features,
+            group_size,
+            top_k: top_k.clamp(1, out_features),
+            candidates: Vec::with_capacity(out_features),
+            stats: PrescreenStats::default(),
+            verification: None,
+        }
+    }
+
+    /// Also runs the exact classifier on every step and records [`PrescreenStats`] against
+    /// the top-p set of the given sampling parameters.
+    pub fn with_verification(mut self, temperature: f32, topp: f32) -> Self {
+        self.verification = Some(PrescreenVerification {
+            temperature,
+            topp,
+            exact: vec![0.0; self.out_features],
+            order: Vec::with_capacity(self.out_features),
+        });
+        self
+    }
+
+    pub fn forward(&mut self, lm_head: &Linear, output: &mut [f32], input: &QuantizedTensor) {
+        let start = Instant::now();
+        self.select_candidates(output, input);
+        lm_head.forward_rows(output, input, &self.candidates);
+        self.stats.steps += 1;
+        self.stats.two_stage_time += start.elapsed();
+
+        if let Some(verification) = &mut self.verification {
+            let start = Instant::now();
+            lm_head.forward(&mut verification.exact, input);
+            self.stats.exact_time += start.elapsed();
+
+            verification.record(&self.candidates, &mut self.stats);
+        }
+    }
+
+    /// Scores the vocabulary with the 4-bit weights and keeps the `top_k` best rows.
+    fn select_candidates(&mut self, scores: &mut [f32], input: &QuantizedTensor) {
+        matmul_q4(
+            scores,
+            input,
+            &self.weight,
+            self.in_features,
+            self.out_features,
+            self.group_size,
+        );
+
+        self.candidates.clear();
+        self.candidates.extend(0..self.out_features as u32);
+        if self.top_k < self.out_features {
+            self.candidates
+                .select_nth_unstable_by(self.top_k - 1, |&a, &b| {
+                    scores[b as usize].total_cmp(&scores[a as usize])
+                });
+            self.candidates.truncate(self.top_k);
+        }
+        // Sorted rows keep the exact rescoring a forward scan over the weights
+        self.candidates.sort_unstable();
+    }
+}
+
+impl PrescreenVerification {
+    fn record(&mut self, candidates: &[u32], stats: &mut PrescreenStats) {
+        let exact = &self.exact;
+        let is_candidate = |token: u32| candidates.binary_search(&token).is_ok();
+
+        self.order.clear();
+        self.order.extend(0..exact.len() as u32);
+        self.order
+            .sort_unstable_by(|&a, &b| exact[b as usize].total_cmp(&exact[a as usize]));
+
+        // Smallest prefix of tokens holding `topp` of the probability mass, and the mass
+        // the candidates miss; greedy decoding puts all of it on the argmax
+        let argmax_hit = is_candidate(self.order[0]);
+        let mut topp_set = 1;
+        let mut missed_mass = if argmax_hit { 0.0 } else { 1.0 };
+        if self.temperature > 0.0 {
+            let max_logit = exact[self.order[0] as usize];
+            let weight =
+                |token: u32| ((exact[token as usize] - max_logit) / self.temperature).exp();
+            let total: f32 = self.order.iter().map(|&token| weight(token)).sum();
+
+            let mut cumulative = 0.0;
+            topp_set = self.order.len();
+            for (i, &token) in self.order.iter().enumerate() {
+                cumulative += weight(token) / total;
+                if cumulative >= self.topp {
+                    topp_set = i + 1;
+                    break;
+                }
+            }
+
+            let missed: f32 = self
+                .order
+                .iter()
+                .filter(|&&token| !is_candidate(token))
+                .map(|&token| weight(token))
+                .sum();
+            missed_mass = (missed / total) as f64;
+        }
+
+        stats.verified_steps += 1;
+        stats.argmax_hits += argmax_hit as usize;
+        stats.topp_hits += self.order[..topp_set].iter().all(|&t| is_candidate(t)) as usize;
+        stats.missed_mass += missed_mass;
+    }
+}
+
+impl std::fmt::Debug for PrescreenHead {
+    fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+        f.debug_struct("PrescreenHead")
+            .field("in_features", &self.in_features)
+            .field("out_features", &self.out_features)
+            .field("group_size", &self.group_size)
+            .field("top_k", &self.top_k)
+            .field("verification", &self.verification.is_some())
+            .finish()
+    }
+}
+
 /// Multi-Head Attention with Grouped Query Attention (GQA) optimization
 ///
 /// **Architecture Details**:
@@ -370,7 +825,7 @@ impl MultiHeadAttention {
             wo,
             q_norm,
             k_norm,
-            rope: RoPE::new(config.head_dim),
+            rope: RoPE::new(config.head_dim, config.rope_theta),
             n_heads: config.n_heads,
             n_kv_heads: config.n_kv_heads,
             head_dim: config.head_dim,
@@ -392,46 +847,116 @@ impl MultiHeadAttention {
             .forward(&mut state.value_cache[current_pos_offset..], &state.xq);
 
         // Apply normalization and RoPE
-        let rope_freqs = self.rope.compute_freqs(pos);
-        self.apply_qk_normalization_and_rope(current_pos_offset, &rope_freqs, state);
+        self.rope.compute_freqs(pos, &mut state.rope_freqs);
+        self.apply_qk_normalization_and_rope(current_pos_offset, state);
 
         // Compute attention
         self.compute_attention(pos, kv_cache_offset, state);
     }
 
-    fn apply_qk_normalization_and_rope(
+    /// Batched counterpart of [`Self::forward`] for the rows of `batch`, whose K/V go to
+    /// the cache rows `start_pos..`. Reads the normalized input from `batch.xq` and leaves
+    /// the output in `batch.att_out`.
+    fn forward_batch(
         &self,
-        current_pos_offset: usize,
-        rope_freqs: &[(f32, f32)],
+        start_pos: usize,
+        layer_idx: usize,
+        batch: &mut BatchState,
         state: &mut RunState,
     ) {
-        // Process Query heads
-        for head_idx in 0..self.n_heads {
-            let q_range = head_idx * self.head_dim..(head_idx + 1) * self.head_dim;
-            let q_slice = &mut state.q[q_range.clone()];
+        let kv_dim = self.n_kv_heads * self.head_dim;
+        let kv_cache_offset = layer_idx * self.seq_len * kv_dim;
+        // The cache rows of consecutive positions are contiguous: write K and V in place
+        let batch_rows = kv_cache_offset + start_pos * kv_dim
+            ..kv_cache_offset + (start_pos + batch.len) * kv_dim;
+
+        self.wq.forward_batch(&mut batch.q, &batch.xq);
+        self.wk
+            .forward_batch(&mut state.key_cache[batch_rows.clone()], &batch.xq);
+        self.wv
+            .forward_batch(&mut state.value_cache[batch_rows.clone()], &batch.xq);
+
+        let all_heads_dim = self.n_heads * self.head_dim;
+        let rows = batch
+            .q
+            .chunks_exact_mut(all_heads_dim)
+            .zip(state.key_cache[batch_rows].chunks_exact_mut(kv_dim));
+        for (&pos, (q, k)) in batch.pos.iter().zip(rows) {
+            self.rope.compute_freqs(pos, &mut state.rope_freqs);
+            self.normalize_and_rotate(q, k, &state.rope_freqs, &mut state.temp_workspace);
+        }
+
+        // One task per (row, head); each attends causally over the cache rows of its own
+        // sequence, from `attend_from` up to its own row. No span exceeds `start_pos +
+        // batch.len`, so each worker reuses one score buffer of that size.
+        let keys = &state.key_cache[kv_cache_offset..];
+        let values = &state.value_cache[kv_cache_offset..];
+        let q = &batch.q;
+        let attend_from = &batch.attend_from;
+        let max_span = start_pos + batch.len;
+        batch
+            .att_out
+            .par_chunks_mut(self.head_dim)
+            .enumerate()
+            .for_each_init(
+                || vec![0.0; max_span],
+                |att, (idx, out)| {
+                    let row = idx / self.n_heads;
+                    let head_idx = idx % self.n_heads;
+                    let first = attend_from[row] * kv_dim;
+                    let q_head = &q[idx * self.head_dim..(idx + 1) * self.head_dim];
+                    let span = start_pos + row + 1 - attend_from[row];
+                    self.attend(
+                        q_head,
+                        head_idx / self.kv_mul,
+                        &keys[first..],
+                        &values[first..],
+                        &mut att[..span],
+                        out,
+                    );
+                },
+            );
+    }
+
+    fn apply_qk_normalization_and_rope(&self, current_pos_offset: usize, state: &mut RunState) {
+        let kv_dim = self.n_kv_heads * self.head_dim;
+        self.normalize_and_rotate(
+            &mut state.q,
+            &mut state.key_cache[current_pos_offset..current_pos_offset + kv_dim],
+            &state.rope_freqs,
+            &mut state.temp_workspace,
+        );
+    }
+
+    /// Applies QK-RMSNorm and RoPE to the query heads `q` and key heads `k` of one position.
+    fn normalize_and_rotate(
+        &self,
+        q: &mut [f32],
+        k: &mut [f32],
+        rope_freqs: &[(f32, f32)],
+        workspace: &mut [f32],
+    ) {
+        let workspace = &mut workspace[..self.head_dim];
 
-            state.temp_workspace[..self.head_dim].copy_from_slice(q_slice);
-            self.q_norm
-                .forward(q_slice, &state.temp_workspace[..self.head_dim]);
+        // Process Query heads
+        for q_slice in q.chunks_exact_mut(self.head_dim) {
+            workspace.copy_from_slice(q_slice);
+            self.q_norm.forward(q_slice, workspace);
             self.rope.apply(q_slice, rope_freqs);
         }
 
         // Process Key heads
-        for head_idx in 0..self.n_kv_heads {
-            let k_range = current_pos_offset + head_idx * self.head_dim
-                ..current_pos_offset + (head_idx + 1) * self.head_dim;
-            let k_slice = &mut state.key_cache[k_range];
-
-            state.temp_workspace[..self.head_dim].copy_from_slice(k_slice);
-            self.k_norm
-                .forward(k_slice, &state.temp_workspace[..self.head_dim]);
+        for k_slice in k.chunks_exact_mut(self.head_dim) {
+            workspace.copy_from_slice(k_slice);
+            self.k_norm.forward(k_slice, workspace);
             self.rope.apply(k_slice, rope_freqs);
         }
     }
 
     fn compute_attention(&self, pos: usize, kv_cache_offset: usize, state: &mut RunState) {
-        let attention_scale = (self.head_dim as f32).sqrt().recip();
-        let kv_dim = self.n_kv_heads * self.head_dim;
+        let keys = &state.key_cache[kv_cache_offset..];
+        let values = &state.value_cache[kv_cache_offset..];
+        let q = &state.q;
 
         state
             .att
@@ -439,46 +964,63 @@ impl MultiHeadAttention {
             .zip(state.xb.par_chunks_mut(self.head_dim))
             .zip((0..self.n_heads).into_par_iter())
             .for_each(|((att_slice, xb_slice), head_idx)| {
-                let q_range = head_idx * self.head_dim..(head_idx + 1) * self.head_dim;
-                let kv_head_idx = head_idx / self.kv_mul;
-
-                // Compute attention scores for this head
-                let att_head = &mut att_slice[0..=pos];
-
-                // Vectorized dot product computation
-                att_head
-                    .iter_mut()
-                    .enumerate()
-                    .for_each(|(time_step, att_score)| {
-                        let k_cache_start =
-                            kv_cache_offset + time_step * kv_dim + kv_head_idx * self.head_dim;
-                        let k_cache_end = k_cache_start + self.head_dim;
-
-                        *att_score = state.q[q_range.clone()]
-                            .iter()
-                            .zip(&state.key_cache[k_cache_start..k_cache_end])
-                            .map(|(&q, &k)| q * k)
-                            .sum::<f32>()
-                            * attention_scale;
-                    });
-
-                // Apply softmax
-                softmax(att_head);
-
-                // Compute weighted sum of values
-                xb_slice.fill(0.0);
-                for time_step in 0..=pos {
-                    let v_cache_start =
-                        kv_cache_offset + time_step * kv_dim + kv_head_idx * self.head_dim;
-                    let v_cache_end = v_cache_start + self.head_dim;
-                    let attention_weight = att_head[time_step];
-
-                    xb_slice
-                        .iter_mut()
-                        .zip(&state.value_cache[v_cache_start..v_cache_end])
-                        .for_each(|(out, &value)| *out += attention_weight * value);
-                }
+                let q_head = &q[head_idx * self.head_dim..(head_idx + 1) * self.head_dim];
+                self.attend(
+                    q_head,
+                    head_idx / self.kv_mul,
+                    keys,
+                    values,
+                    &mut att_slice[0..=pos],
+                    xb_slice,
+                );
+            });
+    }
+
+    /// Attention of one query head over the cached positions `0..att.len()` of a layer.
+    ///
+    /// `keys` and `values` start at the layer's cache rows; the attention weights are left
+    /// in `att` and their weighted sum of values is written to `out`.
+    fn attend(
+        &self,
+        q_head: &[f32],
+        kv_head_idx: usize,
+        keys: &[f32],
+        values: &[f32],
+        att: &mut [f32],
+        out: &mut [f32],
+    ) {
+        let attention_scale = (self.head_dim as f32).sqrt().recip();
+        let kv_dim = self.n_kv_heads * self.head_dim;
+        let head_offset = kv_head_idx * self.head_dim;
+
+        // Vectorized dot product computation
+        att.iter_mut()
+            .enumerate()
+            .for_each(|(time_step, att_score)| {
+                let k_cache_start = time_step * kv_dim + head_offset;
+                let k_cache_end = k_cache_start + self.head_dim;
+
+                *att_score = q_head
+                    .iter()
+                    .zip(&keys[k_cache_start..k_cache_end])
+                    .map(|(&q, &k)| q * k)
+                    .sum::<f32>()
+                    * attention_scale;
             });
+
+        // Apply softmax
+        softmax(att);
+
+        // Compute weighted sum of values
+        out.fill(0.0);
+        for (time_step, &attention_weight) in att.iter().enumerate() {
+            let v_cache_start = time_step * kv_dim + head_offset;
+            let v_cache_end = v_cache_start + self.head_dim;
+
+            out.iter_mut()
+                .zip(&values[v_cache_start..v_cache_end])
+                .for_each(|(out, &value)| *out += attention_weight * value);
+        }
     }
 }
 
@@ -532,19 +1074,33 @@ impl FeedForward {
         self.w3.forward(&mut state.hb2, &state.xq);
 
         // Apply SwiGLU activation
-        state
-            .hb
-            .iter_mut()
-            .zip(state.hb2.iter())
-            .for_each(|(gate_val, &linear_val)| {
-                let swish_output = *gate_val * (1.0f32 + (-*gate_val).exp()).recip();
-                *gate_val = swish_output * linear_val;
-            });
+        swiglu(&mut state.hb, &state.hb2);
 
         // Down projection
         quantize(&mut state.hq, &state.hb, state.hb.len(), self.w2.group_size);
         self.w2.forward(&mut state.xb, &state.hq);
     }
+
+    /// Batched counterpart of [`Self::forward`], from `batch.xq` to `batch.xb2`.
+    fn forward_batch(&self, batch: &mut BatchState) {
+        self.w1.forward_batch(&mut batch.hb, &batch.xq);
+        self.w3.forward_batch(&mut batch.hb2, &batch.xq);
+
+        swiglu(&mut batch.hb, &batch.hb2);
+
+        quantize(&mut batch.hq, &batch.hb, batch.hb.len(), self.w2.group_size);
+        self.w2.forward_batch(&mut batch.xb2, &batch.hq);
+    }
+}
+
+/// SwiGLU activation: `gate = swish(gate) * up`, in place.
+fn swiglu(gate: &mut [f32], up: &[f32]) {
+    gate.iter_mut()
+        .zip(up.iter())
+        .for_each(|(gate_val, &linear_val)| {
+            let swish_output = *gate_val * (1.0f32 + (-*gate_val).exp()).recip();
+            *gate_val = swish_output * linear_val;
+        });
 }
 
 impl std::fmt::Debug for FeedForward {
@@ -651,6 +1207,70 @@ impl TransformerBlock {
             .zip(state.xb.iter())
             .for_each(|(x_val, &delta)| *x_val += delta);
     }
+
+    /// Batched counterpart of [`Self::forward`] over the rows of `batch`.
+    fn forward_batch(&self, start_pos: usize, batch: &mut BatchState, state: &mut RunState) {
+        let dim = self.attn_norm.weight.len();
+
+        // Attention block with residual connection
+        for (xb, x) in batch
+            .xb
+            .chunks_exact_mut(dim)
+            .zip(batch.x.chunks_exact(dim))
+        {
+            self.attn_norm.forward(xb, x);
+        }
+        quantize(
+            &mut batch.xq,
+            &batch.xb,
+            batch.xb.len(),
+            self.attention.wq.group_size,
+        );
+
+        self.attention
+            .forward_batch(start_pos, self.layer_idx, batch, state);
+
+        quantize(
+            &mut batch.att_q,
+            &batch.att_out,
+            batch.att_out.len(),
+            self.attention.wo.group_size,
+        );
+        self.attention
+            .wo
+            .forward_batch(&mut batch.xb2, &batch.att_q);
+
+        // Residual connection
+        batch
+            .x
+            .iter_mut()
+            .zip(batch.xb2.iter())
+            .for_each(|(x_val, &delta)| *x_val += delta);
+
+        // Feed-forward block with residual connection
+        for (xb, x) in batch
+            .xb
+            .chunks_exact_mut(dim)
+            .zip(batch.x.chunks_exact(dim))
+        {
+            self.ffn_norm.forward(xb, x);
+        }
+        quantize(
+            &mut batch.xq,
+            &batch.xb,
+            batch.xb.len(),
+            self.feed_forward.w1.group_size,
+        );
+
+        self.feed_forward.forward_batch(batch);
+
+        // Residual connection
+        batch
+            .x
+            .iter_mut()
+            .zip(batch.xb2.iter())
+            .for_each(|(x_val, &delta)| *x_val += delta);
+    }
 }
 
 impl std::fmt::Debug for TransformerBlock {
@@ -668,28 +1288,105 @@ impl std::fmt::Debug for TransformerBlock {
 /// Builder pattern for creating transformer models
 pub struct TransformerBuilder {
     checkpoint_path: String,
+    checkpoint_cache: Option<String>,
     ctx_length: Option<usize>,
+    prescreen_top_k: Option<usize>,
+    prescreen_verification: Option<(f32, f32)>,
 }
 
 impl TransformerBuilder {
     pub fn new(checkpoint_path: &str) -> Self {
         Self {
             checkpoint_path: checkpoint_path.to_string(),
+            checkpoint_cache: None,
             ctx_length: None,
+            prescreen_top_k: None,
+            prescreen_verification: None,
         }
     }
 
+    /// Where to keep the quantized checkpoint when loading a Hugging Face model directory.
+    ///
+    /// The cache is reused while it is newer than the model files; without it, the model
+    /// is quantized into memory again on every load.
+    pub fn with_checkpoint_cache(mut self, cache: Option<&str>) -> Self {
+        self.checkpoint_cache = cache.map(str::to_string);
+        self
+    }
+
     pub fn with_ctx_length(mut self, ctx_length: Option<usize>) -> Self {
         self.ctx_length = ctx_length;
         self
     }
 
+    /// Enables the two-stage classifier with `top_k` exactly rescored candidates.
+    ///
+    /// Requires a checkpoint exported with the 4-bit classifier copy.
+    pub fn with_prescreen(mut self, top_k: Option<usize>) -> Self {
+        self.prescreen_top_k = top_k;
+        self
+    }
+
+    /// Compares the two-stage classifier against the exact one on every step, measuring
+    /// top-p agreement for the given `(temperature, topp)`.
+    pub fn with_prescreen_verification(mut self, sampling: Option<(f32, f32)>) -> Self {
+        self.prescreen_verification = sampling;
+        self
+    }
+
+    /// Loads the checkpoint, which may also be a GGUF file or a Hugging Face model
+    /// directory; see [`Self::with_checkpoint_cache`].
     pub fn build(self) -> Result<Transformer> {
-        let file = File::open(&self.checkpoint_path)
-            .with_context(|| format!("Failed to open checkpoint: {}", self.checkpoint_path))?;
+        let start = Instant::now();
+        let transformer = if hf_model::is_hf_model_dir(&self.checkpoint_path) {
+            self.build_from_hf_model()?
+        } else if gguf::is_gguf_file(&self.checkpoint_path) {
+            self.load_gguf(Path::new(&self.checkpoint_path))?
+        } else {
+            self.load(Path::new(&self.checkpoint_path))?
+        };
+        info!(
+            "Loaded {} in {:.2}s",
+            self.checkpoint_path,
+            start.elapsed().as_secs_f64()
+        );
+        Ok(transformer)
+    }
+
+    /// Quantizes a Hugging Face model into a checkpoint, cached or in memory, and loads it
+    fn build_from_hf_model(&self) -> Result<Transformer> {
+        let model_dir = &self.checkpoint_path;
+        let prescreen = self.prescreen_top_k.is_some();
+
+        let Some(cache) = &self.checkpoint_cache else {
+            let start = Instant::now();
+            let checkpoint = hf_model::quantize_weights(model_dir, prescreen)?;
+            info!(
+                "Quantized {model_dir} in {:.2}s ({} MiB in memory)",
+                start.elapsed().as_secs_f64(),
+                checkpoint.len() >> 20
+            );
+            return self.load_from(MemoryMapper::from_bytes(checkpoint)?);
+        };
+
+        let cache = Path::new(cache);
+        let reusable = hf_model::is_cache_fresh(model_dir, cache)
+            && read_checkpoint_config(&cache.to_string_lossy())
+                .is_ok_and(|config| config.classifier_prescreen || !prescreen);
+        if !reusable {
+            hf_model::export_weights_to_cache(model_dir, cache, prescreen)?;
+        }
+        self.load(cache)
+    }
+
+    fn load(&self, checkpoint_path: &Path) -> Result<Transformer> {
+        let file = File::open(checkpoint_path)
+            .with_context(|| format!("Failed to open checkpoint: {}", checkpoint_path.display()))?;
 
-        let mut mapper = MemoryMapper::new(file)?;
+        self.load_from(MemoryMapper::new(file)?)
+    }
 
+    fn load_from(&self, mut mapper: MemoryMapper) -> Result<Transformer> {
         // Read config from the first part of the file
         let mut config = read_config(&mut mapper)?;
 
@@ -699,7 +1396,29 @@ impl TransformerBuilder {
         }
 
         let weights = Self::load_weights(&mut mapper, &config)?;
+        self.assemble(config, weights, Some(mapper))
+    }
+
+    /// Loads a GGUF file, converting its weights to the engine's layout
+    fn load_gguf(&self, gguf_path: &Path) -> Result<Transformer> {
+        let gguf = GgufFile::open(gguf_path)?;
+        let mut config = gguf.model_config()?;
+        if let Some(ctx_len) = self.ctx_length {
+            config.seq_len = ctx_len.min(config.seq_len);
+        }
+
+        // The weights are converted to owned buffers, so the mapping is dropped here
+        let weights = gguf.load_weights(&config)?;
+        self.assemble(config, weights, None)
+    }
 
+    /// Builds the model and its runtime state from loaded weights
+    fn assemble(
+        &self,
+        config: ModelConfig,
+        weights: TransformerWeights,
+        mapper: Option<MemoryMapper>,
+    ) -> Result<Transformer> {
         // Initialize runtime state
         let state = RunState::new(&config)?;
 
@@ -721,17 +1440,45 @@ impl TransformerBuilder {
             config.group_size,
         );
 
+        // Create the two-stage classification head, if requested
+        let prescreen = match (self.prescreen_top_k, weights.wcls_q4) {
+            (None, _) => None,
+            (Some(_), None) => anyhow::bail!(
+                "Checkpoint has no 4-bit classifier copy; re-export it with --prescreen-head"
+            ),
+            (Some(top_k), Some(weight)) => {
+                let head = PrescreenHead::new(
+                    weight,
+                    config.dim,
+                    config.vocab_size,
+                    config.group_size,
+                    top_k,
+                );
+                Some(match self.prescreen_verification {
+                    Some((temperature, topp)) => head.with_verification(temperature, topp),
+                    None => head,
+                })
+            }
+        };
+
         // Create token embedding
         let token_embedding = TokenEmbedding::new(weights.token_embedding_table, config.dim);
+        let batch = BatchState::new(0, &config);
 
-        Ok(Transformer {
-            config,
+        let model = Model {
             token_embedding,
             blocks,
             final_norm,
             lm_head,
+            _mapper: mapper,
+        };
+
+        Ok(Transformer {
+            config,
+            model: Arc::new(model),
+            prescreen,
+            batch,
             state,
-            _mapper: mapper, // Keep the mapper alive for the lifetime of the transformer
         })
     }
 
@@ -743,6 +1490,7 @@ impl TransformerBuilder {
     /// 3. Attention weights (quantized)
     /// 4. Feed-forward weights (quantized)
     /// 5. Classification weights (quantized, may be shared)
+    /// 6. 4-bit classification weights (optional)
     fn load_weights(mapper: &mut MemoryMapper, config: &ModelConfig) -> Result<TransformerWeights> {
         let ModelConfig {
             group_size,
@@ -754,6 +1502,7 @@ impl TransformerBuilder {
             n_heads,
             n_kv_heads,
             shared_classifier,
+            classifier_prescreen,
             ..
         } = *config;
 
@@ -774,11 +1523,23 @@ impl TransformerBuilder {
             };
         }
 
-        let rms_att_weight = read_f32_weights!(n_layers * dim, "attention normalization weights");
-        let rms_ffn_weight = read_f32_weights!(n_layers * dim, "FFN normalization weights");
-        let rms_final_weight = read_f32_weights!(dim, "final normalization weights");
-        let q_ln_weights = read_f32_weights!(n_layers * head_dim, "query layer norm weights");
-        let k_ln_weights = read_f32_weights!(n_layers * head_dim, "key layer norm weights");
+        let rms_att_weight = Cow::Borrowed(read_f32_weights!(
+            n_layers * dim,
+            "attention normalization weights"
+        ));
+        let rms_ffn_weight = Cow::Borrowed(read_f32_weights!(
+            n_layers * dim,
+            "FFN normalization weights"
+        ));
+        let rms_final_weight = Cow::Borrowed(read_f32_weights!(dim, "final normalization weights"));
+        let q_ln_weights = Cow::Borrowed(read_f32_weights!(
+            n_layers * head_dim,
+            "query layer norm weights"
+        ));
+        let k_ln_weights = Cow::Borrowed(read_f32_weights!(
+            n_layers * head_dim,
+            "key layer norm weights"
+        ));
 
         // Read quantized tensors
         let q_tokens = Self::create_quantized_tensors(mapper, 1, vocab_size * dim, group_size)?
@@ -807,6 +1568,18 @@ impl TransformerBuilder {
                 .expect("Expected exactly one classification tensor")
         };
 
+        let wcls_q4 = if classifier_prescreen {
+            let q_bytes = mapper
+                .get_bytes(vocab_size * dim / 2)
+                .context("Failed to read 4-bit classifier data")?;
+            // SAFETY: we keep the mmap alive for the lifetime of the transformer
+            let q = unsafe { std::mem::transmute::<&[u8], &'static [u8]>(q_bytes) };
+            let s = read_f32_weights!(vocab_size * dim / group_size, "4-bit classifier scales");
+            Some(Q4Tensor { q, s })
+        } else {
+            None
+        };
+
         Ok(TransformerWeights {
             token_embedding_table,
             rms_att_weight,
@@ -822,6 +1595,7 @@ impl TransformerBuilder {
             w3,
             rms_final_weight,
             wcls,
+            wcls_q4,
         })
     }
 
@@ -947,18 +1721,18 @@ pub(crate) fn softmax(x: &mut [f32]) {
 /// This structure holds both quantized weights (for memory efficiency) and
 /// pre-computed values like the dequantized token embedding table.
 #[derive(Debug)]
-struct TransformerWeights {
+pub(crate) struct TransformerWeights {
     /// Pre-dequantized token embedding table for fast lookup during inference
     /// Shape: [vocab_size, dim]
     pub token_embedding_table: Vec<f32>,
 
     /// RMS normalization weights for attention layers
     /// Shape: [n_layers, dim] (flattened)
-    pub rms_att_weight: &'static [f32],
+    pub rms_att_weight: Cow<'static, [f32]>,
 
     /// RMS normalization weights for feed-forward layers
     /// Shape: [n_layers, dim] (flattened)
-    pub rms_ffn_weight: &'static [f32],
+    pub rms_ffn_weight: Cow<'static, [f32]>,
 
     /// Attention projection weights (quantized for memory efficiency)
     /// Query projections: [n_layers] × [dim, n_heads * head_dim]
@@ -972,9 +1746,9 @@ struct TransformerWeights {
 
     /// QK-RMSNorm weights for Qwen3 architecture
     /// Query layer norm: [n_layers, head_dim] (flattened)
-    pub q_ln_weights: &'static [f32],
+    pub q_ln_weights: Cow<'static, [f32]>,
     /// Key layer norm: [n_layers, head_dim] (flattened)
-    pub k_ln_weights: &'static [f32],
+    pub k_ln_weights: Cow<'static, [f32]>,
 
     /// Feed-forward network weights (quantized)
     /// Gate projection: [n_layers] × [dim, hidden_dim]
@@ -986,11 +1760,15 @@ struct TransformerWeights {
 
     /// Final RMS normalization weight before classification
     /// Shape: [dim]
-    pub rms_final_weight: &'static [f32],
+    pub rms_final_weight: Cow<'static, [f32]>,
 
     /// Classification head weights (may be shared with token embeddings)
     /// Shape: [dim, vocab_size]
     pub wcls: QuantizedTensor,
+
+    /// 4-bit copy of the classification head for the two-stage classifier
+    /// Shape: [dim, vocab_size]
+    pub wcls_q4: Option<Q4Tensor>,
 }
 
 /// Runtime state for transformer inference.
@@ -1049,6 +1827,10 @@ struct RunState {
     /// Temporary workspace to avoid allocations in hot paths.
     /// Used for intermediate computations
     pub temp_workspace: Vec<f32>,
+
+    /// RoPE `(cos, sin)` rotations for the current position
+    /// Shape: [head_dim / 2]
+    pub rope_freqs: Vec<(f32, f32)>,
 }
 
 impl RunState {
@@ -1097,6 +1879,121 @@ impl RunState {
 
             // Temporary workspace for computations
             temp_workspace: vec![0.0; head_dim],
+            rope_freqs: vec![(1.0, 0.0); head_dim / 2],
         })
     }
 }
+
+/// Activations of a batch of positions for [`Transformer::forward_batch`],
+/// [`Transformer::prefill`] and the hidden-state passes, one row per position.
+///
+/// The KV cache is shared with [`RunState`]; row `i` of a batch at `start_pos` is stored in
+/// cache row `start_pos + i`. Buffers are allocated for `capacity` rows and resized in
+/// place to the rows in use, so shorter batches do not reallocate.
+#[derive(Debug)]
+struct BatchState {
+    /// Number of positions in the batch
+    pub len: usize,
+
+    /// Number of rows the buffers are allocated for
+    pub capacity: usize,
+
+    /// Position of each row within its sequence, for RoPE
+    pub pos: Vec<usize>,
+
+    /// First cache row each row attends to: the start of its sequence
+    pub attend_from: Vec<usize>,
+
+    /// Residual stream, then the final-norm hidden states
+    /// Shape: [len, dim]
+    pub x: Vec<f32>,
+
+    /// Normalized residual stream
+    /// Shape: [len, dim]
+    pub xb: Vec<f32>,
+
+    /// Attention and feed-forward outputs
+    /// Shape: [len, dim]
+    pub xb2: Vec<f32>,
+
+    /// Quantized `xb`, then the quantized final hidden states for the classifier
+    /// Shape: [len, dim]
+    pub xq: QuantizedTensor,
+
+    /// Queries
+    /// Shape: [len, n_heads * head_dim]
+    pub q: Vec<f32>,
+
+    /// Attention outputs before the output projection
+    /// Shape: [len, n_heads * head_dim]
+    pub att_out: Vec<f32>,
+
+    /// Quantized `att_out`
+    /// Shape: [len, n_heads * head_dim]
+    pub att_q: QuantizedTensor,
+
+    /// Feed-forward hidden buffers
+    /// Shape: [len, hidden_dim]
+    pub hb: Vec<f32>,
+    pub hb2: Vec<f32>,
+    pub hq: QuantizedTensor,
+
+    /// Logits, only allocated by [`Transformer::forward_batch`]
+    /// Shape: [len, vocab_size]
+    pub logits: Vec<f32>,
+}
+
+impl BatchState {
+    fn new(len: usize, config: &ModelConfig) -> Self {
+        let ModelConfig {
+            group_size,
+            n_heads,
+            head_dim,
+            dim,
+            hidden_dim,
+            ..
+        } = *config;
+        let all_heads_dim = n_heads * head_dim;
+
+        Self {
+            len,
+            capacity: len,
+            pos: vec![0; len],
+            attend_from: vec![0; len],
+            x: vec![0.0; len * dim],
+            xb: vec![0.0; len * dim],
+            xb2: vec![0.0; len * dim],
+            xq: QuantizedTensor::new(len * dim, group_size),
+            q: vec![0.0; len * all_heads_dim],
+            att_out: vec![0.0; len * all_heads_dim],
+            att_q: QuantizedTensor::new(len * all_heads_dim, group_size),
+            hb: vec![0.0; len * hidden_dim],
+            hb2: vec![0.0; len * hidden_dim],
+            hq: QuantizedTensor::new(len * hidden_dim, group_size),
+            logits: Vec::new(),
+        }
+    }
+
+    /// Resizes the buffers to `len` rows; within `capacity` this never reallocates.
+    fn resize(&mut self, len: usize, config: &ModelConfig) {
+        let all_heads_dim = config.n_heads * config.head_dim;
+        let resize_quantized = |tensor: &mut QuantizedTensor, size: usize| {
+            tensor.q.to_mut().resize(size, 0);
+            tensor.s.to_mut().resize(size / config.group_size, 0.0);
+        };
+
+        self.len = len;
+        self.pos.resize(len, 0);
+        self.attend_from.resize(len, 0);
+        self.x.resize(len * config.dim, 0.0);
+        self.xb.resize(len * config.dim, 0.0);
+        self.xb2.resize(len * config.dim, 0.0);
+        resize_quantized(&mut self.xq, len * config.dim);
+        self.q.resize(len * all_heads_dim, 0.0);
+        self.att_out.resize(len * all_heads_dim, 0.0);
+        resize_quantized(&mut self.att_q, len * all_heads_dim);
+        self.hb.resize(len * config.hidden_dim, 0.0);
+        self.hb2.resize(len * config.hidden_dim, 0.0);
+        resize_quantized(&mut self.hq, len * config.hidden_dim);
+    }
+}
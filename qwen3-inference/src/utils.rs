@@ -3,9 +3,17 @@ use memmap2::Mmap;
 use std::fs::File;
 use std::slice;
 
+/// Checkpoint bytes read through a [`MemoryMapper`]
+#[derive(Debug)]
+enum Backing {
+    Mapped(Mmap),
+    /// A checkpoint built in memory, such as one quantized at load
+    Owned(Vec<u8>),
+}
+
 #[derive(Debug)]
 pub(crate) struct MemoryMapper {
-    mmap: Mmap,
+    backing: Backing,
     offset: usize,
 }
 
@@ -16,22 +24,33 @@ impl MemoryMapper {
                 .map(&file)
                 .context("Failed to create memory mapping")?
         };
-        Ok(Self { mmap, offset: 0 })
+        Ok(Self {
+            backing: Backing::Mapped(mmap),
+            offset: 0,
+        })
     }
 
-    pub fn get_f32_slice(&mut self, count: usize) -> Result<&[f32]> {
-        let bytes_needed = count * std::mem::size_of::<f32>();
+    /// Reads a checkpoint held in memory rather than mapped from a file.
+    pub fn from_bytes(bytes: Vec<u8>) -> Result<Self> {
+        if bytes.as_ptr() as usize % std::mem::align_of::<f32>() != 0 {
+            anyhow::bail!("Checkpoint buffer is not aligned for f32 data");
+        }
+        Ok(Self {
+            backing: Backing::Owned(bytes),
+            offset: 0,
+        })
+    }
 
-        if self.offset + bytes_needed > self.mmap.len() {
-            anyhow::bail!(
-                "Insufficient data: need {} bytes, have {} remaining",
-                bytes_needed,
-                self.mmap.len() - self.offset
-            );
+    fn data(&self) -> &[u8] {
+        match &self.backing {
+            Backing::Mapped(mmap) => mmap,
+            Backing::Owned(bytes) => bytes,
         }
+    }
 
-        let byte_slice = &self.mmap[self.offset..self.offset + bytes_needed];
-        self.offset += bytes_needed;
+    pub fn get_f32_slice(&mut self, count: usize) -> Result<&[f32]> {
+        let bytes_needed = count * std::mem::size_of::<f32>();
+        let byte_slice = self.get_bytes(bytes_needed)?;
 
         // SAFETY: We're casting from &[u8] to &[f32]
         // This is safe because:
@@ -44,24 +63,38 @@ impl MemoryMapper {
     }
 
     pub fn get_bytes(&mut self, count: usize) -> Result<&[u8]> {
-        if self.offset + count > self.mmap.len() {
+        let start = self.offset;
+        let available = self.data().len();
+        if start + count > available {
             anyhow::bail!(
                 "Insufficient data: need {} bytes, have {} remaining",
                 count,
-                self.mmap.len() - self.offset
+                available - start
             );
         }
 
-        let result = &self.mmap[self.offset..self.offset + count];
         self.offset += count;
-        Ok(result)
+        Ok(&self.data()[start..start + count])
+    }
+
+    /// The whole mapped file, independent of the read position
+    pub fn bytes(&self) -> &[u8] {
+        self.data()
     }
 
     pub fn skip(&mut self, bytes: usize) -> Result<()> {
-        if self.offset + bytes > self.mmap.len() {
+        if self.offset + bytes > self.data().len() {
             anyhow::bail!("Cannot skip {} bytes: insufficient data", bytes);
         }
         self.offset += bytes;
         Ok(())
     }
 }
+
+/// Peak resident memory of this process in bytes, where the platform reports it.
+pub(crate) fn peak_memory_bytes() -> Option<u64> {
+    let status = std::fs::read_to_string("/proc/self/status").ok()?;
+    let line = status.lines().find(|line| line.starts_with("VmHWM:"))?;
+    let kib: u64 = line.split_whitespace().nth(1)?.parse().ok()?;
+    Some(kib * 1024)
+}
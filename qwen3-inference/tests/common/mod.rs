@@ -0,0 +1,267 @@
+//! Shared helpers for integration tests: writes tiny synthetic checkpoints and tokenizers.
+
+#![allow(dead_code)]
+
+use qwen3_export::TokenizerExporter;
+use qwen3_inference::{Transformer, TransformerBuilder};
+use std::fs::File;
+use std::io::{BufWriter, Write};
+use std::path::{Path, PathBuf};
+
+/// Dimensions of a synthetic test model
+#[derive(Debug, Clone, Copy)]
+pub struct TestModelConfig {
+    pub dim: usize,
+    pub hidden_dim: usize,
+    pub n_layers: usize,
+    pub n_heads: usize,
+    pub n_kv_heads: usize,
+    pub head_dim: usize,
+    pub vocab_size: usize,
+    pub seq_len: usize,
+    pub group_size: usize,
+    pub shared_classifier: bool,
+    /// Append a 4-bit copy of the classifier for the two-stage classifier
+    pub classifier_prescreen: bool,
+}
+
+impl Default for TestModelConfig {
+    fn default() -> Self {
+        Self {
+            dim: 64,
+            hidden_dim: 128,
+            n_layers: 2,
+            n_heads: 4,
+            n_kv_heads: 2,
+            head_dim: 16,
+            vocab_size: 256,
+            seq_len: 64,
+            group_size: 32,
+            shared_classifier: false,
+            classifier_prescreen: false,
+        }
+    }
+}
+
+/// Deterministic pseudo-random values in [-scale, scale]
+pub fn pseudo_random(count: usize, seed: u64, scale: f32) -> Vec<f32> {
+    let mut state = seed.wrapping_mul(0x9E3779B97F4A7C15) | 1;
+    (0..count)
+        .map(|_| {
+            state ^= state >> 12;
+            state ^= state << 25;
+            state ^= state >> 27;
+            let bits = (state.wrapping_mul(0x2545F4914F6CDD1D) >> 40) as f32;
+            (bits / 16777216.0 * 2.0 - 1.0) * scale
+        })
+        .collect()
+}
+
+fn write_f32s<W: Write>(writer: &mut W, values: &[f32]) -> std::io::Result<()> {
+    values
+        .iter()
+        .try_for_each(|v| writer.write_all(&v.to_le_bytes()))
+}
+
+fn write_q4<W: Write>(writer: &mut W, values: &[f32], group_size: usize) -> std::io::Result<()> {
+    let mut scales = Vec::with_capacity(values.len() / group_size);
+    let mut packed = Vec::with_capacity(values.len() / 2);
+    for group in values.chunks(group_size) {
+        let max = group.iter().fold(0.0f32, |acc, v| acc.max(v.abs()));
+        let scale = if max > 0.0 { max / 7.0 } else { 1.0 };
+        scales.push(scale);
+        let nibble = |v: f32| ((v / scale).round().clamp(-7.0, 7.0) as i8 + 8) as u8;
+        packed.extend(
+            group
+                .chunks_exact(2)
+                .map(|pair| nibble(pair[0]) | (nibble(pair[1]) << 4)),
+        );
+    }
+    writer.write_all(&packed)?;
+    write_f32s(writer, &scales)
+}
+
+fn write_q80<W: Write>(writer: &mut W, values: &[f32], group_size: usize) -> std::io::Result<()> {
+    let mut scales = Vec::with_capacity(values.len() / group_size);
+    let mut quantized = Vec::with_capacity(values.len());
+    for group in values.chunks(group_size) {
+        let max = group.iter().fold(0.0f32, |acc, v| acc.max(v.abs()));
+        let scale = if max > 0.0 { max / 127.0 } else { 1.0 };
+        scales.push(scale);
+        quantized.extend(group.iter().map(|v| (v / scale).round() as i8 as u8));
+    }
+    writer.write_all(&quantized)?;
+    write_f32s(writer, &scales)
+}
+
+/// Writes a checkpoint with random weights in the exporter's binary layout.
+pub fn write_checkpoint(dir: &Path, config: &TestModelConfig, seed: u64) -> PathBuf {
+    let path = dir.join("model.bin");
+    let mut writer = BufWriter::new(File::create(&path).unwrap());
+
+    let TestModelConfig {
+        dim,
+        hidden_dim,
+        n_layers,
+        n_heads,
+        n_kv_heads,
+        head_dim,
+        vocab_size,
+        seq_len,
+        group_size,
+        shared_classifier,
+        classifier_prescreen,
+    } = *config;
+
+    let header = [
+        0x616a6331,
+        1,
+        dim as i32,
+        hidden_dim as i32,
+        n_layers as i32,
+        n_heads as i32,
+        n_kv_heads as i32,
+        vocab_size as i32,
+        seq_len as i32,
+        head_dim as i32,
+        shared_classifier as i32,
+        group_size as i32,
+        if classifier_prescreen { 4 } else { 0 },
+    ];
+    for value in header {
+        writer.write_all(&value.to_le_bytes()).unwrap();
+    }
+    writer.write_all(&[0u8; 256 - 52]).unwrap();
+
+    // Normalization weights
+    let ones = |count: usize| vec![1.0f32; count];
+    write_f32s(&mut writer, &ones(n_layers * dim)).unwrap();
+    write_f32s(&mut writer, &ones(n_layers * dim)).unwrap();
+    write_f32s(&mut writer, &ones(dim)).unwrap();
+    write_f32s(&mut writer, &ones(n_layers * head_dim)).unwrap();
+    write_f32s(&mut writer, &ones(n_layers * head_dim)).unwrap();
+
+    let all_heads_dim = n_heads * head_dim;
+    let kv_dim = n_kv_heads * head_dim;
+    let mut tensor_seed = seed;
+    let mut write_tensor = |writer: &mut BufWriter<File>, size: usize, scale: f32| {
+        tensor_seed += 1;
+        let values = pseudo_random(size, tensor_seed, scale);
+        write_q80(writer, &values, group_size).unwrap();
+        values
+    };
+
+    let mut classifier = write_tensor(&mut writer, vocab_size * dim, 1.0);
+    for (size, count) in [
+        (dim * all_heads_dim, n_layers),
+        (dim * kv_dim, n_layers),
+        (dim * kv_dim, n_layers),
+        (all_heads_dim * dim, n_layers),
+        (dim * hidden_dim, n_layers),
+        (hidden_dim * dim, n_layers),
+        (dim * hidden_dim, n_layers),
+    ] {
+        for _ in 0..count {
+            write_tensor(&mut writer, size, 0.2);
+        }
+    }
+    if !shared_classifier {
+        classifier = write_tensor(&mut writer, vocab_size * dim, 1.0);
+    }
+    if classifier_prescreen {
+        write_q4(&mut writer, &classifier, group_size).unwrap();
+    }
+
+    writer.flush().unwrap();
+    path
+}
+
+/// Writes a checkpoint with random weights into `dir` and loads it.
+pub fn build_transformer(dir: &Path, config: &TestModelConfig, seed: u64) -> Transformer {
+    let checkpoint = write_checkpoint(dir, config, seed);
+    TransformerBuilder::new(checkpoint.to_str().unwrap())
+        .build()
+        .unwrap()
+}
+
+/// Logits after each of `tokens`, fed one position at a time
+pub fn logits(transformer: &mut Transformer, tokens: &[usize]) -> Vec<Vec<f32>> {
+    tokens
+        .iter()
+        .enumerate()
+        .map(|(pos, &token)| transformer.forward(token, pos).to_vec())
+        .collect()
+}
+
+/// Deterministic sequence of byte tokens, different for every `seed`
+pub fn tokens(count: usize, seed: usize) -> Vec<usize> {
+    (0..count).map(|i| (i * 37 + seed * 11) % 256).collect()
+}
+
+/// Log-softmax of `logits` at `target`
+pub fn logprob(logits: &[f32], target: usize) -> f32 {
+    let max = logits
+        .iter()
+        .fold(f32::NEG_INFINITY, |acc, &val| acc.max(val));
+    let log_sum = max
+        + logits
+            .iter()
+            .map(|&val| (val - max).exp())
+            .sum::<f32>()
+            .ln();
+    logits[target] - log_sum
+}
+
+/// Writes a byte-level tokenizer next to the checkpoint: token `i` is byte `i`,
+/// followed by the given multi-byte tokens.
+pub fn write_tokenizer(checkpoint: &Path, extra_tokens: &[&str], bos: u32, eos: u32) {
+    write_tokenizer_with_scores(checkpoint, extra_tokens, bos, eos, |rank| {
+        -((rank + 1) as f32).ln()
+    });
+}
+
+/// Writes a tokenizer like [`write_tokenizer`], but in the layout of exporters that gave
+/// every token the default score instead of its merge rank.
+pub fn write_legacy_tokenizer(checkpoint: &Path, extra_tokens: &[&str], bos: u32, eos: u32) {
+    write_tokenizer_with_scores(checkpoint, extra_tokens, bos, eos, |_| -1e6);
+}
+
+fn write_tokenizer_with_scores(
+    checkpoint: &Path,
+    extra_tokens: &[&str],
+    bos: u32,
+    eos: u32,
+    score: impl Fn(usize) -> f32,
+) {
+    let path = format!("{}.tokenizer", checkpoint.display());
+    let mut writer = BufWriter::new(File::create(path).unwrap());
+
+    let max_len = extra_tokens
+        .iter()
+        .map(|t| t.len())
+        .max()
+        .unwrap_or(1)
+        .max(1);
+    // Header, then the token count as the exporter writes it
+    let count = 256 + extra_tokens.len() as u32;
+    let magic = TokenizerExporter::TOKENS_MAGIC;
+    for value in [max_len as u32, bos, eos, magic, count] {
+        writer.write_all(&value.to_le_bytes()).unwrap();
+    }
+
+    let mut write_token = |bytes: &[u8], score: f32| {
+        writer.write_all(&score.to_le_bytes()).unwrap();
+        writer
+            .write_all(&(bytes.len() as u32).to_le_bytes())
+            .unwrap();
+        writer.write_all(bytes).unwrap();
+    };
+    for byte in 0..=255u8 {
+        write_token(&[byte], -1e6);
+    }
+    for (rank, token) in extra_tokens.iter().enumerate() {
+        write_token(token.as_bytes(), score(rank));
+    }
+
+    writer.flush().unwrap();
+}
@@ -0,0 +1,125 @@
+//! Checks that grammar-constrained decoding on a random model always yields matching output.
+
+mod common;
+
+use qwen3_inference::{Grammar, GrammarState, Sampler, TokenMask, Tokenizer, TransformerBuilder};
+use tempfile::TempDir;
+
+const EXTRA_TOKENS: &[&str] = &[
+    "{\"", "\":", "\",\"", "true", "false", "name", "tags", "\"]",
+];
+const EOS: u32 = 1;
+
+const SCHEMA: &str = r#"{
+    "type": "object",
+    "properties": {
+        "name": {"type": "string", "maxLength": 6},
+        "ok": {"type": "boolean"},
+        "tags": {"type": "array", "items": {"enum": ["a", "b"]}, "maxItems": 3}
+    },
+    "required": ["name", "ok", "tags"]
+}"#;
+
+#[test]
+fn test_constrained_generation_produces_valid_json() {
+    let temp_dir = TempDir::new().unwrap();
+    let config = common::TestModelConfig {
+        vocab_size: 256 + EXTRA_TOKENS.len(),
+        seq_len: 128,
+        ..Default::default()
+    };
+    let checkpoint = common::write_checkpoint(temp_dir.path(), &config, 5);
+    common::write_tokenizer(&checkpoint, EXTRA_TOKENS, 0, EOS);
+    let checkpoint = checkpoint.to_str().unwrap();
+
+    let mut transformer = TransformerBuilder::new(checkpoint).build().unwrap();
+    let tokenizer = Tokenizer::new(checkpoint, config.vocab_size).unwrap();
+    let grammar = Grammar::from_json_schema(SCHEMA, &tokenizer).unwrap();
+
+    for (seed, temperature) in [(1, 0.0), (2, 1.0), (3, 1.5)] {
+        let mut sampler = Sampler::new(config.vocab_size, temperature, 0.95, seed);
+        let mut constraint = GrammarState::new(&grammar);
+        let mut output = Vec::new();
+        let mut token = b'\n' as usize;
+
+        for pos in 0..config.seq_len {
+            let logits = transformer.forward(token, pos);
+            constraint.apply(logits);
+            token = sampler.sample(logits);
+            if token == EOS as usize {
+                break;
+            }
+            output.extend_from_slice(tokenizer.decode(token));
+            constraint.advance(token, tokenizer.decode(token));
+        }
+
+        let text = String::from_utf8(output).unwrap();
+        assert!(constraint.is_accepting(), "incomplete output: {text}");
+        let value: serde_json::Value =
+            serde_json::from_str(&text).unwrap_or_else(|e| panic!("invalid JSON '{text}': {e}"));
+        assert!(value["name"].as_str().unwrap().chars().count() <= 6);
+        assert!(value["ok"].is_boolean());
+        assert!(value["tags"].as_array().unwrap().len() <= 3);
+    }
+}
+
+#[test]
+fn test_restricted_rows_match_full_logits() {
+    let temp_dir = TempDir::new().unwrap();
+    let config = common::TestModelConfig {
+        vocab_size: 256 + EXTRA_TOKENS.len(),
+        ..Default::default()
+    };
+    let checkpoint = common::write_checkpoint(temp_dir.path(), &config, 9);
+    common::write_tokenizer(&checkpoint, EXTRA_TOKENS, 0, EOS);
+    let checkpoint = checkpoint.to_str().unwrap();
+
+    let mut full = TransformerBuilder::new(checkpoint).build().unwrap();
+    let mut restricted = TransformerBuilder::new(checkpoint).build().unwrap();
+    let tokenizer = Tokenizer::new(checkpoint, config.vocab_size).unwrap();
+
+    // Label tokens only: a sparse mask that selects the restricted classification head
+    let labels = ["true", "false"].map(|label| tokenizer.str_lookup(label).unwrap());
+    let mask = TokenMask::from_tokens(config.vocab_size, &[labels[0], labels[1], 1]).unwrap();
+    let rows = mask.sparse_tokens().unwrap();
+    assert_eq!(rows.len(), 3);
+
+    for (pos, token) in [10, 200, 65, 257].into_iter().enumerate() {
+        let expected = full.forward(token, pos).to_vec();
+        let logits = restricted.forward_rows(token, pos, rows);
+        for (id, (&logit, &reference)) in logits.iter().zip(&expected).enumerate() {
+            if mask.contains(id) {
+                assert_eq!(logit, reference, "token {id} at position {pos}");
+            } else {
+                assert_eq!(logit, f32::NEG_INFINITY);
+            }
+        }
+    }
+}
+
+#[test]
+fn test_legacy_tokenizer_keeps_multi_byte_tokens() {
+    // Older exporters gave every multi-byte token the score of an added token
+    let temp_dir = TempDir::new().unwrap();
+    let extra_tokens = [EXTRA_TOKENS, &["<|im_end|>"]].concat();
+    let config = common::TestModelConfig {
+        vocab_size: 256 + extra_tokens.len(),
+        ..Default::default()
+    };
+    let checkpoint = common::write_checkpoint(temp_dir.path(), &config, 5);
+    common::write_legacy_tokenizer(&checkpoint, &extra_tokens, 0, EOS);
+    let tokenizer = Tokenizer::new(checkpoint.to_str().unwrap(), config.vocab_size).unwrap();
+    let id = |text: &str| tokenizer.str_lookup(text).unwrap();
+
+    let grammar = Grammar::from_json_schema(SCHEMA, &tokenizer).unwrap();
+    let mut state = GrammarState::new(&grammar);
+    assert!(state.mask().contains(id("{\"")));
+    state.advance(id("{\""), b"{\"");
+    assert!(state.mask().contains(id("name")));
+
+    // Only the `<...>` tokens are control tokens, which never match as text
+    let grammar = Grammar::from_regex(".*", &tokenizer).unwrap();
+    let mask = GrammarState::new(&grammar).mask();
+    assert!(mask.contains(id("true")));
+    assert!(!mask.contains(id("<|im_end|>")));
+}
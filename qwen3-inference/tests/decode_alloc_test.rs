@@ -0,0 +1,193 @@
+//! Checks that the decode loop of [`generate`] (forward, in-place sampling, detokenization)
+//! performs no heap allocations per token, and that batched passes do not allocate per row
+//! or per batch length.
+
+mod common;
+
+use qwen3_inference::{GenerationOptions, Sampler, Tokenizer, TransformerBuilder, generate};
+use std::alloc::{GlobalAlloc, Layout, System};
+use std::cell::Cell;
+use tempfile::TempDir;
+
+/// Global allocator that counts allocations made by the current thread.
+struct CountingAllocator;
+
+thread_local! {
+    static ALLOCATIONS: Cell<usize> = const { Cell::new(0) };
+}
+
+fn count_allocation() {
+    let _ = ALLOCATIONS.try_with(|count| count.set(count.get() + 1));
+}
+
+fn allocations() -> usize {
+    ALLOCATIONS.with(|count| count.get())
+}
+
+unsafe impl GlobalAlloc for CountingAllocator {
+    unsafe fn alloc(&self, layout: Layout) -> *mut u8 {
+        count_allocation();
+        unsafe { System.alloc(layout) }
+    }
+
+    unsafe fn alloc_zeroed(&self, layout: Layout) -> *mut u8 {
+        count_allocation();
+        unsafe { System.alloc_zeroed(layout) }
+    }
+
+    unsafe fn realloc(&self, ptr: *mut u8, layout: Layout, new_size: usize) -> *mut u8 {
+        count_allocation();
+        unsafe { System.realloc(ptr, layout, new_size) }
+    }
+
+    unsafe fn dealloc(&self, ptr: *mut u8, layout: Layout) {
+        unsafe { System.dealloc(ptr, layout) }
+    }
+}
+
+#[global_allocator]
+static ALLOCATOR: CountingAllocator = CountingAllocator;
+
+/// Context lengths of the two runs; the longer one decodes this many more tokens
+const SHORT_CONTEXT: usize = 16;
+const LONG_CONTEXT: usize = 48;
+
+/// Runs [`generate`] to the end of a `ctx_length` context; returns the allocations made.
+fn count_generate_allocations(
+    checkpoint: &str,
+    vocab_size: usize,
+    ctx_length: usize,
+    (temperature, topp): (f32, f32),
+) -> usize {
+    let mut transformer = TransformerBuilder::new(checkpoint)
+        .with_ctx_length(Some(ctx_length))
+        .build()
+        .unwrap();
+    let tokenizer = Tokenizer::new(checkpoint, vocab_size).unwrap();
+    let mut sampler = Sampler::new(vocab_size, temperature, topp, 5);
+
+    // "é" is two byte tokens, so echoing the prompt warms up the detokenizer buffers
+    let before = allocations();
+    generate(
+        &mut transformer,
+        &tokenizer,
+        &mut sampler,
+        Some("Hé!"),
+        GenerationOptions::default(),
+    )
+    .unwrap();
+    allocations() - before
+}
+
+#[test]
+fn test_decode_loop_is_allocation_free() {
+    let temp_dir = TempDir::new().unwrap();
+    let config = common::TestModelConfig::default();
+    let checkpoint = common::write_checkpoint(temp_dir.path(), &config, 11);
+    // Out-of-vocabulary end tokens, so every run decodes to the end of its context
+    let end_token = config.vocab_size as u32;
+    common::write_tokenizer(&checkpoint, &[], end_token, end_token);
+    let checkpoint = checkpoint.to_str().unwrap().to_string();
+
+    // Run on a single worker so every allocation of the loop happens on the counted thread
+    let pool = rayon::ThreadPoolBuilder::new()
+        .num_threads(1)
+        .build()
+        .unwrap();
+
+    pool.install(|| {
+        // Greedy, top-p and plain temperature (Gumbel-max) sampling paths
+        for sampling in [(0.0, 0.9), (0.8, 0.9), (1.0, 1.0)] {
+            let count = |ctx_length| {
+                count_generate_allocations(&checkpoint, config.vocab_size, ctx_length, sampling)
+            };
+            // Setup and prefill allocate the same in both runs, so any difference comes
+            // from the extra decoded tokens
+            let short = count(SHORT_CONTEXT);
+            let long = count(LONG_CONTEXT);
+
+            assert_eq!(
+                long,
+                short,
+                "{} allocations in {} extra decoded tokens (temperature {}, top-p {})",
+                long as isize - short as isize,
+                LONG_CONTEXT - SHORT_CONTEXT,
+                sampling.0,
+                sampling.1
+            );
+        }
+    });
+}
+
+#[test]
+fn test_batched_attention_does_not_allocate_per_row() {
+    let temp_dir = TempDir::new().unwrap();
+    let config = common::TestModelConfig::default();
+    let checkpoint = common::write_checkpoint(temp_dir.path(), &config, 12);
+    let mut transformer = TransformerBuilder::new(checkpoint.to_str().unwrap())
+        .build()
+        .unwrap();
+    let tokens: Vec<usize> = (0..32).map(|i| (i * 7) % config.vocab_size).collect();
+
+    let pool = rayon::ThreadPoolBuilder::new()
+        .num_threads(1)
+        .build()
+        .unwrap();
+
+    pool.install(|| {
+        let mut count = |len: usize| {
+            // The first pass sizes the batch buffers for this length
+            transformer.hidden_states(&tokens[..len], 0);
+            let before = allocations();
+            transformer.hidden_states(&tokens[..len], 0);
+            allocations() - before
+        };
+        let short = count(8);
+        let long = count(tokens.len());
+
+        assert_eq!(
+            long,
+            short,
+            "{} allocations in {} extra batch rows",
+            long as isize - short as isize,
+            tokens.len() - 8
+        );
+    });
+}
+
+#[test]
+fn test_packed_batches_reuse_the_batch_buffers() {
+    let temp_dir = TempDir::new().unwrap();
+    let config = common::TestModelConfig::default();
+    let checkpoint = common::write_checkpoint(temp_dir.path(), &config, 13);
+    let mut transformer = TransformerBuilder::new(checkpoint.to_str().unwrap())
+        .build()
+        .unwrap();
+    let tokens: Vec<usize> = (0..48).map(|i| (i * 5) % config.vocab_size).collect();
+    transformer.reserve_batch(tokens.len());
+
+    let pool = rayon::ThreadPoolBuilder::new()
+        .num_threads(1)
+        .build()
+        .unwrap();
+
+    pool.install(|| {
+        let mut count = |pack: &[&[usize]]| {
+            let before = allocations();
+            transformer.hidden_states_packed(pack);
+            allocations() - before
+        };
+        // Packs of different lengths, shorter and longer than the one before them
+        let counts = [
+            count(&[&tokens[..20], &tokens[20..48]]),
+            count(&[&tokens[..3], &tokens[3..10]]),
+            count(&[&tokens[..30], &tokens[30..40], &tokens[40..44]]),
+        ];
+
+        assert!(
+            counts.iter().all(|&count| count == counts[0]),
+            "allocations per packed pass vary with its length: {:?}",
+            counts
+        );
+    });
+}
@@ -0,0 +1,106 @@
+//! Checks packed embedding batches against sequences run one at a time.
+
+mod common;
+
+use common::{TestModelConfig, build_transformer, tokens};
+use qwen3_inference::{EmbeddingOptions, Pooling, QuantizedEmbedding, embed_sequences};
+use tempfile::TempDir;
+
+#[test]
+fn test_packed_hidden_states_match_separate_sequences() {
+    let temp_dir = TempDir::new().unwrap();
+    let mut transformer = build_transformer(temp_dir.path(), &Default::default(), 41);
+    let dim = transformer.config.dim;
+    let sequences = [tokens(5, 1), tokens(17, 2), tokens(1, 3), tokens(9, 4)];
+
+    let expected: Vec<f32> = sequences
+        .iter()
+        .flat_map(|sequence| transformer.hidden_states(sequence, 0).to_vec())
+        .collect();
+
+    let packed: Vec<&[usize]> = sequences.iter().map(Vec::as_slice).collect();
+    let hidden = transformer.hidden_states_packed(&packed);
+
+    assert_eq!(hidden.len(), 32 * dim);
+    assert_eq!(hidden, &expected[..]);
+}
+
+#[test]
+fn test_embeddings_do_not_depend_on_packing() {
+    let temp_dir = TempDir::new().unwrap();
+    let mut transformer = build_transformer(temp_dir.path(), &Default::default(), 42);
+    let sequences: Vec<Vec<usize>> = (0..12).map(|i| tokens(3 + i * 2, i)).collect();
+
+    for pooling in [Pooling::Mean, Pooling::Last] {
+        let options = EmbeddingOptions {
+            pooling,
+            normalize: false,
+        };
+        let packed = embed_sequences(&mut transformer, &sequences, options).unwrap();
+        for (sequence, embedding) in sequences.iter().zip(&packed) {
+            let alone =
+                embed_sequences(&mut transformer, std::slice::from_ref(sequence), options).unwrap();
+            assert_eq!(&alone[0], embedding, "{pooling:?}");
+        }
+    }
+}
+
+#[test]
+fn test_long_sequence_is_pooled_over_batches() {
+    let config = TestModelConfig {
+        seq_len: 320,
+        ..Default::default()
+    };
+    let temp_dir = TempDir::new().unwrap();
+    let mut transformer = build_transformer(temp_dir.path(), &config, 43);
+    let dim = transformer.config.dim;
+    let sequence = tokens(300, 5);
+
+    let hidden = transformer.hidden_states(&sequence, 0).to_vec();
+    let mut mean = vec![0.0f32; dim];
+    for row in hidden.chunks_exact(dim) {
+        mean.iter_mut()
+            .zip(row)
+            .for_each(|(sum, &value)| *sum += value);
+    }
+    mean.iter_mut().for_each(|value| *value *= 1.0 / 300.0);
+
+    let options = EmbeddingOptions::default();
+    let embedding = embed_sequences(&mut transformer, &[sequence], options).unwrap();
+    assert_eq!(embedding[0], mean);
+}
+
+#[test]
+fn test_normalized_and_quantized_embeddings() {
+    let temp_dir = TempDir::new().unwrap();
+    let mut transformer = build_transformer(temp_dir.path(), &Default::default(), 44);
+    let options = EmbeddingOptions {
+        pooling: Pooling::Mean,
+        normalize: true,
+    };
+    let embeddings = embed_sequences(&mut transformer, &[tokens(7, 6)], options).unwrap();
+
+    let norm = embeddings[0].iter().map(|v| v * v).sum::<f32>().sqrt();
+    assert!((norm - 1.0).abs() < 1e-5, "norm {norm}");
+
+    let quantized = QuantizedEmbedding::new(&embeddings[0]);
+    assert_eq!(quantized.values.len(), embeddings[0].len());
+    for (&q, &value) in quantized.values.iter().zip(&embeddings[0]) {
+        assert!((q as f32 * quantized.scale - value).abs() <= quantized.scale / 2.0 + 1e-7);
+    }
+}
+
+#[test]
+fn test_embedding_rejects_empty_sequences() {
+    let temp_dir = TempDir::new().unwrap();
+    let mut transformer = build_transformer(temp_dir.path(), &Default::default(), 45);
+
+    let result = embed_sequences(
+        &mut transformer,
+        &[tokens(3, 1), vec![]],
+        Default::default(),
+    );
+    assert!(result.is_err());
+    assert_eq!("last".parse::<Pooling>(), Ok(Pooling::Last));
+    assert!("max".parse::<Pooling>().is_err());
+}
@@ -0,0 +1,399 @@
+//! Checks that a GGUF file loads like the exported checkpoint of the same weights.
+
+mod common;
+
+use common::logits;
+use qwen3_inference::{Tokenizer, TransformerBuilder, is_gguf_file, read_checkpoint_config};
+use std::fs;
+use std::path::Path;
+use tempfile::TempDir;
+
+const DIM: usize = 64;
+const HIDDEN_DIM: usize = 128;
+const LAYERS: usize = 2;
+const HEADS: usize = 4;
+const KV_HEADS: usize = 2;
+const HEAD_DIM: usize = 16;
+const VOCAB: usize = 64;
+const SEQ_LEN: usize = 32;
+const GROUP_SIZE: usize = 32;
+const ALIGNMENT: usize = 32;
+
+/// Tokens after the single characters `!`..`]`
+const WORD_TOKENS: [&str; 3] = ["AB", "<|im_start|>", "<|im_end|>"];
+
+enum Tensor {
+    Norm(Vec<f32>),
+    /// Int8 values with one scale per group, in `rows` × `cols` layout
+    Q8 {
+        rows: usize,
+        cols: usize,
+        q: Vec<i8>,
+        scales: Vec<f32>,
+    },
+}
+
+struct TestModel {
+    tensors: Vec<(String, Tensor)>,
+    tied: bool,
+}
+
+impl TestModel {
+    fn new(tied: bool) -> Self {
+        let mut seed = 0u64;
+        let mut random = move || {
+            seed = seed
+                .wrapping_mul(6364136223846793005)
+                .wrapping_add(1442695040888963407);
+            (seed >> 33) as u32
+        };
+
+        let mut tensors = Vec::new();
+        let mut norm = |name: String, len: usize, random: &mut dyn FnMut() -> u32| {
+            let values = (0..len)
+                .map(|_| 1.0 + (random() % 64) as f32 / 256.0 - 0.125)
+                .collect();
+            tensors.push((name, Tensor::Norm(values)));
+        };
+        for layer in 0..LAYERS {
+            norm(format!("blk.{layer}.attn_norm.weight"), DIM, &mut random);
+            norm(format!("blk.{layer}.ffn_norm.weight"), DIM, &mut random);
+            norm(
+                format!("blk.{layer}.attn_q_norm.weight"),
+                HEAD_DIM,
+                &mut random,
+            );
+            norm(
+                format!("blk.{layer}.attn_k_norm.weight"),
+                HEAD_DIM,
+                &mut random,
+            );
+        }
+        norm("output_norm.weight".to_string(), DIM, &mut random);
+
+        let mut matrix = |name: String, rows: usize, cols: usize| {
+            let q = (0..rows * cols)
+                .map(|_| (random() % 255) as i32 - 127)
+                .map(|value| value as i8)
+                .collect();
+            // Scales exactly representable in f16
+            let scales = (0..rows * cols / GROUP_SIZE)
+                .map(|_| (16 + random() % 16) as f32 / 4096.0)
+                .collect();
+            tensors.push((
+                name,
+                Tensor::Q8 {
+                    rows,
+                    cols,
+                    q,
+                    scales,
+                },
+            ));
+        };
+        matrix("token_embd.weight".to_string(), VOCAB, DIM);
+        if !tied {
+            matrix("output.weight".to_string(), VOCAB, DIM);
+        }
+        for layer in 0..LAYERS {
+            let name = |kind: &str| format!("blk.{layer}.{kind}.weight");
+            matrix(name("attn_q"), HEADS * HEAD_DIM, DIM);
+            matrix(name("attn_k"), KV_HEADS * HEAD_DIM, DIM);
+            matrix(name("attn_v"), KV_HEADS * HEAD_DIM, DIM);
+            matrix(name("attn_output"), DIM, HEADS * HEAD_DIM);
+            matrix(name("ffn_gate"), HIDDEN_DIM, DIM);
+            matrix(name("ffn_down"), DIM, HIDDEN_DIM);
+            matrix(name("ffn_up"), HIDDEN_DIM, DIM);
+        }
+
+        Self { tensors, tied }
+    }
+
+    fn tensor(&self, name: &str) -> &Tensor {
+        &self.tensors.iter().find(|(n, _)| n == name).unwrap().1
+    }
+
+    /// Writes the weights in the exporter's checkpoint layout
+    fn write_checkpoint(&self, path: &Path) {
+        let header = [
+            0x616a6331,
+            1,
+            DIM as i32,
+            HIDDEN_DIM as i32,
+            LAYERS as i32,
+            HEADS as i32,
+            KV_HEADS as i32,
+            VOCAB as i32,
+            SEQ_LEN as i32,
+            HEAD_DIM as i32,
+            self.tied as i32,
+            GROUP_SIZE as i32,
+            0,
+        ];
+        let mut out: Vec<u8> = header.iter().flat_map(|v| v.to_le_bytes()).collect();
+        out.resize(256, 0);
+
+        let mut names = Vec::new();
+        let layers = |names: &mut Vec<String>, kind: &str| {
+            names.extend((0..LAYERS).map(|l| format!("blk.{l}.{kind}.weight")));
+        };
+        layers(&mut names, "attn_norm");
+        layers(&mut names, "ffn_norm");
+        names.push("output_norm.weight".to_string());
+        layers(&mut names, "attn_q_norm");
+        layers(&mut names, "attn_k_norm");
+        names.push("token_embd.weight".to_string());
+        for kind in [
+            "attn_q",
+            "attn_k",
+            "attn_v",
+            "attn_output",
+            "ffn_gate",
+            "ffn_down",
+            "ffn_up",
+        ] {
+            layers(&mut names, kind);
+        }
+        if !self.tied {
+            names.push("output.weight".to_string());
+        }
+
+        for name in names {
+            match self.tensor(&name) {
+                Tensor::Norm(values) => out.extend(values.iter().flat_map(|v| v.to_le_bytes())),
+                Tensor::Q8 { q, scales, .. } => {
+                    out.extend(q.iter().map(|&v| v as u8));
+                    out.extend(scales.iter().flat_map(|v| v.to_le_bytes()));
+                }
+            }
+        }
+        fs::write(path, out).unwrap();
+    }
+
+    /// Writes the weights as a GGUF file with Q8_0 matrices and F32 norms, leaving out the
+    /// tensor or metadata entry named `skip`
+    fn write_gguf(&self, path: &Path, skip: Option<&str>) {
+        let mut tokens: Vec<String> = (b'!'..)
+            .take(VOCAB - WORD_TOKENS.len())
+            .map(|byte| char::from(byte).to_string())
+            .collect();
+        tokens.extend(WORD_TOKENS.iter().map(|token| token.to_string()));
+        let token_types: Vec<i32> = tokens
+            .iter()
+            .map(|token| if token.starts_with("<|") { 3 } else { 1 })
+            .collect();
+
+        let mut metadata = Vec::new();
+        let mut metadata_count = 0u64;
+        let mut entry = |key: &str, value_type: u32, value: Vec<u8>| {
+            if Some(key) == skip {
+                return;
+            }
+            metadata_count += 1;
+            write_string(&mut metadata, key);
+            metadata.extend(value_type.to_le_bytes());
+            metadata.extend(value);
+        };
+        let u32_value = |value: usize| (value as u32).to_le_bytes().to_vec();
+        let string_value = |value: &str| {
+            let mut out = Vec::new();
+            write_string(&mut out, value);
+            out
+        };
+        let array_value = |element_type: u32, count: usize, elements: Vec<u8>| {
+            let mut out = element_type.to_le_bytes().to_vec();
+            out.extend((count as u64).to_le_bytes());
+            out.extend(elements);
+            out
+        };
+        entry("general.architecture", 8, string_value("qwen3"));
+        entry("qwen3.embedding_length", 4, u32_value(DIM));
+        entry("qwen3.feed_forward_length", 4, u32_value(HIDDEN_DIM));
+        entry("qwen3.block_count", 4, u32_value(LAYERS));
+        entry("qwen3.attention.head_count", 4, u32_value(HEADS));
+        entry("qwen3.attention.head_count_kv", 4, u32_value(KV_HEADS));
+        entry("qwen3.attention.key_length", 4, u32_value(HEAD_DIM));
+        entry("qwen3.context_length", 4, u32_value(SEQ_LEN));
+        entry("qwen3.rope.freq_base", 6, 1e6f32.to_le_bytes().to_vec());
+        entry("tokenizer.ggml.model", 8, string_value("gpt2"));
+        let token_strings = tokens.iter().flat_map(|t| string_value(t)).collect();
+        entry(
+            "tokenizer.ggml.tokens",
+            9,
+            array_value(8, tokens.len(), token_strings),
+        );
+        let type_values = token_types.iter().flat_map(|t| t.to_le_bytes()).collect();
+        entry(
+            "tokenizer.ggml.token_type",
+            9,
+            array_value(5, tokens.len(), type_values),
+        );
+        entry(
+            "tokenizer.ggml.merges",
+            9,
+            array_value(8, 1, string_value("A B")),
+        );
+        entry("tokenizer.ggml.bos_token_id", 4, u32_value(VOCAB - 1));
+        entry("tokenizer.ggml.eos_token_id", 4, u32_value(VOCAB - 1));
+        let template = "{%- if messages[0].role == 'system' %}<|im_start|>system\n{%- endif %}\
+            <|im_start|>user<|im_end|>{%- if enable_thinking is defined %}{%- endif %}";
+        entry("tokenizer.chat_template", 8, string_value(template));
+
+        let tensors: Vec<_> = self
+            .tensors
+            .iter()
+            .filter(|(name, _)| Some(name.as_str()) != skip)
+            .collect();
+        let mut infos = Vec::new();
+        let mut data = Vec::new();
+        for (name, tensor) in &tensors {
+            data.resize(data.len().next_multiple_of(ALIGNMENT), 0);
+            write_string(&mut infos, name);
+            let (dims, type_id) = match tensor {
+                Tensor::Norm(values) => {
+                    data.extend(values.iter().flat_map(|v| v.to_le_bytes()));
+                    (vec![values.len()], 0u32)
+                }
+                Tensor::Q8 {
+                    rows,
+                    cols,
+                    q,
+                    scales,
+                } => {
+                    for (q, &scale) in q.chunks(GROUP_SIZE).zip(scales) {
+                        data.extend(f32_to_f16(scale).to_le_bytes());
+                        data.extend(q.iter().map(|&v| v as u8));
+                    }
+                    (vec![*cols, *rows], 8u32)
+                }
+            };
+            let offset = data.len() - tensor_bytes(tensor);
+            infos.extend((dims.len() as u32).to_le_bytes());
+            for dim in dims {
+                infos.extend((dim as u64).to_le_bytes());
+            }
+            infos.extend(type_id.to_le_bytes());
+            infos.extend((offset as u64).to_le_bytes());
+        }
+
+        let mut out = b"GGUF".to_vec();
+        out.extend(3u32.to_le_bytes());
+        out.extend((tensors.len() as u64).to_le_bytes());
+        out.extend(metadata_count.to_le_bytes());
+        out.extend(metadata);
+        out.extend(infos);
+        out.resize(out.len().next_multiple_of(ALIGNMENT), 0);
+        out.extend(data);
+        fs::write(path, out).unwrap();
+    }
+}
+
+fn tensor_bytes(tensor: &Tensor) -> usize {
+    match tensor {
+        Tensor::Norm(values) => values.len() * 4,
+        Tensor::Q8 { q, .. } => q.len() / GROUP_SIZE * (GROUP_SIZE + 2),
+    }
+}
+
+fn write_string(out: &mut Vec<u8>, value: &str) {
+    out.extend((value.len() as u64).to_le_bytes());
+    out.extend(value.as_bytes());
+}
+
+/// Converts a normal f32 that is exactly representable in half precision
+fn f32_to_f16(value: f32) -> u16 {
+    let bits = value.to_bits();
+    let exponent = ((bits >> 23) & 0xff) as i32 - 127 + 15;
+    assert!((1..31).contains(&exponent) && bits & 0x1fff == 0);
+    (((bits >> 16) & 0x8000) | ((exponent as u32) << 10) | ((bits >> 13) & 0x3ff)) as u16
+}
+
+/// Writes `model` both ways and checks the logits match exactly
+fn assert_loads_like_checkpoint(model: &TestModel) {
+    let dir = TempDir::new().unwrap();
+    let checkpoint = dir.path().join("model.bin");
+    let gguf = dir.path().join("model.gguf");
+    model.write_checkpoint(&checkpoint);
+    model.write_gguf(&gguf, None);
+    let (checkpoint, gguf) = (checkpoint.to_str().unwrap(), gguf.to_str().unwrap());
+    assert!(is_gguf_file(gguf));
+    assert!(!is_gguf_file(checkpoint));
+
+    let config = read_checkpoint_config(gguf).unwrap();
+    assert_eq!(
+        (
+            config.dim,
+            config.hidden_dim,
+            config.n_layers,
+            config.head_dim
+        ),
+        (DIM, HIDDEN_DIM, LAYERS, HEAD_DIM)
+    );
+    assert_eq!((config.vocab_size, config.seq_len), (VOCAB, SEQ_LEN));
+    assert_eq!(config.shared_classifier, model.tied);
+    assert_eq!(config.group_size, GROUP_SIZE);
+
+    let tokens = [3, 17, 42, 5, 61];
+    let mut expected = TransformerBuilder::new(checkpoint).build().unwrap();
+    let mut loaded = TransformerBuilder::new(gguf).build().unwrap();
+    assert_eq!(logits(&mut loaded, &tokens), logits(&mut expected, &tokens));
+}
+
+#[test]
+fn test_gguf_loads_like_exported_checkpoint() {
+    assert_loads_like_checkpoint(&TestModel::new(false));
+}
+
+#[test]
+fn test_gguf_without_classifier_shares_the_embedding() {
+    assert_loads_like_checkpoint(&TestModel::new(true));
+}
+
+#[test]
+fn test_gguf_tokenizer_from_metadata() {
+    let dir = TempDir::new().unwrap();
+    let gguf = dir.path().join("model.gguf");
+    TestModel::new(false).write_gguf(&gguf, None);
+
+    let tokenizer = Tokenizer::new(gguf.to_str().unwrap(), VOCAB).unwrap();
+    let id = |c: char| c as usize - '!' as usize;
+    // "A B" merges into token 61; special tokens match literally
+    assert_eq!(tokenizer.encode("AB!<|im_end|>"), vec![61, id('!'), 63]);
+    assert_eq!(tokenizer.eos_token_id, 63);
+    assert!(tokenizer.templates.user.contains("<|im_start|>user"));
+}
+
+#[test]
+fn test_gguf_missing_token_ids_fall_back_to_the_vocabulary() {
+    let dir = TempDir::new().unwrap();
+    let gguf = dir.path().join("model.gguf");
+    let gguf_path = gguf.to_str().unwrap();
+
+    // EOS falls back to <|im_end|>
+    TestModel::new(false).write_gguf(&gguf, Some("tokenizer.ggml.eos_token_id"));
+    let tokenizer = Tokenizer::new(gguf_path, VOCAB).unwrap();
+    assert_eq!(tokenizer.eos_token_id, 63);
+
+    // The vocabulary has no <|endoftext|> to use as BOS
+    TestModel::new(false).write_gguf(&gguf, Some("tokenizer.ggml.bos_token_id"));
+    let error = Tokenizer::new(gguf_path, VOCAB).err().unwrap();
+    assert!(
+        format!("{error:#}").contains("tokenizer.ggml.bos_token_id"),
+        "{error:#}"
+    );
+}
+
+#[test]
+fn test_gguf_missing_tensor_is_reported() {
+    let dir = TempDir::new().unwrap();
+    let gguf = dir.path().join("model.gguf");
+    TestModel::new(false).write_gguf(&gguf, Some("blk.1.ffn_up.weight"));
+
+    let error = TransformerBuilder::new(gguf.to_str().unwrap())
+        .build()
+        .err()
+        .unwrap();
+    assert!(
+        error.to_string().contains("blk.1.ffn_up.weight"),
+        "{error:#}"
+    );
+}
@@ -0,0 +1,202 @@
+//! Checks that a Hugging Face model directory loads like its exported checkpoint.
+
+mod common;
+
+use common::{logits, pseudo_random};
+use qwen3_export::{export_model, load_hf_config};
+use qwen3_inference::{Tokenizer, TransformerBuilder, is_hf_model_dir};
+use serde_json::json;
+use std::fs::{self, File};
+use std::io::Write;
+use std::path::Path;
+use tempfile::TempDir;
+
+const DIM: usize = 64;
+const HIDDEN_DIM: usize = 128;
+const LAYERS: usize = 2;
+const HEADS: usize = 4;
+const KV_HEADS: usize = 2;
+const HEAD_DIM: usize = 16;
+const VOCAB: usize = 64;
+
+/// Writes `tensors` as a BF16 safetensors file
+fn write_safetensors(path: &Path, tensors: &[(String, Vec<f32>)]) {
+    let mut header = serde_json::Map::new();
+    let mut data = Vec::new();
+    for (name, values) in tensors {
+        let start = data.len();
+        for value in values {
+            data.extend_from_slice(&((value.to_bits() >> 16) as u16).to_le_bytes());
+        }
+        header.insert(
+            name.clone(),
+            json!({"dtype": "BF16", "shape": [values.len()], "data_offsets": [start, data.len()]}),
+        );
+    }
+    let header = serde_json::to_vec(&header).unwrap();
+    let mut file = File::create(path).unwrap();
+    file.write_all(&(header.len() as u64).to_le_bytes())
+        .unwrap();
+    file.write_all(&header).unwrap();
+    file.write_all(&data).unwrap();
+}
+
+/// Writes a small Qwen3-shaped model in Hugging Face layout
+fn write_hf_model(dir: &Path) {
+    let config = json!({
+        "hidden_size": DIM,
+        "intermediate_size": HIDDEN_DIM,
+        "num_hidden_layers": LAYERS,
+        "num_attention_heads": HEADS,
+        "num_key_value_heads": KV_HEADS,
+        "head_dim": HEAD_DIM,
+        "vocab_size": VOCAB,
+        "max_position_embeddings": 32,
+        "rms_norm_eps": 1e-6,
+        "bos_token_id": 0,
+        "eos_token_id": 1,
+        "tie_word_embeddings": false,
+    });
+    fs::write(dir.join("config.json"), config.to_string()).unwrap();
+
+    let mut tensors = Vec::new();
+    let mut seed = 0;
+    let mut tensor = |name: String, len: usize, offset: f32| {
+        seed += 1;
+        let values = pseudo_random(len, seed, 0.1).into_iter();
+        tensors.push((name, values.map(|value| offset + value).collect()));
+    };
+    tensor("model.embed_tokens.weight".to_string(), VOCAB * DIM, 0.0);
+    tensor("lm_head.weight".to_string(), VOCAB * DIM, 0.0);
+    tensor("model.norm.weight".to_string(), DIM, 1.0);
+    for layer in 0..LAYERS {
+        let prefix = format!("model.layers.{layer}");
+        tensor(format!("{prefix}.input_layernorm.weight"), DIM, 1.0);
+        tensor(
+            format!("{prefix}.post_attention_layernorm.weight"),
+            DIM,
+            1.0,
+        );
+        tensor(format!("{prefix}.self_attn.q_norm.weight"), HEAD_DIM, 1.0);
+        tensor(format!("{prefix}.self_attn.k_norm.weight"), HEAD_DIM, 1.0);
+        tensor(
+            format!("{prefix}.self_attn.q_proj.weight"),
+            HEADS * HEAD_DIM * DIM,
+            0.0,
+        );
+        tensor(
+            format!("{prefix}.self_attn.k_proj.weight"),
+            KV_HEADS * HEAD_DIM * DIM,
+            0.0,
+        );
+        tensor(
+            format!("{prefix}.self_attn.v_proj.weight"),
+            KV_HEADS * HEAD_DIM * DIM,
+            0.0,
+        );
+        tensor(
+            format!("{prefix}.self_attn.o_proj.weight"),
+            DIM * HEADS * HEAD_DIM,
+            0.0,
+        );
+        tensor(
+            format!("{prefix}.mlp.gate_proj.weight"),
+            HIDDEN_DIM * DIM,
+            0.0,
+        );
+        tensor(
+            format!("{prefix}.mlp.up_proj.weight"),
+            HIDDEN_DIM * DIM,
+            0.0,
+        );
+        tensor(
+            format!("{prefix}.mlp.down_proj.weight"),
+            DIM * HIDDEN_DIM,
+            0.0,
+        );
+    }
+    write_safetensors(&dir.join("model.safetensors"), &tensors);
+
+    // Printable ASCII tokens stand for themselves in the byte-level vocabulary
+    let vocab: serde_json::Map<_, _> = (0..VOCAB)
+        .map(|id| (char::from(b'!' + id as u8).to_string(), json!(id)))
+        .collect();
+    let tokenizer = json!({"model": {"vocab": vocab, "merges": ["A B"]}});
+    fs::write(dir.join("tokenizer.json"), tokenizer.to_string()).unwrap();
+    let template = "{%- if messages[0].role == 'system' %}<|im_start|>system\n{%- endif %}\
+        <|im_start|>user<|im_end|>{%- if enable_thinking is defined %}{%- endif %}";
+    let tokenizer_config = json!({"chat_template": template});
+    fs::write(
+        dir.join("tokenizer_config.json"),
+        tokenizer_config.to_string(),
+    )
+    .unwrap();
+}
+
+#[test]
+fn test_model_directory_loads_like_exported_checkpoint() {
+    let model_dir = TempDir::new().unwrap();
+    write_hf_model(model_dir.path());
+    let model_path = model_dir.path().to_str().unwrap();
+    assert!(is_hf_model_dir(model_path));
+
+    let export_dir = TempDir::new().unwrap();
+    let checkpoint = export_dir.path().join("model.bin");
+    let checkpoint = checkpoint.to_str().unwrap();
+    export_model(
+        model_path,
+        checkpoint,
+        load_hf_config(model_path).unwrap(),
+        64,
+    )
+    .unwrap();
+    assert!(!is_hf_model_dir(checkpoint));
+
+    let tokens = [3, 17, 42, 5];
+    let mut exported = TransformerBuilder::new(checkpoint).build().unwrap();
+    let mut direct = TransformerBuilder::new(model_path).build().unwrap();
+    assert_eq!(logits(&mut direct, &tokens), logits(&mut exported, &tokens));
+
+    let text = "AB!?xyz";
+    let exported = Tokenizer::new(checkpoint, VOCAB).unwrap();
+    let direct = Tokenizer::new(model_path, VOCAB).unwrap();
+    assert_eq!(direct.encode(text), exported.encode(text));
+    assert_eq!(direct.templates.user, exported.templates.user);
+    assert_eq!(direct.templates.system, exported.templates.system);
+}
+
+#[test]
+fn test_checkpoint_cache_is_written_once() {
+    let model_dir = TempDir::new().unwrap();
+    write_hf_model(model_dir.path());
+    let model_path = model_dir.path().to_str().unwrap();
+    let cache_dir = TempDir::new().unwrap();
+    let cache = cache_dir.path().join("cached.bin");
+    let cache = cache.to_str().unwrap();
+
+    let build = || {
+        TransformerBuilder::new(model_path)
+            .with_checkpoint_cache(Some(cache))
+            .build()
+            .unwrap()
+    };
+    let tokens = [9, 2, 60];
+    let first = logits(&mut build(), &tokens);
+    let written = fs::metadata(cache).unwrap().modified().unwrap();
+
+    // A fresh cache is loaded as is
+    assert_eq!(logits(&mut build(), &tokens), first);
+    assert_eq!(fs::metadata(cache).unwrap().modified().unwrap(), written);
+
+    // Without the 4-bit classifier copy, a prescreen load exports again
+    TransformerBuilder::new(model_path)
+        .with_checkpoint_cache(Some(cache))
+        .with_prescreen(Some(8))
+        .build()
+        .unwrap();
+    assert!(
+        qwen3_inference::read_checkpoint_config(cache)
+            .unwrap()
+            .classifier_prescreen
+    );
+}
@@ -0,0 +1,61 @@
+//! Checks windowed perplexity evaluation against token-by-token forward passes.
+
+mod common;
+
+use common::{build_transformer, logprob, tokens};
+use qwen3_inference::evaluate_perplexity;
+use tempfile::TempDir;
+
+#[test]
+fn test_perplexity_matches_sequential_forward() {
+    let temp_dir = TempDir::new().unwrap();
+    let mut transformer = build_transformer(temp_dir.path(), &Default::default(), 31);
+    let mut reference = build_transformer(temp_dir.path(), &Default::default(), 31);
+    let corpus = tokens(100, 0);
+    let window_len = 40;
+
+    let report = evaluate_perplexity(&mut transformer, &corpus, window_len, 2).unwrap();
+
+    // Windows of 40, 40 and 20 tokens, each starting from an empty cache
+    let mut nll = 0.0;
+    for window in corpus.chunks(window_len) {
+        for pos in 0..window.len() - 1 {
+            let logits = reference.forward(window[pos], pos);
+            nll -= f64::from(logprob(logits, window[pos + 1]));
+        }
+    }
+
+    assert_eq!(report.windows, 3);
+    assert_eq!(report.tokens, 97);
+    assert!(
+        (report.nll - nll).abs() <= 1e-6 * nll.abs(),
+        "{} != {}",
+        report.nll,
+        nll
+    );
+    assert!((report.perplexity() - (nll / 97.0).exp()).abs() < 1e-6 * report.perplexity());
+}
+
+#[test]
+fn test_perplexity_does_not_depend_on_sessions() {
+    let temp_dir = TempDir::new().unwrap();
+    let mut transformer = build_transformer(temp_dir.path(), &Default::default(), 32);
+    let corpus = tokens(150, 0);
+
+    let single = evaluate_perplexity(&mut transformer, &corpus, 24, 1).unwrap();
+    for sessions in [2, 3, 16] {
+        let report = evaluate_perplexity(&mut transformer, &corpus, 24, sessions).unwrap();
+        assert_eq!(report, single, "{sessions} sessions");
+    }
+}
+
+#[test]
+fn test_perplexity_rejects_bad_windows() {
+    let temp_dir = TempDir::new().unwrap();
+    let mut transformer = build_transformer(temp_dir.path(), &Default::default(), 33);
+    let seq_len = transformer.config.seq_len;
+
+    assert!(evaluate_perplexity(&mut transformer, &tokens(100, 0), seq_len + 1, 1).is_err());
+    assert!(evaluate_perplexity(&mut transformer, &tokens(100, 0), 1, 1).is_err());
+    assert!(evaluate_perplexity(&mut transformer, &tokens(1, 0), 16, 1).is_err());
+}
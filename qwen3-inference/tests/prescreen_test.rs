@@ -0,0 +1,117 @@
+//! Checks the two-stage classifier against the exact Q8 classification head.
+
+mod common;
+
+use qwen3_inference::TransformerBuilder;
+use tempfile::TempDir;
+
+fn prescreen_config() -> common::TestModelConfig {
+    common::TestModelConfig {
+        classifier_prescreen: true,
+        ..Default::default()
+    }
+}
+
+#[test]
+fn test_prescreened_candidates_have_exact_logits() {
+    let temp_dir = TempDir::new().unwrap();
+    let config = prescreen_config();
+    let checkpoint = common::write_checkpoint(temp_dir.path(), &config, 11);
+    let checkpoint = checkpoint.to_str().unwrap();
+
+    let top_k = 16;
+    let mut exact = TransformerBuilder::new(checkpoint).build().unwrap();
+    let mut prescreened = TransformerBuilder::new(checkpoint)
+        .with_prescreen(Some(top_k))
+        .build()
+        .unwrap();
+    assert!(prescreened.has_prescreen());
+
+    for (pos, token) in [3, 97, 200, 41].into_iter().enumerate() {
+        let expected = exact.forward(token, pos).to_vec();
+        let logits = prescreened.forward_prescreened(token, pos);
+
+        let candidates: Vec<usize> = (0..config.vocab_size)
+            .filter(|&id| logits[id].is_finite())
+            .collect();
+        assert_eq!(candidates.len(), top_k);
+        for id in candidates {
+            assert_eq!(logits[id], expected[id], "token {id} at position {pos}");
+        }
+    }
+}
+
+#[test]
+fn test_prescreen_covering_vocabulary_is_exact() {
+    let temp_dir = TempDir::new().unwrap();
+    let config = common::TestModelConfig {
+        shared_classifier: true,
+        ..prescreen_config()
+    };
+    let checkpoint = common::write_checkpoint(temp_dir.path(), &config, 12);
+    let checkpoint = checkpoint.to_str().unwrap();
+
+    let mut exact = TransformerBuilder::new(checkpoint).build().unwrap();
+    let mut prescreened = TransformerBuilder::new(checkpoint)
+        .with_prescreen(Some(config.vocab_size))
+        .with_prescreen_verification(Some((0.8, 0.9)))
+        .build()
+        .unwrap();
+
+    let steps = 5;
+    for pos in 0..steps {
+        let token = pos * 31 + 7;
+        let expected = exact.forward(token, pos).to_vec();
+        assert_eq!(prescreened.forward_prescreened(token, pos), &expected[..]);
+    }
+
+    let stats = prescreened.prescreen_stats().unwrap();
+    assert_eq!(stats.steps, steps);
+    assert_eq!(stats.verified_steps, steps);
+    assert_eq!(stats.topp_hits, steps);
+    assert_eq!(stats.argmax_hits, steps);
+    assert_eq!(stats.missed_mass, 0.0);
+}
+
+#[test]
+fn test_prescreen_stats_measure_missed_probability() {
+    let temp_dir = TempDir::new().unwrap();
+    let config = prescreen_config();
+    let checkpoint = common::write_checkpoint(temp_dir.path(), &config, 14);
+    let checkpoint = checkpoint.to_str().unwrap();
+
+    let steps = 6;
+    let run = |verification| {
+        let mut prescreened = TransformerBuilder::new(checkpoint)
+            .with_prescreen(Some(4))
+            .with_prescreen_verification(verification)
+            .build()
+            .unwrap();
+        for pos in 0..steps {
+            prescreened.forward_prescreened(pos * 13 + 2, pos);
+        }
+        prescreened.prescreen_stats().unwrap().clone()
+    };
+
+    // Steps are counted without verification, agreement only with it
+    let stats = run(None);
+    assert_eq!(stats.steps, steps);
+    assert_eq!(stats.verified_steps, 0);
+
+    // A handful of candidates out of the whole vocabulary misses some probability mass
+    let stats = run(Some((1.0, 0.9)));
+    assert_eq!(stats.verified_steps, steps);
+    assert!(stats.missed_mass > 0.0 && stats.missed_mass < steps as f64);
+    assert!(stats.topp_hits <= stats.argmax_hits);
+}
+
+#[test]
+fn test_prescreen_requires_exported_copy() {
+    let temp_dir = TempDir::new().unwrap();
+    let checkpoint = common::write_checkpoint(temp_dir.path(), &Default::default(), 13);
+
+    let result = TransformerBuilder::new(checkpoint.to_str().unwrap())
+        .with_prescreen(Some(8))
+        .build();
+    assert!(result.is_err());
+}
@@ -0,0 +1,128 @@
+//! Checks batched prefill and sequence scoring against token-by-token forward passes.
+
+mod common;
+
+use common::{build_transformer, logprob, tokens};
+use qwen3_inference::{PREFILL_BATCH, score_continuations};
+use tempfile::TempDir;
+
+#[test]
+fn test_forward_batch_matches_sequential_forward() {
+    let temp_dir = TempDir::new().unwrap();
+    let mut sequential = build_transformer(temp_dir.path(), &Default::default(), 21);
+    let mut batched = build_transformer(temp_dir.path(), &Default::default(), 21);
+    let vocab_size = sequential.config.vocab_size;
+
+    let input = tokens(PREFILL_BATCH + 9, 1);
+    let expected: Vec<Vec<f32>> = input
+        .iter()
+        .enumerate()
+        .map(|(pos, &token)| sequential.forward(token, pos).to_vec())
+        .collect();
+
+    // Two batches, the second starting where the first left off in the KV cache
+    let split = PREFILL_BATCH;
+    let first = batched.forward_batch(&input[..split], 0).to_vec();
+    let second = batched.forward_batch(&input[split..], split).to_vec();
+
+    for (pos, row) in first
+        .chunks_exact(vocab_size)
+        .chain(second.chunks_exact(vocab_size))
+        .enumerate()
+    {
+        assert_eq!(row, &expected[pos][..], "position {pos}");
+    }
+}
+
+#[test]
+fn test_prefill_fills_kv_cache() {
+    let temp_dir = TempDir::new().unwrap();
+    let mut sequential = build_transformer(temp_dir.path(), &Default::default(), 22);
+    let mut prefilled = build_transformer(temp_dir.path(), &Default::default(), 22);
+
+    let prompt = tokens(PREFILL_BATCH + 20, 2);
+    for (pos, &token) in prompt.iter().enumerate() {
+        sequential.forward(token, pos);
+    }
+    prefilled.prefill(&prompt, 0);
+
+    let pos = prompt.len();
+    assert_eq!(prefilled.forward(7, pos), sequential.forward(7, pos));
+}
+
+#[test]
+fn test_scores_match_sequential_log_softmax() {
+    let temp_dir = TempDir::new().unwrap();
+    let mut reference = build_transformer(temp_dir.path(), &Default::default(), 23);
+    let mut scorer = build_transformer(temp_dir.path(), &Default::default(), 23);
+
+    let context = tokens(5, 3);
+    let continuation = tokens(6, 4);
+    let top_k = 3;
+
+    let scores = score_continuations(
+        &mut scorer,
+        &context,
+        std::slice::from_ref(&continuation),
+        top_k,
+    )
+    .unwrap();
+    let score = &scores[0];
+    assert_eq!(score.tokens.len(), continuation.len());
+
+    let sequence: Vec<usize> = context.iter().chain(&continuation).copied().collect();
+    let all_logits: Vec<Vec<f32>> = sequence
+        .iter()
+        .enumerate()
+        .map(|(pos, &token)| reference.forward(token, pos).to_vec())
+        .collect();
+
+    let mut total = 0.0;
+    for (i, token_score) in score.tokens.iter().enumerate() {
+        let logits = &all_logits[context.len() - 1 + i];
+
+        let expected = logprob(logits, continuation[i]);
+        assert_eq!(token_score.token, continuation[i]);
+        assert!((token_score.logprob - expected).abs() < 1e-5);
+        total += token_score.logprob;
+
+        let mut ranked: Vec<usize> = (0..logits.len()).collect();
+        ranked.sort_by(|&a, &b| logits[b].total_cmp(&logits[a]));
+        let top: Vec<usize> = token_score.top.iter().map(|&(token, _)| token).collect();
+        assert_eq!(top, ranked[..top_k]);
+    }
+    assert!((score.logprob() - total).abs() < 1e-5);
+}
+
+#[test]
+fn test_shared_prefixes_score_like_separate_runs() {
+    let temp_dir = TempDir::new().unwrap();
+    let mut scorer = build_transformer(temp_dir.path(), &Default::default(), 24);
+
+    let context = tokens(4, 5);
+    let long = tokens(8, 6);
+    let continuations = vec![
+        long.clone(),
+        // Shares its first five tokens with the previous continuation
+        [&long[..5], &[3, 1, 4]].concat(),
+        tokens(3, 7),
+    ];
+
+    let together = score_continuations(&mut scorer, &context, &continuations, 2).unwrap();
+    for (continuation, score) in continuations.iter().zip(&together) {
+        let alone =
+            score_continuations(&mut scorer, &context, std::slice::from_ref(continuation), 2)
+                .unwrap();
+        assert_eq!(score, &alone[0]);
+    }
+}
+
+#[test]
+fn test_scoring_rejects_empty_context_and_overflow() {
+    let temp_dir = TempDir::new().unwrap();
+    let mut scorer = build_transformer(temp_dir.path(), &Default::default(), 25);
+    let seq_len = scorer.config.seq_len;
+
+    assert!(score_continuations(&mut scorer, &[], &[vec![1]], 1).is_err());
+    assert!(score_continuations(&mut scorer, &tokens(seq_len, 8), &[vec![1, 2]], 1).is_err());
+}
@@ -0,0 +1,81 @@
+//! Checks encoding against the Hugging Face `tokenizers` library on a Qwen2-style tokenizer.
+//!
+//! `fixtures/qwen2_bpe/tokenizer.json` is a small byte-level BPE trained with `tokenizers`
+//! 0.23 using Qwen2's split pattern, with Qwen's added tokens after the vocabulary.
+//! `reference.jsonl` holds texts and the ids `Tokenizer.encode(text).ids` returned for them.
+
+use qwen3_export::TokenizerExporter;
+use qwen3_inference::Tokenizer;
+use serde_json::Value;
+use std::fs;
+use std::path::Path;
+use tempfile::TempDir;
+
+const FIXTURE: &str = concat!(env!("CARGO_MANIFEST_DIR"), "/tests/fixtures/qwen2_bpe");
+
+/// Entries by which Qwen3's model vocabulary (151,936) exceeds its tokenizer's (151,669)
+const QWEN3_VOCAB_PADDING: usize = 267;
+
+/// Exports the fixture and loads it for a model vocabulary `padding` entries larger
+fn load_tokenizer(dir: &Path, padding: usize) -> Tokenizer {
+    let tokenizer_json: Value = serde_json::from_str(
+        &fs::read_to_string(Path::new(FIXTURE).join("tokenizer.json")).unwrap(),
+    )
+    .unwrap();
+    let vocab_size = tokenizer_json["model"]["vocab"].as_object().unwrap().len()
+        + tokenizer_json["added_tokens"].as_array().unwrap().len();
+
+    let checkpoint = dir.join("model.bin");
+    TokenizerExporter::new()
+        .export_tokenizer(Path::new(FIXTURE), &checkpoint, 1024, 1026)
+        .unwrap();
+    Tokenizer::new(checkpoint.to_str().unwrap(), vocab_size + padding).unwrap()
+}
+
+fn reference() -> Vec<(String, Vec<u32>)> {
+    fs::read_to_string(Path::new(FIXTURE).join("reference.jsonl"))
+        .unwrap()
+        .lines()
+        .map(|line| {
+            let entry: Value = serde_json::from_str(line).unwrap();
+            let ids = entry["ids"]
+                .as_array()
+                .unwrap()
+                .iter()
+                .map(|id| id.as_u64().unwrap() as u32)
+                .collect();
+            (entry["text"].as_str().unwrap().to_string(), ids)
+        })
+        .collect()
+}
+
+#[test]
+fn test_encode_matches_reference_ids() {
+    let temp_dir = TempDir::new().unwrap();
+    let tokenizer = load_tokenizer(temp_dir.path(), 0);
+    let reference = reference();
+    assert!(!reference.is_empty());
+
+    for (text, expected) in &reference {
+        let ids: Vec<u32> = tokenizer.encode(text).iter().map(|&id| id as u32).collect();
+        assert_eq!(&ids, expected, "{text:?}");
+    }
+
+    let texts: Vec<&str> = reference.iter().map(|(text, _)| text.as_str()).collect();
+    let batch = tokenizer.encode_batch(&texts);
+    for ((text, expected), ids) in reference.iter().zip(batch) {
+        assert_eq!(&ids, expected, "{text:?} in a batch");
+    }
+}
+
+#[test]
+fn test_padded_model_vocabulary_keeps_the_merge_table() {
+    let temp_dir = TempDir::new().unwrap();
+    let tokenizer = load_tokenizer(temp_dir.path(), QWEN3_VOCAB_PADDING);
+
+    // Derived merges would split some of these differently
+    for (text, expected) in &reference() {
+        let ids: Vec<u32> = tokenizer.encode(text).iter().map(|&id| id as u32).collect();
+        assert_eq!(&ids, expected, "{text:?}");
+    }
+}
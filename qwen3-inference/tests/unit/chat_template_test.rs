@@ -0,0 +1,106 @@
+use super::*;
+
+const USER: &str = "<|im_start|>user\n%s<|im_end|>\n<|im_start|>assistant\n";
+const SYSTEM: &str =
+    "<|im_start|>system\n%s<|im_end|>\n<|im_start|>user\n%s<|im_end|>\n<|im_start|>assistant\n";
+const THINKING: &str =
+    "<|im_start|>user\n%s<|im_end|>\n<|im_start|>assistant\n<think>\n\n</think>\n\n";
+
+/// Byte tokens, the chat special tokens and a few merges across template text
+fn tokenizer(templates: PromptTemplates) -> Tokenizer {
+    let mut vocab: Vec<Vec<u8>> = (0..=255u8).map(|b| vec![b]).collect();
+    let mut merge_scores = vec![-1e6; 256];
+    for token in ["<|im_start|>", "<|im_end|>"] {
+        vocab.push(token.as_bytes().to_vec());
+        merge_scores.push(-1e6);
+    }
+    let merges = ["us", "er", "user", "\n\n", "Hi", " there", "em", "sy", "st"];
+    for (rank, token) in merges.iter().enumerate() {
+        vocab.push(token.as_bytes().to_vec());
+        merge_scores.push(-(rank as f32));
+    }
+    Tokenizer::from_vocab(vocab, merge_scores, 16, 0, 1, templates)
+}
+
+fn templates(system: &str) -> PromptTemplates {
+    PromptTemplates {
+        user: USER.to_string(),
+        system: system.to_string(),
+        user_thinking: Some(THINKING.to_string()),
+        system_thinking: None,
+    }
+}
+
+#[test]
+fn test_user_prompt_matches_rendered_encoding() {
+    let tokenizer = tokenizer(templates(SYSTEM));
+    let prompt = "Hi there\n\nuser";
+    let expected = tokenizer.encode(&USER.replace("%s", prompt));
+    assert_eq!(tokenizer.encode_chat_prompt(None, prompt, false), expected);
+
+    let expected = tokenizer.encode(&THINKING.replace("%s", prompt));
+    assert_eq!(tokenizer.encode_chat_prompt(None, prompt, true), expected);
+}
+
+#[test]
+fn test_system_prompt_fills_its_own_slot() {
+    let tokenizer = tokenizer(templates(SYSTEM));
+    let rendered = SYSTEM
+        .replacen("%s", "system says Hi", 1)
+        .replacen("%s", "Hi there", 1);
+    let expected = tokenizer.encode(&rendered);
+
+    let encoded = tokenizer.encode_chat_prompt(Some("system says Hi"), "Hi there", false);
+    assert_eq!(encoded, expected);
+    // The second time, the system part comes from the cache
+    let encoded = tokenizer.encode_chat_prompt(Some("system says Hi"), "Hi there", false);
+    assert_eq!(encoded, expected);
+
+    let rendered = SYSTEM
+        .replacen("%s", "system says Hi", 1)
+        .replacen("%s", "user", 1);
+    let encoded = tokenizer.encode_chat_prompt(Some("system says Hi"), "user", false);
+    assert_eq!(encoded, tokenizer.encode(&rendered));
+}
+
+#[test]
+fn test_single_slot_system_template_combines_prompts() {
+    let system = "<|im_start|>system\n%s<|im_end|>\n<|im_start|>assistant\n";
+    let tokenizer = tokenizer(templates(system));
+    let expected = tokenizer.encode(&system.replace("%s", "be brief\nHi there"));
+    let encoded = tokenizer.encode_chat_prompt(Some("be brief"), "Hi there", false);
+    assert_eq!(encoded, expected);
+}
+
+#[test]
+fn test_template_without_special_tokens() {
+    let plain = "user: %s\nassistant:";
+    let tokenizer = tokenizer(PromptTemplates {
+        user: plain.to_string(),
+        ..templates(SYSTEM)
+    });
+    let template = ChatTemplate::new(plain, &tokenizer);
+    assert_eq!(template.slots(), 1);
+    assert_eq!(
+        tokenizer.encode_chat_prompt(None, "Hi there", false),
+        tokenizer.encode(&plain.replace("%s", "Hi there"))
+    );
+}
+
+#[test]
+fn test_special_tokens_are_pretokenized() {
+    let tokenizer = tokenizer(templates(SYSTEM));
+    let template = ChatTemplate::new(USER, &tokenizer);
+    let im_start = tokenizer.encode("<|im_start|>");
+    assert_eq!(
+        template.pieces,
+        vec![
+            Piece::Tokens(im_start.clone()),
+            Piece::Text("user\n".to_string()),
+            Piece::Slot(0),
+            Piece::Tokens(tokenizer.encode("<|im_end|>\n<|im_start|>")),
+            Piece::Text("assistant\n".to_string()),
+        ]
+    );
+    assert_eq!(im_start, vec![256]);
+}
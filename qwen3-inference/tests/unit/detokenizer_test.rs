@@ -0,0 +1,60 @@
+use super::*;
+
+/// Pushes each piece and collects the returned text, then the text of `finish`
+fn stream(pieces: &[&[u8]]) -> Vec<String> {
+    let mut detokenizer = Detokenizer::new();
+    let mut deltas: Vec<String> = pieces
+        .iter()
+        .map(|piece| detokenizer.push(piece).to_string())
+        .collect();
+    deltas.push(detokenizer.finish().to_string());
+    deltas
+}
+
+#[test]
+fn test_valid_tokens_pass_through_borrowed() {
+    let mut detokenizer = Detokenizer::new();
+    let token = "héllo".as_bytes();
+    let text = detokenizer.push(token);
+    assert_eq!(text, "héllo");
+    assert_eq!(text.as_ptr(), token.as_ptr());
+}
+
+#[test]
+fn test_characters_split_across_tokens_are_held_back() {
+    let emoji = "🙂".as_bytes();
+    assert_eq!(
+        stream(&[b"a", &emoji[..1], &emoji[1..3], &emoji[3..], b"b"]),
+        vec!["a", "", "", "🙂", "b", ""]
+    );
+    // A token that completes one character and starts the next
+    let text = "é🙂".as_bytes();
+    assert_eq!(
+        stream(&[&text[..1], &text[1..4], &text[4..]]),
+        vec!["", "é", "🙂", ""]
+    );
+}
+
+#[test]
+fn test_invalid_bytes_are_replaced() {
+    assert_eq!(stream(&[b"a\xffb"]), vec!["a\u{FFFD}b", ""]);
+    // An incomplete character followed by a byte that cannot continue it
+    assert_eq!(stream(&[b"\xf0\x9f", b"x"]), vec!["", "\u{FFFD}x", ""]);
+    // An incomplete character at the end of the stream
+    assert_eq!(stream(&[b"ok\xe2\x82"]), vec!["ok", "\u{FFFD}"]);
+}
+
+#[test]
+fn test_output_is_lossy_decoding_of_all_bytes() {
+    let bytes: Vec<u8> = "mixed ü 🙂 text"
+        .bytes()
+        .chain([0xff, 0xc3])
+        .chain("ä end".bytes())
+        .collect();
+    let expected = String::from_utf8_lossy(&bytes);
+
+    for size in 1..=5 {
+        let pieces: Vec<&[u8]> = bytes.chunks(size).collect();
+        assert_eq!(stream(&pieces).concat(), expected, "pieces of {size}");
+    }
+}
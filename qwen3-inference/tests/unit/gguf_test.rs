@@ -0,0 +1,138 @@
+use super::*;
+
+/// Pseudo-random bytes
+fn bytes(count: usize, seed: u32) -> Vec<u8> {
+    (0..count as u32)
+        .map(|i| (i.wrapping_mul(2654435761).wrapping_add(seed) >> 13) as u8)
+        .collect()
+}
+
+/// Packs 6-bit scales and minimums of 8 sub-blocks like llama.cpp's Q4_K/Q5_K
+fn pack_scales_k4(scales: &[u8; 8], mins: &[u8; 8]) -> [u8; 12] {
+    let mut packed = [0; 12];
+    for j in 0..4 {
+        packed[j] = scales[j] | ((scales[j + 4] >> 4) << 6);
+        packed[j + 4] = mins[j] | ((mins[j + 4] >> 4) << 6);
+        packed[j + 8] = (scales[j + 4] & 0xf) | ((mins[j + 4] & 0xf) << 4);
+    }
+    packed
+}
+
+#[test]
+fn test_f16_to_f32() {
+    assert_eq!(f16_to_f32(0x3c00), 1.0);
+    assert_eq!(f16_to_f32(0xc000), -2.0);
+    assert_eq!(f16_to_f32(0x3555), 0.333_251_95);
+    assert_eq!(f16_to_f32(0x7bff), 65504.0);
+    assert_eq!(f16_to_f32(0x0001), 1.0 / (1 << 24) as f32);
+    assert_eq!(f16_to_f32(0x8000).to_bits(), (-0.0f32).to_bits());
+    assert_eq!(f16_to_f32(0xfc00), f32::NEG_INFINITY);
+    assert!(f16_to_f32(0x7e00).is_nan());
+}
+
+#[test]
+fn test_decode_q4_0() {
+    let mut block = vec![0x00, 0x38]; // 0.5
+    block.extend(bytes(16, 1));
+    let mut out = [0.0; 32];
+    BlockType::Q4_0.decode(&block, &mut out);
+
+    for i in 0..16 {
+        let byte = block[2 + i];
+        assert_eq!(out[i], ((byte & 0xf) as f32 - 8.0) * 0.5);
+        assert_eq!(out[i + 16], ((byte >> 4) as f32 - 8.0) * 0.5);
+    }
+}
+
+#[test]
+fn test_decode_q4_k() {
+    // Scales and minimums above 15 exercise the high bits packed into the first bytes
+    let scales = [1, 2, 3, 40, 21, 6, 63, 8];
+    let mins = [1, 17, 1, 1, 2, 2, 50, 2];
+    let values: Vec<u8> = bytes(QK_K, 2).iter().map(|b| b & 0xf).collect();
+
+    let mut block = vec![0x00, 0x3c, 0x00, 0x38]; // d = 1.0, dmin = 0.5
+    block.extend(pack_scales_k4(&scales, &mins));
+    // Sub-blocks 2p and 2p + 1 share 32 bytes: low and high nibbles
+    for pair in 0..4 {
+        for l in 0..32 {
+            block.push(values[64 * pair + l] | (values[64 * pair + 32 + l] << 4));
+        }
+    }
+    let mut out = vec![0.0; QK_K];
+    BlockType::Q4_K.decode(&block, &mut out);
+
+    for (i, &value) in out.iter().enumerate() {
+        let sub_block = i / 32;
+        let expected = scales[sub_block] as f32 * values[i] as f32 - 0.5 * mins[sub_block] as f32;
+        assert_eq!(value, expected, "value {i}");
+    }
+}
+
+#[test]
+fn test_decode_q5_k() {
+    let scales = [5, 33, 3, 4, 9, 6, 7, 62];
+    let mins = [0, 1, 2, 3, 4, 5, 6, 7];
+    let values: Vec<u8> = bytes(QK_K, 3).iter().map(|b| b & 0x1f).collect();
+
+    let mut block = vec![0x00, 0x40, 0x00, 0x3c]; // d = 2.0, dmin = 1.0
+    block.extend(pack_scales_k4(&scales, &mins));
+    // Fifth bits: bit j of byte l belongs to value l of sub-block j
+    for l in 0..32 {
+        block.push((0..8).fold(0, |bits, j| bits | ((values[32 * j + l] >> 4) << j)));
+    }
+    for pair in 0..4 {
+        for l in 0..32 {
+            block.push((values[64 * pair + l] & 0xf) | ((values[64 * pair + 32 + l] & 0xf) << 4));
+        }
+    }
+    let mut out = vec![0.0; QK_K];
+    BlockType::Q5_K.decode(&block, &mut out);
+
+    for (i, &value) in out.iter().enumerate() {
+        let sub_block = i / 32;
+        let expected = 2.0 * scales[sub_block] as f32 * values[i] as f32 - mins[sub_block] as f32;
+        assert_eq!(value, expected, "value {i}");
+    }
+}
+
+#[test]
+fn test_decode_q6_k() {
+    let values: Vec<u8> = bytes(QK_K, 4).iter().map(|b| b & 0x3f).collect();
+    let scales: Vec<i8> = (0..16).map(|i| i * 3 - 20).collect();
+
+    // Each half of 128 values: quarters 0/1 in the low nibbles of 64 bytes, quarters 2/3
+    // in their high nibbles, and the top two bits of all four quarters in 32 bytes
+    let mut ql = vec![0u8; 128];
+    let mut qh = vec![0u8; 64];
+    for (i, &value) in values.iter().enumerate() {
+        let (half, quarter, l) = (i / 128, i % 128 / 32, i % 32);
+        let low = 64 * half + l + 32 * (quarter % 2);
+        ql[low] |= (value & 0xf) << (4 * (quarter / 2));
+        qh[32 * half + l] |= (value >> 4) << (2 * quarter);
+    }
+    let mut block = ql;
+    block.extend(qh);
+    block.extend(scales.iter().map(|&scale| scale as u8));
+    block.extend([0x00, 0x38]); // d = 0.5
+
+    let mut out = vec![0.0; QK_K];
+    BlockType::Q6_K.decode(&block, &mut out);
+
+    for (i, &value) in out.iter().enumerate() {
+        let expected = 0.5 * scales[i / 16] as f32 * (values[i] as f32 - 32.0);
+        assert_eq!(value, expected, "value {i}");
+    }
+}
+
+#[test]
+fn test_unsupported_block_type_is_an_error() {
+    // Q2_K
+    let error = BlockType::from_id(10).unwrap_err();
+    assert!(
+        error
+            .to_string()
+            .contains("Unsupported GGUF tensor type 10")
+    );
+    assert_eq!(BlockType::from_id(8).unwrap(), BlockType::Q8_0);
+}
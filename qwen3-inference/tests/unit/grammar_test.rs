@@ -0,0 +1,184 @@
+use super::*;
+use crate::tokenizer::PromptTemplates;
+
+const EOS: usize = 1;
+
+/// Tokenizer whose first 256 tokens are single bytes, followed by `extra` tokens.
+/// Tokens listed in `special` get the default score, like exported added tokens.
+fn tokenizer(extra: &[&str], special: &[&str]) -> Tokenizer {
+    let mut vocab: Vec<Vec<u8>> = (0..=255u8).map(|b| vec![b]).collect();
+    let mut merge_scores = vec![-1e6; 256];
+    for (rank, token) in extra.iter().enumerate() {
+        vocab.push(token.as_bytes().to_vec());
+        merge_scores.push(-((rank + 1) as f32).ln());
+    }
+    for token in special {
+        vocab.push(token.as_bytes().to_vec());
+        merge_scores.push(-1e6);
+    }
+
+    Tokenizer::from_vocab(
+        vocab,
+        merge_scores,
+        16,
+        0,
+        EOS as u32,
+        PromptTemplates::default(),
+    )
+}
+
+/// Feeds `text` byte by byte through the grammar and reports whether it is a full match.
+fn matches(grammar: &Grammar, text: &str) -> bool {
+    let mut state = GrammarState::new(grammar);
+    for &byte in text.as_bytes() {
+        if !state.mask().contains(byte as usize) && byte as usize != EOS {
+            return false;
+        }
+        state.advance(byte as usize, &[byte]);
+    }
+    state.is_accepting()
+}
+
+fn compile(pattern: &str) -> Grammar {
+    Grammar::from_regex(pattern, &tokenizer(&[], &[])).unwrap()
+}
+
+#[test]
+fn test_regex_literals_classes_and_alternation() {
+    let grammar = compile(r"(cat|dog)s?-[0-9a-f]+");
+    assert!(matches(&grammar, "cat-0"));
+    assert!(matches(&grammar, "dogs-beef42"));
+    assert!(!matches(&grammar, "cat-"));
+    assert!(!matches(&grammar, "cow-1"));
+    assert!(!matches(&grammar, "cat-0g"));
+
+    let grammar = compile(r"[^a-z]\d\s\w.");
+    assert!(matches(&grammar, "Z1 _%"));
+    assert!(!matches(&grammar, "z1 _%"));
+    assert!(!matches(&grammar, "Z1 _\n"));
+}
+
+#[test]
+fn test_regex_counted_repetition() {
+    let grammar = compile(r"^a{2,3}(bc){1}x{0,}$");
+    assert!(!matches(&grammar, "abc"));
+    assert!(matches(&grammar, "aabc"));
+    assert!(matches(&grammar, "aaabcxxx"));
+    assert!(!matches(&grammar, "aaaabc"));
+    assert!(!matches(&grammar, "aabcbc"));
+
+    // Lazy suffixes do not change the language
+    let grammar = compile(r"a+?b*?");
+    assert!(matches(&grammar, "aabb"));
+}
+
+#[test]
+fn test_regex_escapes_and_utf8() {
+    let grammar = compile(r"\x41é[ü?]\.\(\)");
+    assert!(matches(&grammar, "Aéü.()"));
+    assert!(matches(&grammar, "Aé?.()"));
+    assert!(!matches(&grammar, "Aéu.()"));
+}
+
+#[test]
+fn test_regex_syntax_errors() {
+    let tokenizer = tokenizer(&[], &[]);
+    for pattern in ["(ab", "ab)", "a{3,1}", "a{x}", "*a", "[abc", r"\q", "[é-ü]"] {
+        assert!(
+            Grammar::from_regex(pattern, &tokenizer).is_err(),
+            "pattern '{pattern}' should be rejected"
+        );
+    }
+}
+
+#[test]
+fn test_token_masks_follow_grammar() {
+    let tokenizer = tokenizer(&["ye", "yes", "no", "yesno"], &["<|im_end|>"]);
+    let id = |text: &str| {
+        tokenizer
+            .vocab
+            .iter()
+            .position(|t| t == text.as_bytes())
+            .unwrap()
+    };
+    let grammar = Grammar::from_regex("(yes|no)", &tokenizer).unwrap();
+
+    let mut state = GrammarState::new(&grammar);
+    let mask = state.mask();
+    for allowed in ["y", "n", "ye", "yes", "no"] {
+        assert!(mask.contains(id(allowed)), "'{allowed}' should be allowed");
+    }
+    for disallowed in ["x", "yesno", "<|im_end|>"] {
+        assert!(
+            !mask.contains(id(disallowed)),
+            "'{disallowed}' should be masked"
+        );
+    }
+    assert!(!mask.contains(EOS));
+    assert_eq!(mask.count(), 5);
+    let sparse: Vec<usize> = mask
+        .sparse_tokens()
+        .unwrap()
+        .iter()
+        .map(|&t| t as usize)
+        .collect();
+    assert_eq!(sparse, ["n", "y", "ye", "yes", "no"].map(id));
+
+    // A complete match only allows ending the sequence
+    state.advance(id("yes"), b"yes");
+    assert!(state.is_accepting());
+    assert!(state.mask().contains(EOS));
+    assert_eq!(state.mask().count(), 1);
+
+    // Control tokens are never emitted as text, even when their bytes would match
+    let grammar = Grammar::from_regex(".*", &tokenizer).unwrap();
+    let mask = GrammarState::new(&grammar).mask();
+    assert!(mask.contains(id("yesno")));
+    assert!(!mask.contains(id("<|im_end|>")));
+}
+
+#[test]
+fn test_unreachable_state_allows_eos() {
+    // After a mismatch no token can extend the match; ending must stay possible
+    let tokenizer = tokenizer(&[], &[]);
+    let grammar = Grammar::from_regex("a", &tokenizer).unwrap();
+    let mut state = GrammarState::new(&grammar);
+    state.advance(b'b' as usize, b"b");
+    assert!(!state.is_accepting());
+    assert_eq!(state.mask().count(), 1);
+    assert!(state.mask().contains(EOS));
+}
+
+#[test]
+fn test_large_masks_are_not_sparse() {
+    let tokenizer = tokenizer(&[], &[]);
+    let grammar = Grammar::from_regex("[a-z]+", &tokenizer).unwrap();
+    let mask = GrammarState::new(&grammar).mask();
+    assert_eq!(mask.count(), 26);
+    assert!(mask.sparse_tokens().is_none());
+
+    let mask = TokenMask::from_tokens(256, &[7, 3, 3]).unwrap();
+    assert_eq!(mask.sparse_tokens(), Some(&[3, 7][..]));
+    assert!(TokenMask::from_tokens(256, &[256]).is_err());
+}
+
+#[test]
+fn test_mask_apply() {
+    let vocab_size = 200;
+    let mut mask = TokenMask::new(vocab_size);
+    let allowed = [0, 63, 64, 130, 199];
+    allowed.iter().for_each(|&token| mask.insert(token));
+    // Fully allowed word
+    (64..128).for_each(|token| mask.insert(token));
+
+    let mut logits: Vec<f32> = (0..vocab_size).map(|i| i as f32).collect();
+    mask.apply(&mut logits);
+
+    for (token, &logit) in logits.iter().enumerate() {
+        if allowed.contains(&token) || (64..128).contains(&token) {
+            assert_eq!(logit, token as f32);
+        } else {
+            assert_eq!(logit, f32::NEG_INFINITY, "token {token}");
+        }
+    }
+}
@@ -0,0 +1,197 @@
+use super::*;
+use crate::grammar::{Grammar, GrammarState};
+use crate::tokenizer::{PromptTemplates, Tokenizer};
+
+/// Byte-level tokenizer: token `i` is byte `i`
+fn byte_tokenizer() -> Tokenizer {
+    Tokenizer::from_vocab(
+        (0..=255u8).map(|b| vec![b]).collect(),
+        vec![-1e6; 256],
+        1,
+        0,
+        1,
+        PromptTemplates::default(),
+    )
+}
+
+fn compile(schema: &str) -> Grammar {
+    Grammar::from_json_schema(schema, &byte_tokenizer()).unwrap()
+}
+
+fn matches(grammar: &Grammar, text: impl AsRef<[u8]>) -> bool {
+    let mut state = GrammarState::new(grammar);
+    for &byte in text.as_ref() {
+        if !state.mask().contains(byte as usize) {
+            return false;
+        }
+        state.advance(byte as usize, &[byte]);
+    }
+    state.is_accepting()
+}
+
+#[test]
+fn test_object_schema() {
+    let grammar = compile(
+        r#"{
+            "type": "object",
+            "properties": {
+                "name": {"type": "string", "maxLength": 8},
+                "age": {"type": "integer"},
+                "admin": {"type": "boolean"},
+                "score": {"type": ["number", "null"]}
+            },
+            "required": ["name", "age"]
+        }"#,
+    );
+
+    // Required properties first in declared order, then the others alphabetically
+    assert!(matches(
+        &grammar,
+        r#"{"name":"Ann","age":42,"admin":true,"score":-1.5e3}"#
+    ));
+    assert!(matches(
+        &grammar,
+        r#"{ "name": "A\"bé", "age": 0, "admin": false, "score": null }"#
+    ));
+    assert!(!matches(
+        &grammar,
+        r#"{"age":42,"name":"Ann","admin":true,"score":1}"#
+    ));
+    assert!(!matches(
+        &grammar,
+        r#"{"name":"Ann","age":042,"admin":true,"score":1}"#
+    ));
+    assert!(!matches(
+        &grammar,
+        r#"{"name":"Too long name","age":1,"admin":true,"score":1}"#
+    ));
+
+    // Optional properties may be left out, required ones may not
+    assert!(matches(&grammar, r#"{"name":"Ann","age":1}"#));
+    assert!(matches(&grammar, r#"{"name":"Ann","age":1,"score":2}"#));
+    assert!(matches(
+        &grammar,
+        r#"{"name":"Ann", "age":1 ,"admin":true}"#
+    ));
+    assert!(!matches(&grammar, r#"{"name":"Ann","admin":true}"#));
+    assert!(!matches(&grammar, r#"{"name":"Ann","age":1,}"#));
+    assert!(!matches(
+        &grammar,
+        r#"{"name":"Ann","age":1,"score":2,"admin":true}"#
+    ));
+
+    // String content must be well-formed UTF-8
+    let grammar = compile(r#"{"type": "string"}"#);
+    assert!(matches(&grammar, "\"日本 ✓\""));
+    assert!(!matches(&grammar, b"\"\xff\""));
+    assert!(!matches(&grammar, b"\"\xe6\x97\""));
+    assert!(!matches(&grammar, b"\"\xed\xa0\x80\""));
+}
+
+#[test]
+fn test_object_without_required_properties() {
+    let grammar = compile(
+        r#"{"type": "object", "properties": {"b": {"type": "null"}, "a": {"type": "integer"}}}"#,
+    );
+    for text in [
+        "{}",
+        "{ }",
+        r#"{"a":1}"#,
+        r#"{"b":null}"#,
+        r#"{"a":1,"b":null}"#,
+    ] {
+        assert!(matches(&grammar, text), "{text} should match");
+    }
+    for text in [r#"{,"b":null}"#, r#"{"a":1,}"#, r#"{"b":null,"a":1}"#] {
+        assert!(!matches(&grammar, text), "{text} should not match");
+    }
+
+    assert!(matches(&compile(r#"{"type": "object"}"#), "{}"));
+}
+
+#[test]
+fn test_array_enum_and_const() {
+    let grammar = compile(
+        r#"{
+            "type": "array",
+            "items": {"enum": ["red", "green", 3, null]},
+            "minItems": 1,
+            "maxItems": 3
+        }"#,
+    );
+    assert!(matches(&grammar, r#"["red"]"#));
+    assert!(matches(&grammar, r#"["green", 3, null]"#));
+    assert!(!matches(&grammar, "[]"));
+    assert!(!matches(&grammar, r#"["red","red","red","red"]"#));
+    assert!(!matches(&grammar, r#"["blue"]"#));
+
+    let grammar = compile(
+        r#"{"anyOf": [{"const": {"ok": true}}, {"type": "string", "pattern": "^[a-z]+$"}]}"#,
+    );
+    assert!(matches(&grammar, r#"{"ok":true}"#));
+    assert!(matches(&grammar, r#""abc""#));
+    assert!(!matches(&grammar, r#""ABC""#));
+}
+
+#[test]
+fn test_string_patterns_stay_inside_the_string() {
+    let grammar = compile(r#"{"type": "string", "pattern": "^.+$"}"#);
+    assert!(matches(&grammar, r#""any text""#));
+    assert!(matches(&grammar, r#""say \"hi\" \\ bye""#));
+    assert!(matches(&grammar, r#""é🙂""#));
+    assert!(!matches(&grammar, r#""a"b""#));
+    assert!(!matches(&grammar, "\"a\\\""));
+    assert!(!matches(&grammar, "\"a\tb\""));
+    assert!(!matches(&grammar, r#""""#));
+
+    // Negated classes and literal quotes match the escaped forms only
+    let grammar = compile(r#"{"type": "string", "pattern": "[^,]+\"?"}"#);
+    assert!(matches(&grammar, r#""a \" b\u0001\"""#));
+    assert!(!matches(&grammar, r#""a " b""#));
+    assert!(!matches(&grammar, "\"a\x01\""));
+    assert!(!matches(&grammar, r#""a,b""#));
+
+    // Printable ASCII includes the quote and the backslash
+    let grammar = compile(r#"{"type": "string", "pattern": "[ -~]{3}"}"#);
+    assert!(matches(&grammar, r#""a\\b""#));
+    assert!(!matches(&grammar, r#""a\b""#));
+}
+
+#[test]
+fn test_string_pattern_with_escaped_dollar() {
+    let grammar = compile(r#"{"type": "string", "pattern": "^\\$[0-9]+$"}"#);
+    assert!(matches(&grammar, r#""$12""#));
+    assert!(!matches(&grammar, r#""12""#));
+
+    // Only the anchor is stripped, not an escaped dollar at the end
+    let grammar = compile(r#"{"type": "string", "pattern": "^[0-9]+\\$"}"#);
+    assert!(matches(&grammar, r#""12$""#));
+    assert!(!matches(&grammar, r#""12""#));
+
+    // A literal backslash before the anchor
+    let grammar = compile(r#"{"type": "string", "pattern": "^a\\\\$"}"#);
+    assert!(matches(&grammar, r#""a\\""#));
+}
+
+#[test]
+fn test_unsupported_schemas() {
+    for schema in [
+        "true",
+        r#"{"description": "no type"}"#,
+        r#"{"type": "array"}"#,
+        r#"{"type": "tuple"}"#,
+        r#"{"type": "object", "properties": {}, "required": ["missing"]}"#,
+        "not json",
+    ] {
+        assert!(
+            schema_to_regex(schema).is_err(),
+            "{schema} should be rejected"
+        );
+    }
+}
+
+#[test]
+fn test_escape_regex() {
+    assert_eq!(escape_regex("a.b*(c)"), r"a\.b\*\(c\)");
+    assert_eq!(escape_regex(r#""x""#), r#""x""#);
+}
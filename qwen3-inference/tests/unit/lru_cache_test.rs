@@ -0,0 +1,75 @@
+use super::*;
+
+#[test]
+fn test_evicts_least_recently_used() {
+    let mut cache = LruCache::new(2);
+    cache.insert("a", 1);
+    cache.insert("b", 2);
+    assert_eq!(cache.get("a"), Some(&1));
+
+    // "b" is now the least recently used entry
+    cache.insert("c", 3);
+    assert_eq!(cache.len(), 2);
+    assert_eq!(cache.get("b"), None);
+    assert_eq!(cache.get("a"), Some(&1));
+    assert_eq!(cache.get("c"), Some(&3));
+}
+
+#[test]
+fn test_insert_replaces_and_refreshes() {
+    let mut cache = LruCache::new(2);
+    cache.insert("a", 1);
+    cache.insert("b", 2);
+    cache.insert("a", 10);
+    cache.insert("c", 3);
+
+    assert_eq!(cache.get("a"), Some(&10));
+    assert_eq!(cache.get("b"), None);
+    assert_eq!(cache.len(), 2);
+}
+
+#[test]
+fn test_capacity_of_one() {
+    let mut cache = LruCache::new(1);
+    for (index, key) in ["x", "y", "z", "x"].into_iter().enumerate() {
+        cache.insert(key, index);
+        assert_eq!(cache.get(key), Some(&index));
+        assert_eq!(cache.len(), 1);
+    }
+    assert_eq!(cache.get("y"), None);
+}
+
+#[test]
+fn test_insert_with_reuses_the_evicted_value() {
+    let mut cache: LruCache<Vec<u32>> = LruCache::new(1);
+    cache.insert_with("a", |value| {
+        assert!(value.is_empty());
+        value.extend_from_slice(&[1, 2, 3]);
+    });
+    let buffer = cache.get("a").unwrap().as_ptr();
+
+    // "a" is evicted and its value handed to "b", allocation included
+    cache.insert_with("bb", |value| {
+        assert_eq!(value, &[1, 2, 3]);
+        value.clear();
+        value.push(4);
+    });
+    assert_eq!(cache.get("a"), None);
+    assert_eq!(cache.get("bb"), Some(&vec![4]));
+    assert_eq!(cache.get("bb").unwrap().as_ptr(), buffer);
+    assert_eq!(cache.len(), 1);
+}
+
+#[test]
+fn test_insert_with_replaces_an_existing_key() {
+    let mut cache: LruCache<Vec<u32>> = LruCache::new(2);
+    cache.insert("a", vec![1]);
+    cache.insert("b", vec![2]);
+    cache.insert_with("a", |value| value.push(10));
+
+    // "a" was refreshed, so "b" goes first
+    cache.insert("c", vec![3]);
+    assert_eq!(cache.get("a"), Some(&vec![1, 10]));
+    assert_eq!(cache.get("b"), None);
+    assert_eq!(cache.get("c"), Some(&vec![3]));
+}
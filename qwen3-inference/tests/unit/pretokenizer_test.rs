@@ -0,0 +1,137 @@
+use super::*;
+
+/// Splits produced by the Hugging Face `tokenizers` library with Qwen2's split pattern
+const REFERENCE_SPLITS: &[(&str, &[&str])] = &[
+    (
+        "Hello world! It's a test, isn't it? We'LL see what THEY'RE doing.",
+        &[
+            "Hello", " world", "!", " It", "'s", " a", " test", ",", " isn", "'t", " it", "?",
+            " We", "'LL", " see", " what", " THEY", "'RE", " doing", ".",
+        ],
+    ),
+    (
+        "  leading spaces and trailing   ",
+        &[" ", " leading", " spaces", " and", " trailing", "   "],
+    ),
+    (
+        "Numbers: 12345, 3.14 and x2y3 1st 2nd",
+        &[
+            "Numbers", ":", " ", "1", "2", "3", "4", "5", ",", " ", "3", ".", "1", "4", " and",
+            " x", "2", "y", "3", " ", "1", "st", " ", "2", "nd",
+        ],
+    ),
+    (
+        "line one\nline two\n\n  indented after blank",
+        &[
+            "line",
+            " one",
+            "\n",
+            "line",
+            " two",
+            "\n\n",
+            " ",
+            " indented",
+            " after",
+            " blank",
+        ],
+    ),
+    (
+        "tabs\tand\tmixed \t whitespace",
+        &["tabs", "\tand", "\tmixed", " \t", " whitespace"],
+    ),
+    (
+        "def f(x):\n    return x**2  # comment",
+        &[
+            "def", " f", "(x", "):\n", "   ", " return", " x", "**", "2", " ", " #", " comment",
+        ],
+    ),
+    (
+        "Ünïcödé naïve café — “quotes” and ‘single’…",
+        &[
+            "Ünïcödé",
+            " naïve",
+            " café",
+            " —",
+            " “",
+            "quotes",
+            "”",
+            " and",
+            " ‘",
+            "single",
+            "’…",
+        ],
+    ),
+    (
+        "中文字符测试，还有标点。日本語のテキスト",
+        &["中文字符测试", "，还有标点", "。日本語のテキスト"],
+    ),
+    (
+        "emoji 🙂👍 and flags 🇩🇪 ok",
+        &["emoji", " 🙂👍", " and", " flags", " 🇩🇪", " ok"],
+    ),
+    (
+        " ?!  ... -->\r\n\r\n  end",
+        &[" ?!", " ", " ...", " -->\r\n\r\n", " ", " end"],
+    ),
+    (
+        "'S 'T 'Re 'VE 'm 'Ll 'D 'x ''",
+        &[
+            "'S", " '", "T", " '", "Re", " '", "VE", " '", "m", " '", "Ll", " '", "D", " '", "x",
+            " ''",
+        ],
+    ),
+    (
+        "Ⅻ roman ½ half ²",
+        &["Ⅻ", " roman", " ", "½", " half", " ", "²"],
+    ),
+    ("हिन्दी भाषा", &["ह", "िन", "्द", "ी", " भ", "ाष", "ा"]),
+    ("a", &["a"]),
+    (" ", &[" "]),
+    ("\n", &["\n"]),
+    ("x  \n y", &["x", "  \n", " y"]),
+    (
+        "{\"key\": \"value\", \"n\": [1, 2]}\n",
+        &[
+            "{\"", "key", "\":", " \"", "value", "\",", " \"", "n", "\":", " [", "1", ",", " ",
+            "2", "]}\n",
+        ],
+    ),
+];
+
+#[test]
+fn test_words_match_reference_splits() {
+    for &(text, expected) in REFERENCE_SPLITS {
+        let split: Vec<&str> = words(text).collect();
+        assert_eq!(split, expected, "{text:?}");
+    }
+}
+
+#[test]
+fn test_words_concatenate_to_text() {
+    let text = "Mixed: 'quoted' text\r\n\twith  123 and ümlauts, 🙂!  \n";
+    assert_eq!(words(text).collect::<String>(), text);
+    assert_eq!(words("").count(), 0);
+}
+
+#[test]
+fn test_chunks_split_between_words() {
+    let text: String = REFERENCE_SPLITS
+        .iter()
+        .map(|&(text, _)| text)
+        .chain(["!!\n\nx", "a \n b", "x\r\n y", "?\n\n\n'll", "\n"])
+        .collect::<Vec<_>>()
+        .join("\n");
+    let expected: Vec<&str> = words(&text).collect();
+
+    for min_len in [0, 1, 7, 40, text.len()] {
+        let chunks: Vec<&str> = chunks(&text, min_len).collect();
+        assert_eq!(chunks.concat(), text);
+        assert!(
+            chunks[..chunks.len() - 1]
+                .iter()
+                .all(|c| c.len() >= min_len)
+        );
+        let split: Vec<&str> = chunks.iter().flat_map(|chunk| words(chunk)).collect();
+        assert_eq!(split, expected, "min_len {min_len}");
+    }
+}
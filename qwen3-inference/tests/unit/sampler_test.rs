@@ -0,0 +1,114 @@
+use super::*;
+
+/// Reference distribution: softmax(logits / temperature)
+fn expected_probs(logits: &[f32], temperature: f32) -> Vec<f32> {
+    let mut probs: Vec<f32> = logits.iter().map(|&l| l / temperature).collect();
+    softmax(&mut probs);
+    probs
+}
+
+fn draw_samples(sampler: &mut Sampler, logits: &[f32], n: usize) -> Vec<usize> {
+    (0..n)
+        .map(|_| {
+            let mut logits = logits.to_vec();
+            sampler.sample(&mut logits)
+        })
+        .collect()
+}
+
+#[test]
+fn test_gumbel_matches_softmax_distribution() {
+    let logits = [1.0, 2.0, 0.5, -1.0, 3.0, 0.0, 1.5, -0.5];
+    let temperature = 0.8;
+    let num_samples = 100_000;
+
+    let mut sampler = Sampler::new(logits.len(), temperature, 1.0, 42);
+    let mut counts = vec![0usize; logits.len()];
+    for token in draw_samples(&mut sampler, &logits, num_samples) {
+        counts[token] += 1;
+    }
+
+    // Pearson chi-square goodness of fit; 7 degrees of freedom, p = 0.001 critical value
+    let chi_square: f64 = expected_probs(&logits, temperature)
+        .iter()
+        .zip(&counts)
+        .map(|(&p, &observed)| {
+            let expected = p as f64 * num_samples as f64;
+            (observed as f64 - expected).powi(2) / expected
+        })
+        .sum();
+
+    assert!(chi_square < 24.32, "chi-square too large: {chi_square}");
+}
+
+#[test]
+fn test_gumbel_spans_multiple_chunks() {
+    // Hot tokens placed in different parallel chunks, everything else is negligible
+    let vocab_size = 3 * GUMBEL_CHUNK_SIZE + 17;
+    let hot = [5, GUMBEL_CHUNK_SIZE + 3, vocab_size - 1];
+    let mut logits = vec![-30.0f32; vocab_size];
+    for &idx in &hot {
+        logits[idx] = 0.0;
+    }
+
+    let num_samples = 6_000;
+    let mut sampler = Sampler::new(vocab_size, 1.0, 0.0, 7);
+    let mut counts = [0usize; 3];
+    for token in draw_samples(&mut sampler, &logits, num_samples) {
+        let slot = hot.iter().position(|&h| h == token);
+        assert!(slot.is_some(), "sampled a negligible token: {token}");
+        counts[slot.unwrap()] += 1;
+    }
+
+    // Each hot token should get a third of the mass (5 sigma tolerance)
+    let expected = num_samples as f64 / 3.0;
+    let tolerance = 5.0 * (expected * (2.0 / 3.0)).sqrt();
+    for count in counts {
+        assert!((count as f64 - expected).abs() < tolerance, "{counts:?}");
+    }
+}
+
+#[test]
+fn test_gumbel_deterministic_across_thread_counts() {
+    let vocab_size = 2 * GUMBEL_CHUNK_SIZE + 100;
+    let logits: Vec<f32> = (0..vocab_size)
+        .map(|i| ((i * 7919) % 1000) as f32 / 250.0)
+        .collect();
+
+    let run = |threads: usize| {
+        let pool = rayon::ThreadPoolBuilder::new()
+            .num_threads(threads)
+            .build()
+            .unwrap();
+        pool.install(|| {
+            let mut sampler = Sampler::new(vocab_size, 1.2, 1.0, 1234);
+            draw_samples(&mut sampler, &logits, 200)
+        })
+    };
+
+    let single = run(1);
+    assert_eq!(single, run(4));
+    assert_eq!(single, run(7));
+
+    // A different seed must give a different stream
+    let mut other = Sampler::new(vocab_size, 1.2, 1.0, 4321);
+    assert_ne!(single, draw_samples(&mut other, &logits, 200));
+}
+
+#[test]
+fn test_gumbel_does_not_modify_logits() {
+    let logits = vec![0.25f32, -1.0, 2.0, 0.5];
+    let mut sampler = Sampler::new(logits.len(), 0.7, 1.0, 3);
+    let mut working = logits.clone();
+    let token = sampler.sample(&mut working);
+
+    assert!(token < logits.len());
+    assert_eq!(working, logits);
+}
+
+#[test]
+fn test_greedy_sampling_picks_argmax() {
+    let mut logits = vec![0.1f32, 4.0, -2.0, 3.9];
+    let mut sampler = Sampler::new(logits.len(), 0.0, 0.9, 0);
+    assert_eq!(sampler.sample(&mut logits), 1);
+}
@@ -0,0 +1,101 @@
+use super::*;
+
+fn matcher(tokens: &[&str]) -> SpecialTokenMatcher {
+    SpecialTokenMatcher::new(
+        tokens
+            .iter()
+            .enumerate()
+            .map(|(id, token)| (token.as_bytes(), id)),
+    )
+}
+
+/// All matches, scanning on from the end of each one
+fn find_all(matcher: &SpecialTokenMatcher, text: &str) -> Vec<(usize, usize, usize)> {
+    let mut found = Vec::new();
+    let mut from = 0;
+    while let Some(m) = matcher.find(text.as_bytes(), from) {
+        found.push((m.start, m.end, m.id));
+        from = m.end;
+    }
+    found
+}
+
+/// Leftmost-longest matching by trying every token at every position
+fn reference_find_all(tokens: &[&str], text: &str) -> Vec<(usize, usize, usize)> {
+    let mut found = Vec::new();
+    let mut pos = 0;
+    while pos < text.len() {
+        let longest = tokens
+            .iter()
+            .enumerate()
+            .filter(|(_, token)| text.as_bytes()[pos..].starts_with(token.as_bytes()))
+            .max_by_key(|&(id, token)| (token.len(), std::cmp::Reverse(id)));
+        match longest {
+            Some((id, token)) => {
+                found.push((pos, pos + token.len(), id));
+                pos += token.len();
+            }
+            None => pos += 1,
+        }
+    }
+    found
+}
+
+#[test]
+fn test_finds_chat_markers() {
+    let matcher = matcher(&["<|im_start|>", "<|im_end|>", "<think>", "</think>"]);
+    let text = "<|im_start|>user\nhi<|im_end|>\n<think>\n</think>";
+
+    assert_eq!(
+        find_all(&matcher, text),
+        vec![(0, 12, 0), (19, 29, 1), (30, 37, 2), (38, 46, 3)]
+    );
+    assert_eq!(matcher.find(b"plain <text> only", 0), None);
+}
+
+#[test]
+fn test_prefers_the_leftmost_then_longest_token() {
+    let tokens = ["<a>", "<a><b>", "a><", "<b>"];
+    let matcher = matcher(&tokens);
+
+    // "<a><b>" beats "<a>"; "a><" starts later than both
+    assert_eq!(find_all(&matcher, "x<a><b>y"), vec![(1, 7, 1)]);
+    // Without "<b>" after it, the longer token falls back to "<a>"
+    assert_eq!(find_all(&matcher, "<a><c"), vec![(0, 3, 0)]);
+    assert_eq!(find_all(&matcher, "a><b>"), vec![(0, 3, 2)]);
+}
+
+#[test]
+fn test_matches_reference_on_overlapping_tokens() {
+    let tokens = ["<|", "<|a|>", "|>", "<|ab", "b|><", "<", "a|", "<|a|><|b|>"];
+    let matcher = matcher(&tokens);
+
+    // Every string over a small alphabet up to length 6
+    let alphabet = ['<', '|', 'a', 'b', '>'];
+    let mut texts = vec![String::new()];
+    for _ in 0..6 {
+        texts = texts
+            .iter()
+            .flat_map(|text| {
+                alphabet.iter().map(move |&c| {
+                    let mut text = text.clone();
+                    text.push(c);
+                    text
+                })
+            })
+            .collect();
+        for text in &texts {
+            assert_eq!(
+                find_all(&matcher, text),
+                reference_find_all(&tokens, text),
+                "{text:?}"
+            );
+        }
+    }
+}
+
+#[test]
+fn test_empty_matcher_finds_nothing() {
+    let matcher = matcher(&[]);
+    assert_eq!(matcher.find(b"<|im_end|>", 0), None);
+}
@@ -0,0 +1,76 @@
+use super::*;
+
+/// Feeds `tokens` one by one; returns the released text and whether a stop matched.
+fn run(patterns: &[&str], tokens: &[&str]) -> (String, bool) {
+    let sequences = StopSequences::new(patterns).unwrap();
+    let mut matcher = StopMatcher::new(&sequences);
+    let mut output = Vec::new();
+
+    for token in tokens {
+        let (released, stopped) = matcher.push(token.as_bytes());
+        output.extend_from_slice(released);
+        if stopped {
+            return (String::from_utf8(output).unwrap(), true);
+        }
+    }
+    output.extend_from_slice(matcher.finish());
+    (String::from_utf8(output).unwrap(), false)
+}
+
+#[test]
+fn test_stop_within_single_token() {
+    assert_eq!(
+        run(&["</tool_call>"], &["call()", "</tool_call>", "more"]),
+        ("call()".to_string(), true)
+    );
+}
+
+#[test]
+fn test_stop_across_tokens_drops_partial_match() {
+    assert_eq!(
+        run(&["\nUser:"], &["Hi", " there", "\n", "Us", "er: next"]),
+        ("Hi there".to_string(), true)
+    );
+}
+
+#[test]
+fn test_held_bytes_are_released_once_ruled_out() {
+    let sequences = StopSequences::new(&["\nUser:"]).unwrap();
+    let mut matcher = StopMatcher::new(&sequences);
+
+    assert_eq!(matcher.push(b"ok\nUs"), (&b"ok"[..], false));
+    // "\nUsa" cannot become "\nUser:" anymore
+    assert_eq!(matcher.push(b"a"), (&b"\nUsa"[..], false));
+    assert_eq!(matcher.push(b"\n"), (&b""[..], false));
+    assert_eq!(matcher.finish(), b"\n");
+}
+
+#[test]
+fn test_overlapping_patterns_use_failure_links() {
+    // "abab" is preceded by a failed attempt at "abac"
+    assert_eq!(
+        run(&["abac", "bab"], &["xa", "ba", "b"]),
+        ("xa".to_string(), true)
+    );
+    // A pattern that is a suffix of a longer partial match
+    assert_eq!(
+        run(&["she", "he said"], &["s", "h", "e"]),
+        ("".to_string(), true)
+    );
+    assert_eq!(run(&["hers", "is"], &["this"]), ("th".to_string(), true));
+}
+
+#[test]
+fn test_no_match_releases_everything() {
+    assert_eq!(
+        run(&["STOP", "END"], &["We ", "STO", "od at the EN", "trance"]),
+        ("We STOod at the ENtrance".to_string(), false)
+    );
+    assert!(StopSequences::new(&[""]).is_err());
+}
+
+#[test]
+fn test_unescape() {
+    assert_eq!(unescape(r"\nUser:"), "\nUser:");
+    assert_eq!(unescape(r"a\tb\\n\q\"), "a\tb\\n\\q\\");
+}
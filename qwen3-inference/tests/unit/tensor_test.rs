@@ -0,0 +1,142 @@
+use super::*;
+
+fn quantized(values: &[f32], group_size: usize) -> QuantizedTensor {
+    let mut tensor = QuantizedTensor::new(values.len(), group_size);
+    quantize(&mut tensor, values, values.len(), group_size);
+    tensor
+}
+
+#[test]
+fn test_matmul_argmax_matches_full_matmul() {
+    let (n, d, group_size) = (64, 3 * ARGMAX_ROW_BLOCK + 5, 32);
+    let weights: Vec<f32> = (0..n * d)
+        .map(|i| (((i * 2654435761) % 2001) as f32 - 1000.0) / 1000.0)
+        .collect();
+    let input: Vec<f32> = (0..n).map(|i| ((i % 7) as f32 - 3.0) / 3.0).collect();
+
+    let w = quantized(&weights, group_size);
+    let x = quantized(&input, group_size);
+
+    let mut logits = vec![0.0; d];
+    matmul(&mut logits, &x, &w, n, d, group_size);
+    let expected = logits
+        .iter()
+        .enumerate()
+        .max_by(|(_, a), (_, b)| a.total_cmp(b))
+        .map(|(i, _)| i)
+        .unwrap();
+
+    assert_eq!(matmul_argmax(&x, &w, n, d, group_size), expected);
+}
+
+#[test]
+fn test_matmul_argmax_ties_resolve_to_last_row() {
+    let (n, d, group_size) = (4, ARGMAX_ROW_BLOCK + 2, 4);
+    // Identical rows everywhere: every output is equal
+    let w = quantized(&vec![0.5; n * d], group_size);
+    let x = quantized(&[1.0, 1.0, 1.0, 1.0], group_size);
+
+    assert_eq!(matmul_argmax(&x, &w, n, d, group_size), d - 1);
+}
+
+#[test]
+fn test_matmul_rows_matches_full_matmul() {
+    let (n, d, group_size) = (64, 2 * ARGMAX_ROW_BLOCK + 9, 32);
+    let weights: Vec<f32> = (0..n * d)
+        .map(|i| (((i * 40503) % 1001) as f32 - 500.0) / 500.0)
+        .collect();
+    let input: Vec<f32> = (0..n).map(|i| ((i % 5) as f32 - 2.0) / 2.0).collect();
+
+    let w = quantized(&weights, group_size);
+    let x = quantized(&input, group_size);
+
+    let mut expected = vec![0.0; d];
+    matmul(&mut expected, &x, &w, n, d, group_size);
+
+    let rows = [0, 3, ARGMAX_ROW_BLOCK as u32, d as u32 - 1];
+    let mut logits = vec![0.0; d];
+    matmul_rows(&mut logits, &x, &w, n, &rows, group_size);
+
+    for (row, &logit) in logits.iter().enumerate() {
+        if rows.contains(&(row as u32)) {
+            assert_eq!(logit, expected[row]);
+        } else {
+            assert_eq!(logit, f32::NEG_INFINITY, "row {row}");
+        }
+    }
+}
+
+#[test]
+fn test_matmul_batch_matches_matmul_per_vector() {
+    let (n, d, group_size, batch) = (64, 2 * BATCH_ROW_BLOCK + 7, 32, 5);
+    let weights: Vec<f32> = (0..n * d)
+        .map(|i| (((i * 2654435761) % 999) as f32 - 499.0) / 499.0)
+        .collect();
+    let inputs: Vec<f32> = (0..n * batch)
+        .map(|i| ((i % 11) as f32 - 5.0) / 5.0)
+        .collect();
+
+    let w = quantized(&weights, group_size);
+    let mut outputs = vec![0.0; batch * d];
+    matmul_batch(
+        &mut outputs,
+        &quantized(&inputs, group_size),
+        &w,
+        n,
+        d,
+        group_size,
+    );
+
+    for (input, output) in inputs.chunks_exact(n).zip(outputs.chunks_exact(d)) {
+        let mut expected = vec![0.0; d];
+        matmul(
+            &mut expected,
+            &quantized(input, group_size),
+            &w,
+            n,
+            d,
+            group_size,
+        );
+        assert_eq!(output, &expected[..]);
+    }
+}
+
+#[test]
+fn test_matmul_q4_matches_dequantized_reference() {
+    let (n, d, group_size) = (64, 5, 32);
+    // Nibbles cycle through every value 0..16, i.e. weights -8..=7 before scaling
+    let packed: Vec<u8> = (0..n * d / 2).map(|i| (i * 37 % 256) as u8).collect();
+    let scales: Vec<f32> = (0..n * d / group_size)
+        .map(|i| 0.01 * (i + 1) as f32)
+        .collect();
+    let w = Q4Tensor {
+        q: Box::leak(packed.clone().into_boxed_slice()),
+        s: Box::leak(scales.clone().into_boxed_slice()),
+    };
+
+    let input: Vec<f32> = (0..n).map(|i| ((i % 9) as f32 - 4.0) / 4.0).collect();
+    let x = quantized(&input, group_size);
+
+    let mut output = vec![0.0; d];
+    matmul_q4(&mut output, &x, &w, n, d, group_size);
+
+    for (row, &value) in output.iter().enumerate() {
+        let expected: f32 = (0..n)
+            .map(|col| {
+                let index = row * n + col;
+                let byte = packed[index / 2];
+                let nibble = if index % 2 == 0 {
+                    byte & 0x0F
+                } else {
+                    byte >> 4
+                };
+                let weight = (nibble as f32 - 8.0) * scales[index / group_size];
+                weight * x.q[col] as f32 * x.s[col / group_size]
+            })
+            .sum();
+        assert!(
+            (value - expected).abs() < 1e-4,
+            "row {row}: {value} vs {expected}"
+        );
+    }
+}
@@ -0,0 +1,95 @@
+use super::*;
+use crate::tokenizer::PromptTemplates;
+
+const OPEN: usize = 256;
+const CLOSE: usize = 257;
+
+/// Byte-level tokenizer with the think tags as tokens 256 and 257
+fn tokenizer() -> Tokenizer {
+    let mut vocab: Vec<Vec<u8>> = (0..=255u8).map(|b| vec![b]).collect();
+    vocab.push(THINK_OPEN.as_bytes().to_vec());
+    vocab.push(THINK_CLOSE.as_bytes().to_vec());
+
+    let merge_scores = vec![-1e6; vocab.len()];
+
+    Tokenizer::from_vocab(vocab, merge_scores, 8, 0, 1, PromptTemplates::default())
+}
+
+/// Feeds `tokens` and returns what the tracker turned them into, with the reasoning flags
+fn follow(tracker: &mut ThinkingTracker, tokens: &[usize]) -> Vec<(usize, bool)> {
+    tokens.iter().map(|&token| tracker.next(token)).collect()
+}
+
+#[test]
+fn test_counts_reasoning_and_answer_tokens() {
+    let mut tracker = ThinkingTracker::new(&tokenizer(), None).unwrap();
+
+    let followed = follow(&mut tracker, &[OPEN, b'a' as usize, CLOSE, b'b' as usize]);
+    assert_eq!(
+        followed,
+        vec![
+            (OPEN, true),
+            (b'a' as usize, true),
+            (CLOSE, true),
+            (b'b' as usize, false)
+        ]
+    );
+}
+
+#[test]
+fn test_budget_forces_closing_tag() {
+    let mut tracker = ThinkingTracker::new(&tokenizer(), Some(2)).unwrap();
+
+    let tokens: Vec<usize> = follow(
+        &mut tracker,
+        &[
+            OPEN,
+            b'x' as usize,
+            b'y' as usize,
+            b'z' as usize,
+            b'w' as usize,
+        ],
+    )
+    .into_iter()
+    .map(|(token, _)| token)
+    .collect();
+    assert_eq!(
+        tokens,
+        vec![OPEN, b'x' as usize, b'y' as usize, CLOSE, b'w' as usize]
+    );
+
+    // The budget applies per think block
+    tracker.reset();
+    let tokens: Vec<usize> = follow(
+        &mut tracker,
+        &[OPEN, b'x' as usize, b'y' as usize, b'z' as usize],
+    )
+    .into_iter()
+    .map(|(token, _)| token)
+    .collect();
+    assert_eq!(tokens, vec![OPEN, b'x' as usize, b'y' as usize, CLOSE]);
+}
+
+#[test]
+fn test_zero_budget_closes_immediately() {
+    let mut tracker = ThinkingTracker::new(&tokenizer(), Some(0)).unwrap();
+
+    let followed = follow(&mut tracker, &[OPEN, b'x' as usize]);
+    assert_eq!(followed, vec![(OPEN, true), (CLOSE, true)]);
+}
+
+#[test]
+fn test_no_think_tags_in_vocabulary() {
+    let vocab: Vec<Vec<u8>> = (0..=255u8).map(|b| vec![b]).collect();
+    let plain = Tokenizer::from_vocab(vocab, vec![-1e6; 256], 8, 0, 1, PromptTemplates::default());
+
+    assert!(ThinkingTracker::new(&plain, Some(8)).is_none());
+}
+
+#[test]
+fn test_thinking_switch() {
+    assert_eq!(thinking_switch("Explain rust lifetimes /think"), Some(true));
+    assert_eq!(thinking_switch("/no_think What is 2+2?"), Some(false));
+    assert_eq!(thinking_switch("/think then /no_think"), Some(false));
+    assert_eq!(thinking_switch("a path like /thinking/file"), None);
+}
@@ -0,0 +1,287 @@
+use super::*;
+
+/// Byte tokens followed by `extra` tokens, earlier extras having higher merge scores
+fn tokenizer(extra: &[&str]) -> Tokenizer {
+    let mut vocab: Vec<Vec<u8>> = (0..=255u8).map(|b| vec![b]).collect();
+    let mut merge_scores = vec![-1e6; 256];
+    for (rank, token) in extra.iter().enumerate() {
+        vocab.push(token.as_bytes().to_vec());
+        merge_scores.push(-(rank as f32));
+    }
+    Tokenizer::from_vocab(vocab, merge_scores, 16, 0, 1, PromptTemplates::default())
+}
+
+/// Reference encoding: the merge loop with linear vocabulary scans, as the tokenizer did
+/// before it was indexed, applied to the bytes of each pre-tokenized word
+fn reference_encode(tokenizer: &Tokenizer, text: &str) -> Vec<usize> {
+    pretokenizer::words(text)
+        .flat_map(|word| reference_merges(tokenizer, word.bytes().map(usize::from).collect()))
+        .collect()
+}
+
+fn reference_merges(tokenizer: &Tokenizer, mut tokens: Vec<usize>) -> Vec<usize> {
+    loop {
+        let mut best: Option<(f32, usize, usize)> = None;
+        for i in 0..tokens.len().saturating_sub(1) {
+            let mut merged = tokenizer.vocab[tokens[i]].clone();
+            merged.extend_from_slice(&tokenizer.vocab[tokens[i + 1]]);
+            if let Some(id) = tokenizer.vocab.iter().position(|token| *token == merged) {
+                let score = tokenizer.merge_scores[id];
+                if best.is_none_or(|(best_score, _, _)| score > best_score) {
+                    best = Some((score, id, i));
+                }
+            }
+        }
+        let Some((_, id, idx)) = best else {
+            return tokens;
+        };
+        tokens[idx] = id;
+        tokens.remove(idx + 1);
+    }
+}
+
+#[test]
+fn test_str_lookup_uses_first_of_duplicate_tokens() {
+    let tokenizer = tokenizer(&["ab", "<|end|>", "ab"]);
+    assert_eq!(tokenizer.str_lookup("a"), Some(b'a' as usize));
+    assert_eq!(tokenizer.str_lookup("ab"), Some(256));
+    assert_eq!(tokenizer.str_lookup("<|end|>"), Some(257));
+    assert_eq!(tokenizer.str_lookup("abc"), None);
+    assert_eq!(tokenizer.str_lookup(""), None);
+}
+
+#[test]
+fn test_encode_applies_best_merges_first() {
+    let tokenizer = tokenizer(&["th", "he", "the", "e "]);
+    // "th" outranks "he", so "the" is built from "th" + "e"
+    assert_eq!(tokenizer.encode("the"), vec![258]);
+    assert_eq!(tokenizer.encode("he "), vec![257, b' ' as usize]);
+    assert_eq!(
+        tokenizer.encode("<|x|>"),
+        "<|x|>".bytes().map(usize::from).collect::<Vec<_>>()
+    );
+}
+
+#[test]
+fn test_encode_matches_linear_scan_merges() {
+    let extra = [
+        "in", "th", "the", " t", " the", "er", "on", "an", "re", "he", "at", "en", "ing", " a",
+        " an", "and", " and", "nd", "ä", "äb", "er ", "ther", "in ",
+    ];
+    let tokenizer = tokenizer(&extra);
+    let text = "the other thing and another rather än äb in the end, then again the winner";
+
+    assert_eq!(tokenizer.encode(text), reference_encode(&tokenizer, text));
+}
+
+#[test]
+fn test_merge_order_matches_reference_with_ties() {
+    // Every 2- and 3-letter string over a small alphabet, in a few tiers of equal score,
+    // so many candidate pairs tie and must be merged leftmost first
+    let alphabet = ['a', 'b', 'c', ' '];
+    let mut extra: Vec<String> = Vec::new();
+    for x in alphabet {
+        for y in alphabet {
+            extra.push(format!("{x}{y}"));
+            for z in alphabet {
+                extra.push(format!("{x}{y}{z}"));
+            }
+        }
+    }
+    let mut vocab: Vec<Vec<u8>> = (0..=255u8).map(|b| vec![b]).collect();
+    let mut merge_scores = vec![-1e6; 256];
+    for (index, token) in extra.iter().enumerate() {
+        vocab.push(token.as_bytes().to_vec());
+        merge_scores.push(-((index % 3) as f32));
+    }
+    let tokenizer =
+        Tokenizer::from_vocab(vocab, merge_scores, 16, 0, 1, PromptTemplates::default());
+
+    let mut state: u32 = 12345;
+    for length in [0, 1, 2, 5, 17, 64, 200] {
+        let text: String = (0..length)
+            .map(|_| {
+                state = state.wrapping_mul(1_103_515_245).wrapping_add(12345);
+                alphabet[(state >> 16) as usize % alphabet.len()]
+            })
+            .collect();
+        assert_eq!(
+            tokenizer.encode(&text),
+            reference_encode(&tokenizer, &text),
+            "{text:?}"
+        );
+    }
+}
+
+#[test]
+fn test_merges_stay_within_words() {
+    let tokenizer = tokenizer(&["a b", "ab", " b"]);
+    // "a b" is a vocabulary token, but "a" and " b" are separate words
+    assert_eq!(tokenizer.encode("a b"), vec![b'a' as usize, 258]);
+    assert_eq!(tokenizer.encode("ab"), vec![257]);
+}
+
+#[test]
+fn test_characters_fall_back_to_bytes() {
+    let tokenizer = tokenizer(&["é"]);
+    // Not tokens themselves, "ü" and the emoji are encoded as their UTF-8 bytes
+    assert_eq!(tokenizer.encode("é"), vec![256]);
+    assert_eq!(tokenizer.encode("ü"), vec![0xC3, 0xBC]);
+    let emoji: Vec<usize> = "🙂".bytes().map(usize::from).collect();
+    assert_eq!(tokenizer.encode("🙂"), emoji);
+}
+
+#[test]
+fn test_special_tokens_split_the_text() {
+    let mut vocab: Vec<Vec<u8>> = (0..=255u8).map(|b| vec![b]).collect();
+    vocab.push(b"<|im_end|>".to_vec());
+    vocab.push(b"<b>".to_vec());
+    let mut merge_scores = vec![-1e6; 258];
+    // A regular token that looks like a tag is not matched as a special token
+    merge_scores[257] = -1.0;
+    let tokenizer =
+        Tokenizer::from_vocab(vocab, merge_scores, 16, 0, 1, PromptTemplates::default());
+
+    let encoded = tokenizer.encode("x<|im_end|><b>\n");
+    let expected: Vec<usize> = [b'x' as usize, 256]
+        .into_iter()
+        .chain("<b>\n".bytes().map(usize::from))
+        .collect();
+    assert_eq!(encoded, expected);
+}
+
+#[test]
+fn test_cached_words_encode_the_same() {
+    let tokenizer = tokenizer(&["th", "the", " the", "at"]);
+    let text = "the cat the hat the";
+    let first = tokenizer.encode(text);
+    assert_eq!(tokenizer.encode(text), first);
+    assert_eq!(first, reference_encode(&tokenizer, text));
+}
+
+/// Byte tokens followed by `extra` tokens, merging by `merges` in rank order
+fn ranked_tokenizer(extra: &[&str], merges: &[(&str, &str)]) -> Tokenizer {
+    let mut vocab: Vec<Vec<u8>> = (0..=255u8).map(|b| vec![b]).collect();
+    vocab.extend(extra.iter().map(|token| token.as_bytes().to_vec()));
+    let id = |token: &str| vocab.iter().position(|t| t == token.as_bytes()).unwrap() as u32;
+    let merge_table: Vec<[u32; 3]> = merges
+        .iter()
+        .map(|(left, right)| [id(left), id(right), id(&format!("{left}{right}"))])
+        .collect();
+    let merge_scores = vec![-1e6; vocab.len()];
+    Tokenizer::from_merge_table(
+        vocab,
+        merge_scores,
+        &merge_table,
+        16,
+        0,
+        1,
+        PromptTemplates::default(),
+    )
+}
+
+#[test]
+fn test_merge_table_sets_the_merge_order() {
+    // "ab" comes first in the vocabulary, but "b c" has the better rank
+    let tokenizer = ranked_tokenizer(&["ab", "bc", "abc"], &[("b", "c"), ("a", "bc"), ("a", "b")]);
+    assert_eq!(tokenizer.encode("abc"), vec![258]);
+    assert_eq!(tokenizer.encode("ab"), vec![256]);
+}
+
+#[test]
+fn test_only_listed_pairs_merge() {
+    // "abc" is a token, but only reachable through "ab" + "c", which is not a merge
+    let tokenizer = ranked_tokenizer(&["ab", "abc"], &[("a", "b")]);
+    assert_eq!(tokenizer.encode("abc"), vec![256, b'c' as usize]);
+}
+
+#[test]
+fn test_read_merge_table() {
+    let mut bytes = Vec::new();
+    for value in [MERGES_MAGIC, 2, 97, 98, 256, 256, 99, 257] {
+        bytes.extend_from_slice(&value.to_le_bytes());
+    }
+    let table = Tokenizer::read_merge_table(&mut bytes.as_slice()).unwrap();
+    assert_eq!(table, Some(vec![[97, 98, 256], [256, 99, 257]]));
+
+    // Older files end after the vocabulary
+    let table = Tokenizer::read_merge_table(&mut [].as_slice()).unwrap();
+    assert_eq!(table, None);
+
+    // A truncated table is an error rather than a silently partial one
+    assert!(Tokenizer::read_merge_table(&mut bytes[..20].as_ref()).is_err());
+}
+
+#[test]
+fn test_read_vocab_pads_to_the_model_vocabulary() {
+    let token = |bytes: &mut Vec<u8>, score: f32, text: &[u8]| {
+        bytes.extend_from_slice(&score.to_le_bytes());
+        bytes.extend_from_slice(&(text.len() as u32).to_le_bytes());
+        bytes.extend_from_slice(text);
+    };
+    let mut tokens = Vec::new();
+    token(&mut tokens, -1.0, b"a");
+    token(&mut tokens, -2.0, b"bc");
+    let mut counted = Vec::new();
+    for value in [TOKENS_MAGIC, 2] {
+        counted.extend_from_slice(&value.to_le_bytes());
+    }
+    counted.extend_from_slice(&tokens);
+    counted.extend_from_slice(&MERGES_MAGIC.to_le_bytes());
+
+    // The merge table after the counted tokens is left for read_merge_table
+    let mut reader = counted.as_slice();
+    let (vocab, scores) = Tokenizer::read_vocab(&mut reader, 4).unwrap();
+    assert_eq!(vocab, vec![b"a".to_vec(), b"bc".to_vec(), vec![], vec![]]);
+    assert_eq!(scores, vec![-1.0, -2.0, 0.0, 0.0]);
+    assert_eq!(reader, MERGES_MAGIC.to_le_bytes());
+
+    let (vocab, _) = Tokenizer::read_vocab(&mut counted.as_slice(), 1).unwrap();
+    assert_eq!(vocab, vec![b"a".to_vec()]);
+
+    // Files without a count are read up to the model vocabulary
+    let (vocab, scores) = Tokenizer::read_vocab(&mut tokens.as_slice(), 3).unwrap();
+    assert_eq!(vocab, vec![b"a".to_vec(), b"bc".to_vec(), vec![]]);
+    assert_eq!(scores, vec![-1.0, -2.0, 0.0]);
+}
+
+#[test]
+fn test_adjacent_and_unknown_special_tokens() {
+    let mut vocab: Vec<Vec<u8>> = (0..=255u8).map(|b| vec![b]).collect();
+    vocab.push(b"<|im_start|>".to_vec());
+    vocab.push(b"<|im_end|>".to_vec());
+    let merge_scores = vec![-1e6; vocab.len()];
+    let tokenizer =
+        Tokenizer::from_vocab(vocab, merge_scores, 16, 0, 1, PromptTemplates::default());
+
+    assert_eq!(tokenizer.encode("<|im_end|><|im_start|>"), vec![257, 256]);
+    let unknown: Vec<usize> = "<|im_other|>".bytes().map(usize::from).collect();
+    assert_eq!(tokenizer.encode("<|im_other|>"), unknown);
+}
+
+#[test]
+fn test_encode_batch_matches_encode() {
+    let tokenizer = tokenizer(&["th", "the", " the", "he", "in", "ing", " a", "<|im_end|>"]);
+    let line = "the thing in the bathing<|im_end|>\n  the\tend!\n";
+    let long = line.repeat(PARALLEL_CHUNK_BYTES / line.len() * 3);
+    let texts = ["", "the", line, &long, "über the 🙂"];
+
+    let batch = tokenizer.encode_batch(&texts);
+    assert_eq!(batch.len(), texts.len());
+    for (text, tokens) in texts.iter().zip(&batch) {
+        let expected: Vec<u32> = tokenizer.encode(text).iter().map(|&t| t as u32).collect();
+        assert_eq!(tokens, &expected, "{:?}", &text[..text.len().min(40)]);
+    }
+}
+
+#[test]
+fn test_encode_with_busy_scratch() {
+    let tokenizer = tokenizer(&["th", "the", " the", "at"]);
+    let text = "the cat the hat the";
+    let expected = tokenizer.encode(text);
+
+    // Another thread holding the scratch: the fallback starts with an empty word cache
+    let busy = tokenizer.scratch[0].lock().unwrap();
+    assert_eq!(tokenizer.encode(text), expected);
+    drop(busy);
+}
@@ -0,0 +1,73 @@
+use super::*;
+use crate::tokenizer::PromptTemplates;
+
+fn byte_tokenizer(extra_tokens: &[&str]) -> Tokenizer {
+    let mut vocab: Vec<Vec<u8>> = (0..=255u8).map(|byte| vec![byte]).collect();
+    vocab.extend(extra_tokens.iter().map(|token| token.as_bytes().to_vec()));
+    let merge_scores = vec![-1.0; vocab.len()];
+
+    Tokenizer::from_vocab(vocab, merge_scores, 16, 0, 1, PromptTemplates::default())
+}
+
+#[test]
+fn test_round_trip_counts_tokens_and_failures() {
+    let full = byte_tokenizer(&["ä", "ab"]);
+    let trimmed = byte_tokenizer(&["ab"]);
+    let corpus = "abab\n\nab ä\n";
+
+    let report = validate_round_trip(&full, None, corpus);
+    assert!(report.is_ok(0.0));
+    assert_eq!(report.lines, 2);
+    assert_eq!(report.tokens, 2 + 3);
+    assert_eq!(report.reference_tokens, None);
+    assert_eq!(report.inflation(), None);
+    assert!(report.fallback_lines.is_empty());
+
+    // Without a token for "ä" it falls back to its two bytes and still round-trips
+    let report = validate_round_trip(&trimmed, Some(&full), corpus);
+    assert!(report.failed_lines.is_empty());
+    assert_eq!(report.tokens, 2 + 4);
+    assert_eq!(report.reference_tokens, Some(5));
+}
+
+#[test]
+fn test_inflation_against_the_reference_fails_the_check() {
+    let full = byte_tokenizer(&["ä", "ab"]);
+    let trimmed = byte_tokenizer(&["ab"]);
+    let corpus = "abab\n\nab ä\n";
+
+    let report = validate_round_trip(&trimmed, Some(&full), corpus);
+    assert_eq!(
+        report.inflated_lines,
+        vec![InflatedLine {
+            line: 3,
+            tokens: 4,
+            reference_tokens: 3,
+        }]
+    );
+    assert_eq!(report.fallback_lines, vec![3]);
+
+    // 6 tokens instead of 5
+    let inflation = report.inflation().unwrap();
+    assert!((inflation - 0.2).abs() < 1e-9);
+    assert!(report.is_ok(0.25));
+    assert!(!report.is_ok(0.1));
+
+    // Without a reference, byte-fallback lines are still listed
+    let report = validate_round_trip(&trimmed, None, corpus);
+    assert_eq!(report.fallback_lines, vec![3]);
+    assert!(report.is_ok(0.0));
+}
+
+#[test]
+fn test_missing_byte_token_fails_the_round_trip() {
+    let mut vocab: Vec<Vec<u8>> = (0..=255u8).map(|byte| vec![byte]).collect();
+    vocab[b'z' as usize].clear();
+    let merge_scores = vec![-1.0; vocab.len()];
+    let tokenizer =
+        Tokenizer::from_vocab(vocab, merge_scores, 16, 0, 1, PromptTemplates::default());
+
+    let report = validate_round_trip(&tokenizer, None, "abc\nxyz\n");
+    assert_eq!(report.failed_lines, vec![2]);
+    assert!(!report.is_ok(1.0));
+}